@@ -26,6 +26,7 @@
 #endif
 
 #include "kNet/Clock.h"
+#include "kNet/ConnectionRegistry.h"
 #include "kNet/DataDeserializer.h"
 #include "kNet/DataSerializer.h"
 #include "kNet/EndPoint.h"
@@ -33,25 +34,34 @@
 #include "kNet/EventArray.h"
 #include "kNet/IMessageHandler.h"
 #include "kNet/INetworkServerListener.h"
+#include "kNet/LockContention.h"
 #include "kNet/Lockable.h"
+#include "kNet/LogHistogram.h"
 #include "kNet/MaxHeap.h"
 #include "kNet/MessageConnection.h"
 #include "kNet/MessageListParser.h"
+#include "kNet/MessageTypeStatsTable.h"
 #include "kNet/NetException.h"
 #include "kNet/Network.h"
 #include "kNet/NetworkLogging.h"
 #include "kNet/NetworkMessage.h"
+#include "kNet/NetworkMetrics.h"
 #include "kNet/NetworkServer.h"
 #include "kNet/PolledTimer.h"
+#include "kNet/SegmentedQueue.h"
 #include "kNet/SerializationStructCompiler.h"
 #include "kNet/SerializedDataIterator.h"
 #include "kNet/SharedPtr.h"
 #include "kNet/Socket.h"
 #include "kNet/Sort.h"
+#include "kNet/StatsCounters.h"
 #include "kNet/Thread.h"
+#include "kNet/Trace.h"
+#include "kNet/TrafficStatsWindow.h"
 #include "kNet/Types.h"
 #include "kNet/VLEPacker.h"
 #include "kNet/WaitFreeQueue.h"
+#include "kNet/WorkStealingPool.h"
 #include "kNet/64BitAllocDebugger.h"
 
 #ifdef KNET_USE_QT
@@ -27,6 +27,9 @@
 namespace kNet
 {
 
+/// The assumed size of a CPU cache line, in bytes. Used to keep data written by different threads apart to avoid false sharing.
+#define KNET_CACHE_LINE_SIZE 64
+
 /// Is value an exact power of 2? i.e. 1,2,4,8,16,...
 #define IS_POW2(value) (((value) & ((value)-1)) == 0)
 
@@ -32,3 +32,17 @@
 // See http://gcc.gnu.org/onlinedocs/gcc-4.1.2/gcc/Atomic-Builtins.html
 #define CmpXChgPointer(dst, newVal, cmp) __sync_bool_compare_and_swap((dst), (cmp), (newVal))
 #endif
+
+// void CpuPause();
+// Tells the CPU that the calling thread is spinning in a wait loop (the x86 PAUSE instruction). This saves power and
+// frees execution resources for the other hyperthread of the core.
+
+#if defined(_MSC_VER)
+#define CpuPause() YieldProcessor()
+#elif defined(__i386__) || defined(__x86_64__)
+#define CpuPause() __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define CpuPause() __asm__ __volatile__("yield")
+#else
+#define CpuPause() ((void)0)
+#endif
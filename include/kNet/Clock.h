@@ -72,6 +72,17 @@ public:
 	/// @return How many ticks make up a second.
 	static tick_t TicksPerSec(); 
 
+	/// @return A readable name of the counter Tick() reads, e.g. "tsc" or "clock_gettime".
+	static const char *TickSource();
+
+	/// @return The time the calling thread last cached with SetLoopTick(), or Tick() if it has not cached a time.
+	/** The worker threads cache the time once per phase of their loop, so that per-message code that does not need an
+		exact timestamp can read it instead of the clock. [any thread] */
+	static inline tick_t LoopTick() { return loopTick != 0 ? loopTick : Tick(); }
+
+	/// Caches the time LoopTick() returns on the calling thread. Pass 0 to make LoopTick() read the clock again.
+	static inline void SetLoopTick(tick_t tick) { loopTick = tick; }
+
 	static inline tick_t TicksPerMillisecond() { return TicksPerSec() / 1000; }
 
 	/// Returns the number of ticks occurring between the two wallclock times.
@@ -106,6 +117,7 @@ public:
 
 private:
 	static tick_t appStartTime;      ///< Application startup time in ticks.
+	static thread_local tick_t loopTick; ///< The time cached by SetLoopTick(), or 0.
 
 	/// Initializes clock tick frequency and marks the application startup time.
 	static void InitClockData();
@@ -0,0 +1,142 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+#pragma once
+
+/** @file ConnectionRegistry.h
+	@brief The ConnectionRegistry class. The client connections of a NetworkServer, readable without locks or copies. */
+
+#include <atomic>
+#include <vector>
+
+#include "Types.h"
+#include "EndPoint.h"
+#include "SharedPtr.h"
+#include "Lockable.h"
+
+namespace kNet
+{
+
+class MessageConnection;
+
+/// Stores a set of connections keyed by their remote end point, for many readers and few writers.
+/** The connections are kept in an immutable Snapshot, a dense array sorted by end point. A reader takes the current
+	snapshot with a ReadGuard, which costs two atomic increments and no lock, and can then iterate or look up the
+	connections without copying them or touching their reference counts.
+
+	A write copies the current snapshot with the change applied, and publishes the copy. The old snapshot is retired,
+	and freed once no ReadGuard can still see it. The readers count themselves in one of two counters by the parity of
+	a global epoch. The epoch only advances when the readers of the previous epoch of the same parity have left, and a
+	snapshot retired in epoch E is freed once the epoch reaches E+2. Writes are serialized with a lock, and never wait
+	for readers, so a reader may write to the registry while it holds a ReadGuard. */
+class ConnectionRegistry
+{
+public:
+	/// An immutable list of connections, sorted by remote end point.
+	class Snapshot
+	{
+	public:
+		size_t Size() const { return entries.size(); }
+
+		MessageConnection *At(size_t index) const { return entries[index].connection.ptr(); }
+
+		const EndPoint &EndPointAt(size_t index) const { return entries[index].endPoint; }
+
+		/// Returns the connection with the given remote end point, or 0 if there is none. O(log n).
+		MessageConnection *Find(const EndPoint &endPoint) const;
+
+		/// Returns the index of the given connection, or -1 if it is not in this snapshot. O(n).
+		int IndexOf(const MessageConnection *connection) const;
+
+	private:
+		struct Entry
+		{
+			EndPoint endPoint;
+			/// The snapshot holds a reference to each of its connections, so a connection outlives the snapshots it is in.
+			/// Mutable, since the list is immutable but the readers use the connections.
+			mutable Ptr(MessageConnection) connection;
+
+			bool operator <(const Entry &rhs) const { return endPoint < rhs.endPoint; }
+		};
+		std::vector<Entry> entries;
+
+		/// The epoch in which this snapshot was retired.
+		u64 retireEpoch;
+
+		friend class ConnectionRegistry;
+	};
+
+	/// Keeps the current snapshot of a registry alive while the guard exists. [any thread]
+	class ReadGuard
+	{
+	public:
+		explicit ReadGuard(const ConnectionRegistry &registry);
+		~ReadGuard();
+
+		const Snapshot &operator *() const { return *snapshot; }
+		const Snapshot *operator ->() const { return snapshot; }
+
+	private:
+		const ConnectionRegistry &registry;
+		int readerSlot;
+		const Snapshot *snapshot;
+
+		ReadGuard(const ReadGuard &); ///< Noncopyable, N/I.
+		void operator =(const ReadGuard &); ///< Noncopyable, N/I.
+	};
+
+	ConnectionRegistry();
+	~ConnectionRegistry();
+
+	/// Adds the given connection, replacing the one at the same end point if there is one. [any thread]
+	void Insert(const EndPoint &endPoint, const Ptr(MessageConnection) &connection);
+
+	/// Removes the given connection. Returns false if it was not in the registry. [any thread]
+	bool Remove(MessageConnection *connection);
+
+	/// Removes all the given connections with one snapshot, and returns the number of them that were in the registry. [any thread]
+	size_t Remove(const std::vector<MessageConnection*> &connections);
+
+	/// Moves the given connection from the old to the new end point. Returns false if the connection is not at the
+	/// old end point any more. [any thread]
+	bool Move(MessageConnection *connection, const EndPoint &oldEndPoint, const EndPoint &newEndPoint);
+
+	/// Frees the retired snapshots that no reader can see any more. The writes do this as well, but a server that
+	/// stops accepting and dropping clients calls this to release the last retired snapshots. [any thread]
+	void Reclaim();
+
+	/// Returns the number of retired snapshots that have not been freed yet. [any thread]
+	int NumRetiredSnapshots() const { return numRetired.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<const Snapshot*> current;
+
+	mutable std::atomic<u64> epoch;
+	/// The number of ReadGuards that entered in an even or an odd epoch.
+	mutable std::atomic<int> numReaders[2];
+
+	/// The snapshots that have been replaced but may still be read. Also serializes the writes.
+	Lockable<std::vector<Snapshot*> > retired;
+	std::atomic<int> numRetired;
+
+	/// Publishes the given snapshot, retires the old one and reclaims what it can. The lock on retired must be held.
+	void Publish(Snapshot *snapshot, std::vector<Snapshot*> &retiredSnapshots);
+
+	/// Advances the epoch as far as the readers allow, and frees the snapshots no reader can see. The lock on retired must be held.
+	void ReclaimLocked(std::vector<Snapshot*> &retiredSnapshots);
+
+	ConnectionRegistry(const ConnectionRegistry &); ///< Noncopyable, N/I.
+	void operator =(const ConnectionRegistry &); ///< Noncopyable, N/I.
+};
+
+} // ~kNet
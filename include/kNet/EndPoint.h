@@ -65,6 +65,13 @@ struct EndPoint
 		return false;
 	}
 
+	bool operator == (const EndPoint &rhs) const
+	{
+		return memcmp(ip, rhs.ip, sizeof(ip)) == 0 && port == rhs.port;
+	}
+
+	bool operator != (const EndPoint &rhs) const { return !(*this == rhs); }
+
 	///\todo Not IPv6-capable.
 	static EndPoint FromSockAddrIn(const sockaddr_in &addr)
 	{
@@ -49,6 +49,10 @@ public:
 	/// EventArray::WaitFailed if there were invalid event objects added in the array.
 	int Wait(int msecs);
 
+	/// Like Wait, but takes the timeout in microseconds. On Unix, the wait ends with microsecond precision. On Windows,
+	/// the timeout is rounded up to whole milliseconds.
+	int WaitMicroseconds(int usecs);
+
 	/// Returns the number of events added to the array.
 	int Size() const;
 
@@ -67,6 +71,9 @@ private:
 	/// Cache a list of all added events here. This is to remember the order in which the events were added, so that
 	/// we can correctly return the occurred event with the smallest index.
 	std::vector<Event> cachedEvents;
+
+	/// Waits on the added descriptors for the time in tv. Wait and WaitMicroseconds fill tv and call this.
+	int WaitTimeval();
 #endif
 };
 
@@ -0,0 +1,123 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+#pragma once
+
+/** @file HostResolver.h
+	@brief The HostResolver class. Resolves host names to IPv4 addresses on a small pool of background threads,
+	       and caches the results. */
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "EndPoint.h"
+#include "Event.h"
+#include "Lockable.h"
+#include "Thread.h"
+#include "Clock.h"
+
+namespace kNet
+{
+
+/// The number of threads a HostResolver runs lookups on by default.
+const int cDefaultNumResolverThreads = 4;
+
+/// Resolves host names without blocking the calling thread. Numeric addresses and cached names resolve immediately,
+/// others are looked up with getaddrinfo() on a pool of threads that is started on the first lookup.
+class HostResolver
+{
+public:
+	/// The state of a single lookup.
+	enum RequestState
+	{
+		RequestResolving = 0, ///< The lookup is still running on a resolver thread.
+		RequestResolved,      ///< The name was resolved, and Request::address holds the result.
+		RequestFailed,        ///< The name does not resolve to an IPv4 address.
+		RequestReleased       ///< The requester gave the request up while it was running. Only seen by the resolver.
+	};
+
+	/// A single lookup, returned by Resolve(). Free it with Release().
+	struct Request
+	{
+		std::string hostName;
+		/// The resolved address, with the port set to zero. Valid after State() returns RequestResolved.
+		EndPoint address;
+		std::atomic<int> state;
+
+		RequestState State() const { return (RequestState)state.load(std::memory_order_acquire); }
+	};
+
+	explicit HostResolver(int numThreads = cDefaultNumResolverThreads);
+	~HostResolver();
+
+	/// Starts resolving the given host name. [any thread]
+	/// @return A new request, which may already be resolved or failed. Free it with Release().
+	Request *Resolve(const char *hostName);
+
+	/// Frees the given request. If the lookup is still running, its result is discarded when it finishes. [any thread]
+	static void Release(Request *request);
+
+	/// The time a resolved name is kept in the cache.
+	static const int cCacheMSecs = 60 * 1000;
+	/// The time a name that failed to resolve is kept in the cache, so that a burst of connects to a bad name
+	/// does not queue a lookup for each.
+	static const int cFailedCacheMSecs = 5 * 1000;
+
+	/// Forgets all cached lookups. [any thread]
+	void ClearCache();
+
+	/// Returns the number of lookups that are queued or running. [any thread]
+	int NumPendingRequests() const { return numPending.load(std::memory_order_relaxed); }
+
+private:
+	struct CacheEntry
+	{
+		EndPoint address;
+		bool failed;
+		tick_t expiryTick;
+	};
+
+	const int numThreads;
+	std::vector<Thread*> threads;
+	std::atomic<bool> quit;
+
+	Lockable<std::deque<Request*> > queue;
+	/// Set while the queue has requests in it.
+	Event queueEvent;
+	std::atomic<int> numPending;
+
+	Lockable<std::map<std::string, CacheEntry> > cache;
+
+	/// Returns true and fills in the request if its name is in the cache and the entry has not expired.
+	bool LookupCache(Request &request);
+
+	/// Stores the result of a finished lookup to the cache.
+	void StoreCache(const std::string &hostName, const EndPoint &address, bool failed);
+
+	/// Starts the resolver threads if they are not running yet. [any thread]
+	void StartThreads();
+
+	/// The entry point of the resolver threads.
+	void ResolverLoop();
+
+	/// Marks the given request as finished, or frees it if the requester already released it.
+	static void Complete(Request *request, RequestState state);
+
+	HostResolver(const HostResolver &); ///< Noncopyable, N/I.
+	void operator =(const HostResolver &); ///< Noncopyable, N/I.
+};
+
+} // ~kNet
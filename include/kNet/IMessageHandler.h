@@ -50,6 +50,12 @@ public:
 		// The default behavior is to not have a content ID on any message.
 		return 0;
 	}
+
+	/// Returns whether HandleMessage may be called for different connections at the same time, from the threads of
+	/// NetworkServer::SetNumProcessThreads(). The messages of a single connection are still handled one at a time and
+	/// in order, and the handler may reply on the source connection. Anything else it touches, including other
+	/// connections, it has to synchronize itself.
+	virtual bool IsThreadSafe() const { return false; }
 };
 
 } // ~kNet
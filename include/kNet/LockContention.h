@@ -0,0 +1,83 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+#pragma once
+
+/** @file LockContention.h
+	@brief Process-wide accounting of how often named Lockables are acquired, and how long the acquiring threads block. */
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "kNet/Types.h"
+#include "kNet/Alignment.h"
+#include "kNet/Clock.h"
+
+namespace kNet
+{
+
+/// The live counters of all the Lockables that share a name. Obtained with RegisterLockContention(), and updated by
+/// Lockable::LockGet() with relaxed atomics.
+struct alignas(KNET_CACHE_LINE_SIZE) LockContentionCounters
+{
+	std::atomic<u64> acquisitions;
+	/// The acquisitions that found the lock held by another thread and had to block.
+	std::atomic<u64> contendedAcquisitions;
+	/// The total and the longest time spent blocking in the contended acquisitions, in Clock ticks.
+	std::atomic<u64> waitTicks;
+	std::atomic<u64> maxWaitTicks;
+
+	LockContentionCounters():acquisitions(0), contendedAcquisitions(0), waitTicks(0), maxWaitTicks(0) {}
+
+	void AddUncontended()
+	{
+		acquisitions.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void AddContended(tick_t waitTicks_)
+	{
+		acquisitions.fetch_add(1, std::memory_order_relaxed);
+		contendedAcquisitions.fetch_add(1, std::memory_order_relaxed);
+		waitTicks.fetch_add(waitTicks_, std::memory_order_relaxed);
+		u64 longest = maxWaitTicks.load(std::memory_order_relaxed);
+		while(waitTicks_ > longest && !maxWaitTicks.compare_exchange_weak(longest, waitTicks_, std::memory_order_relaxed))
+			;
+	}
+};
+
+/// Returns the counters of the locks with the given name, creating them on first use. The counters stay valid until exit.
+/// Thread-safe, but takes a lock, so resolve the counters once per Lockable. Use Lockable::SetContentionName() instead
+/// of calling this directly.
+LockContentionCounters *RegisterLockContention(const char *name);
+
+/// A copy of the counters of the locks of one name.
+struct LockContentionSample
+{
+	std::string name;
+	u64 acquisitions;
+	u64 contendedAcquisitions;
+	double totalWaitMSecs;
+	double maxWaitMSecs;
+
+	/// Returns the fraction of the acquisitions that had to block, in the range [0, 1].
+	float ContentionRate() const { return acquisitions > 0 ? (float)contendedAcquisitions / acquisitions : 0.f; }
+};
+
+/// Copies the counters of all named locks into the given vector, sorted by name. [any thread]
+void ReadLockContention(std::vector<LockContentionSample> &out);
+
+/// Zeroes the counters of all named locks. [any thread]
+void ResetLockContention();
+
+} // ~kNet
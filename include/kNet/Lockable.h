@@ -28,6 +28,7 @@
 #include <assert.h>
 #include "PolledTimer.h"
 #include "NetworkLogging.h"
+#include "LockContention.h"
 
 namespace kNet
 {
@@ -147,6 +148,7 @@ public:
 	typedef ConstLock<T> ConstLockType;
 
 	Lockable()
+	:contentionCounters(0)
 	{
 #ifndef KNET_USE_BOOST
 #ifdef WIN32
@@ -168,7 +170,7 @@ public:
 	}
 */
 	explicit Lockable(const T &value_)
-	:value(value_)
+	:value(value_), contentionCounters(0)
 	{
 #ifndef KNET_USE_BOOST
 #ifdef WIN32
@@ -206,25 +208,13 @@ public:
 */
 	T &LockGet()
 	{
-#ifdef KNET_USE_BOOST
-		boostMutex.lock();
-#elif defined(WIN32)
-		EnterCriticalSection(&lockObject);
-#else
-		pthread_mutex_lock(&mutex);
-#endif
+		LockMutex();
 		return value;
 	}
 
 	const T &LockGet() const
 	{
-#ifdef KNET_USE_BOOST
-		boostMutex.lock();
-#elif defined(WIN32)
-		EnterCriticalSection(&lockObject);
-#else
-		pthread_mutex_lock(&mutex);
-#endif
+		LockMutex();
 		return value;
 	}
 
@@ -239,6 +229,14 @@ public:
 #endif
 	}
 
+	/// Accounts the acquisitions of this lock under the given name, which is shared by all the Lockables that guard the
+	/// same kind of data, e.g. "NetworkServer::clients". The counters are read with ReadLockContention(). Call this
+	/// before the lock is shared with other threads. Unnamed locks are not accounted.
+	void SetContentionName(const char *name)
+	{
+		contentionCounters = RegisterLockContention(name);
+	}
+
 	LockType Acquire()
 	{
 		return LockType(this);
@@ -277,6 +275,47 @@ public:
 
 private:
 	T value;
+	LockContentionCounters *contentionCounters;
+
+	void LockMutex() const
+	{
+		if (!contentionCounters)
+		{
+			LockMutexBlocking();
+			return;
+		}
+		// Only the acquisitions that find the lock taken are timed, so the uncontended path costs a single atomic increment.
+		if (TryLockMutex())
+		{
+			contentionCounters->AddUncontended();
+			return;
+		}
+		const tick_t waitStart = Clock::Tick();
+		LockMutexBlocking();
+		contentionCounters->AddContended(Clock::TicksInBetween(Clock::Tick(), waitStart));
+	}
+
+	void LockMutexBlocking() const
+	{
+#ifdef KNET_USE_BOOST
+		boostMutex.lock();
+#elif defined(WIN32)
+		EnterCriticalSection(&lockObject);
+#else
+		pthread_mutex_lock(&mutex);
+#endif
+	}
+
+	bool TryLockMutex() const
+	{
+#ifdef KNET_USE_BOOST
+		return boostMutex.try_lock();
+#elif defined(WIN32)
+		return TryEnterCriticalSection(&lockObject) != FALSE;
+#else
+		return pthread_mutex_trylock(&mutex) == 0;
+#endif
+	}
 
 	void operator=(const Lockable<T> &);
 	Lockable(const Lockable<T> &);
@@ -0,0 +1,212 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+#pragma once
+
+/** @file LogHistogram.h
+	@brief The LogHistogram class, a fixed-size histogram with logarithmic buckets for latency and size distributions. */
+
+#include <cstring>
+#include <atomic>
+
+#include "Types.h"
+
+namespace kNet
+{
+
+/// A histogram of u32 values in buckets whose width grows with the magnitude of the values, in the style of HDR histograms.
+/** Values below cNumSubBuckets are counted exactly. Above that, each power of two is split into cNumSubBuckets equal
+	buckets, so that every recorded value is known to a relative precision of 1/cNumSubBuckets. The histogram has a fixed
+	size and Add() does not allocate. Not thread-safe. */
+class LogHistogram
+{
+public:
+	/// The number of bits of each value that are kept.
+	static const int cSubBucketBits = 4;
+	static const int cNumSubBuckets = 1 << cSubBucketBits;
+	static const int cNumBuckets = cNumSubBuckets + (32 - cSubBucketBits) * cNumSubBuckets;
+
+	LogHistogram()
+	{
+		Clear();
+	}
+
+	void Clear()
+	{
+		memset(counts, 0, sizeof(counts));
+		count = 0;
+		sum = 0;
+		min = 0;
+		max = 0;
+	}
+
+	void Add(u32 value)
+	{
+		++counts[BucketIndex(value)];
+		if (count == 0 || value < min)
+			min = value;
+		if (count == 0 || value > max)
+			max = value;
+		++count;
+		sum += value;
+	}
+
+	/// Adds all the values counted in the given histogram to this histogram.
+	void Merge(const LogHistogram &rhs)
+	{
+		if (rhs.count == 0)
+			return;
+		for(int i = 0; i < cNumBuckets; ++i)
+			counts[i] += rhs.counts[i];
+		if (count == 0 || rhs.min < min)
+			min = rhs.min;
+		if (count == 0 || rhs.max > max)
+			max = rhs.max;
+		count += rhs.count;
+		sum += rhs.sum;
+	}
+
+	u64 Count() const { return count; }
+	u64 Sum() const { return sum; }
+	u32 Min() const { return min; }
+	u32 Max() const { return max; }
+	float Mean() const { return count > 0 ? (float)((double)sum / count) : 0.f; }
+
+	/// Returns the value below which the given fraction of the recorded values fall, e.g. 0.99 for the 99th percentile.
+	/// The result is the upper bound of the bucket the percentile falls into, clamped to the range of the recorded values.
+	/// @return The percentile value, or 0 if the histogram is empty.
+	u32 Percentile(double fraction) const
+	{
+		if (count == 0)
+			return 0;
+		u64 rank = (u64)(fraction * (double)count + 0.5);
+		if (rank < 1)
+			rank = 1;
+		if (rank > count)
+			rank = count;
+		u64 accumulated = 0;
+		for(int i = 0; i < cNumBuckets; ++i)
+		{
+			accumulated += counts[i];
+			if (accumulated >= rank)
+			{
+				u32 value = BucketUpperBound(i);
+				if (value > max)
+					value = max;
+				if (value < min)
+					value = min;
+				return value;
+			}
+		}
+		return max;
+	}
+
+	/// Returns the index of the bucket the given value is counted in.
+	static int BucketIndex(u32 value)
+	{
+		if (value < (u32)cNumSubBuckets)
+			return (int)value;
+		const int exponent = HighestBit(value); // In the range [cSubBucketBits, 31].
+		const int subBucket = (int)(value >> (exponent - cSubBucketBits)) & (cNumSubBuckets - 1);
+		return cNumSubBuckets + (exponent - cSubBucketBits) * cNumSubBuckets + subBucket;
+	}
+
+	/// Returns the largest value that is counted in the given bucket.
+	static u32 BucketUpperBound(int index)
+	{
+		if (index < cNumSubBuckets)
+			return (u32)index;
+		const int exponent = (index - cNumSubBuckets) / cNumSubBuckets + cSubBucketBits;
+		const int subBucket = (index - cNumSubBuckets) % cNumSubBuckets;
+		const u64 lowerBound = ((u64)(cNumSubBuckets + subBucket)) << (exponent - cSubBucketBits);
+		const u64 width = (u64)1 << (exponent - cSubBucketBits);
+		return (u32)(lowerBound + width - 1);
+	}
+
+private:
+	u32 counts[cNumBuckets];
+	u64 count;
+	u64 sum;
+	u32 min;
+	u32 max;
+
+	friend class AtomicLogHistogram;
+
+	/// Returns the index of the highest set bit of the given nonzero value.
+	static int HighestBit(u32 value)
+	{
+#ifdef __GNUC__
+		return 31 - __builtin_clz(value);
+#else
+		int bit = 0;
+		while(value >>= 1)
+			++bit;
+		return bit;
+#endif
+	}
+};
+
+/// A LogHistogram that one thread adds values to while other threads read copies of it.
+/** The counters are atomic, so a copy has no torn values. A copy taken while the writer is in Add() can still have the
+	new value in one counter and not in another, so a reader that needs a consistent copy brackets it with a sequence
+	counter that the writer updates around Add(), as MessageTypeStatsTable does. */
+class AtomicLogHistogram
+{
+public:
+	AtomicLogHistogram()
+	{
+		for(int i = 0; i < LogHistogram::cNumBuckets; ++i)
+			counts[i].store(0, std::memory_order_relaxed);
+		count.store(0, std::memory_order_relaxed);
+		sum.store(0, std::memory_order_relaxed);
+		min.store(0, std::memory_order_relaxed);
+		max.store(0, std::memory_order_relaxed);
+	}
+
+	/// [writer thread]
+	void Add(u32 value)
+	{
+		std::atomic<u32> &bucket = counts[LogHistogram::BucketIndex(value)];
+		bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		const u64 oldCount = count.load(std::memory_order_relaxed);
+		if (oldCount == 0 || value < min.load(std::memory_order_relaxed))
+			min.store(value, std::memory_order_relaxed);
+		if (oldCount == 0 || value > max.load(std::memory_order_relaxed))
+			max.store(value, std::memory_order_relaxed);
+		count.store(oldCount + 1, std::memory_order_relaxed);
+		sum.store(sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	/// Copies the values counted so far to the given histogram. [any thread]
+	void Read(LogHistogram &out) const
+	{
+		for(int i = 0; i < LogHistogram::cNumBuckets; ++i)
+			out.counts[i] = counts[i].load(std::memory_order_relaxed);
+		out.count = count.load(std::memory_order_relaxed);
+		out.sum = sum.load(std::memory_order_relaxed);
+		out.min = min.load(std::memory_order_relaxed);
+		out.max = max.load(std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<u32> counts[LogHistogram::cNumBuckets];
+	std::atomic<u64> count;
+	std::atomic<u64> sum;
+	std::atomic<u32> min;
+	std::atomic<u32> max;
+
+	AtomicLogHistogram(const AtomicLogHistogram &); ///< Noncopyable, N/I.
+	void operator =(const AtomicLogHistogram &); ///< Noncopyable, N/I.
+};
+
+} // ~kNet
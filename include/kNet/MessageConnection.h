@@ -20,13 +20,18 @@
 #include <map>
 #include <utility>
 #include <set>
+#include <atomic>
 
 #include "kNetBuildConfig.h"
 #include "WaitFreeQueue.h"
+#include "SegmentedQueue.h"
+#include "TrafficStatsWindow.h"
+#include "MessageTypeStatsTable.h"
 #include "NetworkSimulator.h"
 #include "LockFreePoolAllocator.h"
 #include "Lockable.h"
 #include "Socket.h"
+#include "HostResolver.h"
 #include "IMessageHandler.h"
 #include "BasicSerializedDataTypes.h"
 #include "Datagram.h"
@@ -71,20 +76,6 @@ struct ConnectionStatistics
 	/// Contains an entry for each recently performed Ping operation, sorted by age (oldest first).
 	std::vector<PingTrack> ping;
 
-	/// Remembers both in- and outbound traffic events on the socket.
-	struct TrafficTrack
-	{
-		tick_t tick;          ///< Denotes when this event occurred.
-		unsigned long packetsIn;   ///< The number of datagrams in when this event occurred.
-		unsigned long packetsOut;  ///< The number of datagrams out when this event occurred.
-		unsigned long messagesIn;  ///< The total number of messages the received datagrams contained.
-		unsigned long messagesOut; ///< The total number of messages the sent datagrams contained.
-		unsigned long bytesIn;     ///< The total number of bytes the received datagrams contained.
-		unsigned long bytesOut;    ///< The total number of bytes the sent datagrams contained. 
-	};
-	/// Contains an entry for each recent traffic event (data in/out) on the connection, sorted by age (oldest first).
-	std::vector<TrafficTrack> traffic;
-
 	/// Remembers the send/receive time of a datagram with a certain ID.
 	struct DatagramIDTrack
 	{
@@ -93,6 +84,21 @@ struct ConnectionStatistics
 	};
 	/// Contains an entry for each recently received packet, sorted by age (oldest first).
 	std::vector<DatagramIDTrack> recvPacketIDs;
+
+	/// The per-message ID statistics are kept in MessageConnection::messageTypeStats, outside this lock.
+	typedef kNet::MessageTypeStats MessageTypeStats;
+};
+
+/// The state of a connection started with Network::ConnectAsync(), until its socket has connected.
+struct ConnectAttempt
+{
+	/// The lookup of the remote host name. Owned by the attempt, and freed with HostResolver::Release().
+	HostResolver::Request *resolve;
+	unsigned short port;
+	/// The socket that is being connected, or INVALID_SOCKET while the name is still being resolved.
+	SOCKET socket;
+	/// The local host name of the Network, stored into the connected Socket.
+	std::string localHostName;
 };
 
 /// Comparison object that sorts the two messages by their priority (higher priority/smaller number first).
@@ -187,6 +193,15 @@ public:
 	/// \note You may not call this function in middle of StartNewMessage() - EndAndQueueMessage() function calls.
 	void Close(int maxMSecsToWait = 500); // [main thread]
 
+	/// Starts a benign disconnect like Disconnect(0), and returns immediately. The worker thread moves the connection to
+	/// the ConnectionClosed state when the peer has closed its end as well, or when maxMSecsToWait has passed, whichever
+	/// comes first. The socket is freed when the connection is then reaped by Process() or NetworkServer::Process(), or
+	/// Close(0) is called. A connection that is still pending is closed at once.
+	void CloseAsync(int maxMSecsToWait = 500); // [main thread]
+
+	/// Returns true if a CloseAsync() has been started on this connection, and the connection has not closed yet.
+	bool IsClosingAsync() const { return closeTimeoutTick.load(std::memory_order_relaxed) != 0; } // [main and worker thread]
+
 	// There are 3 ways to send messages through a MessageConnection:
 	// StartNewMessage/EndAndQueueMessage, SendStruct, and Send. See below.
 
@@ -248,8 +263,10 @@ public:
 	/// Returns the number of outbound messages in the worker thread outbound message queue (already accepted and pending a send by the worker thread).
 	size_t OutboundQueueSize() const { return outboundQueue.Size(); } // [main and worker thread]
 
-	/// Returns the underlying raw socket. [main and worker thread]
-	Socket *GetSocket() { return socket; }
+	/// Returns the underlying raw socket. A connection from Network::ConnectAsync() replaces its placeholder socket with
+	/// a new one when it has connected, so do not hold on to the returned pointer. [main and worker thread]
+	Socket *GetSocket() { return socket.load(std::memory_order_acquire); }
+	const Socket *GetSocket() const { return socket.load(std::memory_order_acquire); }
 
 	/// Returns an object that identifies the local endpoint (IP and port) this connection is connected to.
 	EndPoint LocalEndPoint() const; // [main and worker thread]
@@ -331,6 +348,22 @@ public:
 	/// Returns the total number of bytes (excluding IP and TCP/UDP headers) that have been sent from this connection.
 	u64 BytesOutTotal() const { return bytesOutTotal; } // [main and worker thread]
 
+	/// Returns the latency and size distributions of the outbound messages with the given ID. The returned
+	/// histograms are empty if no such messages have been sent. Does not block the worker thread.
+	MessageTypeStats MessageTypeStatistics(message_id_t id) const; // [main and worker thread]
+
+	/// Fills in the IDs of the messages that have been sent out on this connection, in increasing order. IDs from
+	/// MessageTypeStatsTable::cOverflowId up are reported together as that ID.
+	void MessageTypeIds(std::vector<message_id_t> &out) const { messageTypeStats.MessageIds(out); } // [main and worker thread]
+
+	/// Fills in the traffic totals of the connection over the last few seconds. Unlike the ...PerSec() functions above,
+	/// which are refreshed periodically by the worker thread, this reads the current counters. Does not block the worker thread.
+	void TrafficStatistics(TrafficStatsSnapshot &out) const { trafficStats.Snapshot(out, Clock::Tick()); } // [main and worker thread]
+
+	/// Returns true if the connection has been idle long enough that the worker thread has released its idle buffers
+	/// and only keeps it alive with pings. The connection wakes up automatically when application messages flow again.
+	bool IsHibernating() const { return hibernating; } // [main and worker thread]
+
 	/// Returns the simulator object which can be used to apply network condition simulations to this connection.
 	NetworkSimulator &NetworkSendSimulator() { return networkSendSimulator; }
 
@@ -366,10 +399,17 @@ protected:
 	bool IsWorkerThreadRunning() const { return workerThread != 0; } // [main and worker thread]
 
 	/// A queue populated by the main thread to give out messages to the MessageConnection work thread to process.
-	WaitFreeQueue<NetworkMessage*> outboundAcceptQueue; // [produced by main thread, consumed by worker thread]
+	SegmentedQueue<NetworkMessage*> outboundAcceptQueue; // [produced by main thread, consumed by worker thread]
 
 	/// A queue populated by the networking thread to hold all the incoming messages until the application can process them.	
-	WaitFreeQueue<NetworkMessage*> inboundMessageQueue; // [produced by worker thread, consumed by main thread]
+	SegmentedQueue<NetworkMessage*> inboundMessageQueue; // [produced by worker thread, consumed by main thread]
+
+	/// The number of messages the inbound queue is allowed to hold before the worker thread stops reading new data
+	/// from the socket and waits for the application to catch up. The queue itself is unbounded, this is a soft limit.
+	static const int cMaxInboundMessageQueueSize = 16 * 1024;
+
+	/// Returns how many more messages the worker thread may add to inboundMessageQueue before reaching cMaxInboundMessageQueueSize.
+	int InboundMessageQueueCapacityLeft() const { return std::max(0, cMaxInboundMessageQueueSize - inboundMessageQueue.Size()); } // [main and worker thread]
 
 	/// A priority queue that maintains in order all the messages that are going out the pipe.
 	///\todo Make the choice of which of the following structures to use a runtime option.
@@ -414,15 +454,54 @@ protected:
 	/// Returns how many milliseconds need to be waited before this socket can try sending data the next time.
 	virtual unsigned long TimeUntilCanSendPacket() const = 0; // [worker thread]
 
+	/// Returns how many microseconds the worker thread should wait before it calls SendOutPackets() again.
+	virtual unsigned long MicrosecondsUntilCanSendPacket() const = 0; // [worker thread]
+
 	/// Performs the internal work tick that updates this connection.
 	void UpdateConnection(); // [worker thread]
 
+	/// Advances the name lookup and the non-blocking connect of connectAttempt. Frees connectAttempt once the socket
+	/// has connected, or the attempt has failed or timed out, in which case the connection is closed. [worker thread]
+	void UpdateConnectAttempt(); // [worker thread]
+
+	/// Frees connectAttempt and closes its socket, if any.
+	void FreeConnectAttempt();
+
 	/// Overridden by a subclass of MessageConnection to do protocol-specific updates (private implementation -pattern)
 	virtual void DoUpdateConnection() {} // [worker thread]
 
+	/// If true, the connection has seen no application messages for a while, and the periodic statistics and
+	/// protocol timers are skipped until traffic resumes. [written by the worker thread, read by the main thread
+	/// through IsHibernating()]
+	std::atomic<bool> hibernating;
+
+	/// The tick when the last application message was sent or received. [worker thread]
+	tick_t lastMessageActivityTime;
+
+	/// Puts the connection into the hibernating state if it has been idle for long enough.
+	void CheckHibernation(); // [worker thread]
+
+	/// Returns the connection to normal processing from the hibernating state.
+	void WakeUp(); // [worker thread]
+
+	/// Returns true if the protocol-specific state has nothing in flight, so that the connection may hibernate.
+	virtual bool CanHibernate() const { return true; } // [worker thread]
+
+	/// Called when the connection goes to hibernation to free up the protocol-specific buffers that are only needed under traffic.
+	virtual void ReleaseIdleMemory() {} // [worker thread]
+
 	/// Marks that the peer has closed the connection and will not send any more application-level data.
 	void SetPeerClosed(); // [worker thread]
 
+#ifdef KNET_NETWORK_PROFILING
+	/// Returns the metric the size of the given message is recorded into when it is sent out.
+	static StatsMetricId OutboundMessageMetric(const NetworkMessage &msg); // [worker thread]
+
+	/// Returns the metric the fragments of a message recorded into the given metric are recorded into. The name of the
+	/// fragment metric is registered only the first time it is asked for. [main and worker thread]
+	static StatsMetricId FragmentMetric(StatsMetricId messageMetric);
+#endif
+
 	virtual void DumpConnectionStatus() const {} // [main thread]
 
 	/// Posted when the application has pushed us some messages to handle.
@@ -477,6 +556,12 @@ protected:
 	/// Adds a new entry for inbound data statistics.
 	void AddInboundStats(unsigned long numBytes, unsigned long numPackets, unsigned long numMessages); // [worker thread]
 
+	/// Records the queueing delay and size of each of the given messages that was written to the socket for the first time.
+	void AddMessageSendStats(NetworkMessage * const *messages, size_t numMessages, tick_t sendTick); // [worker thread]
+
+	/// Records the time from enqueueing to acknowledgement of each of the given messages.
+	void AddMessageAckStats(NetworkMessage * const *messages, size_t numMessages, tick_t ackTick); // [worker thread]
+
 	/// Pulls in all new messages from the main thread to the worker thread side and admits them to the send priority queue.
 	void AcceptOutboundMessages(); // [worker thread]
 
@@ -486,12 +571,43 @@ protected:
 	/// The object that receives notifications of all received data.
 	IMessageHandler *inboundMessageHandler; // [main thread]
 
-	/// The underlying socket on top of which this connection operates.
-	Socket *socket; // [set by main thread before the worker thread is running. Read-only when worker thread is running. Read by main and worker thread]
+	/// The underlying socket on top of which this connection operates. A Socket is never modified once it is published
+	/// here: a connect that completes on the worker thread stores a new, fully built Socket with release ordering.
+	std::atomic<Socket*> socket; // [set by main thread before the worker thread is running. Read by main and worker thread]
+
+	/// For a connection from Network::ConnectAsync(), the Socket the worker thread fills in once connected, and after
+	/// that the placeholder Socket it replaced. The Network frees it together with socket. [worker thread, main thread after the worker is detached]
+	Socket *spareSocket;
+
+	/// The Sockets a server-side UDP connection replaced when its client moved to a new address. The worker thread may
+	/// still be sending through one, so the Network frees them together with socket. [main thread]
+	std::vector<Socket*> retiredSockets;
 
 	/// Specifies the current connection state.
 	ConnectionState connectionState; // [main and worker thread]
 
+	/// The name lookup and the non-blocking connect of a connection started with Network::ConnectAsync(), or null when
+	/// the socket is connected. The main thread only tests it for null, to tell that the socket has no handle yet.
+	/// [set by the main thread before the worker thread is running, then owned by the worker thread]
+	std::atomic<ConnectAttempt*> connectAttempt;
+
+	/// If nonzero, the connection is closed if it is still in the ConnectionPending state at this tick. [worker thread]
+	tick_t connectTimeoutTick;
+
+	/// If nonzero, a CloseAsync() is in progress, and the connection is closed at this tick at the latest.
+	/// Whichever thread swaps this back to zero reports the finished close to the owner server. [main and worker thread]
+	std::atomic<tick_t> closeTimeoutTick;
+
+	/// Ends a CloseAsync() in progress, if there is one. [main and worker thread]
+	void FinishCloseAsync();
+
+	/// If the connection is down, closes it and returns true. [main thread]
+	bool CloseIfDown();
+
+	/// Passes the messages in the inbound queue to the registered message handler. Called by Process(), and by the
+	/// process threads of the owner server while the main thread waits for them. [main or server process thread]
+	void HandleInboundMessages(int maxMessagesToProcess);
+
 	/// If true, all sends to the socket are on hold, until ResumeOutboundSends() is called.
 	bool bOutboundSendsPaused; // [set by main thread, read by worker thread]
 
@@ -505,6 +621,8 @@ protected:
 	MessageConnection(const MessageConnection &); ///< Noncopyable, N/I.
 
 	float rtt; ///< The currently estimated round-trip time, in milliseconds. [main and worker thread]
+	/// If true, rtt follows the RTT samples taken from the acks of the peer, and the ping replies no longer update it. [worker thread]
+	bool rttFromPacketAcks;
 	tick_t lastHeardTime; ///< The tick since last successful receive from the socket. [main and worker thread]
 	float packetsInPerSec; ///< The average number of datagrams we are receiving/second. [main and worker thread]
 	float packetsOutPerSec; ///< The average number of datagrams we are sending/second. [main and worker thread]
@@ -515,6 +633,12 @@ protected:
 	u64 bytesInTotal;
 	u64 bytesOutTotal;
 
+	/// Counts the in- and outbound traffic over the recent past. Written by the worker thread only. [main and worker thread]
+	TrafficStatsWindow trafficStats;
+
+	/// The latency and size histograms of the outbound messages, per message ID. Written by the worker thread only. [main and worker thread]
+	MessageTypeStatsTable messageTypeStats;
+
 	/// Stores the current settigns related to network conditions testing.
 	/// By default, the simulator is disabled.
 	NetworkSimulator networkSendSimulator;
@@ -556,6 +680,7 @@ protected:
 	static const unsigned long MsgIdPingReply = 2;
 	static const unsigned long MsgIdFlowControlRequest = 3;
 	static const unsigned long MsgIdPacketAck = 4;
+	static const unsigned long MsgIdConnectionId = 5;
 	static const unsigned long MsgIdDisconnect = 0x3FFFFFFF;
 	static const unsigned long MsgIdDisconnectAck = 0x3FFFFFFE;
 
@@ -588,9 +713,8 @@ void MessageConnection::SendStruct(const SerializableData &data, unsigned long i
 	msg->priority = priority;
 	msg->reliable = reliable;
 #ifdef KNET_NETWORK_PROFILING
-	char str[512];
-	sprintf(str, "%s (%u)", SerializableData::Name(), (unsigned int)id);
-	msg->profilerName = str;
+	static StatsMetricFamily profilerMetrics((std::string("messageOut.") + SerializableData::Name() + " (%u)").c_str(), "bytes");
+	msg->profilerMetric = profilerMetrics.Get((u32)id);
 #endif
 
 	EndAndQueueMessage(msg);
@@ -0,0 +1,100 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+#pragma once
+
+/** @file MessageTypeStatsTable.h
+	@brief The MessageTypeStatsTable class, which keeps the latency and size histograms of each outbound message ID. */
+
+#include <atomic>
+#include <vector>
+
+#include "Types.h"
+#include "LogHistogram.h"
+
+namespace kNet
+{
+
+/// The latency and size distributions of the outbound messages of one message ID.
+struct MessageTypeStats
+{
+	/// Microseconds from EndAndQueueMessage to the time the message was first written to the socket.
+	LogHistogram queueTimeUSecs;
+	/// Microseconds from EndAndQueueMessage to the time the peer acknowledged the message. Only reliable messages
+	/// over UDP are acknowledged, TCP leaves this empty.
+	LogHistogram ackTimeUSecs;
+	/// The sizes of the message payloads, in bytes.
+	LogHistogram sizeBytes;
+};
+
+/// The MessageTypeStats of each message ID a connection has sent, indexed by the ID.
+/** There is a single writer thread, which records the messages, and any number of reader threads. The writer never
+	takes a lock. It only allocates the first time it sees a message ID, and when the index grows to take a larger ID.
+	Like TrafficStatsWindow, each entry has a sequence counter that is odd while the writer updates it, and a reader
+	retries its copy if the writer was active meanwhile. */
+class MessageTypeStatsTable
+{
+public:
+	/// The message IDs from this one up are counted together, and reported under this ID.
+	static const message_id_t cOverflowId = 4096;
+
+	MessageTypeStatsTable();
+	~MessageTypeStatsTable();
+
+	/// Records the queueing delay and size of a message that was written to the socket for the first time. [writer thread]
+	void AddSend(message_id_t id, u32 queueTimeUSecs, u32 sizeBytes);
+
+	/// Records the time from enqueueing to acknowledgement of a message. [writer thread]
+	void AddAck(message_id_t id, u32 ackTimeUSecs);
+
+	/// Copies the histograms of the given message ID.
+	/// @return False if no message with the ID has been recorded, in which case out is left untouched. [any thread]
+	bool Read(message_id_t id, MessageTypeStats &out) const;
+
+	/// Fills in the message IDs that have been recorded, in increasing order. [any thread]
+	void MessageIds(std::vector<message_id_t> &out) const;
+
+private:
+	struct Entry
+	{
+		/// Odd while the writer is updating the histograms.
+		std::atomic<u32> sequence;
+		AtomicLogHistogram queueTimeUSecs;
+		AtomicLogHistogram ackTimeUSecs;
+		AtomicLogHistogram sizeBytes;
+	};
+
+	/// The entries of the message IDs [0, size[, or null for the IDs not seen yet.
+	struct Index
+	{
+		size_t size;
+		std::atomic<Entry*> *entries;
+	};
+
+	std::atomic<Index*> index;
+
+	/// The indices that a larger one replaced. Readers may still be using them, so they are freed in the destructor.
+	std::vector<Index*> retiredIndices; // [writer thread]
+
+	/// Returns the entry of the given message ID, allocating it if needed. [writer thread]
+	Entry &EntryFor(message_id_t id);
+
+	static Index *NewIndex(size_t size);
+	static void BeginWrite(Entry &e);
+	static void EndWrite(Entry &e);
+
+	MessageTypeStatsTable(const MessageTypeStatsTable &); ///< Noncopyable, N/I.
+	void operator =(const MessageTypeStatsTable &); ///< Noncopyable, N/I.
+};
+
+} // ~kNet
@@ -27,12 +27,16 @@
 #include "Socket.h"
 #include "NetworkServer.h"
 #include "MessageConnection.h"
+#include "HostResolver.h"
 #include "StatsEventHierarchy.h"
+#include "StatsCounters.h"
 
 namespace kNet
 {
 
 class NetworkWorkerThread;
+class MetricsEndpoint;
+struct NetworkMetrics;
 
 /// Provides the application an interface for both client and server networking.
 class Network
@@ -74,8 +78,27 @@ public:
 	void CloseConnection(MessageConnection *connection);
 
 	/** Connects to the given address:port using kNet over UDP or TCP. When you are done with the connection,
-		free it by letting the refcount go to 0. */
-	Ptr(MessageConnection) Connect(const char *address, unsigned short port, SocketTransportLayer transport, IMessageHandler *messageHandler, Datagram *connectMessage = 0);
+		free it by letting the refcount go to 0.
+		Over UDP, the connectMessage is passed to INetworkServerListener::NewConnectionAttempt() on the server, and the
+		messages sent on the connection before the server answers travel in the same Connection Start datagrams. Pass
+		holdConnectDatagram=true to get the connection with its outbound sends paused: queue the first messages of the
+		session (login, join) and call ResumeOutboundSends() to send them together with the connection attempt. */
+	Ptr(MessageConnection) Connect(const char *address, unsigned short port, SocketTransportLayer transport, IMessageHandler *messageHandler,
+		Datagram *connectMessage = 0, bool holdConnectDatagram = false);
+
+	/** Starts connecting to the given address:port like Connect(), but returns right away without blocking on the name
+		lookup or on the TCP handshake. The name is resolved on the resolver threads of Resolver(), and a worker thread
+		finishes the non-blocking connect, so that any number of connects can be in progress at once.
+		The returned connection is in the ConnectionPending state until the connect completes. Poll GetConnectionState()
+		or call WaitToEstablishConnection() on it. If the name does not resolve, the connect fails, or the connection is not
+		established within timeoutMSecs, the connection transitions to ConnectionClosed. See Connect() for holdConnectDatagram. [main thread]
+		@param timeoutMSecs Must be positive.
+		@return The new connection, or null if the parameters are invalid. */
+	Ptr(MessageConnection) ConnectAsync(const char *address, unsigned short port, SocketTransportLayer transport, IMessageHandler *messageHandler,
+		Datagram *connectMessage = 0, int timeoutMSecs = 5000, bool holdConnectDatagram = false);
+
+	/// Returns the host name resolver used by ConnectAsync(). Its threads are started on the first lookup. [main thread]
+	HostResolver &Resolver();
 
 	/// Returns the local host name of the system (the local machine name or the local IP, whatever is specified by the system).
 	const char *LocalAddress() const { return localHostName.c_str(); }
@@ -90,7 +113,11 @@ public:
 	static int GetLastError();
 
 	/// Returns the amount of currently executing background network worker threads.
-	int NumWorkerThreads() const { return workerThreads.size(); }
+	int NumWorkerThreads() const { return workerThreads.Acquire()->size(); }
+
+	/// Sets the busy-poll mode of all the current and future worker threads of this Network. See
+	/// NetworkWorkerThread::SetBusyPoll(). Pass 0 to go back to blocking waits. [main thread]
+	void SetWorkerBusyPoll(int idleMSecs);
 
 	/// Returns the NetworkServer object, or null if no server has been started.
 	Ptr(NetworkServer) GetServer() { return server; }
@@ -98,8 +125,30 @@ public:
 	/// Returns all current connections in the system.
 	std::set<MessageConnection *> Connections() const { return connections; }
 
-	/// Returns the data structure that collects statistics about the whole Network.
-	Lock<StatsEventHierarchyNode> Statistics() { return statistics.Acquire(); }
+	/// Returns the data structure that collects statistics about the whole Network. The values recorded into Counters()
+	/// since the previous call are added to the hierarchy before it is returned.
+	Lock<StatsEventHierarchyNode> Statistics();
+
+	/// Returns the lock-free counters the ADDEVENT macro records the network events into. [any thread]
+	StatsCounters &Counters() { return counters; }
+
+	/// Fills in the current statistics of all the worker threads, servers and connections of this Network, and the
+	/// values recorded into Counters(). Serialize the result with MetricsToJSON() or MetricsToPrometheus(). [any thread]
+	void SnapshotMetrics(NetworkMetrics &out);
+
+	/// Starts serving SnapshotMetrics() over HTTP on the given TCP port, at /metrics in the Prometheus text format and
+	/// at /metrics.json as JSON. The requests are served on a thread of its own. Stops a previously started endpoint first.
+	/// @param loopbackOnly If true, the endpoint only accepts connections from the local host.
+	/// @return True if the endpoint was started.
+	bool StartMetricsEndpoint(unsigned short port, bool loopbackOnly = true);
+
+#ifndef WIN32
+	/// Starts serving SnapshotMetrics() over HTTP on a Unix domain socket at the given path. See StartMetricsEndpoint().
+	bool StartMetricsEndpoint(const char *unixSocketPath);
+#endif
+
+	/// Stops the endpoint started with StartMetricsEndpoint(), if one is running.
+	void StopMetricsEndpoint();
 
 private:
 	/// Specifies the local network address of the system. This name is cached here on initialization
@@ -110,20 +159,41 @@ private:
 	/// is acting as a server. Otherwise this data is not used.
 	Ptr(NetworkServer) server;
 
-	/// Contains all active sockets in the system.
-	std::list<Socket> sockets;
+	/// Contains all active sockets in the system. Each socket stores its index in this list in Socket::networkIndex.
+	std::vector<Socket*> sockets;
+
+	/// Closed Socket objects that are kept for reuse, so that a server with high connection churn does not allocate
+	/// a new one for each connection. At most cMaxFreeSockets are kept.
+	std::vector<Socket*> freeSockets;
+	static const size_t cMaxFreeSockets = 256;
 
 	/// Tracks all existing connections in the system.
 	std::set<MessageConnection *> connections;
 
 	Lockable<StatsEventHierarchyNode> statistics;
 
+	StatsCounters counters;
+
+	/// The HTTP endpoint that serves the metrics, or null if it has not been started.
+	MetricsEndpoint *metricsEndpoint;
+
 	/// Takes the ownership of the given socket, and returns a pointer to the owned one.
 	Socket *StoreSocket(const Socket &cp);
 
+	/// Removes the given socket from the socket list and returns it to the free list. The socket must be closed.
+	void ReleaseSocket(Socket *socket);
+
+	/// Resolves the host names of ConnectAsync(). Created on first use.
+	HostResolver *resolver;
+
+	/// The busy-poll idle time that new worker threads are created with, or 0.
+	int workerBusyPollIdleMSecs;
+
 	friend class NetworkServer;
+	friend class MessageConnection;
 
-	void SendUDPConnectDatagram(Socket &socket, Datagram *connectMessage);
+	/// Returns a client Socket that wraps the given connected socket handle.
+	static Socket CreateConnectedSocket(SOCKET connectSocket, SocketTransportLayer transport, const char *localHostName);
 
 	/// Returns a new UDP socket that is bound to communicating with the given endpoint, under
 	/// the given UDP master server socket.
@@ -138,8 +208,9 @@ private:
 
 	/// Stores all the currently running network worker threads. Each thread is assigned
 	/// a list of MessageConnections and NetworkServers to oversee. The worker threads
-	/// then manage the socket reads and writes on these connections.
-	std::vector<NetworkWorkerThread*> workerThreads;
+	/// then manage the socket reads and writes on these connections. Only the main thread adds and removes threads,
+	/// the lock lets SnapshotMetrics() walk the list from other threads.
+	Lockable<std::vector<NetworkWorkerThread*> > workerThreads;
 
 	/// Examines each currently running worker thread and returns one that has sufficiently low load,
 	/// or creates a new thread and returns it if no such thread exists. The thread is added and maintained
@@ -59,6 +59,29 @@ bool IsLogChannelActive(LogChannel channel);
 /// logging to target std::cout.
 void SetLogFile(const char *filename);
 
+/// Switches between synchronous and asynchronous logging. By default, each line is formatted and written out by the
+/// thread that logs it, under a global lock. In asynchronous mode, the logging thread only formats the line into a
+/// lock-free ring buffer of its own, and a background thread writes the lines of all threads out in timestamp order.
+/// If a ring is full, the line is dropped and counted, and the background thread logs the number of dropped lines.
+/// Disabling asynchronous logging writes out all the queued lines first.
+void SetAsyncLogging(bool enabled);
+
+/// Returns true if asynchronous logging is enabled.
+bool IsAsyncLoggingEnabled();
+
+/// Writes out all the lines queued so far in asynchronous mode, and flushes the log file.
+void FlushLog();
+
+/// Limits the number of lines each LOG() call site can print per second. The lines over the limit are dropped, and the
+/// next line the call site prints tells how many were suppressed. Pass in 0 to disable the limit, which is the default.
+void SetLogRateLimit(int maxLinesPerSecond);
+
+/// Returns the total number of lines that were dropped because the asynchronous log ring of the logging thread was full.
+unsigned long long NumDroppedLogLines();
+
+/// Returns the total number of lines that were dropped by the per call site rate limit.
+unsigned long long NumRateLimitedLogLines();
+
 /// When called, sets the runtime to print out all memory leaks at program exit time. Win32-only. On
 /// linux, this is a no-op.
 void EnableMemoryLeakLoggingAtExit();
@@ -19,6 +19,8 @@
 #include "kNetBuildConfig.h"
 #include "LockFreePoolAllocator.h"
 #include "FragmentedTransferManager.h"
+#include "StatsCounters.h"
+#include "Clock.h"
 #include "Types.h"
 
 namespace kNet
@@ -108,8 +110,16 @@ public:
 	/// to leave the outbound send queue.
 	bool obsolete;
 
+	/// The time this message was queued for sending with EndAndQueueMessage.
+	tick_t enqueueTick;
+	/// The time this message was most recently serialized into an outbound packet.
+	tick_t packTick;
+	/// The time this message was first written to the socket, or 0 if it has not been sent yet.
+	tick_t sendTick;
+
 #ifdef KNET_NETWORK_PROFILING
-	std::string profilerName;
+	/// The metric the size of this message is recorded into when it is sent out, or cInvalidStatsMetric to record it by the message ID.
+	StatsMetricId profilerMetric;
 #endif
 
 	/// Checks if this message is newer than the other message.
@@ -0,0 +1,187 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+#pragma once
+
+/** @file NetworkMetrics.h
+	@brief Machine-readable snapshots of the statistics of a Network, and the MetricsEndpoint that serves them over HTTP. */
+
+#include <string>
+#include <vector>
+
+#include "Types.h"
+#include "Socket.h"
+#include "MessageConnection.h"
+#include "StatsCounters.h"
+#include "Thread.h"
+#include "LockContention.h"
+#include "NetworkWorkerThread.h"
+
+namespace kNet
+{
+
+class Network;
+class NetworkServer;
+
+/// A summary of a LogHistogram.
+struct HistogramMetrics
+{
+	u64 count;
+	u64 sum;
+	u32 p50;
+	u32 p90;
+	u32 p99;
+	u32 max;
+};
+
+/// The latency and size distributions of the outbound messages of one message ID on one connection.
+struct MessageTypeMetrics
+{
+	message_id_t id;
+	HistogramMetrics queueTimeUSecs;
+	HistogramMetrics ackTimeUSecs;
+	HistogramMetrics sizeBytes;
+};
+
+/// A point-in-time copy of the statistics of a MessageConnection.
+struct ConnectionMetrics
+{
+	std::string localEndPoint;
+	std::string remoteEndPoint;
+	SocketTransportLayer transport;
+	ConnectionState state;
+	/// True if the connection was accepted by a NetworkServer, false if it was opened with Network::Connect.
+	bool serverSide;
+	bool hibernating;
+	/// The index of the NetworkWorkerThread that manages this connection in NetworkMetrics::workerThreads.
+	int workerThread;
+
+	float roundTripTime;
+	float lastHeardTime;
+	u64 bytesInTotal;
+	u64 bytesOutTotal;
+	TrafficStatsSnapshot traffic;
+	u32 inboundMessagesPending;
+	u32 outboundMessagesPending;
+
+	// The following are only filled in for UDP connections, and are zero for TCP.
+	float packetLossRate;
+	float retransmissionTimeout;
+	float datagramSendRate;
+	u32 outboundUnackedDatagrams;
+
+	std::vector<MessageTypeMetrics> messageTypes;
+};
+
+/// A point-in-time copy of the state of a NetworkServer.
+struct ServerMetrics
+{
+	/// The one-line summary given by NetworkServer::ToString().
+	std::string description;
+	/// The local ports the server is listening on, and the transport of each.
+	std::vector<std::pair<unsigned short, SocketTransportLayer> > listenPorts;
+	bool acceptsNewConnections;
+	int numConnections;
+	int workerThread;
+};
+
+/// A point-in-time copy of the load of a NetworkWorkerThread.
+struct WorkerThreadMetrics
+{
+	int numConnections;
+	int numServers;
+	/// Where the thread has spent its time since it was started.
+	WorkerLoopStatistics loop;
+};
+
+/// A snapshot of all the statistics of a Network: its worker threads, its server and all the connections they manage,
+/// and the values recorded into Network::Counters(). Produced by Network::SnapshotMetrics(), and serialized with
+/// MetricsToJSON() or MetricsToPrometheus().
+struct NetworkMetrics
+{
+	std::vector<WorkerThreadMetrics> workerThreads;
+	std::vector<ServerMetrics> servers;
+	std::vector<ConnectionMetrics> connections;
+	/// The aggregated values of each StatsCounters metric, indexed by the metric id. Metrics with no values have a count of zero.
+	std::vector<StatsSample> counters;
+	/// The contention of all named Lockables in the process, see ReadLockContention().
+	std::vector<LockContentionSample> locks;
+
+	void Clear();
+};
+
+/// Fills in the summary of the given histogram.
+void SummarizeHistogram(const LogHistogram &histogram, HistogramMetrics &out);
+
+/// Fills in the statistics of the given connection. [main and worker thread]
+void SnapshotConnectionMetrics(const MessageConnection &connection, ConnectionMetrics &out);
+
+/// Fills in the state of the given server. [main and worker thread]
+void SnapshotServerMetrics(const NetworkServer &server, ServerMetrics &out);
+
+/// Serializes the given metrics to a JSON object with "workerThreads", "servers", "connections", "counters" and "locks" arrays.
+std::string MetricsToJSON(const NetworkMetrics &metrics);
+
+/// Serializes the given metrics to the Prometheus text exposition format (version 0.0.4). All metric names are prefixed
+/// with "knet_", and connections are labeled by their endpoints and transport.
+std::string MetricsToPrometheus(const NetworkMetrics &metrics);
+
+/// A minimal HTTP server that runs on its own thread and serves the metrics of a Network.
+/** The endpoint answers GET /metrics with MetricsToPrometheus() and GET /metrics.json with MetricsToJSON(), and
+	closes the connection after each response. Requests are served one at a time, so a slow scraper only delays the
+	other scrapers, never the network worker threads. Create it with Network::StartMetricsEndpoint(). */
+class MetricsEndpoint
+{
+public:
+	explicit MetricsEndpoint(Network *owner);
+	~MetricsEndpoint();
+
+	/// Starts listening for HTTP requests on the given TCP port.
+	/// @param loopbackOnly If true, binds to 127.0.0.1 only, so that the metrics are not exposed to the network.
+	/// @return True on success.
+	bool StartTCP(unsigned short port, bool loopbackOnly);
+
+#ifndef WIN32
+	/// Starts listening for HTTP requests on a Unix domain socket at the given path. An existing file at the path is
+	/// replaced, and the file is removed when the endpoint is stopped.
+	/// @return True on success.
+	bool StartUnix(const char *path);
+#endif
+
+	/// Stops the serving thread and closes the listen socket.
+	void Stop();
+
+	bool IsRunning() const { return listenSocket != INVALID_SOCKET; }
+
+	/// Returns the HTTP response (status line, headers and body) for a request with the given path.
+	static std::string Respond(Network &network, const std::string &path);
+
+private:
+	Network *owner;
+	SOCKET listenSocket;
+	std::string unixSocketPath;
+	Thread thread;
+
+	bool StartThread(SOCKET socket);
+
+	/// The entry point of the serving thread.
+	void MainLoop();
+
+	/// Reads a single request from the given client socket and sends the response.
+	void ServeClient(SOCKET client);
+
+	MetricsEndpoint(const MetricsEndpoint &); ///< Noncopyable, N/I.
+	void operator =(const MetricsEndpoint &); ///< Noncopyable, N/I.
+};
+
+} // ~kNet
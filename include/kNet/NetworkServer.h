@@ -16,7 +16,10 @@
 /** @file NetworkServer.h
 	@brief The NetworkServer class. The main class for hosting a kNet server. */
 
+#include <atomic>
 #include <list>
+#include <random>
+#include <unordered_map>
 
 #include "kNetBuildConfig.h"
 #include "SharedPtr.h"
@@ -25,6 +28,8 @@
 #include "Datagram.h"
 #include "INetworkServerListener.h"
 #include "Lockable.h"
+#include "ConnectionRegistry.h"
+#include "WorkStealingPool.h"
 
 namespace kNet
 {
@@ -49,6 +54,13 @@ public:
 	// Returns whether this server is handling new connection attempts.
 	bool AcceptsNewConnections() const { return acceptNewConnections; }
 
+	/// Enables or disables connection IDs for the UDP connections accepted from now on. With connection IDs, a client
+	/// whose packets start arriving from a new address (NAT rebinding, a switch of networks) keeps its connection,
+	/// at the cost of four bytes in each packet it sends. Disabled by default. [main thread]
+	void SetConnectionIdsEnabled(bool enabled) { connectionIdsEnabled = enabled; }
+
+	bool ConnectionIdsEnabled() const { return connectionIdsEnabled; }
+
 	/// Enables or disables whether rejected connection attempts are messaged back to the client (UDP only).
 	/// i.e. whether to message "Connection rejected" back to the peer.
 	void SetStealthMode(bool stealthModeEnabled);
@@ -57,6 +69,14 @@ public:
 	/// Periodically call this function to update the NetworkServer object.
 	void Process();
 
+	/// Sets the number of extra threads Process() uses to handle the inbound messages of the clients whose message
+	/// handler returns true from IMessageHandler::IsThreadSafe(). Process() returns only after all of them are done, and
+	/// the messages of each client are still handled in order on one thread at a time. The other clients are handled
+	/// on the calling thread first. 0, the default, handles all clients on the calling thread. [main thread]
+	void SetNumProcessThreads(int numThreads);
+
+	int NumProcessThreads() const { return processPool ? processPool->NumThreads() : 0; }
+
 	/// Broadcasts the given message to all currently active connections, except for the single 'exclude' connection.
 	/// If exclude is 0, all clients will receive the message.
 	/// @param msg The message to send.
@@ -86,10 +106,23 @@ public:
 	/// It can take an indefinite time for the connections to bidirectionally close, since it is up to the individual
 	/// clients to write-close their end of the connections. This function returns immediately.
 	void DisconnectAllClients();
+
+	/// Starts closing all client connections with MessageConnection::CloseAsync(), and returns immediately. Also calls
+	/// SetAcceptNewConnections(false). The worker threads close each connection when its peer has closed its end, or
+	/// when maxMSecsToWait has passed, and ClientsClosedEvent() is set once they all have. Keep calling Process() to
+	/// reap the closed connections. [main thread]
+	void CloseAllClientsAsync(int maxMSecsToWait);
+
+	/// Returns an event that is set when no MessageConnection::CloseAsync() of a client of this server is in progress.
+	/// The NetworkServer must be kept alive until the event is set or Close() has been called.
+	Event ClientsClosedEvent() const { return clientsClosedEvent; }
+
+	/// Returns the number of client connections with a MessageConnection::CloseAsync() in progress. [main and worker thread]
+	int NumClosingClients() const { return numClosingClients.load(std::memory_order_relaxed); }
 		
 	/// Forcibly closes down the server. Calls SetAcceptNewConnections(false) so that no new connections are accepted.
-	/// @param disconnectWaitMilliseconds If >0, this function calls DisconnectAllClients() and waits for the given amount
-	///         of time until calling Close() on each client connection. If 0, MessageConnection::Close(0) will be immediately
+	/// @param disconnectWaitMilliseconds If >0, this function calls CloseAllClientsAsync() and waits until all the clients
+	///         have closed or the given amount of time has passed, before calling Close() on each client connection. If 0, MessageConnection::Close(0) will be immediately
 	///         called on each client. In that case, this function returns immediately and all active clients will be left
 	///         to time out at their end. Calling this function does not guarantee that all outbound data will be received
 	///         by the peers.
@@ -100,12 +133,22 @@ public:
 
 	/// Returns all the sockets this server is listening on.
 	std::vector<Socket *> &ListenSockets();
+	const std::vector<Socket *> &ListenSockets() const { return listenSockets; }
 
 	typedef std::map<EndPoint, Ptr(MessageConnection)> ConnectionMap;
 
-	/// Returns all the currently tracked connections.
+	/// Returns a copy of all the currently tracked connections.
 	ConnectionMap GetConnections();
 
+	/// Returns the currently tracked connections. Read them with a ConnectionRegistry::ReadGuard, which neither locks
+	/// nor copies them:
+	/// @code
+	/// ConnectionRegistry::ReadGuard snapshot(server->Clients());
+	/// for(size_t i = 0; i < snapshot->Size(); ++i)
+	///     snapshot->At(i)->...;
+	/// @endcode [main and worker thread]
+	const ConnectionRegistry &Clients() const { return clients; }
+
 	/// Returns the number of currently active connections. A connection is active if it is at least read- or write-open.
 	int NumConnections() const;
 
@@ -122,7 +165,64 @@ private:
 	std::vector<Socket *> listenSockets;
 
 	/// The list of active client connections.
-	Lockable<ConnectionMap> clients;
+	ConnectionRegistry clients;
+
+	typedef std::unordered_map<u32, Ptr(MessageConnection)> ConnectionIdMap;
+
+	/// The UDP connections that have a connection ID, indexed by the ID.
+	Lockable<ConnectionIdMap> connectionIds;
+
+	bool connectionIdsEnabled;
+
+	/// Generates the connection IDs. It draws from the entropy source of the OS, so that an ID cannot be predicted from
+	/// the IDs of other clients, as the output of a seeded pseudorandom generator could be.
+	std::random_device connectionIdGenerator; // [main thread]
+
+	/// Returns a new nonzero connection ID that is not in use. [main thread]
+	u32 NewConnectionId();
+
+	/// The number of clients with a MessageConnection::CloseAsync() in progress.
+	std::atomic<int> numClosingClients;
+
+	/// Set while numClosingClients is zero.
+	Event clientsClosedEvent;
+
+	/// Called by MessageConnection::CloseAsync() before it starts. [main thread]
+	void ClientCloseStarted();
+
+	/// Called when a MessageConnection::CloseAsync() has finished. [main and worker thread]
+	void ClientCloseFinished();
+
+	/// Runs the message handlers of the clients with thread-safe handlers in parallel, or null if disabled. [main thread]
+	WorkStealingPool *processPool;
+
+	/// The clients Process() hands to processPool. Kept to reuse the storage between calls. [main thread]
+	std::vector<MessageConnection*> parallelClients;
+
+	/// The clients CleanupDeadConnections() removes. Kept to reuse the storage between calls. [main thread]
+	std::vector<MessageConnection*> deadClients;
+
+	/// The WorkStealingPool task that handles the inbound messages of parallelClients[index]. [server process thread]
+	static void ProcessClientTask(void *server, size_t index);
+
+	/// Forgets the connection ID of the given connection, if it has one.
+	void RemoveConnectionId(MessageConnection *connection);
+
+	/// A UDP connection that validated a datagram from a new address of its client.
+	struct UDPConnectionMigration
+	{
+		Ptr(MessageConnection) connection;
+		EndPoint newEndPoint;
+	};
+
+	/// The moves queued by the worker threads, for the main thread to make.
+	Lockable<std::vector<UDPConnectionMigration> > udpConnectionMigrations;
+
+	/// Queues the given UDP connection to move to the new address of its client. [worker thread]
+	void QueueUDPConnectionMigration(MessageConnection *connection, const EndPoint &newEndPoint);
+
+	/// Moves the queued UDP connections to the new addresses of their clients. [main thread]
+	void ProcessUDPConnectionMigrations();
 
 	/// The Network object this NetworkServer was spawned from.
 	Network *owner;
@@ -150,6 +250,9 @@ private:
 	/// This function pulls all new data from the socket and sends it to MessageConnection instances for deserialization and processing.
 	void ReadUDPSocketData(Socket *listenSocket); // [worker thread]
 
+	/// Passes a single datagram read from the given listen socket to the connection it belongs to.
+	void HandleUDPDatagram(Socket *listenSocket, const ConnectionRegistry::Snapshot &connections, OverlappedTransferBuffer *recvData); // [worker thread]
+
 	void RegisterServerListener(INetworkServerListener *listener);
 
 	/// Stops listening for new connections, but all already established connections are maintained.
@@ -173,29 +276,32 @@ private:
 	/// Called from the network worker thread.
 	void EnqueueNewUDPConnectionAttempt(Socket *listenSocket, const EndPoint &endPoint, const char *data, size_t numBytes);
 
+	/// The packets of repeated connection attempts from clients that are already connected, passed from the main thread
+	/// to the worker thread.
+	WaitFreeQueue<ConnectionAttemptDescriptor> repeatedConnectPackets;
+
+	/// Queues the packets in repeatedConnectPackets to their connections. [worker thread]
+	void QueueRepeatedConnectPackets();
+
 	bool ProcessNewUDPConnectionAttempt(Socket *listenSocket, const EndPoint &endPoint, const char *data, size_t numBytes);
 
 	friend class Network;
 	friend class NetworkWorkerThread;
+	friend class MessageConnection;
+	friend class UDPMessageConnection;
 };
 
 template<typename SerializableData>
 void NetworkServer::BroadcastStruct(const SerializableData &data, unsigned long id, bool inOrder, 
 	bool reliable, unsigned long priority, unsigned long contentID, MessageConnection *exclude)
 {
-	PolledTimer timer;
-	Lockable<ConnectionMap>::LockType clientsLock = clients.Acquire();
-	if (timer.MSecsElapsed() >= 50.f)
-	{
-		LOG(LogWaits, "NetworkServer::BroadcastMessage: Accessing the connection list took %f msecs.",
-			timer.MSecsElapsed());
-	}
+	ConnectionRegistry::ReadGuard snapshot(clients);
 
 	const size_t dataSize = data.Size();
 
-	for(ConnectionMap::iterator iter = clientsLock->begin(); iter != clientsLock->end(); ++iter)
+	for(size_t i = 0; i < snapshot->Size(); ++i)
 	{
-		MessageConnection *connection = iter->second;
+		MessageConnection *connection = snapshot->At(i);
 		assert(connection);
 		if (connection == exclude || !connection->IsWriteOpen())
 			continue;
@@ -216,9 +322,8 @@ void NetworkServer::BroadcastStruct(const SerializableData &data, unsigned long
 		msg->contentID = contentID;
 
 #ifdef KNET_NETWORK_PROFILING
-		char str[512];
-		sprintf(str, "%s (%u)", SerializableData::Name(), (unsigned int)id);
-		msg->profilerName = str;
+		static StatsMetricFamily profilerMetrics((std::string("messageOut.") + SerializableData::Name() + " (%u)").c_str(), "bytes");
+		msg->profilerMetric = profilerMetrics.Get((u32)id);
 #endif
 
 		connection->EndAndQueueMessage(msg);
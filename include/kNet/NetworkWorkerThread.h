@@ -17,6 +17,8 @@
 	@brief The NetworkWorkerThread class. Implements a background thread for responsive
 	processing of server and client connections. */
 
+#include <atomic>
+
 #include "SharedPtr.h"
 
 #include "Lockable.h"
@@ -27,6 +29,35 @@
 namespace kNet
 {
 
+struct NetworkMetrics;
+class EventArray;
+
+/// The parts of the NetworkWorkerThread main loop that are timed separately.
+enum WorkerLoopPhase
+{
+	WorkerLoopWait = 0,         ///< Blocked waiting for socket and application events, or sleeping with nothing to manage.
+	WorkerLoopUpdateConnection, ///< Running UpdateConnection() on each connection and collecting the events to wait on.
+	WorkerLoopReadSocket,       ///< Reading and parsing the data received on a connection socket.
+	WorkerLoopSendOutPackets,   ///< Packing the outbound messages and sending them to the sockets.
+	WorkerLoopServerRead,       ///< Reading the UDP server sockets and dispatching the datagrams to the connections.
+	NumWorkerLoopPhases
+};
+
+/// Returns a readable name for the given phase, e.g. "wait".
+const char *WorkerLoopPhaseToString(WorkerLoopPhase phase);
+
+/// The time a NetworkWorkerThread has spent in each part of its main loop, since the thread was started or since
+/// the previous call to NetworkWorkerThread::ResetLoopStatistics().
+struct WorkerLoopStatistics
+{
+	u64 iterations;
+	double elapsedMSecs;
+	double phaseMSecs[NumWorkerLoopPhases];
+
+	/// Returns the time that is not covered by the phases, spent e.g. copying the connection and server lists.
+	double OtherMSecs() const;
+};
+
 class NetworkWorkerThread
 {
 public:
@@ -44,14 +75,50 @@ public:
 	int NumConnections() const;
 	int NumServers() const;
 
+	/// Appends the load of this thread, and the statistics of the servers and connections it manages, to the given
+	/// snapshot. The locks to the connection and server lists are held while copying. [any thread]
+	void SnapshotMetrics(NetworkMetrics &out, int threadIndex) const;
+
+	/// Returns the time this thread has spent in each part of its main loop. [any thread]
+	void LoopStatistics(WorkerLoopStatistics &out) const;
+
+	/// Restarts the accounting returned by LoopStatistics(). [any thread]
+	void ResetLoopStatistics();
+
 	Thread &ThreadObject() { return workThread; }
 
+	/// Enables the busy-poll mode, in which the thread spins on its sockets and connection queues instead of sleeping
+	/// in the OS until an event wakes it up. This cuts the wake-up latency at the cost of a full CPU core. The thread
+	/// also sets SO_BUSY_POLL on its sockets. After idleMSecs without events, it goes back to blocking waits until
+	/// the next event arrives. Pass 0 to disable the mode. [any thread]
+	void SetBusyPoll(int idleMSecs) { busyPollIdleMSecs.store(idleMSecs, std::memory_order_relaxed); }
+
+	/// Returns the idle time set with SetBusyPoll(), or 0 if the busy-poll mode is disabled. [any thread]
+	int BusyPollIdleMSecs() const { return busyPollIdleMSecs.load(std::memory_order_relaxed); }
+
 private:
 	Lockable<std::vector<MessageConnection *> > connections;
 	Lockable<std::vector<NetworkServer *> > servers;
 
 	Thread workThread;
 
+	// The main loop accounting. Only the worker thread adds to the counters, other threads read and reset them.
+	std::atomic<u64> loopIterations;
+	std::atomic<u64> loopPhaseTicks[NumWorkerLoopPhases];
+	std::atomic<tick_t> loopStatisticsStartTick;
+
+	std::atomic<int> busyPollIdleMSecs; ///< 0 if the busy-poll mode is disabled.
+
+	/// Polls the given events without blocking until one of them triggers or the given time has passed, and returns
+	/// the index of the event, like EventArray::Wait(). [worker thread]
+	int BusyPollWait(EventArray &waitEvents, int usecs);
+
+	/// Sets SO_BUSY_POLL on the sockets of the connections and servers. Returns false if the system refused it. [worker thread]
+	bool SetSocketBusyPoll(const std::vector<MessageConnection*> &connectionList, const std::vector<NetworkServer*> &serverList, int usecs);
+
+	/// Adds the time since phaseStart to the given phase, and sets phaseStart to the current time. [worker thread]
+	void AddLoopTime(WorkerLoopPhase phase, tick_t &phaseStart);
+
 	/// The entry point for the work thread, which runs a loop that manages network connections.
 	void MainLoop();
 };
@@ -0,0 +1,305 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+#pragma once
+
+/** @file SegmentedQueue.h
+	@brief The SegmentedQueue<T> and SegmentedQueueBlockPool<Block> template classes. */
+
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+#include <cassert>
+#include "Alignment.h"
+#include "Lockable.h"
+
+namespace kNet
+{
+
+/// A process-wide cache of the fixed-size blocks that SegmentedQueue instances of the same type grow into.
+/** Blocks freed to the pool are kept for reuse by other queues, up to a fixed number of cached blocks, beyond which
+	they are returned to the runtime heap. Thread-safe. */
+template<typename Block>
+class SegmentedQueueBlockPool
+{
+public:
+	/// The maximum number of unused blocks the pool holds on to.
+	static const size_t cMaxCachedBlocks = 256;
+
+	static SegmentedQueueBlockPool &Instance()
+	{
+		static SegmentedQueueBlockPool pool;
+		return pool;
+	}
+
+	~SegmentedQueueBlockPool()
+	{
+		std::vector<Block*> &blocks = freeBlocks.UnsafeGetValue();
+		for(size_t i = 0; i < blocks.size(); ++i)
+			delete blocks[i];
+		blocks.clear();
+	}
+
+	Block *Allocate()
+	{
+		{
+			Lock<std::vector<Block*> > blocks = freeBlocks.Acquire();
+			if (!blocks->empty())
+			{
+				Block *block = blocks->back();
+				blocks->pop_back();
+				return block;
+			}
+		}
+		return new Block;
+	}
+
+	void Free(Block *block)
+	{
+		if (!block)
+			return;
+		{
+			Lock<std::vector<Block*> > blocks = freeBlocks.Acquire();
+			if (blocks->size() < cMaxCachedBlocks)
+			{
+				blocks->push_back(block);
+				return;
+			}
+		}
+		delete block;
+	}
+
+	/// Returns the number of unused blocks currently cached in the pool.
+	size_t NumCachedBlocks() const
+	{
+		ConstLock<std::vector<Block*> > blocks = freeBlocks.Acquire();
+		return blocks->size();
+	}
+
+private:
+	Lockable<std::vector<Block*> > freeBlocks;
+};
+
+/// An unbounded single-producer single-consumer queue that grows and shrinks in fixed-size blocks.
+/** Has the same threading contract as WaitFreeQueue: at most one thread calls Insert() and at most one thread
+	calls Front() and PopFront(). Unlike WaitFreeQueue, the queue never becomes full. Items are stored in a linked
+	list of blocks of BlockSize items each. A queue starts out with a single block, and takes new blocks from a
+	SegmentedQueueBlockPool shared by all queues of the same type when it grows past that.
+	When the consumer moves past a block, it hands the block back to the producer through a single-slot exchange,
+	and a block that is already parked there is returned to the shared pool. In steady state a queue cycles between
+	two blocks, and the operations are wait-free. The pool lock is only taken when the queue grows past its own
+	blocks or shrinks after a burst.
+	Only POD types are supported. If you need non-POD objects, store pointers to objects instead. */
+template<typename T, int BlockSize = 128>
+class SegmentedQueue
+{
+public:
+	struct Block
+	{
+		T items[BlockSize];
+		Block *next;
+	};
+
+	typedef SegmentedQueueBlockPool<Block> BlockPool;
+
+	SegmentedQueue()
+	:numPopped(0), cachedNumPushed(0), headIndex(0), spareBlock(0), numPushed(0), tailIndex(0)
+	{
+		headBlock = tailBlock = BlockPool::Instance().Allocate();
+		headBlock->next = 0;
+	}
+
+	~SegmentedQueue()
+	{
+		BlockPool &pool = BlockPool::Instance();
+		while(headBlock)
+		{
+			Block *next = (headBlock == tailBlock) ? 0 : headBlock->next;
+			pool.Free(headBlock);
+			headBlock = next;
+		}
+		pool.Free(spareBlock.load(std::memory_order_relaxed));
+	}
+
+	/// Adds a new item to the end of the queue. Can be called only from a single producer thread.
+	void Insert(const T &value)
+	{
+		if (tailIndex == BlockSize)
+			AppendBlock();
+		tailBlock->items[tailIndex++] = value;
+		numPushed.store(numPushed.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	/// Adds the given values to the end of the queue, and publishes them all to the consumer at once.
+	/// Can be called only from a single producer thread.
+	void InsertBatch(const T *values, int numValues)
+	{
+		for(int i = 0; i < numValues; ++i)
+		{
+			if (tailIndex == BlockSize)
+				AppendBlock();
+			tailBlock->items[tailIndex++] = values[i];
+		}
+		if (numValues > 0)
+			numPushed.store(numPushed.load(std::memory_order_relaxed) + numValues, std::memory_order_release);
+	}
+
+	/// Returns a pointer to the first item (the item with index 0), or null if the queue is empty.
+	/// Can be called only from a single consumer thread.
+	T *Front()
+	{
+		if (!HasItems())
+			return 0;
+		return (headIndex == BlockSize) ? &headBlock->next->items[0] : &headBlock->items[headIndex];
+	}
+
+	const T *Front() const
+	{
+		if (!HasItems())
+			return 0;
+		return (headIndex == BlockSize) ? &headBlock->next->items[0] : &headBlock->items[headIndex];
+	}
+
+	/// Removes the first item in the queue. Can be called only from a single consumer thread.
+	void PopFront()
+	{
+		assert(HasItems());
+		if (!HasItems())
+			return;
+		if (headIndex == BlockSize)
+			AdvanceHeadBlock();
+		++headIndex;
+		numPopped.store(numPopped.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	/// Returns a copy of the first item in the queue and pops that item off the queue. The queue must not be empty.
+	/// Can be called only from a single consumer thread.
+	T TakeFront()
+	{
+		assert(HasItems());
+		T value = *Front();
+		PopFront();
+		return value;
+	}
+
+	/// Copies up to maxItems items from the front of the queue to dst and pops them off the queue.
+	/// Can be called only from a single consumer thread.
+	/// @return The number of items popped, in the range [0, maxItems].
+	int PopFrontBatch(T *dst, int maxItems)
+	{
+		unsigned long numPopped_ = numPopped.load(std::memory_order_relaxed);
+		int numAvailable = (int)(cachedNumPushed - numPopped_);
+		if (numAvailable < maxItems)
+		{
+			cachedNumPushed = numPushed.load(std::memory_order_acquire);
+			numAvailable = (int)(cachedNumPushed - numPopped_);
+		}
+		const int numToPop = (maxItems < numAvailable) ? maxItems : numAvailable;
+		for(int i = 0; i < numToPop; ++i)
+		{
+			if (headIndex == BlockSize)
+				AdvanceHeadBlock();
+			dst[i] = headBlock->items[headIndex++];
+		}
+		if (numToPop > 0)
+			numPopped.store(numPopped_ + numToPop, std::memory_order_release);
+		return numToPop;
+	}
+
+	/// Removes all elements in the queue. Does not call dtors for removed objects, as this queue is only for POD types.
+	/// Can be called only from a single consumer thread.
+	void Clear()
+	{
+		while(HasItems())
+			PopFront();
+	}
+
+	/// Returns the consumed block that is kept around for the producer to reuse back to the shared pool, so that an idle
+	/// queue only holds on to the block it is currently using. Can be called from either the consumer or producer thread.
+	void ReleaseSpareBlock()
+	{
+		BlockPool::Instance().Free(spareBlock.exchange(0, std::memory_order_acquire));
+	}
+
+	/// Returns the number of elements currently filled in the queue. Can be called from either the consumer or producer thread.
+	int Size() const
+	{
+		unsigned long numPopped_ = numPopped.load(std::memory_order_acquire);
+		unsigned long numPushed_ = numPushed.load(std::memory_order_acquire);
+		return (int)(numPushed_ - numPopped_);
+	}
+
+private:
+	/// Returns true if there is at least one item to pop. [consumer thread]
+	bool HasItems() const
+	{
+		unsigned long numPopped_ = numPopped.load(std::memory_order_relaxed);
+		if (numPopped_ == cachedNumPushed)
+			cachedNumPushed = numPushed.load(std::memory_order_acquire);
+		return numPopped_ != cachedNumPushed;
+	}
+
+	/// Links a fresh block after the current tail block. [producer thread]
+	void AppendBlock()
+	{
+		Block *block = spareBlock.exchange(0, std::memory_order_acquire);
+		if (!block)
+			block = BlockPool::Instance().Allocate();
+		block->next = 0;
+		// The link is published to the consumer by the release store to numPushed that follows.
+		tailBlock->next = block;
+		tailBlock = block;
+		tailIndex = 0;
+	}
+
+	/// Moves past a fully consumed head block, which is only done when the producer has already linked
+	/// the next block. [consumer thread]
+	void AdvanceHeadBlock()
+	{
+		Block *consumed = headBlock;
+		headBlock = headBlock->next;
+		headIndex = 0;
+		assert(headBlock);
+		Block *previousSpare = spareBlock.exchange(consumed, std::memory_order_release);
+		if (previousSpare)
+			BlockPool::Instance().Free(previousSpare);
+	}
+
+	SegmentedQueue(const SegmentedQueue &); ///< Noncopyable, not implemented.
+	void operator =(const SegmentedQueue &); ///< Noncopyable, not implemented.
+
+	// Consumer-side fields.
+	/// The total number of items ever popped. [written by the consumer]
+	std::atomic<unsigned long> numPopped;
+	/// The consumer's most recently observed value of numPushed.
+	mutable unsigned long cachedNumPushed;
+	Block *headBlock;
+	int headIndex;
+
+	char padding0[KNET_CACHE_LINE_SIZE];
+
+	/// A consumed block handed back from the consumer to the producer for reuse, or null.
+	std::atomic<Block*> spareBlock;
+
+	char padding1[KNET_CACHE_LINE_SIZE];
+
+	// Producer-side fields.
+	/// The total number of items ever inserted. [written by the producer]
+	std::atomic<unsigned long> numPushed;
+	Block *tailBlock;
+	int tailIndex;
+
+	char padding2[KNET_CACHE_LINE_SIZE];
+};
+
+} // ~kNet
@@ -19,24 +19,38 @@
 
 #include "kNet/Alignment.h"
 #include "kNet/NetworkLogging.h"
+#include "kNet/Clock.h"
 
 namespace kNet
 {
 
+/// Remembers a sliding window of recently added integers, for detecting duplicates of (mostly) sequential IDs.
+/** The values are stored in a hash table indexed by the low bits of the value, so a newer value replaces an older
+	value that maps to the same slot. The table is allocated lazily on the first Add(), and it grows by doubling
+	(up to maxTableSize) whenever it cycles through all its slots in less than minHistoryMSecs, so that a slow
+	stream of values costs only a small table, while a fast stream still gets a long enough history window. */
 class SequentialIntegerSet
 {
 public:
+	/// Creates a set with a fixed-size table of tableSize_ slots. The table is allocated on the first Add().
 	explicit SequentialIntegerSet(int tableSize_)
-	:tableSize(tableSize_), tableSizeMask(tableSize_-1)
+	:table(0), tableSize(0), tableSizeMask(0), initialTableSize(tableSize_), maxTableSize(tableSize_), minHistoryMSecs(0.f),
+	size(0), numAddsInWindow(0), windowStartTick(0)
 	{
-		assert(IS_POW2(tableSize));
-		table = new unsigned long[tableSize];
-
-		// A bit unconventionally, a value of 0xFFFFFFFF denotes an empty spot.
-		memset(table, 0xFF, sizeof(unsigned long) * tableSize);
+		assert(IS_POW2(initialTableSize));
+	}
 
-		size = 0;
+	/// Creates a set that starts out with initialTableSize_ slots and grows up to maxTableSize_ slots to remember
+	/// at least the values added during the last minHistoryMSecs_ milliseconds. Both sizes must be powers of 2.
+	SequentialIntegerSet(int initialTableSize_, int maxTableSize_, float minHistoryMSecs_)
+	:table(0), tableSize(0), tableSizeMask(0), initialTableSize(initialTableSize_), maxTableSize(maxTableSize_), minHistoryMSecs(minHistoryMSecs_),
+	size(0), numAddsInWindow(0), windowStartTick(0)
+	{
+		assert(IS_POW2(initialTableSize));
+		assert(IS_POW2(maxTableSize));
+		assert(initialTableSize <= maxTableSize);
 	}
+
 	~SequentialIntegerSet()
 	{
 		delete[] table;
@@ -45,8 +59,12 @@ public:
 	/// Cannot necessarily return the exact size, but only an upper bound.
 	int Size() const { return size; }
 
+	/// Returns the number of slots currently allocated for the table.
 	int Capacity() const { return tableSize; }
 
+	/// Returns the number of bytes currently allocated for the table.
+	size_t AllocatedBytes() const { return sizeof(unsigned long) * tableSize; }
+
     /// Recomputes the size of this set, so that Size() returns the exact value.
 	void CountSize()
 	{
@@ -58,7 +76,10 @@ public:
 
 	void Prune()
 	{
+		if (!table)
+			return;
 		unsigned long *newTable = new unsigned long[tableSize];
+		memset(newTable, 0xFF, sizeof(unsigned long) * tableSize);
 		size = 0;
 		for(int i = 0; i < tableSize; ++i)
 			if (IsValid(table[i]))
@@ -70,6 +91,17 @@ public:
 		table = newTable;
 	}
 
+	/// Frees the table, forgetting all the values in the set. The next Add() allocates a table of the initial size again.
+	void Release()
+	{
+		delete[] table;
+		table = 0;
+		tableSize = 0;
+		tableSizeMask = 0;
+		size = 0;
+		numAddsInWindow = 0;
+	}
+
 	/// Returns the index in the table where the given value should exist.
 	int Hash(unsigned long value) const { return (int)(value & tableSizeMask); }
 
@@ -82,19 +114,71 @@ public:
 
 	void Add(unsigned long value)	
 	{
+		if (!table)
+		{
+			Allocate(initialTableSize);
+			windowStartTick = Clock::Tick();
+		}
+		else if (++numAddsInWindow >= tableSize && tableSize < maxTableSize)
+		{
+			// The whole table has been overwritten once since windowStartTick. If that happened too quickly,
+			// the table is too small to hold the requested history.
+			tick_t now = Clock::Tick();
+			if (Clock::TicksToMillisecondsF(Clock::TicksInBetween(now, windowStartTick)) < minHistoryMSecs)
+				Grow(tableSize * 2);
+			numAddsInWindow = 0;
+			windowStartTick = now;
+		}
 		Add(table, value);
 	}
 
 	bool Exists(unsigned long value) const
 	{
-		return table[Hash(value)] == value;
+		return table && table[Hash(value)] == value;
 	}
 
 private:
 	unsigned long *table;
 	int tableSize;
 	int tableSizeMask;
+	/// The number of slots allocated on the first Add().
+	int initialTableSize;
+	/// The table will not be grown past this many slots.
+	int maxTableSize;
+	/// The table is grown if it is cycled through faster than this.
+	float minHistoryMSecs;
 	int size;
+	/// Counts the Add() calls since windowStartTick.
+	int numAddsInWindow;
+	tick_t windowStartTick;
+
+	void Allocate(int newTableSize)
+	{
+		assert(!table);
+		tableSize = newTableSize;
+		tableSizeMask = newTableSize - 1;
+		table = new unsigned long[tableSize];
+
+		// A bit unconventionally, a value of 0xFFFFFFFF denotes an empty spot.
+		memset(table, 0xFF, sizeof(unsigned long) * tableSize);
+		size = 0;
+		numAddsInWindow = 0;
+	}
+
+	void Grow(int newTableSize)
+	{
+		unsigned long *oldTable = table;
+		int oldTableSize = tableSize;
+		table = 0;
+		Allocate(newTableSize);
+		for(int i = 0; i < oldTableSize; ++i)
+			if (IsValid(oldTable[i]))
+			{
+				Add(table, oldTable[i]);
+				++size;
+			}
+		delete[] oldTable;
+	}
 
 	void Add(unsigned long *dstTable, int value)
 	{
@@ -18,6 +18,7 @@
 
 #include <cstdlib>
 #include <cassert>
+#include <atomic>
 
 /// Smart pointer for dynamic single object allocations on the heap.
 #define Ptr(type) kNet::SharedPtr< type > 
@@ -26,6 +27,7 @@ namespace kNet
 {
 
 /// Objects that require reference count tracking derive publicly from this.
+/// The reference count is atomic, so SharedPtrs to the same object can be copied and released on different threads.
 /// \note The dtor of RefCountable is not virtual. NEVER manage pointers to RefCountables
 ///       and never delete a pointer to a RefCountable.
 class RefCountable
@@ -36,30 +38,40 @@ public:
 	{
 	}
 
+	/// A copy is a new object, so it starts without references.
+	RefCountable(const RefCountable &)
+	:refCount(0)
+	{
+	}
+
+	/// Assignment copies the contents of an object, not its references.
+	RefCountable &operator =(const RefCountable &) { return *this; }
+
 	~RefCountable()
 	{
-		refCount = -100000; // Mark the refCount to an arbitrary negative value so that any increments or decrements will catch an assertion failure.
+		refCount.store(-100000, std::memory_order_relaxed); // Mark the refCount to an arbitrary negative value so that any increments or decrements will catch an assertion failure.
 	}
 
 	void AddRef()
 	{ 
-		assert(refCount >= 0); 
-		++refCount;
+		assert(refCount.load(std::memory_order_relaxed) >= 0); 
+		refCount.fetch_add(1, std::memory_order_relaxed);
 	}
 
-	void DecRef()
+	/// Returns true if this released the last reference, in which case the caller frees the object.
+	bool DecRef()
 	{ 
-		assert(refCount > 0); 
-		--refCount; 
+		assert(refCount.load(std::memory_order_relaxed) > 0); 
+		return refCount.fetch_sub(1, std::memory_order_acq_rel) == 1;
 	}
 
 	int RefCount() const
 	{ 
-		return refCount;
+		return refCount.load(std::memory_order_relaxed);
 	}
 
 private:
-	int refCount;
+	std::atomic<int> refCount;
 };
 
 /** @brief SharedPtr is an intrusive refcount-tracked single-object lifetime-manager.
@@ -127,12 +127,8 @@ void SharedPtr<T>::Release()
 	if (!dataPtr) // if refCount is zero, this pointer wasn't even initialized.
 		return;
 
-	dataPtr->DecRef();
-
-	assert(dataPtr->RefCount() >= 0 && "Reference count was decreased to a negative value!!");
-
-	// Free the object if no users left
-	if (dataPtr->RefCount() == 0)
+	// Free the object if no users left. Only the thread that releases the last reference sees DecRef() return true.
+	if (dataPtr->DecRef())
 		delete dataPtr;
 
 	dataPtr = 0;
@@ -131,6 +131,10 @@ public:
 		const EndPoint &remoteEndPoint, const char *remoteHostName, 
 		SocketTransportLayer transport, SocketType type, size_t maxSendSize);
 
+	/// Creates a closed client socket without a handle, for a connection that is still resolving or connecting.
+	/// A connected Socket is assigned over it when the connect completes.
+	Socket(const char *localHostName, const char *remoteHostName, SocketTransportLayer transport, size_t maxSendSize);
+
 	Socket(const Socket &);
 	~Socket();
 
@@ -228,6 +232,9 @@ public:
 	OverlappedTransferBuffer *BeginReceive();
 	/// Finishes a read operation on the socket. Frees the given buffer to be re-queued for a future socket read operation.
 	void EndReceive(OverlappedTransferBuffer *buffer);
+	/// Returns the number of datagrams read in by the last recvmmsg() call that BeginReceive() has not yet returned.
+	/// Always 0 on other systems than Linux, which read one datagram per BeginReceive() call.
+	int NumBatchedReceives() const;
 #ifdef WIN32
 	/// Returns the number of receive buffers that have been queued for the socket.
 	int NumOverlappedReceivesInProgress() const { return queuedReceiveBuffers.Size(); }
@@ -267,6 +274,9 @@ public:
 	/// If SocketType == ServerListenSocket, returns 0.
 	unsigned short DestinationPort() const { return remoteEndPoint.port; }
 
+	/// Redirects the datagrams of a server-side UDP socket to the given peer, after the client moved to a new address.
+	void SetUDPPeer(const EndPoint &remoteEndPoint);
+
 	/// Returns a human-readable representation of this socket, specifying the peer address and port this socket is
 	/// connected to.
 	std::string ToString() const;
@@ -283,6 +293,26 @@ public:
 	/// Read more about Nagle's algorithm here: http://msdn.microsoft.com/en-us/library/ms817942.aspx
 	void SetNaglesAlgorithmEnabled(bool enabled);
 
+	/// Limits the rate at which the kernel sends out the data of this socket (SO_MAX_PACING_RATE). The fq qdisc then
+	/// spaces out the packets evenly at this rate. Pass 0 to remove the limit. Linux only.
+	/// @return False if the option is not supported on this system.
+	bool SetMaxPacingRate(u64 bytesPerSec);
+
+	/// Makes the kernel busy poll the device queue for up to the given time when a read or select() on this socket finds
+	/// no data (SO_BUSY_POLL). Pass 0 to disable. Values above net.core.busy_read need CAP_NET_ADMIN. Linux only.
+	/// @return False if the option could not be set.
+	bool SetBusyPoll(int usecs);
+
+	/// Returns the value last set with SetBusyPoll(), or 0.
+	int BusyPoll() const { return busyPollUSecs; }
+
+	/// Makes EndSend() on a UDP socket hold on to the datagrams until EndSendBatch(), which sends them all out with a
+	/// single sendmmsg() call. Has no effect on TCP sockets, or on other systems than Linux.
+	void BeginSendBatch();
+	/// Sends out the datagrams held since BeginSendBatch().
+	/// @return False if not all of the datagrams could be sent.
+	bool EndSendBatch();
+
 private:
 	/// Stores the handle to the underlying BSD socket object. Has the value INVALID_SOCKET if uninitialized.
 	SOCKET connectSocket;
@@ -330,6 +360,15 @@ private:
 	/// Tracks whether the socket is open for receiving data (doesn't mean that there necessarily exists new data to be read).
 	bool readOpen;
 
+	/// The SO_BUSY_POLL time set with SetBusyPoll(), in usecs.
+	int busyPollUSecs;
+
+	/// The position of this socket in the socket list of the Network that owns it, so that it can be removed in constant time.
+	/// Not copied by operator=.
+	size_t networkIndex;
+
+	friend class Network;
+
 #ifdef WIN32
 	WaitFreeQueue<OverlappedTransferBuffer*> queuedReceiveBuffers;
 	WaitFreeQueue<OverlappedTransferBuffer*> queuedSendBuffers;
@@ -339,6 +378,29 @@ private:
 
 	void EnqueueNewReceiveBuffer(OverlappedTransferBuffer *buffer = 0);
 #endif
+
+#ifdef __linux__
+	/// The datagrams the last recvmmsg() call read into a UDP server socket. BeginReceive() hands these out in order,
+	/// starting from receiveBatchPos. None of the batch members are copied by operator=.
+	std::vector<OverlappedTransferBuffer*> receiveBatch;
+	size_t receiveBatchPos;
+
+	/// The receive buffers given back with EndReceive(), reused by the next recvmmsg() call.
+	std::vector<OverlappedTransferBuffer*> spareReceiveBuffers;
+
+	/// The datagrams held by EndSend() while sendBatching is true.
+	std::vector<OverlappedTransferBuffer*> sendBatch;
+	bool sendBatching;
+
+	/// Reads in as many datagrams as are available, up to the batch size, with a single recvmmsg() call.
+	void ReceiveBatch();
+
+	/// Sends out the datagrams in sendBatch with sendmmsg() and frees them.
+	bool SendBatch();
+
+	/// Frees the receive and send buffers held by this socket.
+	void FreeBatchBuffers();
+#endif
 };
 
 } // ~kNet
@@ -0,0 +1,183 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+#pragma once
+
+/** @file StatsCounters.h
+	@brief Interned statistics metrics and the StatsCounters class that records them with per-thread counters. */
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "kNet/Types.h"
+#include "kNet/Alignment.h"
+#include "kNet/Lockable.h"
+
+// These macros are used inside MessageConnection and NetworkServer objects, which have the 'owner' member.
+// The metric name is interned once per call site, so the name must be the same string every time the site is executed.
+#ifdef KNET_NETWORK_PROFILING
+#define ADDEVENT(name, value, valueType) \
+	do { \
+		static const kNet::StatsMetricId statsMetricId_ = kNet::RegisterStatsMetric((name), (valueType)); \
+		if (owner) owner->Counters().Add(statsMetricId_, (float)(value)); \
+	} while(0)
+/// Records a value into a metric resolved beforehand, e.g. through a StatsMetricFamily.
+#define ADDMETRIC(metricId, value) \
+	do { if (owner) owner->Counters().Add((metricId), (float)(value)); } while(0)
+#else
+#define ADDEVENT(name, value, valueType) ((void)0)
+#define ADDMETRIC(metricId, value) ((void)0)
+#endif
+
+namespace kNet
+{
+
+class StatsEventHierarchyNode;
+
+/// Identifies a metric interned with RegisterStatsMetric. The ids are process-wide and stay valid until exit.
+typedef int StatsMetricId;
+
+/// Returned by RegisterStatsMetric when no more metrics can be registered. Values added to it are ignored.
+const StatsMetricId cInvalidStatsMetric = -1;
+
+/// The maximum number of distinct metrics in the process.
+const int cMaxStatsMetrics = 1024;
+
+/// The number of log2 buckets in each metric histogram. Bucket 0 counts values below 1, bucket k counts the values
+/// in the range [2^(k-1), 2^k), and the last bucket counts everything above.
+const int cNumStatsHistogramBuckets = 24;
+
+/// Returns the id of the metric with the given dotted name, e.g. "messageIn.5", registering it first if needed.
+/// Thread-safe, but takes a lock. Resolve the id once and store it instead of calling this for each recorded value.
+StatsMetricId RegisterStatsMetric(const char *name, const char *unit);
+
+/// Returns the number of metrics registered so far. The ids are in the range [0, NumStatsMetrics()[.
+int NumStatsMetrics();
+
+/// Returns the name the metric with the given id was registered with.
+const char *StatsMetricName(StatsMetricId id);
+
+/// Returns the unit string the metric with the given id was registered with.
+const char *StatsMetricUnit(StatsMetricId id);
+
+/// Returns the histogram bucket the given value falls into.
+int StatsHistogramBucket(float value);
+
+/// A set of metrics whose names differ only by an integer index, like the per-message-ID "messageIn.<id>" metrics.
+/** The ids of the indices below cNumDirectIndices are cached in a lock-free table after the first lookup. */
+class StatsMetricFamily
+{
+public:
+	/// @param nameFormat A printf format string for the metric names with a single %u for the index, e.g. "messageIn.%u".
+	StatsMetricFamily(const char *nameFormat, const char *unit);
+
+	/// Returns the id of the metric of the given index, registering it on first use.
+	StatsMetricId Get(u32 index);
+
+private:
+	static const u32 cNumDirectIndices = 256;
+	std::string nameFormat;
+	std::string unit;
+	std::atomic<StatsMetricId> directIds[cNumDirectIndices];
+
+	StatsMetricFamily(const StatsMetricFamily &); ///< Noncopyable, N/I.
+	void operator =(const StatsMetricFamily &); ///< Noncopyable, N/I.
+};
+
+/// The aggregate of all values recorded into a metric.
+struct StatsSample
+{
+	u64 count;
+	double sum;
+	float min;
+	float max;
+	/// The most recently recorded value. If several threads record into the metric, this is the latest value of the thread
+	/// that has recorded the most values.
+	float latest;
+	u64 histogram[cNumStatsHistogramBuckets];
+
+	void Clear();
+	float Average() const { return count > 0 ? (float)(sum / count) : 0.f; }
+};
+
+/// Records values into interned metrics with no locking on the recording path.
+/** Each thread that records values gets its own set of counters, so the recording threads never write to the same
+	cache lines. The counters of all threads are summed up when the values are read. Add() is wait-free after the
+	first value a thread records into a given StatsCounters object. Read() can be called from any thread. */
+class StatsCounters
+{
+public:
+	StatsCounters();
+	~StatsCounters();
+
+	/// Records a value into the given metric. [any thread]
+	void Add(StatsMetricId id, float value);
+
+	/// Aggregates the values recorded into the given metric by all threads. [any thread]
+	void Read(StatsMetricId id, StatsSample &out) const;
+
+	/// Aggregates all the metrics that have had at least one value recorded, indexed by the metric id. Metrics with no
+	/// values have a count of zero. [any thread]
+	void ReadAll(std::vector<StatsSample> &out) const;
+
+	/// Adds an event to the corresponding node of the given hierarchy for each metric that has received new values since the
+	/// previous call. The event value is the average of the new values. The caller must hold the lock to the hierarchy,
+	/// which also guards the bookkeeping of this function.
+	void UpdateHierarchy(StatsEventHierarchyNode &root, int oldAgeMSecs);
+
+private:
+	/// The counters of one metric, written only by the thread that owns the ThreadCounters they live in.
+	struct Cell
+	{
+		std::atomic<u64> count;
+		std::atomic<double> sum;
+		std::atomic<float> min;
+		std::atomic<float> max;
+		std::atomic<float> latest;
+		std::atomic<u32> histogram[cNumStatsHistogramBuckets];
+	};
+
+	static const int cCellsPerChunk = 64;
+	static const int cNumChunks = cMaxStatsMetrics / cCellsPerChunk;
+
+	/// The cells of a thread are allocated in chunks when the thread first records a value into a metric in that chunk.
+	struct alignas(KNET_CACHE_LINE_SIZE) Chunk
+	{
+		Cell cells[cCellsPerChunk];
+	};
+
+	struct ThreadCounters
+	{
+		std::atomic<Chunk*> chunks[cNumChunks];
+		/// Identifies the thread that owns these counters.
+		std::thread::id threadId;
+	};
+
+	/// Distinguishes this object from any StatsCounters that existed before at the same address, for the per-thread lookup cache.
+	u64 uniqueId;
+
+	Lockable<std::vector<ThreadCounters*> > threads;
+
+	/// The count and sum of each metric at the previous UpdateHierarchy() call.
+	std::vector<std::pair<u64, double> > hierarchyBookkeeping;
+
+	ThreadCounters *CurrentThreadCounters();
+	static void AccumulateCell(const Cell &cell, StatsSample &out, u64 &mostValuesPerThread);
+
+	StatsCounters(const StatsCounters &); ///< Noncopyable, N/I.
+	void operator =(const StatsCounters &); ///< Noncopyable, N/I.
+};
+
+} // ~kNet
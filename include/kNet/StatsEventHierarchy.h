@@ -22,15 +22,9 @@
 #include "kNet/WaitFreeQueue.h"
 #include "kNet/Clock.h"
 
-// This macro is used inside MessageConnection and NetworkServer objects, which have the 'owner' member.
+/// The age after which events are pruned from the hierarchy.
 static const int cEventOldAgeMSecs = 30 * 1000;
 
-#ifdef KNET_NETWORK_PROFILING
-#define ADDEVENT(name, value, valueType) (owner ? owner->Statistics()->AddEventToHierarchy((name), (value), (valueType), cEventOldAgeMSecs) : ((void)0))
-#else
-#define ADDEVENT(name, value, valueType) ((void)0)
-#endif
-
 namespace kNet
 {
 
@@ -54,7 +54,11 @@ private:
 
 	void DoUpdateConnection(); // [worker thread]
 
+	bool CanHibernate() const; // [worker thread]
+	void ReleaseIdleMemory(); // [worker thread]
+
 	unsigned long TimeUntilCanSendPacket() const;
+	unsigned long MicrosecondsUntilCanSendPacket() const;
 
 	/// Parses the raw inbound byte stream into messages. [used internally by worker thread]
 	void ExtractMessages();
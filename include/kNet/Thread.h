@@ -79,6 +79,10 @@ public:
 	/// from the worker thread.
 	void CheckHold();
 
+	/// Returns the event that is set while the owner waits in Hold(). A thread that blocks on other events can add
+	/// this to its wait set, so that Hold() does not have to wait for the blocking call to time out.
+	Event HoldEvent() const { return threadHoldEvent; }
+
 	/// Tries first to gracefully close the thread (waits for a while), and forcefully terminates the thread if
 	/// it didn't respond in that time. \todo Allow specifying the timeout period.
 	void Stop();
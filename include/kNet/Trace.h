@@ -0,0 +1,114 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+#pragma once
+
+/** @file Trace.h
+	@brief Structured event tracing of the connection lifecycle and the packet path, with per-thread flight recorder
+	       buffers and an exporter to the Chrome trace event format. */
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "kNet/Types.h"
+#include "kNet/Clock.h"
+
+// The trace points compile to nothing unless KNET_ENABLE_TRACING is defined. When compiled in, they cost a single
+// relaxed load until tracing is switched on with SetTracingEnabled(true).
+#ifdef KNET_ENABLE_TRACING
+#define KNET_TRACE(event, object, arg0, arg1) \
+	do { if (kNet::IsTracingEnabled()) kNet::TraceEvent((event), (object), (u32)(arg0), (u32)(arg1)); } while(0)
+#define KNET_TRACE_THREAD_NAME(name) kNet::SetTraceThreadName(name)
+#else
+#define KNET_TRACE(event, object, arg0, arg1) ((void)0)
+#define KNET_TRACE_THREAD_NAME(name) ((void)0)
+#endif
+
+namespace kNet
+{
+
+/// Identifies the trace points. The meaning of the two arguments of each record is given after each event.
+enum TraceEventType
+{
+	TraceMessageQueued = 0,     ///< The application queued a message. arg0: message number, arg1: message ID.
+	TraceMessageAccepted,       ///< The worker thread took the message into the outbound queue. arg0: message number, arg1: message ID.
+	TraceMessagePacked,         ///< The message was written into a datagram or TCP send. arg0: message number, arg1: packet ID.
+	TracePacketSent,            ///< A datagram or TCP send went to the socket. arg0: packet ID (0 for TCP), arg1: bytes.
+	TracePacketAcked,           ///< The peer acked a reliable datagram. arg0: packet ID, arg1: the number of messages in it.
+	TracePacketTimedOut,        ///< A reliable datagram was not acked in time and its messages were requeued. arg0: packet ID, arg1: the number of messages.
+	TracePacketReceived,        ///< A datagram or TCP read came in. arg0: packet ID (0 for TCP), arg1: bytes.
+	TraceMessageReceived,       ///< The worker thread queued an inbound message for the application. arg0: packet ID, arg1: message ID.
+	TraceMessageHandled,        ///< The application handled an inbound message in Process(). arg0: packet ID, arg1: message ID.
+	TraceConnectionState,       ///< The connection changed its state. arg0: the new ConnectionState.
+	TraceWorkerWaitBegin,       ///< A NetworkWorkerThread starts waiting for socket events. arg0: the wait time in usecs, arg1: the number of events.
+	TraceWorkerWaitEnd,         ///< A NetworkWorkerThread finished waiting. arg0: the index of the signalled event, or 0xFFFFFFFF on timeout.
+	NumTraceEventTypes
+};
+
+/// Returns a readable name for the given trace event type.
+const char *TraceEventTypeToString(TraceEventType event);
+
+/// A single trace record. The records are fixed-size and contain no pointers to live data, so recording is a plain store.
+struct TraceRecord
+{
+	tick_t tick;
+	/// The object the event happened to, usually a MessageConnection or NetworkWorkerThread. Only used as an identifier.
+	u64 object;
+	u32 arg0;
+	u32 arg1;
+	u16 event;
+	/// The index of the thread that recorded the event, in the order the threads first recorded an event.
+	u16 thread;
+	u32 reserved;
+};
+
+/// The size of the trace buffer of each thread, in records. When the buffer is full, the oldest records are overwritten,
+/// and ReadTrace() returns the cTraceBufferSize-1 most recent ones.
+const int cTraceBufferSize = 16 * 1024;
+
+extern std::atomic<bool> traceEnabled;
+
+/// Returns true if the trace points currently record events. [any thread]
+inline bool IsTracingEnabled() { return traceEnabled.load(std::memory_order_relaxed); }
+
+/// Starts or stops recording the trace points. Disabled by default. [any thread]
+void SetTracingEnabled(bool enabled);
+
+/// Records an event into the trace buffer of the calling thread. Normally called through the KNET_TRACE macro.
+/** Wait-free after the first event a thread records. [any thread] */
+void TraceEvent(TraceEventType event, const void *object, u32 arg0, u32 arg1);
+
+/// Names the calling thread in the exported traces. [any thread]
+void SetTraceThreadName(const char *name);
+
+/// Copies the records of all threads into the given vector, sorted by time. Records that were being overwritten
+/// while they were read are left out. [any thread]
+void ReadTrace(std::vector<TraceRecord> &out);
+
+/// Returns the name the thread with the given index was given with SetTraceThreadName(), or an empty string.
+std::string TraceThreadName(int thread);
+
+/// Discards all the recorded events. [any thread]
+void ClearTrace();
+
+/// Serializes the given records to the Chrome trace event JSON format, which opens in chrome://tracing and Perfetto.
+/** Each message is shown as an async span from TraceMessageQueued to TraceMessagePacked, the worker thread waits as
+	duration events, and all other events as instant events on the thread that recorded them. */
+std::string TraceToChromeJSON(const std::vector<TraceRecord> &records);
+
+/// Writes the currently recorded events to the given file in the Chrome trace event JSON format.
+/// @return True on success.
+bool WriteChromeTrace(const char *filename);
+
+} // ~kNet
@@ -0,0 +1,207 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+#pragma once
+
+/** @file TrafficStatsWindow.h
+	@brief The TrafficStatsWindow class, which tracks the traffic of a connection over a rolling time window. */
+
+#include <atomic>
+#include <thread>
+
+#include "Types.h"
+#include "Clock.h"
+
+namespace kNet
+{
+
+/// The traffic totals over the time window of a TrafficStatsWindow.
+struct TrafficStatsSnapshot
+{
+	u64 packetsIn;
+	u64 packetsOut;
+	u64 messagesIn;
+	u64 messagesOut;
+	u64 bytesIn;
+	u64 bytesOut;
+	/// The length of time the totals were accumulated over, in seconds. This is the time from the start of the oldest
+	/// bucket with traffic to the time of the snapshot, but at least one second, so that it can be used to compute rates.
+	float windowSecs;
+
+	float PacketsInPerSec() const { return packetsIn / windowSecs; }
+	float PacketsOutPerSec() const { return packetsOut / windowSecs; }
+	float MessagesInPerSec() const { return messagesIn / windowSecs; }
+	float MessagesOutPerSec() const { return messagesOut / windowSecs; }
+	float BytesInPerSec() const { return bytesIn / windowSecs; }
+	float BytesOutPerSec() const { return bytesOut / windowSecs; }
+};
+
+/// Accumulates in- and outbound traffic counts into fixed time buckets that cover a rolling window of the recent past.
+/** There is a single writer thread, which records the traffic events, and any number of reader threads, which take
+	snapshots of the totals over the window. The writer never blocks and never allocates: each event adds to the
+	counters of the bucket of the current time, and a bucket that is reused for a new time slot is cleared first.
+	The writer brackets its updates with a sequence counter (a seqlock), and a reader retries its snapshot if the
+	writer was active while it was reading, so that a snapshot never mixes the counters of two events. */
+class TrafficStatsWindow
+{
+public:
+	/// The length of time each bucket covers.
+	static const int cBucketMSecs = 100;
+	/// The number of buckets. The window covers cNumBuckets * cBucketMSecs milliseconds.
+	static const int cNumBuckets = 50;
+
+	TrafficStatsWindow()
+	:sequence(0), bucketTicks(Clock::TicksPerSec() * cBucketMSecs / 1000)
+	{
+		if (bucketTicks == 0)
+			bucketTicks = 1;
+		for(int i = 0; i < cNumBuckets; ++i)
+			buckets[i].slot.store(cNoSlot, std::memory_order_relaxed);
+	}
+
+	/// Records inbound traffic that occurred at the given time. [writer thread]
+	void AddInbound(u32 numBytes, u32 numPackets, u32 numMessages, tick_t now)
+	{
+		BeginWrite();
+		Bucket &b = BucketAt(now);
+		Increment(b.bytesIn, numBytes);
+		Increment(b.packetsIn, numPackets);
+		Increment(b.messagesIn, numMessages);
+		EndWrite();
+	}
+
+	/// Records outbound traffic that occurred at the given time. [writer thread]
+	void AddOutbound(u32 numBytes, u32 numPackets, u32 numMessages, tick_t now)
+	{
+		BeginWrite();
+		Bucket &b = BucketAt(now);
+		Increment(b.bytesOut, numBytes);
+		Increment(b.packetsOut, numPackets);
+		Increment(b.messagesOut, numMessages);
+		EndWrite();
+	}
+
+	/// Forgets all recorded traffic. [writer thread]
+	void Clear()
+	{
+		// Only the slots need resetting: the counters of a bucket are not read until BucketAt() clears them for a new slot.
+		BeginWrite();
+		for(int i = 0; i < cNumBuckets; ++i)
+			buckets[i].slot.store(cNoSlot, std::memory_order_relaxed);
+		EndWrite();
+	}
+
+	/// Fills in the traffic totals over the window that ends at the given time. [any thread]
+	void Snapshot(TrafficStatsSnapshot &out, tick_t now) const
+	{
+		const u64 currentSlot = now / bucketTicks;
+		u64 oldestSlot;
+		for(;;)
+		{
+			const u32 seqBegin = sequence.load(std::memory_order_acquire);
+			if ((seqBegin & 1) != 0) // The writer is in the middle of an update.
+			{
+				std::this_thread::yield();
+				continue;
+			}
+
+			out.packetsIn = out.packetsOut = out.messagesIn = out.messagesOut = out.bytesIn = out.bytesOut = 0;
+			oldestSlot = currentSlot;
+			for(int i = 0; i < cNumBuckets; ++i)
+			{
+				const Bucket &b = buckets[i];
+				const u64 slot = b.slot.load(std::memory_order_relaxed);
+				if (slot == cNoSlot || slot > currentSlot || currentSlot - slot >= (u64)cNumBuckets)
+					continue;
+				out.packetsIn += b.packetsIn.load(std::memory_order_relaxed);
+				out.packetsOut += b.packetsOut.load(std::memory_order_relaxed);
+				out.messagesIn += b.messagesIn.load(std::memory_order_relaxed);
+				out.messagesOut += b.messagesOut.load(std::memory_order_relaxed);
+				out.bytesIn += b.bytesIn.load(std::memory_order_relaxed);
+				out.bytesOut += b.bytesOut.load(std::memory_order_relaxed);
+				if (slot < oldestSlot)
+					oldestSlot = slot;
+			}
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (sequence.load(std::memory_order_relaxed) == seqBegin)
+				break;
+		}
+
+		const tick_t windowTicks = now - oldestSlot * bucketTicks;
+		const float windowSecs = (float)Clock::TicksToMillisecondsD(windowTicks) / 1000.f;
+		out.windowSecs = (windowSecs > 1.f) ? windowSecs : 1.f;
+	}
+
+private:
+	static const u64 cNoSlot = ~(u64)0;
+
+	struct Bucket
+	{
+		/// The index of the time slot (time / bucket length) this bucket currently holds the counts of, or cNoSlot.
+		std::atomic<u64> slot;
+		std::atomic<u64> packetsIn;
+		std::atomic<u64> packetsOut;
+		std::atomic<u64> messagesIn;
+		std::atomic<u64> messagesOut;
+		std::atomic<u64> bytesIn;
+		std::atomic<u64> bytesOut;
+	};
+
+	/// Odd while the writer is updating the buckets.
+	std::atomic<u32> sequence;
+	tick_t bucketTicks;
+	Bucket buckets[cNumBuckets];
+
+	void BeginWrite()
+	{
+		sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	void EndWrite()
+	{
+		sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	/// Returns the bucket of the time slot of the given time, clearing it first if it holds the counts of an older slot.
+	Bucket &BucketAt(tick_t now)
+	{
+		const u64 slot = now / bucketTicks;
+		Bucket &b = buckets[slot % cNumBuckets];
+		if (b.slot.load(std::memory_order_relaxed) != slot)
+			ClearBucket(b, slot);
+		return b;
+	}
+
+	static void ClearBucket(Bucket &b, u64 slot)
+	{
+		b.slot.store(slot, std::memory_order_relaxed);
+		b.packetsIn.store(0, std::memory_order_relaxed);
+		b.packetsOut.store(0, std::memory_order_relaxed);
+		b.messagesIn.store(0, std::memory_order_relaxed);
+		b.messagesOut.store(0, std::memory_order_relaxed);
+		b.bytesIn.store(0, std::memory_order_relaxed);
+		b.bytesOut.store(0, std::memory_order_relaxed);
+	}
+
+	static void Increment(std::atomic<u64> &counter, u32 amount)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	TrafficStatsWindow(const TrafficStatsWindow &); ///< Noncopyable, N/I.
+	void operator =(const TrafficStatsWindow &); ///< Noncopyable, N/I.
+};
+
+} // ~kNet
@@ -22,11 +22,12 @@
 #include "OrderedHashTable.h"
 
 /*
-UDP packet format: 3 bytes if InOrder=false. 5-6 bytes if InOrder=true.
-1bit   - InOrder packet.   This packet contains InOrder messages.
+UDP packet format: 3 bytes if ConnectionID=false. 7 bytes if ConnectionID=true.
+1bit   - ConnectionID.     The packet carries the connection ID of the sender. (Old: InOrder packet, never read.)
 1bit   - Reliable packet.  This packet is expected to be Acked by the receiver.
 6 bits - The six lowest bits of the PacketID.
 u16      The 16 next bits of the PacketID. This gives 22 bits of the PacketID in total.
+u32      The connection ID the server assigned to the client.         Only present if ConnectionID=true.
 * u8       InOrder array length.
 * N x u8-u16   InOrder PacketID delta counter. VLE-encoded 1.7/8 Only present if InOrder=true.
 .Message.
@@ -55,6 +56,23 @@ Content format:
 u8-u32 MessageID			      VLE-encoded 1.7/1.7/16
 N bytes Content data
 
+Connection Start datagram: Sent by a UDP client to open the connection. Until the server answers, every datagram
+the client sends starts with this header, so the messages queued before connecting travel with the connection attempt.
+8 bytes  "kNetCon" and the version byte 2.
+u8       Capability flags. Bit 0: the client takes a connection ID, see below.
+u16      Connect data length.
+N bytes  Connect data. Passed to INetworkServerListener::NewConnectionAttempt.
+.Packet.  Optional. A UDP packet in the format above, delivered to the new connection once it is accepted.
+
+Version 1 of the header has no capability flags byte. A datagram that does not start with the header is taken whole as
+the connect data.
+
+Connection IDs: If enabled on the NetworkServer, the server assigns a random ID to each new UDP connection whose client
+set the connection ID capability, and sends it to the client in a ConnectionId message (u32). From then on, the client
+sets the ConnectionID flag in its packets. When a packet with a known ID arrives from a new address, say after a NAT
+rebinding, the server moves the connection to the new address instead of taking the packet as a new connection attempt.
+Older clients use the same bit as the InOrder flag, so the server reads the ID only from the clients it assigned one.
+
 */
 
 namespace kNet
@@ -74,10 +92,28 @@ public:
 
 	void SetDatagramSendRate(float newRateDgramsPerSecond) { datagramSendRate = newRateDgramsPerSecond; }
 
+	/// If enabled, the send rate of the connection is also given to the kernel as SO_MAX_PACING_RATE, so that the fq
+	/// qdisc spaces out the datagrams on the wire. Only takes effect on Linux, and only for a client connection, since the
+	/// connections of a UDP server share the listen socket. Disabled by default. [worker thread]
+	void SetKernelPacingEnabled(bool enabled) { kernelPacingEnabled = enabled; }
+
+	bool KernelPacingEnabled() const { return kernelPacingEnabled; }
+
 	float SmoothedRtt() const { return smoothedRTT; }
 
 	float RttVariation() const { return rttVariation; }
 
+	/// If enabled, the PacketAck messages sent to the peer carry the time each ack was held back before sending. The peer
+	/// then takes an RTT sample from every ack without the up to 33 msecs of ack batching in it, and uses the samples for
+	/// its retransmission timeout and RoundTripTime(). Disabled by default, since kNet versions before the ack delay field
+	/// reject the longer PacketAck messages. [main and worker thread]
+	void SetAckDelayEnabled(bool enabled) { ackDelayEnabled = enabled; }
+
+	bool AckDelayEnabled() const { return ackDelayEnabled; }
+
+	/// Returns the number of RTT samples taken from PacketAck messages that carried the ack delay of the peer.
+	u64 NumAckRttSamples() const { return numAckRttSamples; }
+
 	size_t NumOutboundUnackedDatagrams() const { return outboundPacketAckTrack.Size(); }
 
 	size_t NumReceivedUnackedDatagrams() const { return inboundPacketAckTrack.size(); }
@@ -86,6 +122,26 @@ public:
 
 	float PacketLossRate() const { return packetLossRate; }
 
+	/// Makes this client connection open itself with Connection Start datagrams carrying the given connect data. The
+	/// messages queued to the connection go out inside the Connection Start datagrams until the server answers, so
+	/// the server receives the first messages of the session together with the connection attempt. Pause the outbound
+	/// sends to hold the first datagram back until all of those messages are queued.
+	/// [main thread, before the connection is assigned to a worker thread]
+	void StartConnect(const Datagram *connectMessage);
+
+	/// Splits the given datagram into the connect data and the packet of a Connection Start datagram.
+	/// @param takesConnectionId If not null, receives whether the client set the connection ID capability.
+	/// @return False if the datagram does not start with the Connection Start header. [any thread]
+	static bool ParseConnectDatagram(const char *data, size_t numBytes, const char *&connectData, size_t &connectDataSize,
+		const char *&packet, size_t &packetSize, bool *takesConnectionId = 0);
+
+	/// Returns the ID the server assigned to this connection, or 0 if connection IDs are not in use.
+	u32 ConnectionId() const { return connectionId; }
+
+	/// Reads the connection ID from the header of the given packet.
+	/// @return False if the packet does not carry a connection ID. [any thread]
+	static bool ReadConnectionId(const char *data, size_t numBytes, u32 &connectionId);
+
 private:
 	/// Reads all the new bytes available in the socket.
 	/// @return The number of bytes successfully read.
@@ -128,11 +184,31 @@ private:
 	bool HaveReceivedPacketID(packet_id_t packetID) const; // [worker thread]
 
 	/// Copies the given message to an internal queue to wait to be processed by the worker thread that owns this connection.
-	void QueueInboundDatagram(const char *data, size_t numBytes); // [thread-safe].
+	/// @param newEndPoint If not null, the datagram carried the ID of this connection but came from another address. If
+	///        the datagram is a valid new packet, the connection moves to that address.
+	/// [server worker thread, or the main thread before the connection is assigned to a worker thread]
+	void QueueInboundDatagram(const char *data, size_t numBytes, const EndPoint *newEndPoint = 0);
+
+	/// Returns true if the given datagram from a new address carries the ID of this connection and a packet that has
+	/// not been received yet and is not far from the packets received so far. [worker thread]
+	bool IsValidMigrationDatagram(const char *data, size_t numBytes) const;
+
+	/// Asks the server to send the datagrams of this server-side connection to the new address of the client. The main
+	/// thread makes the move, since the socket is read from the other threads as well. [worker thread]
+	void MigrateToEndPoint(const EndPoint &newEndPoint);
+
+	/// Assigns the connection ID of a new server-side connection, and queues the message that tells it to the client.
+	/// [main thread, before the connection is assigned to a worker thread]
+	void SetConnectionId(u32 connectionId);
+
+	void HandleConnectionIdMessage(const char *data, size_t numBytes); // [worker thread]
 
 	/// Handles all the previously queued datagrams this connection has received.
 	void ProcessQueuedDatagrams(); // [worker thread]
 
+	bool CanHibernate() const; // [worker thread]
+	void ReleaseIdleMemory(); // [worker thread]
+
 	/// Specifies the PacketID of the last received datagram with InOrder flag set.
 	packet_id_t lastReceivedInOrderPacketID;
 
@@ -158,8 +234,11 @@ private:
 
 	// These variables correspond to RFC2988, http://tools.ietf.org/html/rfc2988 , section 2.
 	bool rttCleared; ///< If true, smoothedRTT and rttVariation do not contain meaningful values, but "are clear".
-	float smoothedRTT;
-	float rttVariation;
+	float smoothedRTT; ///< In milliseconds.
+	float rttVariation; ///< In milliseconds.
+
+	bool ackDelayEnabled; ///< If true, the PacketAck messages sent to the peer carry the ack delay. [main and worker thread]
+	u64 numAckRttSamples; ///< The number of RTT samples taken from the ack delays of the peer. [worker thread]
 
 	// The following are used for statistics purposes:
 
@@ -209,6 +288,7 @@ private:
 	PacketSendResult SendOutPacket(); // [worker thread]
 	void SendOutPackets(); // [worker thread]
 	unsigned long TimeUntilCanSendPacket() const; // [worker thread]
+	unsigned long MicrosecondsUntilCanSendPacket() const; // [worker thread]
 
 	void PerformDisconnection(); // [main thread]
 
@@ -221,6 +301,16 @@ private:
 	/// Used to perform flow control on outbound UDP messages.
 	mutable tick_t lastDatagramSendTime; ///\todo. No mutable. Rename to nextDatagramSendTime.
 
+	/// True if the last SendOutPackets() call was allowed to send, but the connection had nothing it could send, or
+	/// the socket had no free send buffers. The worker then polls the connection at the old 1 msec interval. [worker thread]
+	bool sendStalled;
+
+	bool kernelPacingEnabled; ///< If true, datagramSendRate is passed to the socket as SO_MAX_PACING_RATE. [worker thread]
+	float kernelPacingRate; ///< The datagram rate last passed to the socket, or 0 if none. [worker thread]
+
+	/// Passes datagramSendRate to the socket as SO_MAX_PACING_RATE if kernel pacing is enabled and the rate has changed.
+	void UpdateKernelPacingRate(); // [worker thread]
+
 	/// Connection control update timer.
 	PolledTimer udpUpdateTimer;
 
@@ -236,9 +326,44 @@ private:
 
 	static int BiasedBinarySearchFindPacketIndex(UDPMessageConnection::PacketAckTrackQueue &queue, int packetID);
 
-	WaitFreeQueue<Datagram> queuedInboundDatagrams;
+	/// If true, this is a client connection that prefixes its datagrams with the Connection Start header while it is in
+	/// the ConnectionPending state. [worker thread]
+	bool sendConnectHeader;
+	/// The connect data sent in the Connection Start header. [worker thread]
+	Datagram connectData;
+	/// The time the last Connection Start datagram was sent, or zero if none has been sent yet. [worker thread]
+	tick_t lastConnectDatagramTick;
+
+	size_t ConnectHeaderSize() const;
+	void WriteConnectHeader(DataSerializer &writer) const;
+
+	/// Sends a Connection Start datagram that carries no messages. [worker thread]
+	void SendConnectDatagram();
+
+	/// The ID the server assigned to this connection, or 0. [set before the worker thread starts on the server, by the worker thread on the client]
+	u32 connectionId;
+	/// If true, this is a client connection that sends connectionId in its packets. [worker thread]
+	bool sendConnectionId;
+
+	struct QueuedDatagram
+	{
+		Datagram datagram;
+		/// If true, the datagram came from newEndPoint instead of the current address of the peer.
+		bool fromNewEndPoint;
+		EndPoint newEndPoint;
+	};
+
+	/// Datagrams read by the NetworkServer from the shared UDP listen socket, waiting for this connection's worker thread.
+	SegmentedQueue<QueuedDatagram, 4> queuedInboundDatagrams; // [produced by the server worker thread, consumed by worker thread]
+
+	/// Frees the messages of the given reliable packet that no longer needs to be resent.
+	/// @param acked True if the peer acknowledged the packet, false if the packet is just being discarded.
+	/// @param sampleRtt If true, the time the ack took is used as an RTT sample.
+	/// @param ackDelay The time the peer held back the ack before sending it, which is left out of the RTT sample,
+	///                 or cAckDelayUnknown if the peer did not send it.
+	void FreeOutboundPacketAckTrack(packet_id_t packetID, bool acked, bool sampleRtt = true, tick_t ackDelay = cAckDelayUnknown); // [worker thread]
 
-	void FreeOutboundPacketAckTrack(packet_id_t packetID); // [worker thread]
+	static const tick_t cAckDelayUnknown = (tick_t)-1;
 
 	// Contains a list of all messages we've received that we need to Ack at some point.
 	PacketAckTrackMap inboundPacketAckTrack;
@@ -17,6 +17,7 @@
 	@brief The WaitFreeQueue<T> template class. */
 
 #include <stddef.h>
+#include <atomic>
 #include "Alignment.h"
 
 namespace kNet
@@ -30,14 +31,18 @@ namespace kNet
 	 - Does not use locks or spin-waits, and is hence wait-free.
 	 - Does not perform any memory allocation after initialization.
 	 - Only POD types are supported. If you need non-POD objects, store pointers to objects instead.
-	 - The queue has a fixed upper size that must be a power-of-2 and must be speficied in the constructor. */
+	 - The queue has a fixed upper size that must be a power-of-2 and must be speficied in the constructor.
+	The head index (written by the consumer) and the tail index (written by the producer) live on separate cache lines,
+	and each side keeps a private cached copy of the other side's index. The shared index is only reloaded when the cached
+	copy says the queue is full (producer) or empty (consumer), so in steady state neither side touches the other's cache line.
+	Use InsertBatch() and PopFrontBatch() to move several items with a single index publish. */
 template<typename T>
 class WaitFreeQueue
 {
 public:
 	/// @param maxElements A power-of-2 number, > 2,  that specifies the size of the ring buffer to construct. The number of elements the queue can store is maxElements-1.
 	explicit WaitFreeQueue(size_t maxElements)
-	:head(0), tail(0)
+	:head(0), cachedTail(0), tail(0), cachedHead(0)
 	{
 		assert(IS_POW2(maxElements)); // The caller really needs to round to correct pow2,
 		assert(maxElements > 2);
@@ -49,7 +54,8 @@ public:
 
 	/// Warning: This is not thread-safe.
 	WaitFreeQueue(const WaitFreeQueue &rhs)
-	:head(rhs.head), tail(rhs.tail), maxElementsMask(rhs.maxElementsMask)
+	:maxElementsMask(rhs.maxElementsMask), head(rhs.head.load(std::memory_order_relaxed)), cachedTail(rhs.tail.load(std::memory_order_relaxed)),
+	tail(rhs.tail.load(std::memory_order_relaxed)), cachedHead(rhs.head.load(std::memory_order_relaxed))
 	{
 		size_t maxElements = rhs.maxElementsMask+1;
 		data = new T[maxElements];
@@ -63,8 +69,10 @@ public:
 		if (this == &rhs)
 			return *this;
 
-		head = rhs.head;
-		tail = rhs.tail;
+		head.store(rhs.head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		tail.store(rhs.tail.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		cachedHead = head.load(std::memory_order_relaxed);
+		cachedTail = tail.load(std::memory_order_relaxed);
 		size_t maxElements = rhs.maxElementsMask+1;
 		maxElementsMask = rhs.maxElementsMask;
 
@@ -103,37 +111,66 @@ public:
 	///  This function can be called only by a single producer thread.
 	T *BeginInsert()
 	{
-		unsigned long tail_ = tail;
+		unsigned long tail_ = tail.load(std::memory_order_relaxed);
 		unsigned long nextTail = (tail_ + 1) & maxElementsMask;
-		if (nextTail == head)
-			return 0;
-		return &data[tail];
+		if (nextTail == cachedHead)
+		{
+			cachedHead = head.load(std::memory_order_acquire);
+			if (nextTail == cachedHead)
+				return 0;
+		}
+		return &data[tail_];
 	}
 
 	/// Commits to the end of the queue the item filled with a previous call to BeginInsert.
 	///  This function can be called only by a single producer thread.
 	void FinishInsert()
 	{
-		unsigned long tail_ = tail;
+		unsigned long tail_ = tail.load(std::memory_order_relaxed);
 		unsigned long nextTail = (tail_ + 1) & maxElementsMask;
-		assert(nextTail != head && "Error: Calling FinishInsert after BeginInsert failed, or was not even called!");
-		tail = nextTail;
+		assert(nextTail != cachedHead && "Error: Calling FinishInsert after BeginInsert failed, or was not even called!");
+		tail.store(nextTail, std::memory_order_release);
 	}
 
 	/// Inserts the new value into the queue. Can be called only by a single producer thread.
 	bool Insert(const T &value)
 	{
 		// Inserts are made to the 'tail' of the queue, incrementing the tail index.
-		unsigned long tail_ = tail;
+		unsigned long tail_ = tail.load(std::memory_order_relaxed);
 		unsigned long nextTail = (tail_ + 1) & maxElementsMask;
-		if (nextTail == head)
-			return false;
+		if (nextTail == cachedHead)
+		{
+			cachedHead = head.load(std::memory_order_acquire);
+			if (nextTail == cachedHead)
+				return false;
+		}
 		data[tail_] = value;
-		tail = nextTail;
+		tail.store(nextTail, std::memory_order_release);
 
 		return true;
 	}
 
+	/// Inserts as many of the given values into the queue as there is space for, and publishes them all to the consumer
+	/// at once. Can be called only by a single producer thread.
+	/// @return The number of values inserted, in the range [0, numValues]. The values are inserted in order, so the
+	///         ones that did not fit are values[returnValue, numValues[.
+	int InsertBatch(const T *values, int numValues)
+	{
+		unsigned long tail_ = tail.load(std::memory_order_relaxed);
+		int numFree = (int)((cachedHead - tail_ - 1) & maxElementsMask);
+		if (numFree < numValues)
+		{
+			cachedHead = head.load(std::memory_order_acquire);
+			numFree = (int)((cachedHead - tail_ - 1) & maxElementsMask);
+		}
+		const int numToInsert = (numValues < numFree) ? numValues : numFree;
+		for(int i = 0; i < numToInsert; ++i)
+			data[(tail_ + i) & maxElementsMask] = values[i];
+		if (numToInsert > 0)
+			tail.store((tail_ + numToInsert) & maxElementsMask, std::memory_order_release);
+		return numToInsert;
+	}
+
 	/// Inserts the new value into the queue. If there is not enough free space in the queue, the capacity
 	/// of the queue is doubled.
 	/// \note This function is not thread-safe. Do not call this if you cannot guarantee that the other
@@ -163,8 +200,10 @@ public:
 			newData[newTail++] = *ItemAt(i);
 		delete[] data;
 		data = newData;
-		head = 0;
-		tail = newTail;
+		head.store(0, std::memory_order_relaxed);
+		tail.store(newTail, std::memory_order_relaxed);
+		cachedHead = 0;
+		cachedTail = newTail;
 		maxElementsMask = newSize - 1;
 	}
 
@@ -178,9 +217,14 @@ public:
 	/// This function can safely be called even if the queue is empty, in which case 0 is returned.
 	T *Front()
 	{
-		if (head == tail)
-			return 0;
-		return &data[head];
+		unsigned long head_ = head.load(std::memory_order_relaxed);
+		if (head_ == cachedTail)
+		{
+			cachedTail = tail.load(std::memory_order_acquire);
+			if (head_ == cachedTail)
+				return 0;
+		}
+		return &data[head_];
 	}
 
 	/// Returns a pointer to the first item in the queue (the item that is coming off next, i.e. the one that has
@@ -188,9 +232,14 @@ public:
 	/// This function can safely be called even if the queue is empty, in which case 0 is returned.
 	const T *Front() const
 	{
-		if (head == tail)
-			return 0;
-		return &data[head];
+		unsigned long head_ = head.load(std::memory_order_relaxed);
+		if (head_ == cachedTail)
+		{
+			cachedTail = tail.load(std::memory_order_acquire);
+			if (head_ == cachedTail)
+				return 0;
+		}
+		return &data[head_];
 	}
 
 	/// Returns a copy of the first item in the queue and pops that item off the queue. Can be called only from a single consumer thread.
@@ -207,18 +256,20 @@ public:
 	/// Can be called only from a single consumer thread.
 	T *Back()
 	{
-		if (head == tail)
+		unsigned long tail_ = tail.load(std::memory_order_acquire);
+		if (head.load(std::memory_order_relaxed) == tail_)
 			return 0;
-		return &data[(tail + maxElementsMask) & maxElementsMask];
+		return &data[(tail_ + maxElementsMask) & maxElementsMask];
 	}
 
 	/// Returns a pointer to the last item (the item that was just added) in the queue.
 	/// Can be called only from a single consumer thread.
 	const T *Back() const
 	{
-		if (head == tail)
+		unsigned long tail_ = tail.load(std::memory_order_acquire);
+		if (head.load(std::memory_order_relaxed) == tail_)
 			return 0;
-		return &data[(tail + maxElementsMask) & maxElementsMask];
+		return &data[(tail_ + maxElementsMask) & maxElementsMask];
 	}
 
 	/// Returns a pointer to the item at the given index. ItemAt(0) will return the first item (the front item)
@@ -227,7 +278,7 @@ public:
 	T *ItemAt(int index)
 	{
 		assert(index >= 0 && index < (int)Size());
-		return &data[(head + index) & maxElementsMask];
+		return &data[(head.load(std::memory_order_relaxed) + index) & maxElementsMask];
 	}
 
 	/// Returns a pointer to the item at the given index. Can be called only from a single consumer thread.
@@ -235,7 +286,7 @@ public:
 	const T *ItemAt(int index) const
 	{
 		assert(index >= 0 && index < (int)Size());
-		return &data[(head + index) & maxElementsMask];
+		return &data[(head.load(std::memory_order_relaxed) + index) & maxElementsMask];
 	}
 
 	/// Returns true if the given element exists in the queue. Can be called only from a single consumer thread.
@@ -261,39 +312,73 @@ public:
 	/// Can be called only from a single consumer thread.
 	void Clear()
 	{
-		tail = head;
+		cachedTail = tail.load(std::memory_order_acquire);
+		head.store(cachedTail, std::memory_order_release);
 	}
 
 	/// Returns the number of elements currently filled in the queue. Can be called from either the consumer or producer thread.
 	int Size() const
 	{
-		unsigned long head_ = head;
-		unsigned long tail_ = tail;
-		if (tail_ >= head_)
-			return tail_ - head_;
-		else
-			return maxElementsMask + 1 - (head_ - tail_);
+		unsigned long head_ = head.load(std::memory_order_acquire);
+		unsigned long tail_ = tail.load(std::memory_order_acquire);
+		return (int)((tail_ - head_) & maxElementsMask);
 	}
 
 	/// Removes the first item in the queue. Can be called only from a single consumer thread.
 	void PopFront()
 	{
-		assert(head != tail);
-		if (head == tail)
+		unsigned long head_ = head.load(std::memory_order_relaxed);
+		if (head_ == cachedTail)
+			cachedTail = tail.load(std::memory_order_acquire);
+		assert(head_ != cachedTail);
+		if (head_ == cachedTail)
 			return;
-		size_t head_ = (head + 1) & maxElementsMask;
-		head = head_;
+		head.store((head_ + 1) & maxElementsMask, std::memory_order_release);
+	}
+
+	/// Copies up to maxItems items from the front of the queue to dst and pops them off the queue, releasing their
+	/// slots to the producer at once. Can be called only from a single consumer thread.
+	/// @return The number of items popped, in the range [0, maxItems].
+	int PopFrontBatch(T *dst, int maxItems)
+	{
+		unsigned long head_ = head.load(std::memory_order_relaxed);
+		int numAvailable = (int)((cachedTail - head_) & maxElementsMask);
+		if (numAvailable < maxItems)
+		{
+			cachedTail = tail.load(std::memory_order_acquire);
+			numAvailable = (int)((cachedTail - head_) & maxElementsMask);
+		}
+		const int numToPop = (maxItems < numAvailable) ? maxItems : numAvailable;
+		for(int i = 0; i < numToPop; ++i)
+			dst[i] = data[(head_ + i) & maxElementsMask];
+		if (numToPop > 0)
+			head.store((head_ + numToPop) & maxElementsMask, std::memory_order_release);
+		return numToPop;
 	}
 
 private:
 	T *data;
 	/// Stores the AND mask (2^Size-1) used to perform the modulo check.
 	unsigned long maxElementsMask;
+
+	// The fields below are laid out so that the consumer-written and the producer-written indices never share
+	// a cache line with each other or with the read-only fields above.
+	char padding0[KNET_CACHE_LINE_SIZE];
+
 	/// Stores the index of the first element in the queue. The next item to come off the queue is at this position,
-	/// unless head==tail, and the queue is empty. \todo Convert to C++0x atomic<unsigned long> head;
-	volatile unsigned long head;
-	/// Stores the index of one past the last element in the queue. \todo Convert to C++0x atomic<unsigned long> head;
-	volatile unsigned long tail; 
+	/// unless head==tail, and the queue is empty. [written by the consumer]
+	std::atomic<unsigned long> head;
+	/// The consumer's most recently observed value of tail. Only the consumer thread accesses this.
+	mutable unsigned long cachedTail;
+
+	char padding1[KNET_CACHE_LINE_SIZE];
+
+	/// Stores the index of one past the last element in the queue. [written by the producer]
+	std::atomic<unsigned long> tail;
+	/// The producer's most recently observed value of head. Only the producer thread accesses this.
+	unsigned long cachedHead;
+
+	char padding2[KNET_CACHE_LINE_SIZE];
 
 	/// Removes the element at the given index, but instead of filling the contiguous gap that forms by moving elements to the
 	/// right, this function will instead move items at the front of the queue.
@@ -302,9 +387,10 @@ private:
 	{
 		assert(Size() > 0);
 		int numItemsToMove = index;
+		unsigned long head_ = head.load(std::memory_order_relaxed);
 		for(int i = 0; i < numItemsToMove; ++i)
-			data[(head+index + maxElementsMask+1 -i)&maxElementsMask] = data[(head+index + maxElementsMask+1 -i-1) &maxElementsMask];
-		head = (head+1) & maxElementsMask;
+			data[(head_+index + maxElementsMask+1 -i)&maxElementsMask] = data[(head_+index + maxElementsMask+1 -i-1) &maxElementsMask];
+		head.store((head_+1) & maxElementsMask, std::memory_order_release);
 	}
 
 	/// Removes the element at the given index, and fills the contiguous gap that forms by shuffling each item after index one space down.
@@ -313,9 +399,13 @@ private:
 	{
 		assert(Size() > 0);
 		int numItemsToMove = Size()-1-index;
+		unsigned long head_ = head.load(std::memory_order_relaxed);
 		for(int i = 0; i < numItemsToMove; ++i)
-			data[(head+index+i)&maxElementsMask] = data[(head+index+i+1)&maxElementsMask];
-		tail = (tail + maxElementsMask+1 - 1) & maxElementsMask;
+			data[(head_+index+i)&maxElementsMask] = data[(head_+index+i+1)&maxElementsMask];
+		unsigned long tail_ = (tail.load(std::memory_order_relaxed) + maxElementsMask+1 - 1) & maxElementsMask;
+		tail.store(tail_, std::memory_order_release);
+		cachedHead = head_;
+		cachedTail = tail_;
 	}
 };
 
@@ -0,0 +1,92 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+#pragma once
+
+/** @file WorkStealingPool.h
+	@brief The WorkStealingPool class. Runs batches of independent tasks on a fixed set of threads. */
+
+#include <atomic>
+#include <vector>
+
+#include "Types.h"
+#include "Event.h"
+#include "Thread.h"
+
+namespace kNet
+{
+
+/// Runs batches of independent tasks on a fixed set of threads, and on the thread that starts the batch.
+/** The tasks of a batch are dealt out as even index ranges, one for each thread. Each thread takes tasks from the
+	front of its own range, and when that runs out, steals from the back of the ranges of the others, so that a few
+	slow tasks do not leave the other threads idle. Each task runs exactly once, on one thread. */
+class WorkStealingPool
+{
+public:
+	/// The function a batch runs for each task index.
+	typedef void (*TaskFunc)(void *context, size_t taskIndex);
+
+	/// Starts the given number of threads. The thread that calls Run() takes part as well, so a pool of N threads
+	/// runs N+1 tasks at a time.
+	explicit WorkStealingPool(int numThreads);
+	~WorkStealingPool();
+
+	int NumThreads() const { return (int)workers.size(); }
+
+	/// Calls func(context, i) for each i in [0, numTasks), and returns when all the calls have returned.
+	/// Only one thread may call Run() at a time.
+	void Run(size_t numTasks, TaskFunc func, void *context);
+
+private:
+	struct Worker
+	{
+		WorkStealingPool *pool;
+		int index;
+		Thread thread;
+		/// Set by Run() to start the worker on a batch.
+		Event wakeEvent;
+	};
+
+	/// The task ranges of each thread, with the first index in the high 32 bits and the end index in the low 32 bits,
+	/// so that a thread taking from the front and a thief taking from the back agree with a single compare-and-swap.
+	/// The last range belongs to the thread that calls Run().
+	std::vector<std::atomic<u64>*> ranges;
+
+	std::vector<Worker*> workers;
+
+	TaskFunc taskFunc;
+	void *taskContext;
+
+	/// The number of workers still running the current batch.
+	std::atomic<int> numBusy;
+	/// Set when the last worker finishes the current batch.
+	Event doneEvent;
+
+	std::atomic<bool> quit;
+
+	/// Runs tasks until the ranges of all threads are empty, starting from the range of the given thread.
+	void RunTasks(int rangeIndex);
+
+	/// Takes the first task of the given range. Returns false if the range is empty.
+	bool TakeFront(int rangeIndex, size_t &taskIndex);
+
+	/// Takes the last task of the given range. Returns false if the range is empty.
+	bool TakeBack(int rangeIndex, size_t &taskIndex);
+
+	static void WorkerMain(Worker *worker);
+
+	WorkStealingPool(const WorkStealingPool &); ///< Noncopyable, N/I.
+	void operator =(const WorkStealingPool &); ///< Noncopyable, N/I.
+};
+
+} // ~kNet
@@ -32,6 +32,7 @@ namespace kNet
 	class NetException;
 	class Network;
 	class NetworkMessage;
+	struct NetworkMetrics;
 	class NetworkServer;
 	struct OverlappedTransferBuffer;
 	class PolledTimer;
@@ -0,0 +1,385 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file Benchmark.cpp
+	@brief An automated end-to-end throughput and latency benchmark. Runs both the server and the clients
+	       in the same process over loopback, sweeps through a set of transport/reliability/message size/
+	       connection count configurations and outputs the results as JSON. */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+#include "kNet.h"
+#include "kNet/DebugMemoryLeakCheck.h"
+
+using namespace std;
+using namespace kNet;
+
+const message_id_t cBenchmarkMessage = 100;
+
+/// Each benchmark message starts with the send timestamp and a sequence number. Since the server and the client
+/// live in the same process, the receiver can compute the one-way latency directly from the timestamp.
+const size_t cBenchmarkHeaderSize = sizeof(u64) + sizeof(u32);
+
+/// Returns the amount of CPU time (user+kernel) this process has consumed so far, in microseconds.
+double ProcessCPUMicroseconds()
+{
+#ifdef WIN32
+	FILETIME creationTime, exitTime, kernelTime, userTime;
+	if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime))
+		return 0.0;
+	ULARGE_INTEGER k, u;
+	k.LowPart = kernelTime.dwLowDateTime; k.HighPart = kernelTime.dwHighDateTime;
+	u.LowPart = userTime.dwLowDateTime; u.HighPart = userTime.dwHighDateTime;
+	return (k.QuadPart + u.QuadPart) / 10.0; // FILETIME is in 100ns units.
+#else
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0.0;
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#endif
+}
+
+/// Returns the given percentile [0, 1] of the given sorted sequence.
+double Percentile(const std::vector<float> &sorted, double p)
+{
+	if (sorted.empty())
+		return 0.0;
+	size_t idx = (size_t)(p * (sorted.size() - 1) + 0.5);
+	return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+struct BenchmarkConfig
+{
+	SocketTransportLayer transport;
+	bool reliable;
+	size_t messageSize;
+	int numConnections;
+};
+
+struct BenchmarkResult
+{
+	BenchmarkConfig config;
+	bool connected;
+	u64 messagesSent;
+	u64 messagesReceived;
+	double seconds;
+	double cpuMicroseconds;
+	double latencyP50;
+	double latencyP99;
+	double latencyP999;
+	double latencyMax;
+
+	std::string ToJSON() const
+	{
+		const double msgsPerSec = (seconds > 0.0) ? messagesReceived / seconds : 0.0;
+		const double bytesPerSec = msgsPerSec * config.messageSize;
+		const double cpuPerMessage = (messagesReceived > 0) ? cpuMicroseconds / messagesReceived : 0.0;
+		const double lossRate = (messagesSent > 0) ? 1.0 - (double)messagesReceived / messagesSent : 0.0;
+
+		char str[1024];
+		sprintf(str, "{ \"transport\": \"%s\", \"reliable\": %s, \"messageSize\": %d, \"connections\": %d, \"connected\": %s, "
+			"\"messagesSent\": %llu, \"messagesReceived\": %llu, \"lossRate\": %.6f, \"seconds\": %.4f, "
+			"\"messagesPerSec\": %.1f, \"bytesPerSec\": %.1f, \"cpuMicrosPerMessage\": %.4f, "
+			"\"latencyMs\": { \"p50\": %.4f, \"p99\": %.4f, \"p999\": %.4f, \"max\": %.4f } }",
+			SocketTransportLayerToString(config.transport).c_str(), config.reliable ? "true" : "false",
+			(int)config.messageSize, config.numConnections, connected ? "true" : "false",
+			(unsigned long long)messagesSent, (unsigned long long)messagesReceived, lossRate, seconds,
+			msgsPerSec, bytesPerSec, cpuPerMessage, latencyP50, latencyP99, latencyP999, latencyMax);
+		return str;
+	}
+};
+
+class NetworkApp : public IMessageHandler, public INetworkServerListener
+{
+	std::vector<float> latencies;
+	u64 messagesReceived;
+
+public:
+	/// Called to notify the listener that a new connection has been established.
+	void NewConnectionEstablished(MessageConnection *connection)
+	{
+		connection->RegisterInboundMessageHandler(this);
+	}
+
+	void HandleMessage(MessageConnection *source, packet_id_t packetId, message_id_t messageId, const char *data, size_t numBytes)
+	{
+		if (messageId != cBenchmarkMessage || numBytes < cBenchmarkHeaderSize)
+			return;
+
+		DataDeserializer dd(data, numBytes);
+		tick_t sendTime = dd.Read<u64>();
+		latencies.push_back(Clock::TimespanToMillisecondsF(sendTime, Clock::Tick()));
+		++messagesReceived;
+	}
+
+	void SendMessage(MessageConnection *connection, size_t size, bool reliable, u32 sequenceNumber)
+	{
+		NetworkMessage *msg = connection->StartNewMessage(cBenchmarkMessage, size);
+		msg->priority = 100;
+		msg->reliable = reliable;
+		DataSerializer ds(msg->data, msg->Size());
+		ds.Add<u64>(Clock::Tick());
+		ds.Add<u32>(sequenceNumber);
+		// The rest of the message is left uninitialized, only the size is of interest.
+		connection->EndAndQueueMessage(msg);
+	}
+
+	BenchmarkResult Run(const BenchmarkConfig &config, unsigned short port, int durationMSecs, size_t outboundWindow)
+	{
+		BenchmarkResult result;
+		memset(&result, 0, sizeof(result));
+		result.config = config;
+		latencies.clear();
+		messagesReceived = 0;
+
+		// Use separate Network objects for the server and the clients so that both sides get their own worker threads,
+		// like they would when running in separate processes.
+		Network serverNetwork;
+		Network clientNetwork;
+
+		NetworkServer *server = serverNetwork.StartServer(port, config.transport, this, true);
+		if (!server)
+		{
+			LOG(LogError, "Unable to start server in port %d!", (int)port);
+			return result;
+		}
+
+		std::vector<Ptr(MessageConnection)> connections;
+		for(int i = 0; i < config.numConnections; ++i)
+		{
+			Ptr(MessageConnection) connection = clientNetwork.Connect("127.0.0.1", port, config.transport, this);
+			if (connection)
+				connections.push_back(connection);
+		}
+
+		// Wait until all the connections are established. UDP connection attempts are only accepted by NetworkServer::Process().
+		PolledTimer connectTimeout(5000.f);
+		for(;;)
+		{
+			server->Process();
+			size_t numPending = 0;
+			for(size_t i = 0; i < connections.size(); ++i)
+			{
+				connections[i]->Process();
+				if (connections[i]->GetConnectionState() == ConnectionPending)
+					++numPending;
+			}
+			if (numPending == 0 || connectTimeout.Test())
+				break;
+			Clock::Sleep(1);
+		}
+
+		result.connected = !connections.empty();
+		for(size_t i = 0; i < connections.size(); ++i)
+			if (connections[i]->GetConnectionState() != ConnectionOK)
+				result.connected = false;
+
+		if (!result.connected)
+		{
+			LOG(LogError, "Failed to establish %d connections to the benchmark server!", config.numConnections);
+			return result;
+		}
+
+		const size_t messageSize = std::max(config.messageSize, cBenchmarkHeaderSize);
+		const double cpuStart = ProcessCPUMicroseconds();
+		const tick_t startTime = Clock::Tick();
+		PolledTimer sendTimer((float)durationMSecs);
+		PolledTimer drainTimeout;
+		bool sending = true;
+		u32 sequenceNumber = 0;
+
+		for(;;)
+		{
+			// PolledTimer::Test() disarms the timer once it has gone off, so latch the phase transitions here.
+			if (sending && sendTimer.Test())
+			{
+				sending = false;
+				drainTimeout.StartMSecs(2000.f);
+			}
+			bool didWork = false;
+
+			for(size_t i = 0; i < connections.size(); ++i)
+			{
+				MessageConnection *connection = connections[i];
+				connection->Process();
+				// Keep a bounded window of data in the outbound queue so that the measured latency reflects the
+				// cost of the network path and not an arbitrarily long application-side queue.
+				while(sending && connection->NumOutboundMessagesPending() < outboundWindow)
+				{
+					SendMessage(connection, messageSize, config.reliable, sequenceNumber++);
+					++result.messagesSent;
+					didWork = true;
+				}
+			}
+
+			const u64 numReceivedBefore = messagesReceived;
+			server->Process();
+			if (messagesReceived != numReceivedBefore)
+				didWork = true;
+
+			if (!sending)
+			{
+				bool allSent = true;
+				for(size_t i = 0; i < connections.size(); ++i)
+					if (connections[i]->NumOutboundMessagesPending() > 0)
+						allSent = false;
+				if ((allSent && messagesReceived >= result.messagesSent) || !drainTimeout.Enabled() || drainTimeout.Test())
+					break;
+			}
+
+			if (!didWork)
+				Clock::Sleep(1);
+		}
+
+		result.seconds = Clock::TimespanToSecondsD(startTime, Clock::Tick());
+		result.cpuMicroseconds = ProcessCPUMicroseconds() - cpuStart;
+		result.messagesReceived = messagesReceived;
+
+		std::sort(latencies.begin(), latencies.end());
+		result.latencyP50 = Percentile(latencies, 0.5);
+		result.latencyP99 = Percentile(latencies, 0.99);
+		result.latencyP999 = Percentile(latencies, 0.999);
+		result.latencyMax = latencies.empty() ? 0.0 : latencies.back();
+
+		for(size_t i = 0; i < connections.size(); ++i)
+			connections[i]->Close(0);
+		connections.clear();
+		serverNetwork.StopServer();
+
+		return result;
+	}
+};
+
+void PrintUsage()
+{
+	cout << "Usage: " << endl;
+	cout << "       Benchmark [quick] [duration <msecs>] [port <port>] [window <numMessages>] [out <file.json>]" << endl;
+	cout << "   quick: Runs a reduced sweep with a short duration per configuration." << endl;
+	cout << "   duration: The time to spend sending data in each configuration (default: 2000 msecs)." << endl;
+	cout << "   port: The first local port to use. Each configuration uses a new port (default: 2345)." << endl;
+	cout << "   window: The max number of messages to keep queued per connection (default: 256)." << endl;
+	cout << "   out: Writes the JSON results to the given file instead of stdout." << endl;
+}
+
+BottomMemoryAllocator bma;
+
+int main(int argc, char **argv)
+{
+	bool quick = false;
+	int durationMSecs = 2000;
+	unsigned short port = 2345;
+	size_t outboundWindow = 256;
+	const char *outFile = 0;
+
+	for(int i = 1; i < argc; ++i)
+	{
+		if (!_stricmp(argv[i], "quick"))
+			quick = true;
+		else if (!_stricmp(argv[i], "duration") && i+1 < argc)
+			durationMSecs = atoi(argv[++i]);
+		else if (!_stricmp(argv[i], "port") && i+1 < argc)
+			port = (unsigned short)atoi(argv[++i]);
+		else if (!_stricmp(argv[i], "window") && i+1 < argc)
+			outboundWindow = (size_t)atoi(argv[++i]);
+		else if (!_stricmp(argv[i], "out") && i+1 < argc)
+			outFile = argv[++i];
+		else
+		{
+			PrintUsage();
+			return 0;
+		}
+	}
+
+	if (quick)
+		durationMSecs = std::min(durationMSecs, 500);
+
+	EnableMemoryLeakLoggingAtExit();
+
+	// Build the sweep of configurations to run.
+	const size_t sizesFull[] = { 16, 128, 1024, 4096 };
+	const size_t sizesQuick[] = { 16, 1024 };
+	const int connectionsFull[] = { 1, 8 };
+	const int connectionsQuick[] = { 1 };
+	const SocketTransportLayer transports[] = { SocketOverTCP, SocketOverUDP };
+
+	std::vector<size_t> sizes = quick ? std::vector<size_t>(sizesQuick, sizesQuick + 2) : std::vector<size_t>(sizesFull, sizesFull + 4);
+	std::vector<int> connectionCounts = quick ? std::vector<int>(connectionsQuick, connectionsQuick + 1) : std::vector<int>(connectionsFull, connectionsFull + 2);
+
+	std::vector<BenchmarkConfig> configs;
+	for(int t = 0; t < 2; ++t)
+		for(int reliable = 1; reliable >= 0; --reliable)
+		{
+			if (transports[t] == SocketOverTCP && !reliable)
+				continue; // TCP is always reliable.
+			for(size_t s = 0; s < sizes.size(); ++s)
+				for(size_t c = 0; c < connectionCounts.size(); ++c)
+				{
+					BenchmarkConfig config;
+					config.transport = transports[t];
+					config.reliable = (reliable != 0);
+					config.messageSize = sizes[s];
+					config.numConnections = connectionCounts[c];
+					configs.push_back(config);
+				}
+		}
+
+	std::stringstream json;
+	json << "{" << endl;
+	json << "  \"benchmark\": \"kNet\"," << endl;
+	json << "  \"durationMSecs\": " << durationMSecs << "," << endl;
+	json << "  \"outboundWindow\": " << outboundWindow << "," << endl;
+	json << "  \"results\": [" << endl;
+
+	NetworkApp app;
+	for(size_t i = 0; i < configs.size(); ++i)
+	{
+		const BenchmarkConfig &c = configs[i];
+		cerr << "Running " << SocketTransportLayerToString(c.transport) << (c.reliable ? " reliable" : " unreliable")
+			<< ", " << c.messageSize << " bytes, " << c.numConnections << " connection(s).." << endl;
+
+		BenchmarkResult result = app.Run(c, (unsigned short)(port + i), durationMSecs, outboundWindow);
+		json << "    " << result.ToJSON() << ((i+1 < configs.size()) ? "," : "") << endl;
+	}
+
+	json << "  ]" << endl;
+	json << "}" << endl;
+
+	if (outFile)
+	{
+		std::ofstream out(outFile);
+		out << json.str();
+		if (!out)
+		{
+			cerr << "Failed to write the benchmark results to " << outFile << "!" << endl;
+			return 1;
+		}
+	}
+	else
+		cout << json.str();
+
+	return 0;
+}
@@ -69,18 +69,91 @@ public:
 
 		cout << "Finished connection flood." << endl;
 	}
+
+	/// Measures the cost of short-lived sessions: opens a connection to a server in this process, waits until it is
+	/// established on both ends, and closes it, one session after another.
+	void RunChurnBenchmark(unsigned short port, SocketTransportLayer transport, int numSessions)
+	{
+		Network serverNetwork;
+		NetworkServer *server = serverNetwork.StartServer(port, transport, 0, true);
+		if (!server)
+		{
+			cout << "Failed to start the server on port " << port << "!" << endl;
+			return;
+		}
+
+		int numEstablished = 0;
+		double connectMSecs = 0.0, closeMSecs = 0.0;
+		tick_t start = Clock::Tick();
+		for(int i = 0; i < numSessions; ++i)
+		{
+			tick_t sessionStart = Clock::Tick();
+			Ptr(MessageConnection) connection = network.Connect("127.0.0.1", port, transport, this);
+			if (!connection)
+				break;
+			while(connection->GetConnectionState() == ConnectionPending || server->NumConnections() == 0)
+			{
+				server->Process();
+				connection->Process();
+				if (Clock::SecondsSinceF(sessionStart) > 5.f)
+					break;
+				Clock::Sleep(0);
+			}
+			if (connection->GetConnectionState() == ConnectionOK)
+				++numEstablished;
+			tick_t closeStart = Clock::Tick();
+			connectMSecs += Clock::TimespanToMillisecondsD(sessionStart, closeStart);
+			// Disconnect, and close the server end once it sees the client leave, like a server application would.
+			connection->Disconnect(0);
+			while(server->NumConnections() > 0 && Clock::SecondsSinceF(closeStart) < 5.f)
+			{
+				server->Process();
+				connection->Process();
+				ConnectionRegistry::ReadGuard clients(server->Clients());
+				for(size_t i = 0; i < clients->Size(); ++i)
+					if (!clients->At(i)->IsReadOpen())
+						clients->At(i)->Close(0);
+				Clock::Sleep(0);
+			}
+			connection->Close(0);
+			connection = 0;
+			server->Process();
+			closeMSecs += Clock::MillisecondsSinceF(closeStart);
+		}
+		const double totalSecs = Clock::SecondsSinceF(start);
+		cout << "Churned " << numSessions << " " << SocketTransportLayerToString(transport) << " sessions in " << totalSecs << " seconds ("
+			<< (numSessions / totalSecs) << " sessions/sec), " << numEstablished << " established." << endl;
+		cout << "  Connect: " << (connectMSecs * 1000.0 / numSessions) << " usecs/session. Close: " << (closeMSecs * 1000.0 / numSessions)
+			<< " usecs/session." << endl;
+		serverNetwork.StopServer();
+	}
 };
 
 void PrintUsage()
 {
 	cout << "Usage: " << endl;
 	cout << "       tcp|udp <hostname> <port> <numConcurrentConnections> <numTotalConnections>" << endl;
+	cout << "       churn tcp|udp <port> <numSessions>" << endl;
+	cout << "The churn mode runs a server in this process, and opens and closes one session after another against it." << endl;
 }
 
 BottomMemoryAllocator bma;
 
 int main(int argc, char **argv)
 {
+	if (argc == 5 && !strcmp(argv[1], "churn"))
+	{
+		SocketTransportLayer transport = StringToSocketTransportLayer(argv[2]);
+		if (transport == InvalidTransportLayer)
+		{
+			cout << "The transport is either 'tcp' or 'udp'!" << endl;
+			return 0;
+		}
+		NetworkApp app;
+		app.RunChurnBenchmark((unsigned short)atoi(argv[3]), transport, atoi(argv[4]));
+		return 0;
+	}
+
 	if (argc < 6)
 	{
 		PrintUsage();
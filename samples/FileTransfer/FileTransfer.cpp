@@ -248,7 +248,8 @@ void NetworkApp::SenderMainLoopIteration()
 			msg->reliable = true;
 			msg->inOrder = true;
 #ifdef KNET_NETWORK_PROFILING
-			msg->profilerName = "File (31)";
+			static const StatsMetricId profilerMetric = RegisterStatsMetric("messageOut.File (31)", "bytes");
+			msg->profilerMetric = profilerMetric;
 #endif
 
 			DataSerializer ds(msg->data, msg->Size());
@@ -344,7 +345,8 @@ void NetworkApp::RunSender(const char *address, unsigned short port, SocketTrans
 	msg->reliable = true;
 	msg->inOrder = true;
 #ifdef KNET_NETWORK_PROFILING
-	msg->profilerName = "TransferStart (30)";
+	static const StatsMetricId profilerMetric = RegisterStatsMetric("messageOut.TransferStart (30)", "bytes");
+	msg->profilerMetric = profilerMetric;
 #endif
 	connection->EndAndQueueMessage(msg, ds.BytesFilled());
 
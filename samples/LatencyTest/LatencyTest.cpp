@@ -18,6 +18,7 @@
 #include <iostream>
 #include <string>
 #include <cmath>
+#include <algorithm>
 
 #include "kNet.h"
 
@@ -34,12 +35,36 @@ class NetworkApp : public IMessageHandler, public INetworkServerListener
 
 	tick_t pingSendTime;
 	u16 sentPingNumber;
+
+	// The round trip times measured from the PONG replies, in msecs.
+	int numPongs;
+	float minRTT;
+	float maxRTT;
+	float totalRTT;
 public:
+	/// If true, the application loops do not sleep between the calls to Process().
+	bool spin;
+
+	/// The time between two PINGs, in msecs.
+	float pingIntervalMSecs;
+
+	/// The client quits after receiving this many PONGs. 0 runs forever.
+	int numPings;
+
 	NetworkApp()	
 	{
 		sentPingNumber = 0;
+		numPongs = 0;
+		minRTT = 1e9f;
+		maxRTT = 0.f;
+		totalRTT = 0.f;
+		spin = false;
+		pingIntervalMSecs = 2000.f;
+		numPings = 0;
 	}
 
+	Network &GetNetwork() { return network; }
+
 	void SendPingMessage(MessageConnection *connection)
 	{
 		NetworkMessage *msg = connection->StartNewMessage(customPingMessageId, 2);
@@ -71,7 +96,14 @@ public:
 		DataDeserializer dd(receivedPingData, receivedPingDataNumBytes);
 		u16 receivedPingNumber = dd.Read<u16>();
 		if (receivedPingNumber == sentPingNumber)
-			cout << "Received PONG_" << receivedPingNumber << " in " << Clock::TimespanToMillisecondsF(pingSendTime, Clock::Tick()) << " msecs from sending PING_" << sentPingNumber << "." << std::endl;		
+		{
+			const float rtt = Clock::TimespanToMillisecondsF(pingSendTime, Clock::Tick());
+			cout << "Received PONG_" << receivedPingNumber << " in " << rtt << " msecs from sending PING_" << sentPingNumber << "." << std::endl;		
+			++numPongs;
+			minRTT = min(minRTT, rtt);
+			maxRTT = max(maxRTT, rtt);
+			totalRTT += rtt;
+		}
 		else
 			cout << "Received old PONG_" << receivedPingNumber << endl;
 	}
@@ -105,7 +137,8 @@ public:
 		for(;;)
 		{
 			server->Process();
-			Clock::Sleep(1);
+			if (!spin)
+				Clock::Sleep(1);
 		}
 	}
 
@@ -137,23 +170,25 @@ public:
 
 	void RunLatencyTest(MessageConnection *connection)
 	{
-		PolledTimer pingSendTimer(2000.f);
+		PolledTimer pingSendTimer(pingIntervalMSecs);
 
-		float previousRTT = 0.f;
-
-		for(;;)
+		while(numPings == 0 || numPongs < numPings)
 		{
 			connection->Process();
 
-			Clock::Sleep(1);
+			if (!spin)
+				Clock::Sleep(1);
 			if (pingSendTimer.TriggeredOrNotRunning())
 			{
 				cout << "kNet-estimated round trip time is " << connection->RoundTripTime() << " msecs." << std::endl; 
 				SendPingMessage(connection);
-				pingSendTimer.StartMSecs(2000.f);
+				pingSendTimer.StartMSecs(pingIntervalMSecs);
 			}
 		}
 
+		cout << "Round trip times of " << numPongs << " PINGs: min " << minRTT << ", avg " << totalRTT / numPongs
+			<< ", max " << maxRTT << " msecs." << endl;
+
 		connection->Disconnect();
 		connection->RunModalClient();
 	}
@@ -162,8 +197,13 @@ public:
 void PrintUsage()
 {
 	cout << "Usage: " << endl;
-	cout << "       server tcp|udp port" << endl;
-	cout << "       client tcp|udp hostname port" << endl;
+	cout << "       server tcp|udp port [options]" << endl;
+	cout << "       client tcp|udp hostname port [options]" << endl;
+	cout << "Options:" << endl;
+	cout << "   spin: Calls Process() in a loop without sleeping in between." << endl;
+	cout << "   busypoll <idleMSecs>: Runs the worker threads in the busy-poll mode. See Network::SetWorkerBusyPoll()." << endl;
+	cout << "   interval <msecs>: The time between two PINGs (default: 2000 msecs)." << endl;
+	cout << "   pings <count>: The client prints the round trip time statistics and quits after this many PINGs." << endl;
 }
 
 BottomMemoryAllocator bma;
@@ -193,6 +233,24 @@ int main(int argc, char **argv)
 		return 0;
 	}
 	NetworkApp app;
+	const int firstOption = !_stricmp(argv[1], "client") ? 5 : 4;
+	for(int i = firstOption; i < argc; ++i)
+	{
+		if (!_stricmp(argv[i], "spin"))
+			app.spin = true;
+		else if (!_stricmp(argv[i], "busypoll") && i+1 < argc)
+			app.GetNetwork().SetWorkerBusyPoll(atoi(argv[++i]));
+		else if (!_stricmp(argv[i], "interval") && i+1 < argc)
+			app.pingIntervalMSecs = (float)atof(argv[++i]);
+		else if (!_stricmp(argv[i], "pings") && i+1 < argc)
+			app.numPings = atoi(argv[++i]);
+		else
+		{
+			PrintUsage();
+			return 0;
+		}
+	}
+
 	if (!_stricmp(argv[1], "server"))
 	{
 		unsigned short port = atoi(argv[3]);
@@ -0,0 +1,625 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file ScalabilityBenchmark.cpp
+	@brief Measures how a single NetworkServer behaves with a large number of concurrent connections.
+	       For each tested connection count N, a client process is forked that opens N connections to the
+	       server over loopback. The server then runs through an idle, a steady-chat and a broadcast-heavy phase,
+	       and records its memory use, CPU use, read/write syscall rate and ping latency in each phase.
+	       A final silent phase sends no application messages at all, so that the connections hibernate,
+	       and reports how many did and the resulting memory use per connection. */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdio>
+
+#ifndef WIN32
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+#include "kNet.h"
+#include "kNet/DebugMemoryLeakCheck.h"
+
+using namespace std;
+using namespace kNet;
+
+const message_id_t cPhaseMessage = 100;     ///< server->client: u8 phase. Tells the client process what to do.
+const message_id_t cPingMessage = 101;      ///< server->client: u64 send timestamp. The client echoes it back as a pong.
+const message_id_t cPongMessage = 102;      ///< client->server: u64 timestamp of the ping or broadcast being answered.
+const message_id_t cChatMessage = 103;      ///< client->server: a small chat line, sent periodically in the chat phase.
+const message_id_t cBroadcastMessage = 104; ///< server->all clients: u64 send timestamp plus payload.
+
+enum BenchmarkPhase
+{
+	PhaseIdle = 0,
+	PhaseChat,
+	PhaseBroadcast,
+	PhaseSilent,
+	PhaseQuit,
+	NumPhases = PhaseQuit
+};
+
+const char *phaseNames[NumPhases] = { "idle", "chat", "broadcast", "silent" };
+
+const float cChatIntervalMSecs = 100.f;      ///< Each client sends a chat message at 10Hz in the chat phase.
+const float cPingIntervalMSecs = 1000.f;     ///< Each client is pinged once per second in every phase except the silent one.
+const int cMinSilentPhaseMSecs = 12000;      ///< Long enough for idle connections to hibernate.
+const float cBroadcastIntervalMSecs = 50.f;  ///< The server broadcasts at 20Hz in the broadcast phase.
+const size_t cChatMessageSize = 32;
+const size_t cBroadcastMessageSize = 256;
+const int cBroadcastEchoModulo = 16;         ///< Every 16th client echoes the broadcasts back to measure the fan-out latency.
+const float cConnectStallTimeoutMSecs = 5000.f; ///< Stop waiting for more clients if none have connected in this time.
+
+#ifndef WIN32
+
+/// Returns the resident set size of this process, in bytes.
+u64 ResidentSetSize()
+{
+	u64 size = 0, resident = 0;
+	FILE *handle = fopen("/proc/self/statm", "r");
+	if (!handle)
+		return 0;
+	if (fscanf(handle, "%llu %llu", (unsigned long long*)&size, (unsigned long long*)&resident) != 2)
+		resident = 0;
+	fclose(handle);
+	return resident * (u64)sysconf(_SC_PAGESIZE);
+}
+
+/// Returns the number of read- and write-type syscalls this process has performed. This does not include
+/// select() and other calls that do not transfer data, but it tracks the per-packet syscall cost well.
+u64 ReadWriteSyscalls()
+{
+	FILE *handle = fopen("/proc/self/io", "r");
+	if (!handle)
+		return 0;
+	u64 total = 0;
+	char line[256];
+	while(fgets(line, sizeof(line), handle))
+	{
+		unsigned long long value = 0;
+		if (sscanf(line, "syscr: %llu", &value) == 1 || sscanf(line, "syscw: %llu", &value) == 1)
+			total += value;
+	}
+	fclose(handle);
+	return total;
+}
+
+struct ProcessTimes
+{
+	double cpuMicroseconds;
+	u64 contextSwitches;
+};
+
+ProcessTimes CurrentProcessTimes()
+{
+	ProcessTimes t;
+	rusage usage;
+	memset(&usage, 0, sizeof(usage));
+	getrusage(RUSAGE_SELF, &usage);
+	t.cpuMicroseconds = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+	t.contextSwitches = usage.ru_nvcsw + usage.ru_nivcsw;
+	return t;
+}
+
+/// Raises the soft limit of open file descriptors to the hard limit, since each connection needs a few.
+void RaiseFileDescriptorLimit()
+{
+	rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+}
+
+/// Returns the given percentile [0, 1] of the given sorted sequence.
+double Percentile(const std::vector<float> &sorted, double p)
+{
+	if (sorted.empty())
+		return 0.0;
+	size_t idx = (size_t)(p * (sorted.size() - 1) + 0.5);
+	return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+/// The client side of the benchmark, runs in the forked child process.
+class ClientApp : public IMessageHandler
+{
+	Network network;
+	std::vector<Ptr(MessageConnection)> connections;
+	std::map<MessageConnection *, size_t> connectionIndices;
+	BenchmarkPhase phase;
+
+public:
+	ClientApp():phase(PhaseIdle) {}
+
+	void HandleMessage(MessageConnection *source, packet_id_t packetId, message_id_t messageId, const char *data, size_t numBytes)
+	{
+		switch(messageId)
+		{
+		case cPhaseMessage:
+			if (numBytes >= 1)
+				phase = (BenchmarkPhase)(u8)data[0];
+			break;
+		case cPingMessage:
+			SendPong(source, data, numBytes);
+			break;
+		case cBroadcastMessage:
+			if (ConnectionIndex(source) % cBroadcastEchoModulo == 0)
+				SendPong(source, data, numBytes);
+			break;
+		}
+	}
+
+	size_t ConnectionIndex(MessageConnection *connection) const
+	{
+		std::map<MessageConnection *, size_t>::const_iterator iter = connectionIndices.find(connection);
+		return (iter != connectionIndices.end()) ? iter->second : (size_t)-1;
+	}
+
+	void SendPong(MessageConnection *connection, const char *data, size_t numBytes)
+	{
+		if (numBytes < sizeof(u64))
+			return;
+		NetworkMessage *msg = connection->StartNewMessage(cPongMessage, sizeof(u64));
+		msg->priority = 100;
+		msg->reliable = false;
+		memcpy(msg->data, data, sizeof(u64));
+		connection->EndAndQueueMessage(msg);
+	}
+
+	void SendChat(MessageConnection *connection)
+	{
+		NetworkMessage *msg = connection->StartNewMessage(cChatMessage, cChatMessageSize);
+		msg->priority = 50;
+		msg->reliable = true;
+		msg->inOrder = true;
+		memset(msg->data, 'x', cChatMessageSize);
+		connection->EndAndQueueMessage(msg);
+	}
+
+	void Run(const char *address, unsigned short port, SocketTransportLayer transport, int numConnections)
+	{
+		for(int i = 0; i < numConnections; ++i)
+		{
+			Ptr(MessageConnection) connection = network.Connect(address, port, transport, this);
+			if (!connection)
+			{
+				LOG(LogError, "ScalabilityBenchmark client: Failed to open connection %d/%d!", i+1, numConnections);
+				break;
+			}
+			connectionIndices[connection.ptr()] = connections.size();
+			connections.push_back(connection);
+		}
+
+		PolledTimer chatTimer;
+		chatTimer.Start();
+		size_t nextChatIndex = 0;
+		u64 numChatsSent = 0;
+
+		while(phase != PhaseQuit)
+		{
+			for(size_t i = 0; i < connections.size(); ++i)
+				connections[i]->Process();
+
+			// Spread the chat messages evenly over time so that each connection sends one per chat interval.
+			if (phase == PhaseChat && !connections.empty())
+			{
+				u64 numChatsDue = (u64)(chatTimer.MSecsElapsed() * connections.size() / cChatIntervalMSecs);
+				for(; numChatsSent < numChatsDue; ++numChatsSent)
+				{
+					MessageConnection *connection = connections[nextChatIndex];
+					nextChatIndex = (nextChatIndex + 1) % connections.size();
+					if (connection->GetConnectionState() == ConnectionOK)
+						SendChat(connection);
+				}
+			}
+			else
+			{
+				chatTimer.Start();
+				numChatsSent = 0;
+			}
+
+			Clock::Sleep(1);
+		}
+
+		for(size_t i = 0; i < connections.size(); ++i)
+			connections[i]->Close(0);
+		connections.clear();
+	}
+};
+
+struct PhaseResult
+{
+	double seconds;
+	double cpuPercent;
+	double syscallsPerSec;
+	double contextSwitchesPerSec;
+	double messagesInPerSec;
+	double messagesOutPerSec;
+	u64 rss;
+	size_t numHibernating;
+	u64 numLatencySamples;
+	double latencyP50;
+	double latencyP99;
+	double latencyP999;
+};
+
+/// The server side of the benchmark, runs in the parent process and performs all the measurements.
+class ServerApp : public IMessageHandler, public INetworkServerListener
+{
+	std::vector<float> latencies;
+	u64 messagesIn;
+
+public:
+	ServerApp():messagesIn(0) {}
+
+	void NewConnectionEstablished(MessageConnection *connection)
+	{
+		connection->RegisterInboundMessageHandler(this);
+	}
+
+	void HandleMessage(MessageConnection *source, packet_id_t packetId, message_id_t messageId, const char *data, size_t numBytes)
+	{
+		++messagesIn;
+		if (messageId == cPongMessage && numBytes >= sizeof(u64))
+		{
+			DataDeserializer dd(data, numBytes);
+			tick_t sendTime = dd.Read<u64>();
+			latencies.push_back(Clock::TimespanToMillisecondsF(sendTime, Clock::Tick()));
+		}
+	}
+
+	void SendPing(MessageConnection *connection)
+	{
+		NetworkMessage *msg = connection->StartNewMessage(cPingMessage, sizeof(u64));
+		msg->priority = 100;
+		msg->reliable = false;
+		DataSerializer ds(msg->data, msg->Size());
+		ds.Add<u64>(Clock::Tick());
+		connection->EndAndQueueMessage(msg);
+	}
+
+	void BroadcastPhase(NetworkServer *server, BenchmarkPhase phase)
+	{
+		u8 data = (u8)phase;
+		server->BroadcastMessage(cPhaseMessage, true, true, 100, 0, (const char *)&data, 1);
+	}
+
+	PhaseResult RunPhase(NetworkServer *server, std::vector<Ptr(MessageConnection)> &connections, BenchmarkPhase phase, int durationMSecs)
+	{
+		BroadcastPhase(server, phase);
+
+		latencies.clear();
+		messagesIn = 0;
+		u64 messagesOut = 0;
+
+		std::vector<char> broadcastData(cBroadcastMessageSize, 0);
+		PolledTimer broadcastTimer(cBroadcastIntervalMSecs);
+
+		const ProcessTimes startTimes = CurrentProcessTimes();
+		const u64 startSyscalls = ReadWriteSyscalls();
+		const tick_t startTime = Clock::Tick();
+		PolledTimer phaseTimer;
+		phaseTimer.Start();
+		u64 numPingsSent = 0;
+		size_t nextPingIndex = 0;
+
+		while(phaseTimer.MSecsElapsed() < durationMSecs)
+		{
+			server->Process();
+
+			// Ping each connection once per ping interval, spreading the pings evenly over time.
+			if (!connections.empty() && phase != PhaseSilent)
+			{
+				u64 numPingsDue = (u64)(phaseTimer.MSecsElapsed() * connections.size() / cPingIntervalMSecs);
+				for(; numPingsSent < numPingsDue; ++numPingsSent)
+				{
+					MessageConnection *connection = connections[nextPingIndex];
+					nextPingIndex = (nextPingIndex + 1) % connections.size();
+					if (connection->GetConnectionState() == ConnectionOK)
+					{
+						SendPing(connection);
+						++messagesOut;
+					}
+				}
+			}
+
+			if (phase == PhaseBroadcast && broadcastTimer.Test())
+			{
+				DataSerializer ds(&broadcastData[0], broadcastData.size());
+				ds.Add<u64>(Clock::Tick());
+				server->BroadcastMessage(cBroadcastMessage, false, false, 100, 0, &broadcastData[0], broadcastData.size());
+				messagesOut += connections.size();
+				broadcastTimer.StartMSecs(cBroadcastIntervalMSecs);
+			}
+
+			Clock::Sleep(1);
+		}
+
+		const double seconds = Clock::SecondsSinceD(startTime);
+		const ProcessTimes endTimes = CurrentProcessTimes();
+
+		PhaseResult r;
+		r.seconds = seconds;
+		r.cpuPercent = (endTimes.cpuMicroseconds - startTimes.cpuMicroseconds) / (seconds * 1e6) * 100.0;
+		r.syscallsPerSec = (ReadWriteSyscalls() - startSyscalls) / seconds;
+		r.contextSwitchesPerSec = (endTimes.contextSwitches - startTimes.contextSwitches) / seconds;
+		r.messagesInPerSec = messagesIn / seconds;
+		r.messagesOutPerSec = messagesOut / seconds;
+		r.rss = ResidentSetSize();
+		r.numHibernating = 0;
+		for(size_t i = 0; i < connections.size(); ++i)
+			if (connections[i]->IsHibernating())
+				++r.numHibernating;
+		std::sort(latencies.begin(), latencies.end());
+		r.numLatencySamples = latencies.size();
+		r.latencyP50 = Percentile(latencies, 0.5);
+		r.latencyP99 = Percentile(latencies, 0.99);
+		r.latencyP999 = Percentile(latencies, 0.999);
+		return r;
+	}
+
+	/// Runs all the benchmark phases against a client process that opens numConnections connections.
+	/// @param startSignalFd The write end of a pipe that releases the client process to connect once the server is up.
+	std::string Run(unsigned short port, SocketTransportLayer transport, int numConnections, int phaseMSecs, int startSignalFd)
+	{
+		std::stringstream json;
+		const u64 rssBaseline = ResidentSetSize();
+
+		Network network;
+		NetworkServer *server = network.StartServer(port, transport, this, true);
+		if (!server)
+		{
+			LOG(LogError, "Unable to start server in port %d!", (int)port);
+			close(startSignalFd);
+			json << "{ \"connections\": " << numConnections << ", \"error\": \"Failed to start the server.\" }";
+			return json.str();
+		}
+		const u64 rssServerStarted = ResidentSetSize();
+
+		// Release the client process to start connecting.
+		char go = 1;
+		if (write(startSignalFd, &go, 1) != 1)
+			LOG(LogError, "Failed to signal the client process to start!");
+		close(startSignalFd);
+
+		// Wait until all the clients have connected, or until no new connections have arrived in a while.
+		// Connecting is not rate-limited here on purpose: the time it takes is one of the measured results.
+		const tick_t connectStartTime = Clock::Tick();
+		PolledTimer connectStallTimeout(cConnectStallTimeoutMSecs);
+		int numConnected = 0;
+		while(numConnected < numConnections && !connectStallTimeout.Test())
+		{
+			server->Process();
+			if (server->NumConnections() != numConnected)
+			{
+				numConnected = server->NumConnections();
+				connectStallTimeout.StartMSecs(cConnectStallTimeoutMSecs);
+			}
+			Clock::Sleep(1);
+		}
+		const double connectSeconds = Clock::SecondsSinceD(connectStartTime);
+
+		NetworkServer::ConnectionMap connectionMap = server->GetConnections();
+		std::vector<Ptr(MessageConnection)> connections;
+		for(NetworkServer::ConnectionMap::iterator iter = connectionMap.begin(); iter != connectionMap.end(); ++iter)
+			connections.push_back(iter->second);
+		connectionMap.clear();
+
+		const u64 rssConnected = ResidentSetSize();
+		const u64 bytesPerConnection = connections.empty() ? 0 : (rssConnected - std::min(rssConnected, rssServerStarted)) / connections.size();
+
+		json << "{ \"connections\": " << numConnections << ", \"connected\": " << connections.size()
+			<< ", \"connectSeconds\": " << connectSeconds << ", \"workerThreads\": " << network.NumWorkerThreads()
+			<< ", \"rssBaseline\": " << rssBaseline << ", \"rssConnected\": " << rssConnected
+			<< ", \"bytesPerConnection\": " << bytesPerConnection << ", \"phases\": [";
+
+		for(int phase = 0; phase < NumPhases; ++phase)
+		{
+			cerr << "  " << phaseNames[phase] << ".." << endl;
+			const int durationMSecs = (phase == PhaseSilent) ? std::max(phaseMSecs, cMinSilentPhaseMSecs) : phaseMSecs;
+			PhaseResult r = RunPhase(server, connections, (BenchmarkPhase)phase, durationMSecs);
+			const u64 phaseBytesPerConnection = connections.empty() ? 0 : (r.rss - std::min(r.rss, rssServerStarted)) / connections.size();
+			char str[1024];
+			sprintf(str, "%s{ \"name\": \"%s\", \"seconds\": %.3f, \"cpuPercent\": %.2f, \"rss\": %llu, \"bytesPerConnection\": %llu, "
+				"\"hibernating\": %d, \"syscallsPerSec\": %.1f, "
+				"\"contextSwitchesPerSec\": %.1f, \"messagesInPerSec\": %.1f, \"messagesOutPerSec\": %.1f, "
+				"\"latencySamples\": %llu, \"latencyMs\": { \"p50\": %.4f, \"p99\": %.4f, \"p999\": %.4f } }",
+				(phase > 0) ? ", " : " ", phaseNames[phase], r.seconds, r.cpuPercent, (unsigned long long)r.rss,
+				(unsigned long long)phaseBytesPerConnection, (int)r.numHibernating, r.syscallsPerSec,
+				r.contextSwitchesPerSec, r.messagesInPerSec, r.messagesOutPerSec,
+				(unsigned long long)r.numLatencySamples, r.latencyP50, r.latencyP99, r.latencyP999);
+			json << str;
+		}
+		json << " ] }";
+
+		BroadcastPhase(server, PhaseQuit);
+		PolledTimer quitTimer(500.f);
+		while(!quitTimer.Test())
+		{
+			server->Process();
+			Clock::Sleep(1);
+		}
+
+		connections.clear();
+		network.StopServer();
+		return json.str();
+	}
+};
+
+#endif
+
+void PrintUsage()
+{
+	cout << "Usage: " << endl;
+	cout << "       ScalabilityBenchmark tcp|udp [connections <n1,n2,..>] [phase <msecs>] [port <port>] [out <file.json>]" << endl;
+	cout << "   connections: The comma-separated list of connection counts to test (default: 100,1000)." << endl;
+	cout << "   phase: The duration of each of the idle, chat and broadcast phases (default: 5000 msecs)." << endl;
+	cout << "          The silent phase lasts at least " << cMinSilentPhaseMSecs << " msecs to let the connections hibernate." << endl;
+	cout << "   port: The first local port to use. Each connection count uses a new port (default: 2445)." << endl;
+	cout << "   out: Writes the JSON results to the given file instead of stdout." << endl;
+}
+
+BottomMemoryAllocator bma;
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		PrintUsage();
+		return 0;
+	}
+
+	SocketTransportLayer transport = StringToSocketTransportLayer(argv[1]);
+	if (transport == InvalidTransportLayer)
+	{
+		cout << "The first parameter is either 'tcp' or 'udp'!" << endl;
+		return 0;
+	}
+
+	std::vector<int> connectionCounts;
+	int phaseMSecs = 5000;
+	unsigned short port = 2445;
+	const char *outFile = 0;
+
+	for(int i = 2; i < argc; ++i)
+	{
+		if (!_stricmp(argv[i], "connections") && i+1 < argc)
+		{
+			std::stringstream ss(argv[++i]);
+			std::string count;
+			while(std::getline(ss, count, ','))
+				if (atoi(count.c_str()) > 0)
+					connectionCounts.push_back(atoi(count.c_str()));
+		}
+		else if (!_stricmp(argv[i], "phase") && i+1 < argc)
+			phaseMSecs = atoi(argv[++i]);
+		else if (!_stricmp(argv[i], "port") && i+1 < argc)
+			port = (unsigned short)atoi(argv[++i]);
+		else if (!_stricmp(argv[i], "out") && i+1 < argc)
+			outFile = argv[++i];
+		else
+		{
+			PrintUsage();
+			return 0;
+		}
+	}
+	if (connectionCounts.empty())
+	{
+		connectionCounts.push_back(100);
+		connectionCounts.push_back(1000);
+	}
+
+#ifdef WIN32
+	cout << "ScalabilityBenchmark forks a separate client process and reads /proc, and only runs on Unix hosts." << endl;
+	return 0;
+#else
+	RaiseFileDescriptorLimit();
+	// A client process that exits early must not take the server down with a SIGPIPE.
+	signal(SIGPIPE, SIG_IGN);
+
+	std::stringstream json;
+	json << "{" << endl;
+	json << "  \"benchmark\": \"kNetScalability\"," << endl;
+	json << "  \"transport\": \"" << SocketTransportLayerToString(transport) << "\"," << endl;
+	json << "  \"phaseMSecs\": " << phaseMSecs << "," << endl;
+	json << "  \"results\": [" << endl;
+
+	for(size_t i = 0; i < connectionCounts.size(); ++i)
+	{
+		const int numConnections = connectionCounts[i];
+		const unsigned short serverPort = (unsigned short)(port + i);
+		cerr << "Running " << numConnections << " connections over " << SocketTransportLayerToString(transport) << ".." << endl;
+
+		int startSignal[2];
+		if (pipe(startSignal) != 0)
+		{
+			cerr << "pipe() failed!" << endl;
+			return 1;
+		}
+
+		// Fork the client process before any kNet threads exist in this process, so that the child starts from a clean state.
+		pid_t child = fork();
+		if (child == 0)
+		{
+			close(startSignal[1]);
+			char go = 0;
+			bool started = (read(startSignal[0], &go, 1) == 1);
+			close(startSignal[0]);
+			if (started)
+			{
+				ClientApp client;
+				client.Run("127.0.0.1", serverPort, transport, numConnections);
+			}
+			_exit(0);
+		}
+		close(startSignal[0]);
+		if (child < 0)
+		{
+			close(startSignal[1]);
+			cerr << "fork() failed!" << endl;
+			return 1;
+		}
+
+		std::string result;
+		{
+			ServerApp server;
+			result = server.Run(serverPort, transport, numConnections, phaseMSecs, startSignal[1]);
+		}
+		json << "    " << result << ((i+1 < connectionCounts.size()) ? "," : "") << endl;
+
+		// Give the client process a moment to exit on its own after the quit phase, then make sure it is gone.
+		int status = 0;
+		PolledTimer exitTimeout(5000.f);
+		while(waitpid(child, &status, WNOHANG) == 0)
+		{
+			if (exitTimeout.Test())
+			{
+				kill(child, SIGKILL);
+				waitpid(child, &status, 0);
+				break;
+			}
+			Clock::Sleep(10);
+		}
+	}
+
+	json << "  ]" << endl;
+	json << "}" << endl;
+
+	if (outFile)
+	{
+		std::ofstream out(outFile);
+		out << json.str();
+		if (!out)
+		{
+			cerr << "Failed to write the benchmark results to " << outFile << "!" << endl;
+			return 1;
+		}
+	}
+	else
+		cout << json.str();
+
+	return 0;
+#endif
+}
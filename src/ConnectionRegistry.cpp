@@ -0,0 +1,204 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file ConnectionRegistry.cpp
+	@brief */
+
+#include <algorithm>
+#include <cassert>
+
+#include "kNet/DebugMemoryLeakCheck.h"
+
+#include "kNet/ConnectionRegistry.h"
+#include "kNet/MessageConnection.h"
+
+namespace kNet
+{
+
+MessageConnection *ConnectionRegistry::Snapshot::Find(const EndPoint &endPoint) const
+{
+	size_t first = 0;
+	size_t last = entries.size();
+	while(first < last)
+	{
+		const size_t mid = first + (last - first) / 2;
+		if (entries[mid].endPoint < endPoint)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+	if (first < entries.size() && entries[first].endPoint == endPoint)
+		return entries[first].connection.ptr();
+	return 0;
+}
+
+int ConnectionRegistry::Snapshot::IndexOf(const MessageConnection *connection) const
+{
+	for(size_t i = 0; i < entries.size(); ++i)
+		if (entries[i].connection.ptr() == connection)
+			return (int)i;
+	return -1;
+}
+
+ConnectionRegistry::ReadGuard::ReadGuard(const ConnectionRegistry &registry_)
+:registry(registry_)
+{
+	// Count this reader in the current epoch. If the epoch advanced meanwhile, the writer may not have seen the
+	// increment, so count again in the new epoch.
+	for(;;)
+	{
+		const u64 e = registry.epoch.load();
+		readerSlot = (int)(e & 1);
+		registry.numReaders[readerSlot].fetch_add(1);
+		if (registry.epoch.load() == e)
+			break;
+		registry.numReaders[readerSlot].fetch_sub(1);
+	}
+	snapshot = registry.current.load();
+}
+
+ConnectionRegistry::ReadGuard::~ReadGuard()
+{
+	registry.numReaders[readerSlot].fetch_sub(1, std::memory_order_release);
+}
+
+ConnectionRegistry::ConnectionRegistry()
+:current(new Snapshot), epoch(2), numRetired(0)
+{
+	numReaders[0].store(0);
+	numReaders[1].store(0);
+	retired.SetContentionName("ConnectionRegistry::retired");
+}
+
+ConnectionRegistry::~ConnectionRegistry()
+{
+	// No readers are left when the owner is destroyed.
+	std::vector<Snapshot*> &retiredSnapshots = retired.UnsafeGetValue();
+	for(size_t i = 0; i < retiredSnapshots.size(); ++i)
+		delete retiredSnapshots[i];
+	retiredSnapshots.clear();
+	delete current.load();
+}
+
+void ConnectionRegistry::Insert(const EndPoint &endPoint, const Ptr(MessageConnection) &connection)
+{
+	Lock<std::vector<Snapshot*> > lock = retired.Acquire();
+	const Snapshot *old = current.load();
+	Snapshot *snapshot = new Snapshot;
+	snapshot->entries.reserve(old->entries.size() + 1);
+
+	Snapshot::Entry entry;
+	entry.endPoint = endPoint;
+	entry.connection = connection;
+	std::vector<Snapshot::Entry>::const_iterator pos = std::lower_bound(old->entries.begin(), old->entries.end(), entry);
+	snapshot->entries.insert(snapshot->entries.end(), old->entries.begin(), pos);
+	snapshot->entries.push_back(entry);
+	if (pos != old->entries.end() && pos->endPoint == endPoint)
+		++pos; // Replaced.
+	snapshot->entries.insert(snapshot->entries.end(), pos, old->entries.end());
+	Publish(snapshot, *lock);
+}
+
+bool ConnectionRegistry::Remove(MessageConnection *connection)
+{
+	return Remove(std::vector<MessageConnection*>(1, connection)) > 0;
+}
+
+size_t ConnectionRegistry::Remove(const std::vector<MessageConnection*> &connections)
+{
+	if (connections.empty())
+		return 0;
+	std::vector<MessageConnection*> sorted(connections);
+	std::sort(sorted.begin(), sorted.end());
+
+	Lock<std::vector<Snapshot*> > lock = retired.Acquire();
+	const Snapshot *old = current.load();
+	Snapshot *snapshot = new Snapshot;
+	snapshot->entries.reserve(old->entries.size());
+	for(size_t i = 0; i < old->entries.size(); ++i)
+		if (!std::binary_search(sorted.begin(), sorted.end(), old->entries[i].connection.ptr()))
+			snapshot->entries.push_back(old->entries[i]);
+	const size_t numRemoved = old->entries.size() - snapshot->entries.size();
+	if (numRemoved == 0)
+		delete snapshot; // None of them were in the registry.
+	else
+		Publish(snapshot, *lock);
+	return numRemoved;
+}
+
+bool ConnectionRegistry::Move(MessageConnection *connection, const EndPoint &oldEndPoint, const EndPoint &newEndPoint)
+{
+	Lock<std::vector<Snapshot*> > lock = retired.Acquire();
+	const Snapshot *old = current.load();
+	if (old->Find(oldEndPoint) != connection)
+		return false; // The connection was closed or moved meanwhile.
+
+	Snapshot *snapshot = new Snapshot;
+	snapshot->entries.reserve(old->entries.size());
+	Snapshot::Entry moved;
+	for(size_t i = 0; i < old->entries.size(); ++i)
+		if (old->entries[i].endPoint == oldEndPoint)
+			moved = old->entries[i];
+		else if (old->entries[i].endPoint != newEndPoint)
+			snapshot->entries.push_back(old->entries[i]);
+	moved.endPoint = newEndPoint;
+	snapshot->entries.insert(std::lower_bound(snapshot->entries.begin(), snapshot->entries.end(), moved), moved);
+	Publish(snapshot, *lock);
+	return true;
+}
+
+void ConnectionRegistry::Reclaim()
+{
+	if (numRetired.load(std::memory_order_relaxed) == 0)
+		return;
+	Lock<std::vector<Snapshot*> > lock = retired.Acquire();
+	ReclaimLocked(*lock);
+}
+
+void ConnectionRegistry::Publish(Snapshot *snapshot, std::vector<Snapshot*> &retiredSnapshots)
+{
+	Snapshot *old = const_cast<Snapshot*>(current.exchange(snapshot));
+	// The readers that may see the old snapshot entered in this epoch at the latest.
+	old->retireEpoch = epoch.load();
+	retiredSnapshots.push_back(old);
+	numRetired.fetch_add(1, std::memory_order_relaxed);
+	ReclaimLocked(retiredSnapshots);
+}
+
+void ConnectionRegistry::ReclaimLocked(std::vector<Snapshot*> &retiredSnapshots)
+{
+	// Entering epoch e+1 needs the readers of epoch e-1, which share its counter, to have left. The readers
+	// of epoch e+1 see only the snapshots published before the epoch advanced.
+	for(int i = 0; i < 2; ++i)
+	{
+		const u64 e = epoch.load();
+		if (numReaders[(e + 1) & 1].load() != 0)
+			break;
+		epoch.store(e + 1);
+	}
+
+	// A snapshot retired in epoch r is read only by readers of epochs r and earlier, and those have all left once
+	// the epoch reaches r+2.
+	const u64 e = epoch.load();
+	size_t numKept = 0;
+	for(size_t i = 0; i < retiredSnapshots.size(); ++i)
+		if (retiredSnapshots[i]->retireEpoch + 2 <= e)
+			delete retiredSnapshots[i];
+		else
+			retiredSnapshots[numKept++] = retiredSnapshots[i];
+	numRetired.fetch_sub((int)(retiredSnapshots.size() - numKept), std::memory_order_relaxed);
+	retiredSnapshots.resize(numKept);
+}
+
+} // ~kNet
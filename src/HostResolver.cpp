@@ -0,0 +1,201 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file HostResolver.cpp
+	@brief */
+
+#include <cstring>
+
+#ifdef WIN32
+#include "kNet/win32/WS2Include.h"
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#endif
+
+#include "kNet/DebugMemoryLeakCheck.h"
+
+#include "kNet/HostResolver.h"
+#include "kNet/NetworkLogging.h"
+
+namespace kNet
+{
+
+/// How often the idle resolver threads check whether they should quit.
+static const int cQuitPollMSecs = 100;
+
+HostResolver::HostResolver(int numThreads_)
+:numThreads(numThreads_ > 0 ? numThreads_ : 1), quit(false), numPending(0)
+{
+	queue.SetContentionName("HostResolver::queue");
+	queueEvent = CreateNewEvent(EventWaitSignal);
+}
+
+HostResolver::~HostResolver()
+{
+	quit = true;
+	queueEvent.Set();
+	for(size_t i = 0; i < threads.size(); ++i)
+	{
+		threads[i]->Stop();
+		delete threads[i];
+	}
+	threads.clear();
+
+	// The requests that never got to a thread are still owned by the resolver or their requesters.
+	Lock<std::deque<Request*> > requests = queue.Acquire();
+	for(size_t i = 0; i < requests->size(); ++i)
+		Complete((*requests)[i], RequestFailed);
+	requests->clear();
+	requests.Unlock();
+	queueEvent.Close();
+}
+
+HostResolver::Request *HostResolver::Resolve(const char *hostName)
+{
+	Request *request = new Request;
+	request->hostName = hostName ? hostName : "";
+	request->state = RequestResolving;
+
+	// Numeric addresses need no lookup.
+	in_addr numeric;
+	numeric.s_addr = inet_addr(request->hostName.c_str());
+	if (numeric.s_addr != INADDR_NONE || request->hostName == "255.255.255.255")
+	{
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_addr = numeric;
+		request->address = EndPoint::FromSockAddrIn(addr);
+		request->state = RequestResolved;
+		return request;
+	}
+
+	if (LookupCache(*request))
+		return request;
+
+	Lock<std::deque<Request*> > requests = queue.Acquire();
+	if (threads.empty())
+		StartThreads();
+	requests->push_back(request);
+	numPending.fetch_add(1, std::memory_order_relaxed);
+	queueEvent.Set();
+	return request;
+}
+
+void HostResolver::Release(Request *request)
+{
+	if (!request)
+		return;
+	int expected = RequestResolving;
+	if (request->state.compare_exchange_strong(expected, RequestReleased, std::memory_order_acq_rel))
+		return; // The resolver thread frees the request when the lookup finishes.
+	delete request;
+}
+
+void HostResolver::Complete(Request *request, RequestState state)
+{
+	int expected = RequestResolving;
+	if (!request->state.compare_exchange_strong(expected, state, std::memory_order_acq_rel))
+		delete request; // Released by the requester while the lookup was running.
+}
+
+void HostResolver::ClearCache()
+{
+	cache.Acquire()->clear();
+}
+
+bool HostResolver::LookupCache(Request &request)
+{
+	Lock<std::map<std::string, CacheEntry> > entries = cache.Acquire();
+	std::map<std::string, CacheEntry>::iterator iter = entries->find(request.hostName);
+	if (iter == entries->end())
+		return false;
+	if (Clock::IsNewer(Clock::Tick(), iter->second.expiryTick))
+	{
+		entries->erase(iter);
+		return false;
+	}
+	request.address = iter->second.address;
+	request.state = iter->second.failed ? RequestFailed : RequestResolved;
+	return true;
+}
+
+void HostResolver::StoreCache(const std::string &hostName, const EndPoint &address, bool failed)
+{
+	CacheEntry entry;
+	entry.address = address;
+	entry.failed = failed;
+	const int cacheMSecs = failed ? cFailedCacheMSecs : cCacheMSecs;
+	entry.expiryTick = Clock::Tick() + (tick_t)cacheMSecs * Clock::TicksPerMillisecond();
+	(*cache.Acquire())[hostName] = entry;
+}
+
+void HostResolver::StartThreads()
+{
+	for(int i = 0; i < numThreads; ++i)
+	{
+		Thread *thread = new Thread();
+		threads.push_back(thread);
+		thread->Run(this, &HostResolver::ResolverLoop);
+		thread->SetName("kNet HostResolver");
+	}
+}
+
+void HostResolver::ResolverLoop()
+{
+	while(!quit)
+	{
+		if (!queueEvent.Wait(cQuitPollMSecs))
+			continue;
+
+		Lock<std::deque<Request*> > requests = queue.Acquire();
+		if (requests->empty())
+		{
+			queueEvent.Reset();
+			continue;
+		}
+		Request *request = requests->front();
+		requests->pop_front();
+		if (requests->empty())
+			queueEvent.Reset();
+		requests.Unlock();
+
+		// The requester may have given up while the request was queued. Resolve it anyway, the result is cached.
+		addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		addrinfo *result = 0;
+		int ret = getaddrinfo(request->hostName.c_str(), 0, &hints, &result);
+		RequestState state = RequestFailed;
+		if (ret == 0 && result && result->ai_family == AF_INET)
+		{
+			request->address = EndPoint::FromSockAddrIn(*(const sockaddr_in*)result->ai_addr);
+			request->address.port = 0;
+			state = RequestResolved;
+		}
+		else
+			LOG(LogError, "HostResolver: Failed to resolve host name \"%s\": %s", request->hostName.c_str(), gai_strerror(ret));
+		if (result)
+			freeaddrinfo(result);
+
+		StoreCache(request->hostName, request->address, state != RequestResolved);
+		numPending.fetch_sub(1, std::memory_order_relaxed);
+		Complete(request, state);
+	}
+}
+
+} // ~kNet
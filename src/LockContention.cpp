@@ -0,0 +1,85 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file LockContention.cpp
+	@brief Implements the registry of named lock contention counters. */
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "kNet/DebugMemoryLeakCheck.h"
+
+#include "kNet/LockContention.h"
+#include "kNet/Lockable.h"
+
+namespace kNet
+{
+
+namespace
+{
+
+typedef std::map<std::string, LockContentionCounters*> LockContentionMap;
+
+/// The registry is never freed, since Lockables owned by static objects may still be locked after the static
+/// destructors of this file have run.
+Lockable<LockContentionMap> &Registry()
+{
+	static Lockable<LockContentionMap> *registry = new Lockable<LockContentionMap>();
+	return *registry;
+}
+
+} // ~unnamed namespace
+
+LockContentionCounters *RegisterLockContention(const char *name)
+{
+	Lock<LockContentionMap> counters = Registry().Acquire();
+	LockContentionCounters *&c = (*counters)[name ? name : ""];
+	if (!c)
+		c = new LockContentionCounters();
+	return c;
+}
+
+void ReadLockContention(std::vector<LockContentionSample> &out)
+{
+	out.clear();
+	const double msecsPerTick = 1000.0 / (double)Clock::TicksPerSec();
+	Lock<LockContentionMap> counters = Registry().Acquire();
+	for(LockContentionMap::const_iterator iter = counters->begin(); iter != counters->end(); ++iter)
+	{
+		const LockContentionCounters &c = *iter->second;
+		LockContentionSample s;
+		s.name = iter->first;
+		s.acquisitions = c.acquisitions.load(std::memory_order_relaxed);
+		s.contendedAcquisitions = c.contendedAcquisitions.load(std::memory_order_relaxed);
+		s.totalWaitMSecs = c.waitTicks.load(std::memory_order_relaxed) * msecsPerTick;
+		s.maxWaitMSecs = c.maxWaitTicks.load(std::memory_order_relaxed) * msecsPerTick;
+		out.push_back(s);
+	}
+}
+
+void ResetLockContention()
+{
+	Lock<LockContentionMap> counters = Registry().Acquire();
+	for(LockContentionMap::iterator iter = counters->begin(); iter != counters->end(); ++iter)
+	{
+		LockContentionCounters &c = *iter->second;
+		c.acquisitions.store(0, std::memory_order_relaxed);
+		c.contendedAcquisitions.store(0, std::memory_order_relaxed);
+		c.waitTicks.store(0, std::memory_order_relaxed);
+		c.maxWaitTicks.store(0, std::memory_order_relaxed);
+	}
+}
+
+} // ~kNet
@@ -18,6 +18,14 @@
 #include <algorithm>
 #include <iostream>
 #include <cassert>
+#include <cstring>
+
+#if defined(__unix) || defined(ANDROID) || defined(__APPLE__)
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
 
 #ifdef KNET_USE_BOOST
 #include <boost/thread/thread.hpp>
@@ -39,6 +47,7 @@
 #include "kNet/NetworkServer.h"
 #include "kNet/Clock.h"
 #include "kNet/NetworkWorkerThread.h"
+#include "kNet/Trace.h"
 
 using namespace std;
 
@@ -57,6 +66,54 @@ namespace
 	const float cConnectTimeOutMSecs = 15 * 1000.f; ///< \todo Actually use this time limit.
 
 	const float cDisconnectTimeOutMSecs = 5 * 1000.f; ///< \todo Actually use this time limit.
+
+	/// The time without any application messages in either direction after which a connection hibernates.
+	const float cHibernateAfterIdleMSecs = 10 * 1000.f;
+
+	/// Returns the time between the two ticks in microseconds, saturated to the range of u32.
+	u32 TicksToMicroseconds(kNet::tick_t oldTick, kNet::tick_t newTick)
+	{
+		if (kNet::Clock::IsNewer(oldTick, newTick) && oldTick != newTick)
+			return 0;
+		const double usecs = kNet::Clock::TimespanToMillisecondsD(oldTick, newTick) * 1000.0;
+		return usecs < 4294967295.0 ? (u32)usecs : 0xFFFFFFFF;
+	}
+
+	/// The maximum number of outbound message events kept for reuse.
+	const size_t cMaxFreeOutboundEvents = 256;
+
+	/// The outbound message events of deleted connections. Creating an event takes a few system calls (a pipe on Unix),
+	/// so reusing them makes connection churn cheaper. Never freed, since connections owned by static objects may still
+	/// be deleted after the static destructors of this file have run.
+	kNet::Lockable<std::vector<kNet::Event> > &FreeOutboundEvents()
+	{
+		static kNet::Lockable<std::vector<kNet::Event> > *events = new kNet::Lockable<std::vector<kNet::Event> >();
+		return *events;
+	}
+
+	kNet::Event AcquireOutboundEvent()
+	{
+		kNet::Lock<std::vector<kNet::Event> > events = FreeOutboundEvents().Acquire();
+		if (events->empty())
+		{
+			events.Unlock();
+			return kNet::CreateNewEvent(kNet::EventWaitSignal);
+		}
+		kNet::Event event = events->back();
+		events->pop_back();
+		return event;
+	}
+
+	void ReleaseOutboundEvent(kNet::Event &event)
+	{
+		event.Reset();
+		kNet::Lock<std::vector<kNet::Event> > events = FreeOutboundEvents().Acquire();
+		if (events->size() < cMaxFreeOutboundEvents)
+			events->push_back(event);
+		else
+			event.Close();
+		event = kNet::Event();
+	}
 }
 
 namespace kNet
@@ -87,9 +144,8 @@ std::string ConnectionStateToString(ConnectionState state)
 
 MessageConnection::MessageConnection(Network *owner_, NetworkServer *ownerServer_, Socket *socket_, ConnectionState startingState)
 :owner(owner_), ownerServer(ownerServer_), inboundMessageHandler(0), socket(socket_), 
-bOutboundSendsPaused(false),
-outboundAcceptQueue(16*1024), inboundMessageQueue(16*1024), 
-rtt(0.f), packetsInPerSec(0), packetsOutPerSec(0), 
+spareSocket(0), connectAttempt(0), connectTimeoutTick(0), closeTimeoutTick(0), bOutboundSendsPaused(false),
+rtt(0.f), rttFromPacketAcks(false), packetsInPerSec(0), packetsOutPerSec(0), 
 msgsInPerSec(0), msgsOutPerSec(0), bytesInPerSec(0), bytesOutPerSec(0),
 lastHeardTime(Clock::Tick()), outboundMessageNumberCounter(0), outboundReliableMessageNumberCounter(0),
 #ifdef KNET_NO_MAXHEAP
@@ -102,9 +158,14 @@ bytesInTotal(0), bytesOutTotal(0)
 #endif
 {
 	connectionState = startingState;
+	KNET_TRACE(TraceConnectionState, this, connectionState, 0);
+	statistics.SetContentionName("MessageConnection::statistics");
+	fragmentedSends.SetContentionName("MessageConnection::fragmentedSends");
 	networkSendSimulator.owner = this;
+	hibernating = false;
+	lastMessageActivityTime = Clock::Tick();
 
-	eventMsgsOutAvailable = CreateNewEvent(EventWaitSignal);
+	eventMsgsOutAvailable = AcquireOutboundEvent();
 	assert(eventMsgsOutAvailable.IsValid());
 }
 
@@ -120,8 +181,9 @@ MessageConnection::~MessageConnection()
 	assert(ownerServer == 0);
 	assert(workerThread == 0);
 
+	FreeConnectAttempt();
 	FreeMessageData();
-	eventMsgsOutAvailable.Close();
+	ReleaseOutboundEvent(eventMsgsOutAvailable);
 }
 
 ConnectionState MessageConnection::GetConnectionState() const
@@ -133,11 +195,14 @@ ConnectionState MessageConnection::GetConnectionState() const
 	// the connection is closed though.
 	if (connectionState == ConnectionPending)
 		return ConnectionPending;
-	if (!socket->IsReadOpen() && !socket->IsWriteOpen())
+	// A connection that has timed out is closed, even though its socket is still open.
+	if (connectionState == ConnectionClosed)
 		return ConnectionClosed;
-	if (!socket->IsReadOpen())
+	if (!GetSocket()->IsReadOpen() && !GetSocket()->IsWriteOpen())
+		return ConnectionClosed;
+	if (!GetSocket()->IsReadOpen())
 		return ConnectionPeerClosed;
-	if (!socket->IsWriteOpen())
+	if (!GetSocket()->IsWriteOpen())
 		return ConnectionDisconnecting;
 
 	return connectionState;
@@ -147,16 +212,18 @@ bool MessageConnection::IsReadOpen() const
 {
 	if (NumInboundMessagesPending() > 0) // We are always read-open if there are any messages pending to be read.
 		return true;
-	if (socket && socket->IsOverlappedReceiveReady()) // If the socket is physically open, we are read-open.
+	if (socket && GetSocket()->IsOverlappedReceiveReady()) // If the socket is physically open, we are read-open.
 		return true;
-	if (!socket || connectionState == ConnectionPeerClosed || connectionState == ConnectionClosed) // Check against the main connectionState variable.
+	// Check against the socket as well, so that a TCP peer close shows up at once, not only when the worker thread next updates connectionState.
+	const ConnectionState state = GetConnectionState();
+	if (state == ConnectionPeerClosed || state == ConnectionClosed)
 		return false;
 	return true;
 }
 
 bool MessageConnection::IsWriteOpen() const
 { 
-	return socket && socket->IsWriteOpen() && 
+	return socket && GetSocket()->IsWriteOpen() && 
 		GetConnectionState() != ConnectionDisconnecting && GetConnectionState() != ConnectionClosed;
 }
 
@@ -203,15 +270,15 @@ void MessageConnection::Disconnect(int maxMSecsToWait)
 {
 	AssertInMainThreadContext();
 
-	if (!socket || !socket->IsWriteOpen())
+	if (!socket || !GetSocket()->IsWriteOpen())
 		return;
 
 	if (connectionState == ConnectionClosed || connectionState == ConnectionDisconnecting)
 		return;
 
 	LOG(LogInfo, "MessageConnection::Disconnect(%d msecs): Write-closing connection. connectionState = %s, socket readOpen:%s, socket writeOpen:%s.", 
-		maxMSecsToWait, ConnectionStateToString(connectionState).c_str(), socket->IsReadOpen() ? "true":"false",
-		socket->IsWriteOpen() ? "true":"false");
+		maxMSecsToWait, ConnectionStateToString(connectionState).c_str(), GetSocket()->IsReadOpen() ? "true":"false",
+		GetSocket()->IsWriteOpen() ? "true":"false");
 	assert(maxMSecsToWait >= 0);
 
 	PerformDisconnection();
@@ -219,7 +286,7 @@ void MessageConnection::Disconnect(int maxMSecsToWait)
 	if (maxMSecsToWait > 0)
 	{
 		PolledTimer timer((float)maxMSecsToWait);
-		while(socket && socket->IsWriteOpen() && !timer.Test())
+		while(socket && GetSocket()->IsWriteOpen() && !timer.Test())
 		{
 			Clock::Sleep(1); ///\todo Instead of waiting multiple 1msec slices, should wait for proper event.
 		}
@@ -236,14 +303,16 @@ void MessageConnection::Close(int maxMSecsToWait) // [main thread]
 {
 	AssertInMainThreadContext();
 
-	if (maxMSecsToWait > 0 && socket && socket->IsWriteOpen())
+	if (maxMSecsToWait > 0 && socket && GetSocket()->IsWriteOpen())
 	{
 		Disconnect(maxMSecsToWait);
 		LOG(LogInfo, "MessageConnection::Close(%d msecs): Disconnecting. connectionState = %s, readOpen:%s, writeOpen:%s.", 
-			maxMSecsToWait, ConnectionStateToString(connectionState).c_str(), (socket && socket->IsReadOpen()) ? "true":"false",
-			(socket && socket->IsWriteOpen()) ? "true":"false");
+			maxMSecsToWait, ConnectionStateToString(connectionState).c_str(), (socket && GetSocket()->IsReadOpen()) ? "true":"false",
+			(socket && GetSocket()->IsWriteOpen()) ? "true":"false");
 	}
 
+	FinishCloseAsync();
+
 	if (owner)
 	{
 		LOG(LogInfo, "MessageConnection::Close: Closed connection to %s.", ToString().c_str());
@@ -255,12 +324,13 @@ void MessageConnection::Close(int maxMSecsToWait) // [main thread]
 
 	if (socket)
 	{
-		socket->Close();
+		GetSocket()->Close();
 		assert(!IsWorkerThreadRunning());
 		socket = 0; // Worker thread assumes access to the socket pointer, so can't have the thread running any more when we are doing this.
 	}
 
 	connectionState = ConnectionClosed;
+	KNET_TRACE(TraceConnectionState, this, connectionState, 0);
 
 	if (outboundAcceptQueue.Size() > 0)
 		LOG(LogVerbose, "MessageConnection::Close(): Had %d messages in outboundAcceptQueue!", (int)outboundAcceptQueue.Size());
@@ -280,6 +350,36 @@ void MessageConnection::Close(int maxMSecsToWait) // [main thread]
 	FreeMessageData();
 }
 
+void MessageConnection::CloseAsync(int maxMSecsToWait) // [main thread]
+{
+	AssertInMainThreadContext();
+	assert(maxMSecsToWait >= 0);
+
+	if (!socket || IsClosingAsync())
+		return;
+
+	ConnectionState state = GetConnectionState();
+	if (state == ConnectionPending || connectAttempt)
+	{
+		Close(0);
+		return;
+	}
+	if (state == ConnectionClosed)
+		return; // Already closed, only waits to be reaped.
+
+	if (ownerServer)
+		ownerServer->ClientCloseStarted();
+	// The tick is never zero, since zero means that no close is in progress.
+	closeTimeoutTick.store(max<tick_t>(1, Clock::Tick() + (tick_t)maxMSecsToWait * Clock::TicksPerMillisecond()), std::memory_order_release);
+	Disconnect(0);
+}
+
+void MessageConnection::FinishCloseAsync() // [main and worker thread]
+{
+	if (closeTimeoutTick.exchange(0, std::memory_order_acq_rel) != 0 && ownerServer)
+		ownerServer->ClientCloseFinished();
+}
+
 void MessageConnection::PauseOutboundSends()
 {
 	AssertInMainThreadContext();
@@ -297,6 +397,34 @@ void MessageConnection::ResumeOutboundSends()
 		eventMsgsOutAvailable.Set();
 }
 
+#ifdef KNET_NETWORK_PROFILING
+StatsMetricId MessageConnection::OutboundMessageMetric(const NetworkMessage &msg)
+{
+	if (msg.profilerMetric != cInvalidStatsMetric)
+		return msg.profilerMetric;
+	static StatsMetricFamily messageOutMetrics("messageOut.%u", "bytes");
+	return messageOutMetrics.Get((u32)msg.id);
+}
+
+StatsMetricId MessageConnection::FragmentMetric(StatsMetricId messageMetric)
+{
+	if (messageMetric < 0 || messageMetric >= cMaxStatsMetrics)
+		return cInvalidStatsMetric;
+
+	// Indexed by the metric of the whole message. Zero means not registered yet, the others hold the metric id plus one.
+	// Two threads registering the same name get the same id, so the race is harmless.
+	static std::atomic<StatsMetricId> fragmentMetrics[cMaxStatsMetrics];
+	const StatsMetricId cached = fragmentMetrics[messageMetric].load(std::memory_order_relaxed);
+	if (cached != 0)
+		return cached - 1;
+
+	const StatsMetricId id = RegisterStatsMetric((std::string(StatsMetricName(messageMetric)) + "_Fragment").c_str(), "bytes");
+	if (id != cInvalidStatsMetric)
+		fragmentMetrics[messageMetric].store(id + 1, std::memory_order_relaxed);
+	return id;
+}
+#endif
+
 void MessageConnection::SetPeerClosed()
 {
 	AssertInWorkerThreadContext();
@@ -321,6 +449,7 @@ void MessageConnection::SetPeerClosed()
 		assert(false);
 		break;
 	}
+	KNET_TRACE(TraceConnectionState, this, connectionState, 0);
 }
 
 void MessageConnection::FreeMessageData() // [main thread]
@@ -361,7 +490,7 @@ void MessageConnection::FreeMessageData() // [main thread]
 	Lockable<ConnectionStatistics>::LockType stats_ = statistics.Acquire();
 	stats_->ping.clear();
 	stats_->recvPacketIDs.clear();
-	stats_->traffic.clear();
+	trafficStats.Clear();
 
 	networkSendSimulator.Free();
 }
@@ -379,6 +508,7 @@ void MessageConnection::DetectConnectionTimeOut()
 		LOG(LogInfo, "It's been %.2fms since last heard from other end. connectionLostTimeout=%.2fms, so closing connection.",
 			lastHeardSince, connectionLostTimeout);
 		connectionState = ConnectionClosed;
+		KNET_TRACE(TraceConnectionState, this, connectionState, 0);
 	}
 }
 
@@ -406,24 +536,173 @@ void MessageConnection::AcceptOutboundMessages() // [worker thread]
 	// at each execution frame.
 	int numMessagesToAcceptPerFrame = 500;
 
-	// Empty the queue from messages that the main thread has submitted for sending.
-	while(outboundAcceptQueue.Size() > 0 && --numMessagesToAcceptPerFrame > 0)
+	// Empty the queue from messages that the main thread has submitted for sending. The messages are taken off
+	// in batches so that the slots are handed back to the main thread with a single index update per batch.
+	const int cBatchSize = 64;
+	NetworkMessage *batch[cBatchSize];
+	while(numMessagesToAcceptPerFrame > 0)
 	{
-		assert(outboundAcceptQueue.Front() != 0);
-		NetworkMessage *msg = *outboundAcceptQueue.Front();
-		outboundAcceptQueue.PopFront();
+		int numPopped = outboundAcceptQueue.PopFrontBatch(batch, std::min(cBatchSize, numMessagesToAcceptPerFrame));
+		if (numPopped == 0)
+			break;
+		numMessagesToAcceptPerFrame -= numPopped;
+		lastMessageActivityTime = Clock::LoopTick();
+		if (hibernating)
+			WakeUp();
 
+		for(int i = 0; i < numPopped; ++i)
+		{
+			NetworkMessage *msg = batch[i];
+			assert(msg != 0);
+			KNET_TRACE(TraceMessageAccepted, this, msg->messageNumber, msg->id);
 #ifdef KNET_NO_MAXHEAP
-		outboundQueue.InsertWithResize(msg);
+			outboundQueue.InsertWithResize(msg);
 #else
-		outboundQueue.Insert(msg);
+			outboundQueue.Insert(msg);
 #endif
-		CheckAndSaveOutboundMessageWithContentID(msg);
+			CheckAndSaveOutboundMessageWithContentID(msg);
+		}
 	}
 //	assert(ContainerUniqueAndNoNullElements(outboundQueue));
 //	assert(ContainerUniqueAndNoNullElements(outboundAcceptQueue));
 }
 
+void MessageConnection::FreeConnectAttempt()
+{
+	ConnectAttempt *attempt = connectAttempt.exchange(0);
+	if (!attempt)
+		return;
+	HostResolver::Release(attempt->resolve);
+	if (attempt->socket != INVALID_SOCKET)
+		closesocket(attempt->socket);
+	delete attempt;
+}
+
+void MessageConnection::UpdateConnectAttempt() // [Called from the worker thread]
+{
+	AssertInWorkerThreadContext();
+
+	ConnectAttempt &attempt = *connectAttempt;
+	if (connectionState != ConnectionPending) // The application closed the connection while it was connecting.
+	{
+		FreeConnectAttempt();
+		return;
+	}
+	if (Clock::IsNewer(Clock::LoopTick(), connectTimeoutTick))
+	{
+		LOG(LogError, "MessageConnection::UpdateConnectAttempt: Connecting to %s:%d timed out.", attempt.resolve->hostName.c_str(), (int)attempt.port);
+		FreeConnectAttempt();
+		connectionState = ConnectionClosed;
+		KNET_TRACE(TraceConnectionState, this, connectionState, 0);
+		return;
+	}
+
+	const SocketTransportLayer transport = GetSocket()->TransportLayer();
+	if (attempt.socket == INVALID_SOCKET)
+	{
+		switch(attempt.resolve->State())
+		{
+		case HostResolver::RequestResolving:
+			return;
+		case HostResolver::RequestResolved:
+			break;
+		default:
+			LOG(LogError, "MessageConnection::UpdateConnectAttempt: Cannot connect to %s, the name does not resolve.", attempt.resolve->hostName.c_str());
+			FreeConnectAttempt();
+			connectionState = ConnectionClosed;
+			KNET_TRACE(TraceConnectionState, this, connectionState, 0);
+			return;
+		}
+
+		attempt.socket = ::socket(AF_INET, (transport == SocketOverTCP) ? SOCK_STREAM : SOCK_DGRAM, (transport == SocketOverTCP) ? IPPROTO_TCP : IPPROTO_UDP);
+		if (attempt.socket == (SOCKET)KNET_SOCKET_ERROR)
+			attempt.socket = INVALID_SOCKET;
+		bool started = (attempt.socket != INVALID_SOCKET);
+		if (started)
+		{
+#ifdef WIN32
+			u_long nonBlocking = 1;
+			started = (ioctlsocket(attempt.socket, FIONBIO, &nonBlocking) == 0);
+#else
+			int flags = fcntl(attempt.socket, F_GETFL, 0);
+			started = (flags != -1 && fcntl(attempt.socket, F_SETFL, flags | O_NONBLOCK) != -1);
+#endif
+		}
+		if (started)
+		{
+			EndPoint remote = attempt.resolve->address;
+			remote.port = attempt.port;
+			sockaddr_in addr = remote.ToSockAddrIn();
+			if (connect(attempt.socket, (sockaddr*)&addr, sizeof(addr)) == KNET_SOCKET_ERROR)
+			{
+				int error = Network::GetLastError();
+#ifdef WIN32
+				started = (error == WSAEWOULDBLOCK);
+#else
+				started = (error == EINPROGRESS);
+#endif
+			}
+		}
+		if (!started)
+		{
+			LOG(LogError, "MessageConnection::UpdateConnectAttempt: Connecting to %s:%d failed: %s", attempt.resolve->hostName.c_str(), (int)attempt.port,
+				Network::GetLastErrorString().c_str());
+			FreeConnectAttempt();
+			connectionState = ConnectionClosed;
+			KNET_TRACE(TraceConnectionState, this, connectionState, 0);
+			return;
+		}
+	}
+
+	// The non-blocking connect has finished when the socket becomes writable. A mass connect goes past FD_SETSIZE
+	// descriptors, so poll() the socket instead of select()ing it.
+#ifdef WIN32
+	fd_set writeFds;
+	FD_ZERO(&writeFds);
+	FD_SET(attempt.socket, &writeFds);
+	timeval noWait;
+	noWait.tv_sec = 0;
+	noWait.tv_usec = 0;
+	if (select((int)attempt.socket + 1, NULL, &writeFds, NULL, &noWait) <= 0)
+		return;
+#else
+	pollfd writePoll;
+	writePoll.fd = attempt.socket;
+	writePoll.events = POLLOUT;
+	writePoll.revents = 0;
+	if (poll(&writePoll, 1, 0) <= 0)
+		return;
+#endif
+
+	int error = 0;
+	socklen_t errorLen = sizeof(error);
+	if (getsockopt(attempt.socket, SOL_SOCKET, SO_ERROR, (char*)&error, &errorLen) != 0 || error != 0)
+	{
+		LOG(LogError, "MessageConnection::UpdateConnectAttempt: Connecting to %s:%d failed: %s", attempt.resolve->hostName.c_str(), (int)attempt.port,
+			Network::GetErrorString(error).c_str());
+		FreeConnectAttempt();
+		connectionState = ConnectionClosed;
+		KNET_TRACE(TraceConnectionState, this, connectionState, 0);
+		return;
+	}
+
+	// The application may be reading the placeholder Socket, so fill in the spare one and then publish it in its place.
+	// The placeholder stays allocated until the connection is closed.
+	*spareSocket = Network::CreateConnectedSocket(attempt.socket, transport, attempt.localHostName.c_str());
+	attempt.socket = INVALID_SOCKET; // Now owned by the Socket.
+	spareSocket = socket.exchange(spareSocket, std::memory_order_acq_rel);
+	// A UDP connection stays pending until the server answers the Connection Start datagrams it now starts sending.
+	if (transport == SocketOverUDP)
+		LOG(LogInfo, "MessageConnection::UpdateConnectAttempt: Connected a UDP socket to %s.", GetSocket()->ToString().c_str());
+	else
+	{
+		LOG(LogInfo, "MessageConnection::UpdateConnectAttempt: Connected a TCP socket to %s.", GetSocket()->ToString().c_str());
+		connectionState = ConnectionOK;
+		KNET_TRACE(TraceConnectionState, this, connectionState, 0);
+	}
+	FreeConnectAttempt();
+}
+
 void MessageConnection::UpdateConnection() // [Called from the worker thread]
 {
 	AssertInWorkerThreadContext();
@@ -431,19 +710,54 @@ void MessageConnection::UpdateConnection() // [Called from the worker thread]
 	if (!socket)
 		return;
 
+	if (connectionState == ConnectionPending && connectTimeoutTick != 0 && Clock::IsNewer(Clock::LoopTick(), connectTimeoutTick))
+	{
+		LOG(LogError, "MessageConnection::UpdateConnection: Connection to %s timed out.", ToString().c_str());
+		connectionState = ConnectionClosed;
+		KNET_TRACE(TraceConnectionState, this, connectionState, 0);
+		return;
+	}
+
+	// A CloseAsync() ends when the peer has closed its end as well, or when the time given to it runs out.
+	const tick_t closeTimeout = closeTimeoutTick.load(std::memory_order_acquire);
+	if (closeTimeout != 0 && (GetConnectionState() == ConnectionClosed || Clock::IsNewer(Clock::LoopTick(), closeTimeout)))
+	{
+		if (GetConnectionState() != ConnectionClosed)
+			LOG(LogInfo, "MessageConnection::UpdateConnection: Closing the connection to %s, the peer did not close its end in time.", ToString().c_str());
+		connectionState = ConnectionClosed;
+		KNET_TRACE(TraceConnectionState, this, connectionState, 0);
+		FinishCloseAsync();
+		return;
+	}
+
 	AcceptOutboundMessages();
 
-	networkSendSimulator.Process();
+	if (hibernating && connectionState != ConnectionOK)
+		WakeUp();
 
 	// MessageConnection needs to automatically manage the sending of ping messages in an unreliable channel.
+	// This is kept up also while hibernating, so that neither end times out the connection.
 	if (connectionState == ConnectionOK && pingTimer.TriggeredOrNotRunning())
 	{
 		if (!bOutboundSendsPaused)
 			SendPingRequestMessage(true);
 		DetectConnectionTimeOut();
 		pingTimer.StartMSecs(pingIntervalMSecs);
+
+		if (hibernating && (!socket || !GetSocket()->IsReadOpen()))
+			WakeUp(); // Let the statistics update below notice that the peer has closed the connection.
+	}
+
+	if (hibernating)
+	{
+		// A hibernating connection skips the statistics and the protocol timers, and only lets the
+		// subclass pick up received data (which wakes the connection up if it carries application messages).
+		DoUpdateConnection();
+		return;
 	}
 
+	networkSendSimulator.Process();
+
 	// Produce statistics back to the application about the current connection state.
 	if (statsRefreshTimer.TriggeredOrNotRunning())
 	{
@@ -451,7 +765,7 @@ void MessageConnection::UpdateConnection() // [Called from the worker thread]
 
 		// Check if the socket is dead and mark it read-closed.
 		if (connectionState == ConnectionOK || connectionState == ConnectionDisconnecting)
-			if (!socket || !socket->IsReadOpen())
+			if (!socket || !GetSocket()->IsReadOpen())
 			{
 				LOG(LogInfo, "Peer closed connection.");
 				SetPeerClosed();
@@ -469,12 +783,46 @@ void MessageConnection::UpdateConnection() // [Called from the worker thread]
 		ADDEVENT("bytesOutTotal", (float)BytesOutTotal(), "bytes");
 
 		statsRefreshTimer.StartMSecs(statsRefreshIntervalMSecs);
+
+		CheckHibernation();
+		if (hibernating)
+			return;
 	}
 
 	// Perform the TCP/UDP -specific connection update.
 	DoUpdateConnection();
 }
 
+void MessageConnection::CheckHibernation() // [worker thread]
+{
+	AssertInWorkerThreadContext();
+
+	if (hibernating || connectionState != ConnectionOK || bOutboundSendsPaused)
+		return;
+	if (outboundQueue.Size() > 0 || outboundAcceptQueue.Size() > 0 || !CanHibernate())
+		return;
+	if (Clock::TicksToMillisecondsF(Clock::TicksInBetween(Clock::Tick(), lastMessageActivityTime)) < cHibernateAfterIdleMSecs)
+		return;
+
+	LOG(LogVerbose, "MessageConnection::CheckHibernation: Connection %s has been idle for %.2f seconds, hibernating.",
+		ToString().c_str(), cHibernateAfterIdleMSecs / 1000.f);
+	hibernating = true;
+	outboundAcceptQueue.ReleaseSpareBlock();
+	inboundMessageQueue.ReleaseSpareBlock();
+	ReleaseIdleMemory();
+}
+
+void MessageConnection::WakeUp() // [worker thread]
+{
+	AssertInWorkerThreadContext();
+
+	if (!hibernating)
+		return;
+	LOG(LogVerbose, "MessageConnection::WakeUp: Connection %s resumes from hibernation.", ToString().c_str());
+	hibernating = false;
+	statsRefreshTimer.Stop();
+}
+
 NetworkMessage *MessageConnection::AllocateNewMessage()
 {
 	NetworkMessage *msg = messagePool.New();
@@ -518,8 +866,10 @@ NetworkMessage *MessageConnection::StartNewMessage(unsigned long id, size_t numB
 	// fragmentation is examined and this field will be updated if needed.
 	msg->transfer = 0; 
 
+	msg->enqueueTick = msg->packTick = msg->sendTick = 0;
+
 #ifdef KNET_NETWORK_PROFILING
-	msg->profilerName = "";
+	msg->profilerMetric = cInvalidStatsMetric;
 #endif
 
 	msg->Resize(numBytes);
@@ -593,8 +943,9 @@ void MessageConnection::SplitAndQueueMessage(NetworkMessage *message, bool inter
 		fragment->transfer = transfer;
 		fragment->fragmentIndex = currentFragmentIndex++;
 		fragment->reliableMessageNumber = outboundReliableMessageNumberCounter++; ///\todo Convert to atomic increment, or this is a race condition.
+		fragment->enqueueTick = message->enqueueTick;
 #ifdef KNET_NETWORK_PROFILING
-		fragment->profilerName = message->profilerName + "_Fragment";
+		fragment->profilerMetric = FragmentMetric(message->profilerMetric);
 #endif
 
 		// Copy the data from the old message that's supposed to go into this fragment.
@@ -614,14 +965,7 @@ void MessageConnection::SplitAndQueueMessage(NetworkMessage *message, bool inter
 //			assert(ContainerUniqueAndNoNullElements(outboundQueue));
 		}
 		else
-		{
-			if (!outboundAcceptQueue.Insert(fragment))
-			{
-				///\todo Is it possible to check beforehand if this criteria is avoided, or if we are doomed?
-				LOG(LogError, "Critical: Failed to add message fragment to outboundAcceptQueue! Queue was full. Do not know how to recover here!");
-				assert(false);
-			}
-		}
+			outboundAcceptQueue.Insert(fragment);
 	}
 
 	// Signal the worker thread that there are new outbound events available.
@@ -647,13 +991,13 @@ void MessageConnection::EndAndQueueMessage(NetworkMessage *msg, size_t numBytes,
 		return;
 
 	// If the message was marked obsolete to start with, discard it.
-	if (msg->obsolete || !socket || GetConnectionState() == ConnectionClosed || !socket->IsWriteOpen() || 
+	if (msg->obsolete || !socket || GetConnectionState() == ConnectionClosed || !GetSocket()->IsWriteOpen() || 
 		(internalQueue == false && !IsWriteOpen()))
 	{
 		LOG(LogVerbose, "MessageConnection::EndAndQueueMessage: Discarded message with ID 0x%X and size %d bytes. "
-			"msg->obsolete: %d. socket ptr: %p. ConnectionState: %s. socket->IsWriteOpen(): %s. msgconn->IsWriteOpen: %s. "
+			"msg->obsolete: %d. socket ptr: %p. ConnectionState: %s. GetSocket()->IsWriteOpen(): %s. msgconn->IsWriteOpen: %s. "
 			"internalQueue: %s.",
-			(int)msg->id, (int)numBytes, (int)msg->obsolete, socket, ConnectionStateToString(GetConnectionState()).c_str(), (socket && socket->IsWriteOpen()) ? "true" : "false",
+			(int)msg->id, (int)numBytes, (int)msg->obsolete, GetSocket(), ConnectionStateToString(GetConnectionState()).c_str(), (socket && GetSocket()->IsWriteOpen()) ? "true" : "false",
 			IsWriteOpen() ? "true" : "false", internalQueue ? "true" : "false");
 		FreeMessage(msg);
 		return;
@@ -663,6 +1007,8 @@ void MessageConnection::EndAndQueueMessage(NetworkMessage *msg, size_t numBytes,
 	if (numBytes != (size_t)(-1))
 		msg->dataSize = numBytes;
 
+	msg->enqueueTick = Clock::Tick();
+
 	assert(msg->dataSize <= msg->Capacity());
 	if (msg->dataSize > msg->Capacity())
 	{
@@ -675,10 +1021,10 @@ void MessageConnection::EndAndQueueMessage(NetworkMessage *msg, size_t numBytes,
 	///\todo We can optimize here by doing the splitting at datagram creation time to create optimally sized datagrams, but
 	/// it is quite more complicated, so left for later. 
 	const size_t sendHeaderUpperBound = 32; // Reserve some bytes for the packet and message headers. (an approximate upper bound)
-	if (msg->dataSize + sendHeaderUpperBound > socket->MaxSendSize())
+	if (msg->dataSize + sendHeaderUpperBound > GetSocket()->MaxSendSize())
 	{
-		const size_t maxFragmentSize = socket->MaxSendSize() / 4 - sendHeaderUpperBound; ///\todo Check this is ok.
-		assert(maxFragmentSize > 0 && maxFragmentSize < socket->MaxSendSize());
+		const size_t maxFragmentSize = GetSocket()->MaxSendSize() / 4 - sendHeaderUpperBound; ///\todo Check this is ok.
+		assert(maxFragmentSize > 0 && maxFragmentSize < GetSocket()->MaxSendSize());
 		SplitAndQueueMessage(msg, internalQueue, maxFragmentSize);
 		return;
 	}
@@ -686,6 +1032,7 @@ void MessageConnection::EndAndQueueMessage(NetworkMessage *msg, size_t numBytes,
 	msg->messageNumber = outboundMessageNumberCounter++; ///\todo Convert to atomic increment, or this is a race condition.
 	msg->reliableMessageNumber = (msg->reliable ? outboundReliableMessageNumberCounter++ : 0); ///\todo Convert to atomic increment, or this is a race condition.
 	msg->sendCount = 0;
+	KNET_TRACE(TraceMessageQueued, this, msg->messageNumber, msg->id);
 
 	if (internalQueue) // if true, we are accessing from the worker thread, and can directly access the outboundQueue member.
 	{
@@ -700,17 +1047,7 @@ void MessageConnection::EndAndQueueMessage(NetworkMessage *msg, size_t numBytes,
 	}
 	else
 	{
-		if (!outboundAcceptQueue.Insert(msg))
-		{
-			if (msg->reliable) // For nonreliable messages it is not critical if we can't enqueue the message. Just discard it.
-			{
-				///\todo Is it possible to check beforehand if this criteria is avoided, or if we are doomed?
-				LOG(LogVerbose, "Critical: Failed to add new reliable message to outboundAcceptQueue! Queue was full. Discarding the message!");
-				assert(false);
-			}
-			FreeMessage(msg);
-			return;
-		}
+		outboundAcceptQueue.Insert(msg);
 		LOG(LogData, "MessageConnection::EndAndQueueMessage: Queued message of size %d bytes and ID 0x%X.", (int)msg->Size(), (int)msg->id);
 	}
 
@@ -747,14 +1084,28 @@ void MessageConnection::Process(int maxMessagesToProcess)
 
 	assert(maxMessagesToProcess >= 0);
 
-	// Check the status of the connection worker thread.
-	if (connectionState == ConnectionClosed || !socket || !socket->Connected())
+	if (!CloseIfDown())
+		HandleInboundMessages(maxMessagesToProcess);
+}
+
+bool MessageConnection::CloseIfDown() // [main thread]
+{
+	// Check the status of the connection worker thread. A connection from Network::ConnectAsync() has no socket handle until it has connected.
+	// The worker thread publishes the connected socket before it frees connectAttempt, so test connectAttempt first.
+	if (connectionState == ConnectionClosed || !socket || (!connectAttempt.load(std::memory_order_acquire) && !GetSocket()->Connected()))
 	{
 		if (socket)
-			Close(); ///\todo This will block, since it is called with the default time period.
+			Close(0); // The connection is already down, so there is nothing to wait for.
 		connectionState = ConnectionClosed;
-		return;
+		KNET_TRACE(TraceConnectionState, this, connectionState, 0);
+		return true;
 	}
+	return false;
+}
+
+void MessageConnection::HandleInboundMessages(int maxMessagesToProcess) // [main or server process thread]
+{
+	assert(maxMessagesToProcess >= 0);
 
 	// The number of messages we are willing to process this cycle. If there are fewer messages than this 
 	// to process, we will return immediately (won't wait for this many messages to actually be received, it is just an upper limit).
@@ -775,6 +1126,7 @@ void MessageConnection::Process(int maxMessagesToProcess)
 		inboundMessageQueue.PopFront();
 		assert(msg);
 
+		KNET_TRACE(TraceMessageHandled, this, msg->receivedPacketID, msg->id);
 		inboundMessageHandler->HandleMessage(this, msg->receivedPacketID, msg->id, (msg->dataSize > 0) ? msg->data : 0, msg->dataSize);
 
 		FreeMessage(msg);
@@ -880,15 +1232,7 @@ void MessageConnection::AddOutboundStats(unsigned long numBytes, unsigned long n
 	if (numBytes == 0 && numMessages == 0 && numPackets == 0)
 		return;
 
-	ConnectionStatistics &cs = statistics.LockGet();
-	cs.traffic.push_back(ConnectionStatistics::TrafficTrack());
-	ConnectionStatistics::TrafficTrack &t = cs.traffic.back();
-	t.bytesIn = t.messagesIn = t.packetsIn = 0;
-	t.bytesOut = numBytes;
-	t.packetsOut = numPackets;
-	t.messagesOut = numMessages;
-	t.tick = Clock::Tick();
-	statistics.Unlock();
+	trafficStats.AddOutbound(numBytes, numPackets, numMessages, Clock::LoopTick());
 	bytesOutTotal += numBytes;
 }
 
@@ -899,68 +1243,51 @@ void MessageConnection::AddInboundStats(unsigned long numBytes, unsigned long nu
 	if (numBytes == 0 && numMessages == 0 && numPackets == 0)
 		return;
 
-	ConnectionStatistics &cs = statistics.LockGet();
-	cs.traffic.push_back(ConnectionStatistics::TrafficTrack());
-	ConnectionStatistics::TrafficTrack &t = cs.traffic.back();
-	t.bytesOut = t.messagesOut = t.packetsOut = 0;
-	t.bytesIn = numBytes;
-	t.packetsIn = numPackets;
-	t.messagesIn = numMessages;
-	t.tick = Clock::Tick();
-	statistics.Unlock();
+	trafficStats.AddInbound(numBytes, numPackets, numMessages, Clock::LoopTick());
 	bytesInTotal += numBytes;
 }
 
-void MessageConnection::ComputeStats()
+void MessageConnection::AddMessageSendStats(NetworkMessage * const *messages, size_t numMessages, tick_t sendTick)
 {
 	AssertInWorkerThreadContext();
 
-	ConnectionStatistics &cs = statistics.LockGet();
-
-	const tick_t maxEntryAge = Clock::TicksPerSec() * 5;
-	const tick_t timeNow = Clock::Tick();
-	const tick_t maxTickAge = timeNow - maxEntryAge;
-
-	for(size_t i = 0; i < cs.traffic.size(); ++i)
-		if (Clock::IsNewer(cs.traffic[i].tick, maxTickAge))
-		{
-			cs.traffic.erase(cs.traffic.begin(), cs.traffic.begin() + i);
-			break;
-		}
-
-	if (cs.traffic.size() <= 1)
+	for(size_t i = 0; i < numMessages; ++i)
 	{
-		bytesInPerSec = bytesOutPerSec = msgsInPerSec = msgsOutPerSec = packetsInPerSec = packetsOutPerSec = 0.f;
-		statistics.Unlock();
-		return;
+		NetworkMessage *msg = messages[i];
+		if (msg->sendTick != 0) // Only the first send of a message counts towards its queueing delay.
+			continue;
+		msg->sendTick = sendTick;
+		messageTypeStats.AddSend(msg->id, TicksToMicroseconds(msg->enqueueTick, sendTick), (u32)msg->dataSize);
 	}
+}
 
-	unsigned long totalBytesIn = 0;
-	unsigned long totalBytesOut = 0;
-	unsigned long totalMsgsIn = 0;
-	unsigned long totalMsgsOut = 0;
-	unsigned long totalPacketsIn = 0;
-	unsigned long totalPacketsOut = 0;
+void MessageConnection::AddMessageAckStats(NetworkMessage * const *messages, size_t numMessages, tick_t ackTick)
+{
+	AssertInWorkerThreadContext();
 
-	for(size_t i = 0; i < cs.traffic.size(); ++i)
-	{
-		totalBytesIn += cs.traffic[i].bytesIn;
-		totalBytesOut += cs.traffic[i].bytesOut;
-		totalPacketsIn += cs.traffic[i].packetsIn;
-		totalPacketsOut += cs.traffic[i].packetsOut;
-		totalMsgsIn += cs.traffic[i].messagesIn;
-		totalMsgsOut += cs.traffic[i].messagesOut;
-	}
-	tick_t ticks = cs.traffic.back().tick - cs.traffic.front().tick;
-	float secs = max(1.f, (float)Clock::TicksToMillisecondsD(ticks) / 1000.f);
-	bytesInPerSec = (float)totalBytesIn / secs;
-	bytesOutPerSec = (float)totalBytesOut / secs;
-	packetsInPerSec = (float)totalPacketsIn / secs;
-	packetsOutPerSec = (float)totalPacketsOut / secs;
-	msgsInPerSec = (float)totalMsgsIn / secs;
-	msgsOutPerSec = (float)totalMsgsOut / secs;
+	for(size_t i = 0; i < numMessages; ++i)
+		messageTypeStats.AddAck(messages[i]->id, TicksToMicroseconds(messages[i]->enqueueTick, ackTick));
+}
 
-	statistics.Unlock();
+MessageTypeStats MessageConnection::MessageTypeStatistics(message_id_t id) const
+{
+	MessageTypeStats s;
+	messageTypeStats.Read(id, s);
+	return s;
+}
+
+void MessageConnection::ComputeStats()
+{
+	AssertInWorkerThreadContext();
+
+	TrafficStatsSnapshot traffic;
+	trafficStats.Snapshot(traffic, Clock::Tick());
+	bytesInPerSec = traffic.BytesInPerSec();
+	bytesOutPerSec = traffic.BytesOutPerSec();
+	packetsInPerSec = traffic.PacketsInPerSec();
+	packetsOutPerSec = traffic.PacketsOutPerSec();
+	msgsInPerSec = traffic.MessagesInPerSec();
+	msgsOutPerSec = traffic.MessagesOutPerSec();
 }
 
 void MessageConnection::CheckAndSaveOutboundMessageWithContentID(NetworkMessage *msg)
@@ -1023,7 +1350,7 @@ bool MessageConnection::CheckAndSaveContentIDStamp(message_id_t messageID, u32 c
 
 	assert(contentID != 0);
 
-	tick_t now = Clock::Tick();
+	tick_t now = Clock::LoopTick();
 
 	MsgContentIDPair key = std::make_pair(messageID, contentID);
 	ContentIDReceiveTrack::iterator iter = inboundContentIDStamps.find(key);
@@ -1058,14 +1385,23 @@ void MessageConnection::HandleInboundMessage(packet_id_t packetID, const char *d
 	message_id_t messageID = reader.ReadVLE<VLE8_16_32>(); ///\todo Check that there actually is enough space to read.
 	if (messageID == DataDeserializer::VLEReadError)
 	{
-		LOG(LogError, "Error parsing messageID of a message in socket %s. Data size: %d bytes.", socket->ToString().c_str(), (int)numBytes);
+		LOG(LogError, "Error parsing messageID of a message in socket %s. Data size: %d bytes.", GetSocket()->ToString().c_str(), (int)numBytes);
 		throw NetException("MessageConnection::HandleInboundMessage: Network error occurred when deserializing message ID VLE field!");
 	}
-	LOG(LogData, "Received message with ID %d and size %d from peer %s.", (int)packetID, (int)numBytes, socket->ToString().c_str());
+	LOG(LogData, "Received message with ID %d and size %d from peer %s.", (int)packetID, (int)numBytes, GetSocket()->ToString().c_str());
 
-	char str[256];
-	sprintf(str, "messageIn.%u", (unsigned int)messageID);
-	ADDEVENT(str, (float)reader.BytesLeft(), "bytes");
+#ifdef KNET_NETWORK_PROFILING
+	static StatsMetricFamily messageInMetrics("messageIn.%u", "bytes");
+	ADDMETRIC(messageInMetrics.Get((u32)messageID), (float)reader.BytesLeft());
+#endif
+
+	// Pings are exchanged also on idle connections, any other message means the connection is in use.
+	if (messageID != MsgIdPingRequest && messageID != MsgIdPingReply)
+	{
+		lastMessageActivityTime = Clock::LoopTick();
+		if (hibernating)
+			WakeUp();
+	}
 
 	// Pass the message to TCP/UDP -specific message handler.
 	bool childHandledMessage = HandleMessage(packetID, messageID, data + reader.BytePos(), reader.BytesLeft());
@@ -1090,13 +1426,8 @@ void MessageConnection::HandleInboundMessage(packet_id_t packetID, const char *d
 			msg->id = messageID;
 			msg->contentID = 0;
 			msg->receivedPacketID = packetID;
-			bool success = inboundMessageQueue.Insert(msg);
-			if (!success)
-			{
-				LOG(LogError, "Failed to add a new message of ID %d and size %dB to inbound queue! Queue was full.",
-					(int)messageID, (int)msg->dataSize);
-				FreeMessage(msg);
-			}
+			KNET_TRACE(TraceMessageReceived, this, packetID, messageID);
+			inboundMessageQueue.Insert(msg);
 		}
 		break;
 	}
@@ -1137,7 +1468,8 @@ void MessageConnection::SendPingRequestMessage(bool internalQueue)
 	msg->data[0] = pingID;
 	msg->priority = NetworkMessage::cMaxPriority - 2;
 #ifdef KNET_NETWORK_PROFILING
-	msg->profilerName = "PingRequest (1)";
+	static const StatsMetricId profilerMetric = RegisterStatsMetric("messageOut.PingRequest (1)", "bytes");
+	msg->profilerMetric = profilerMetric;
 #endif
 	EndAndQueueMessage(msg, 1, internalQueue);
 	LOG(LogVerbose, "Enqueued ping message %d.", (int)pingID);
@@ -1158,7 +1490,8 @@ void MessageConnection::HandlePingRequestMessage(const char *data, size_t numByt
 	msg->data[0] = pingID;
 	msg->priority = NetworkMessage::cMaxPriority - 1;
 #ifdef KNET_NETWORK_PROFILING
-	msg->profilerName = "PingReply (2)";
+	static const StatsMetricId profilerMetric = RegisterStatsMetric("messageOut.PingReply (2)", "bytes");
+	msg->profilerMetric = profilerMetric;
 #endif
 	EndAndQueueMessage(msg, 1, true);
 	LOG(LogVerbose, "HandlePingRequestMessage: %d.", (int)pingID);
@@ -1187,20 +1520,21 @@ void MessageConnection::HandlePingReplyMessage(const char *data, size_t numBytes
 			float newRtt = (float)Clock::TicksToMillisecondsD(Clock::TicksInBetween(cs.ping[i].pingReplyTick, cs.ping[i].pingSentTick));
 			cs.ping[i].replyReceived = true;
 			statistics.Unlock();
-			rtt = rttPredictBias * newRtt + (1.f * rttPredictBias) * rtt;
+			if (!rttFromPacketAcks)
+				rtt = rttPredictBias * newRtt + (1.f * rttPredictBias) * rtt;
 
 			LOG(LogVerbose, "HandlePingReplyMessage: %d.", (int)pingID);
 			return;
 		}
 
 	statistics.Unlock();
-	LOG(LogError, "Received PingReply with ID %d in socket %s, but no matching PingRequest was ever sent!", (int)pingID, socket->ToString().c_str());
+	LOG(LogError, "Received PingReply with ID %d in socket %s, but no matching PingRequest was ever sent!", (int)pingID, GetSocket()->ToString().c_str());
 }
 
 std::string MessageConnection::ToString() const
 {
 	if (socket)
-		return socket->ToString();
+		return GetSocket()->ToString();
 	else
 		return "(Not connected)";
 }
@@ -1236,30 +1570,47 @@ void MessageConnection::DumpStatus() const
 		IsReadOpen() ? "readOpen" : "",
 		IsWriteOpen() ? "writeOpen" : "",
 		socket ? "exists" : "zero",
-		(socket && socket->Connected()) ? "connected" : "",
-		(socket && socket->IsReadOpen()) ? "readOpen" : "",
-		(socket && socket->IsWriteOpen()) ? "writeOpen" : "",
+		(socket && GetSocket()->Connected()) ? "connected" : "",
+		(socket && GetSocket()->IsReadOpen()) ? "readOpen" : "",
+		(socket && GetSocket()->IsWriteOpen()) ? "writeOpen" : "",
 		RoundTripTime(), LastHeardTime(), PacketsInPerSec(), PacketsOutPerSec(),
 		MsgsInPerSec(), MsgsOutPerSec(), 
 		FormatBytes(BytesInPerSec()).c_str(), FormatBytes(BytesOutPerSec()).c_str(),
 		(int)eventMsgsOutAvailable.Test(), 
 #ifdef WIN32
-		socket ? socket->NumOverlappedReceivesInProgress() : -1,
+		socket ? GetSocket()->NumOverlappedReceivesInProgress() : -1,
 #else
 		-1,
 #endif
-		(socket && socket->GetOverlappedReceiveEvent().Test()) ? "true" : "false",
+		(socket && socket.load()->GetOverlappedReceiveEvent().Test()) ? "true" : "false",
 #ifdef WIN32
-		socket ? socket->NumOverlappedSendsInProgress() : -1,
+		socket ? GetSocket()->NumOverlappedSendsInProgress() : -1,
 #else
 		-1,
 #endif
-		(socket && socket->GetOverlappedSendEvent().Test()) ? "true" : "false",
+		(socket && socket.load()->GetOverlappedSendEvent().Test()) ? "true" : "false",
 		(int)TimeUntilCanSendPacket(),
 		(int)outboundQueue.Size());
 
 	LOGUSER(str);
 
+	{
+		std::vector<message_id_t> ids;
+		MessageTypeIds(ids);
+		for(size_t i = 0; i < ids.size(); ++i)
+		{
+			MessageTypeStats s;
+			messageTypeStats.Read(ids[i], s);
+			sprintf(str, "\tMessage ID %u: %d sent, size p50/p99/max %u/%u/%u bytes, queue p50/p99/p999 %.2f/%.2f/%.2fms, "
+				"ack p50/p99/p999 %.2f/%.2f/%.2fms.\n",
+				(unsigned int)ids[i], (int)s.queueTimeUSecs.Count(),
+				s.sizeBytes.Percentile(0.5), s.sizeBytes.Percentile(0.99), s.sizeBytes.Max(),
+				s.queueTimeUSecs.Percentile(0.5) / 1000.f, s.queueTimeUSecs.Percentile(0.99) / 1000.f, s.queueTimeUSecs.Percentile(0.999) / 1000.f,
+				s.ackTimeUSecs.Percentile(0.5) / 1000.f, s.ackTimeUSecs.Percentile(0.99) / 1000.f, s.ackTimeUSecs.Percentile(0.999) / 1000.f);
+			LOGUSER(str);
+		}
+	}
+
 	DumpConnectionStatus();
 }
 
@@ -1322,7 +1673,7 @@ void MessageConnection::SetWorkerThread(NetworkWorkerThread *thread)
 EndPoint MessageConnection::LocalEndPoint() const
 {
 	if (socket)
-		return socket->LocalEndPoint();
+		return GetSocket()->LocalEndPoint();
 	else
 		return EndPoint();
 }
@@ -1330,7 +1681,7 @@ EndPoint MessageConnection::LocalEndPoint() const
 EndPoint MessageConnection::RemoteEndPoint() const
 {
 	if (socket)
-		return socket->RemoteEndPoint();
+		return GetSocket()->RemoteEndPoint();
 	else
 		return EndPoint();
 }
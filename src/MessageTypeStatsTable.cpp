@@ -0,0 +1,160 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file MessageTypeStatsTable.cpp
+	@brief */
+
+#include <thread>
+
+#include "kNet/DebugMemoryLeakCheck.h"
+
+#include "kNet/MessageTypeStatsTable.h"
+
+namespace kNet
+{
+
+/// The number of message IDs the index covers at first. Most applications use a few small IDs.
+static const size_t cInitialIndexSize = 64;
+
+MessageTypeStatsTable::MessageTypeStatsTable()
+:index(0)
+{
+}
+
+MessageTypeStatsTable::~MessageTypeStatsTable()
+{
+	Index *current = index.load(std::memory_order_relaxed);
+	if (current)
+	{
+		for(size_t i = 0; i < current->size; ++i)
+			delete current->entries[i].load(std::memory_order_relaxed);
+		retiredIndices.push_back(current);
+	}
+	for(size_t i = 0; i < retiredIndices.size(); ++i)
+	{
+		delete[] retiredIndices[i]->entries;
+		delete retiredIndices[i];
+	}
+}
+
+MessageTypeStatsTable::Index *MessageTypeStatsTable::NewIndex(size_t size)
+{
+	Index *newIndex = new Index;
+	newIndex->size = size;
+	newIndex->entries = new std::atomic<Entry*>[size];
+	for(size_t i = 0; i < size; ++i)
+		newIndex->entries[i].store(0, std::memory_order_relaxed);
+	return newIndex;
+}
+
+MessageTypeStatsTable::Entry &MessageTypeStatsTable::EntryFor(message_id_t id)
+{
+	const size_t slot = (id < cOverflowId) ? (size_t)id : (size_t)cOverflowId;
+	Index *current = index.load(std::memory_order_relaxed);
+	if (!current || slot >= current->size)
+	{
+		// Grow the index and publish it whole, the readers keep using the old one until they see the new one.
+		size_t newSize = current ? current->size * 2 : cInitialIndexSize;
+		while(newSize <= slot)
+			newSize *= 2;
+		if (newSize > (size_t)cOverflowId + 1)
+			newSize = (size_t)cOverflowId + 1;
+		Index *grown = NewIndex(newSize);
+		if (current)
+		{
+			for(size_t i = 0; i < current->size; ++i)
+				grown->entries[i].store(current->entries[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+			retiredIndices.push_back(current);
+		}
+		index.store(grown, std::memory_order_release);
+		current = grown;
+	}
+
+	Entry *e = current->entries[slot].load(std::memory_order_relaxed);
+	if (!e)
+	{
+		e = new Entry;
+		e->sequence.store(0, std::memory_order_relaxed);
+		current->entries[slot].store(e, std::memory_order_release);
+	}
+	return *e;
+}
+
+void MessageTypeStatsTable::BeginWrite(Entry &e)
+{
+	e.sequence.store(e.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+void MessageTypeStatsTable::EndWrite(Entry &e)
+{
+	e.sequence.store(e.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void MessageTypeStatsTable::AddSend(message_id_t id, u32 queueTimeUSecs, u32 sizeBytes)
+{
+	Entry &e = EntryFor(id);
+	BeginWrite(e);
+	e.queueTimeUSecs.Add(queueTimeUSecs);
+	e.sizeBytes.Add(sizeBytes);
+	EndWrite(e);
+}
+
+void MessageTypeStatsTable::AddAck(message_id_t id, u32 ackTimeUSecs)
+{
+	Entry &e = EntryFor(id);
+	BeginWrite(e);
+	e.ackTimeUSecs.Add(ackTimeUSecs);
+	EndWrite(e);
+}
+
+bool MessageTypeStatsTable::Read(message_id_t id, MessageTypeStats &out) const
+{
+	const size_t slot = (id < cOverflowId) ? (size_t)id : (size_t)cOverflowId;
+	const Index *current = index.load(std::memory_order_acquire);
+	if (!current || slot >= current->size)
+		return false;
+	const Entry *e = current->entries[slot].load(std::memory_order_acquire);
+	if (!e)
+		return false;
+
+	for(;;)
+	{
+		const u32 seqBegin = e->sequence.load(std::memory_order_acquire);
+		if ((seqBegin & 1) != 0) // The writer is in the middle of an update.
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		e->queueTimeUSecs.Read(out.queueTimeUSecs);
+		e->ackTimeUSecs.Read(out.ackTimeUSecs);
+		e->sizeBytes.Read(out.sizeBytes);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (e->sequence.load(std::memory_order_relaxed) == seqBegin)
+			return true;
+	}
+}
+
+void MessageTypeStatsTable::MessageIds(std::vector<message_id_t> &out) const
+{
+	out.clear();
+	const Index *current = index.load(std::memory_order_acquire);
+	if (!current)
+		return;
+	for(size_t i = 0; i < current->size; ++i)
+		if (current->entries[i].load(std::memory_order_acquire))
+			out.push_back((message_id_t)i);
+}
+
+} // ~kNet
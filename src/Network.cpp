@@ -39,6 +39,7 @@
 #include "kNet/TCPMessageConnection.h"
 #include "kNet/UDPMessageConnection.h"
 #include "kNet/NetworkWorkerThread.h"
+#include "kNet/NetworkMetrics.h"
 #include "kNet/NetworkLogging.h"
 
 namespace kNet
@@ -102,19 +103,66 @@ std::string FormatBytes(double numBytes)
 }
 
 Network::Network()
+:metricsEndpoint(0), resolver(0), workerBusyPollIdleMSecs(0)
 {
 #ifdef WIN32
 	memset(&wsaData, 0, sizeof(wsaData));
 #endif
+	statistics.SetContentionName("Network::statistics");
+	workerThreads.SetContentionName("Network::workerThreads");
 	Init();
 }
 
 Network::~Network()
 {
+	StopMetricsEndpoint();
 	StopServer();
 	DeInit();
 }
 
+Lock<StatsEventHierarchyNode> Network::Statistics()
+{
+	Lock<StatsEventHierarchyNode> hierarchy = statistics.Acquire();
+	counters.UpdateHierarchy(*hierarchy, cEventOldAgeMSecs);
+	return hierarchy;
+}
+
+void Network::SnapshotMetrics(NetworkMetrics &out)
+{
+	out.Clear();
+	{
+		// Holding the list lock keeps the main thread from deleting the worker threads, and each worker thread holds
+		// its own locks while it copies out the connections and servers, so none of them can be freed mid-snapshot.
+		Lockable<std::vector<NetworkWorkerThread*> >::LockType lock = workerThreads.Acquire();
+		for(size_t i = 0; i < lock->size(); ++i)
+			(*lock)[i]->SnapshotMetrics(out, (int)i);
+	}
+	counters.ReadAll(out.counters);
+	ReadLockContention(out.locks);
+}
+
+bool Network::StartMetricsEndpoint(unsigned short port, bool loopbackOnly)
+{
+	if (!metricsEndpoint)
+		metricsEndpoint = new MetricsEndpoint(this);
+	return metricsEndpoint->StartTCP(port, loopbackOnly);
+}
+
+#ifndef WIN32
+bool Network::StartMetricsEndpoint(const char *unixSocketPath)
+{
+	if (!metricsEndpoint)
+		metricsEndpoint = new MetricsEndpoint(this);
+	return metricsEndpoint->StartUnix(unixSocketPath);
+}
+#endif
+
+void Network::StopMetricsEndpoint()
+{
+	delete metricsEndpoint;
+	metricsEndpoint = 0;
+}
+
 void PrintLocalIP()
 {
 	char ac[80];
@@ -295,19 +343,30 @@ NetworkWorkerThread *Network::GetOrCreateWorkerThread()
 {
 	static const int maxConnectionsPerThread = 8;
 
+	Lockable<std::vector<NetworkWorkerThread*> >::LockType lock = workerThreads.Acquire();
+
 	// Find an existing thread with sufficiently low load.
-	for(size_t i = 0; i < workerThreads.size(); ++i)
-		if (workerThreads[i]->NumConnections() + workerThreads[i]->NumServers() < maxConnectionsPerThread)
-			return workerThreads[i];
+	for(size_t i = 0; i < lock->size(); ++i)
+		if ((*lock)[i]->NumConnections() + (*lock)[i]->NumServers() < maxConnectionsPerThread)
+			return (*lock)[i];
 
 	// No appropriate thread found. Create a new one.
 	NetworkWorkerThread *workerThread = new NetworkWorkerThread();
+	workerThread->SetBusyPoll(workerBusyPollIdleMSecs);
 	workerThread->StartThread();
-	workerThreads.push_back(workerThread);
-	LOG(LogInfo, "Created a new NetworkWorkerThread. There are now %d worker threads.", (int)workerThreads.size());
+	lock->push_back(workerThread);
+	LOG(LogInfo, "Created a new NetworkWorkerThread. There are now %d worker threads.", (int)lock->size());
 	return workerThread;
 }
 
+void Network::SetWorkerBusyPoll(int idleMSecs)
+{
+	Lockable<std::vector<NetworkWorkerThread*> >::LockType lock = workerThreads.Acquire();
+	workerBusyPollIdleMSecs = idleMSecs;
+	for(size_t i = 0; i < lock->size(); ++i)
+		(*lock)[i]->SetBusyPoll(idleMSecs);
+}
+
 void Network::AssignConnectionToWorkerThread(MessageConnection *connection)
 {
 	NetworkWorkerThread *workerThread = GetOrCreateWorkerThread();
@@ -363,15 +422,19 @@ void Network::CloseWorkerThread(NetworkWorkerThread *workerThread)
 	if (workerThread->NumConnections() + workerThread->NumServers() > 0)
 		LOG(LogError, "Warning: Closing a worker thread %p when it still has %d connections and %d servers to handle.", workerThread, workerThread->NumConnections(), workerThread->NumServers());
 
-	for(size_t i = 0; i < workerThreads.size(); ++i)
-		if (workerThreads[i] == workerThread)
+	Lockable<std::vector<NetworkWorkerThread*> >::LockType lock = workerThreads.Acquire();
+	for(size_t i = 0; i < lock->size(); ++i)
+		if ((*lock)[i] == workerThread)
 		{
 			// Remove the thread pointer from internal list.
-			std::swap(workerThreads[i], workerThreads[workerThreads.size()-1]);
-			workerThreads.pop_back();
+			std::swap((*lock)[i], (*lock)[lock->size()-1]);
+			lock->pop_back();
+			const int numThreadsLeft = (int)lock->size();
+			(void)numThreadsLeft; // Only logged, and LOG may compile to nothing.
+			lock.Unlock();
 
 			workerThread->StopThread();
-			LOG(LogInfo, "Deleted a NetworkWorkerThread. There are now %d worker threads left.", (int)workerThreads.size());
+			LOG(LogInfo, "Deleted a NetworkWorkerThread. There are now %d worker threads left.", numThreadsLeft);
 			delete workerThread;
 			return;
 		}
@@ -472,17 +535,17 @@ void Network::DeleteSocket(Socket *socket)
 		return;
 	}
 
-	for(std::list<Socket>::iterator iter = sockets.begin(); iter != sockets.end(); ++iter)
-		if (&*iter == socket)
-		{
-			socket->Close();
-			// The Socket pointers MessageConnection objects have are pointers to this list,
-			// so after calling this function with a Socket pointer, the Socket is deleted for good.
-			sockets.erase(iter);
-			LOG(LogInfo, "Network::DeleteSocket: Closed socket %p.", socket);
-			return;
-		}
-	LOG(LogError, "Network::DeleteSocket: Tried to free a nonexisting socket %p!", socket);
+	if (socket->networkIndex >= sockets.size() || sockets[socket->networkIndex] != socket)
+	{
+		LOG(LogError, "Network::DeleteSocket: Tried to free a nonexisting socket %p!", socket);
+		return;
+	}
+
+	socket->Close();
+	// The Socket pointers MessageConnection objects have are pointers to this list,
+	// so after calling this function with a Socket pointer, the Socket is deleted for good.
+	ReleaseSocket(socket);
+	LOG(LogInfo, "Network::DeleteSocket: Closed socket %p.", socket);
 }
 
 void Network::CloseConnection(MessageConnection *connection)
@@ -494,6 +557,12 @@ void Network::CloseConnection(MessageConnection *connection)
 	RemoveConnectionFromItsWorkerThread(connection);
 	DeleteSocket(connection->socket);
 	connection->socket = 0;
+	if (connection->spareSocket)
+		DeleteSocket(connection->spareSocket);
+	connection->spareSocket = 0;
+	for(size_t i = 0; i < connection->retiredSockets.size(); ++i)
+		DeleteSocket(connection->retiredSockets[i]);
+	connection->retiredSockets.clear();
 	connection->owner = 0;
 	connection->ownerServer = 0;
 	connections.erase(connection);
@@ -514,16 +583,24 @@ void Network::DeInit()
 	// Kill the server, if it's running.
 	StopServer();
 
+	// The connections that were still resolving have released their lookups above.
+	delete resolver;
+	resolver = 0;
+
 	// Kill all worker threads.
-	while(workerThreads.size() > 0)
-		CloseWorkerThread(workerThreads.front()); // Erases the item from workerThreads, so this loop terminates.
+	while(NumWorkerThreads() > 0)
+		CloseWorkerThread(workerThreads.Acquire()->front()); // Erases the item from workerThreads, so this loop terminates.
 
 	// Clean up any sockets that might be remaining.
 	while(sockets.size() > 0)
 	{
-		sockets.front().Close();
-		sockets.pop_front();
+		sockets.back()->Close();
+		delete sockets.back();
+		sockets.pop_back();
 	}
+	for(size_t i = 0; i < freeSockets.size(); ++i)
+		delete freeSockets[i];
+	freeSockets.clear();
 
 	// Deinitialize network subsystem.
 #ifdef WIN32
@@ -623,8 +700,7 @@ Socket *Network::OpenListenSocket(unsigned short port, SocketTransportLayer tran
 	remoteEndPoint.Reset();
 
 	const size_t maxSendSize = (transport == SocketOverTCP ? cMaxTCPSendSize : cMaxUDPSendSize);
-	sockets.push_back(Socket(listenSocket, localEndPoint, localHostName.c_str(), remoteEndPoint, "", transport, ServerListenSocket, maxSendSize));
-	Socket *listenSock = &sockets.back();
+	Socket *listenSock = StoreSocket(Socket(listenSocket, localEndPoint, localHostName.c_str(), remoteEndPoint, "", transport, ServerListenSocket, maxSendSize));
 	listenSock->SetBlocking(false);
 
 	return listenSock;
@@ -684,10 +760,15 @@ Socket *Network::ConnectSocket(const char *address, unsigned short port, SocketT
 		return 0;
 	}
 
+	return StoreSocket(CreateConnectedSocket(connectSocket, transport, localHostName.c_str()));
+}
+
+Socket Network::CreateConnectedSocket(SOCKET connectSocket, SocketTransportLayer transport, const char *localHostName)
+{
 	EndPoint localEndPoint;
 	sockaddr_in sockname;
 	socklen_t socknamelen = sizeof(sockname);
-	ret = getsockname(connectSocket, (sockaddr*)&sockname, &socknamelen);
+	int ret = getsockname(connectSocket, (sockaddr*)&sockname, &socknamelen);
 	if (ret == 0)
 		 localEndPoint = EndPoint::FromSockAddrIn(sockname);
 	else
@@ -705,36 +786,83 @@ Socket *Network::ConnectSocket(const char *address, unsigned short port, SocketT
 	std::string remoteHostName = remoteEndPoint.IPToString();
 
 	const size_t maxSendSize = (transport == SocketOverTCP) ? cMaxTCPSendSize : cMaxUDPSendSize;
-	Socket socket(connectSocket, localEndPoint, localHostName.c_str(), remoteEndPoint, remoteHostName.c_str(), transport, ClientSocket, maxSendSize);
+	Socket socket(connectSocket, localEndPoint, localHostName, remoteEndPoint, remoteHostName.c_str(), transport, ClientSocket, maxSendSize);
 
 	socket.SetBlocking(false);
-	sockets.push_back(socket);
-
-	Socket *sock = &sockets.back();
-
-	return sock;
+	return socket;
 }
 
 Ptr(MessageConnection) Network::Connect(const char *address, unsigned short port, 
-	SocketTransportLayer transport, IMessageHandler *messageHandler, Datagram *connectMessage)
+	SocketTransportLayer transport, IMessageHandler *messageHandler, Datagram *connectMessage, bool holdConnectDatagram)
 {
 	Socket *socket = ConnectSocket(address, port, transport);
 	if (!socket)
 		return 0;
 
-	if (transport == SocketOverUDP)
+	Ptr(MessageConnection) connection;
+	if (transport == SocketOverTCP)
 	{
-		SendUDPConnectDatagram(*socket, connectMessage);
-		LOG(LogInfo, "Network::Connect: Sent a UDP Connection Start datagram to to %s.", socket->ToString().c_str());
+		LOG(LogInfo, "Network::Connect: Connected a TCP socket to %s.", socket->ToString().c_str());
+		connection = new TCPMessageConnection(this, 0, socket, ConnectionOK);
 	}
 	else
-		LOG(LogInfo, "Network::Connect: Connected a TCP socket to %s.", socket->ToString().c_str());
+	{
+		// The worker thread sends the Connection Start datagrams.
+		LOG(LogInfo, "Network::Connect: Connecting a UDP socket to %s.", socket->ToString().c_str());
+		UDPMessageConnection *udpConnection = new UDPMessageConnection(this, 0, socket, ConnectionPending);
+		udpConnection->StartConnect(connectMessage);
+		connection = udpConnection;
+	}
+
+	if (holdConnectDatagram)
+		connection->PauseOutboundSends();
+	connection->RegisterInboundMessageHandler(messageHandler);
+	AssignConnectionToWorkerThread(connection);
+
+	connections.insert(connection);
+	return connection;
+}
+
+Ptr(MessageConnection) Network::ConnectAsync(const char *address, unsigned short port, SocketTransportLayer transport,
+	IMessageHandler *messageHandler, Datagram *connectMessage, int timeoutMSecs, bool holdConnectDatagram)
+{
+	if (!address || (transport != SocketOverTCP && transport != SocketOverUDP))
+	{
+		LOG(LogError, "Network::ConnectAsync: Invalid address or transport!");
+		return 0;
+	}
+	if (timeoutMSecs <= 0)
+	{
+		LOG(LogError, "Network::ConnectAsync: Invalid timeout %d msecs!", timeoutMSecs);
+		return 0;
+	}
+
+	// The connection gets a placeholder Socket without a handle, which the worker thread replaces once connected.
+	const size_t maxSendSize = (transport == SocketOverTCP) ? cMaxTCPSendSize : cMaxUDPSendSize;
+	Socket *socket = StoreSocket(Socket(localHostName.c_str(), address, transport, maxSendSize));
+
+	ConnectAttempt *attempt = new ConnectAttempt;
+	attempt->resolve = Resolver().Resolve(address);
+	attempt->port = port;
+	attempt->socket = INVALID_SOCKET;
+	attempt->localHostName = localHostName;
 
 	Ptr(MessageConnection) connection;
 	if (transport == SocketOverTCP)
-		connection = new TCPMessageConnection(this, 0, socket, ConnectionOK);
+		connection = new TCPMessageConnection(this, 0, socket, ConnectionPending);
 	else
-		connection = new UDPMessageConnection(this, 0, socket, ConnectionPending);
+	{
+		UDPMessageConnection *udpConnection = new UDPMessageConnection(this, 0, socket, ConnectionPending);
+		udpConnection->StartConnect(connectMessage);
+		connection = udpConnection;
+	}
+	// The worker thread fills in the spare socket once connected, and swaps it with the placeholder.
+	connection->spareSocket = StoreSocket(*socket);
+	connection->connectAttempt = attempt;
+	if (holdConnectDatagram)
+		connection->PauseOutboundSends();
+	// Over UDP, the timeout also covers the wait for the reply of the server to the Connection Start datagram.
+	connection->connectTimeoutTick = Clock::Tick() + (tick_t)timeoutMSecs * Clock::TicksPerMillisecond();
 
 	connection->RegisterInboundMessageHandler(messageHandler);
 	AssignConnectionToWorkerThread(connection);
@@ -743,6 +871,13 @@ Ptr(MessageConnection) Network::Connect(const char *address, unsigned short port
 	return connection;
 }
 
+HostResolver &Network::Resolver()
+{
+	if (!resolver)
+		resolver = new HostResolver();
+	return *resolver;
+}
+
 Socket *Network::CreateUDPSlaveSocket(Socket *serverListenSocket, const EndPoint &remoteEndPoint, const char *remoteHostName)
 {
 	if (!serverListenSocket)
@@ -758,9 +893,8 @@ Socket *Network::CreateUDPSlaveSocket(Socket *serverListenSocket, const EndPoint
 		return 0;
 	}
 
-	sockets.push_back(Socket(udpSocket, serverListenSocket->LocalEndPoint(),
+	Socket *socket = StoreSocket(Socket(udpSocket, serverListenSocket->LocalEndPoint(),
 		serverListenSocket->LocalAddress(), remoteEndPoint, remoteHostName, SocketOverUDP, ServerClientSocket, cMaxUDPSendSize));
-	Socket *socket = &sockets.back();
 	socket->SetBlocking(false);
 
 	LOG(LogInfo, "Network::CreateUDPSlaveSocket: Connected an UDP socket to %s.", socket->ToString().c_str());
@@ -769,33 +903,33 @@ Socket *Network::CreateUDPSlaveSocket(Socket *serverListenSocket, const EndPoint
 
 Socket *Network::StoreSocket(const Socket &cp)
 {
-	sockets.push_back(cp);
-	return &sockets.back();
+	Socket *socket;
+	if (!freeSockets.empty())
+	{
+		// Assigning over a released socket reuses the storage of its host name strings as well.
+		socket = freeSockets.back();
+		freeSockets.pop_back();
+		*socket = cp;
+	}
+	else
+		socket = new Socket(cp);
+	socket->networkIndex = sockets.size();
+	sockets.push_back(socket);
+	return socket;
 }
 
-void Network::SendUDPConnectDatagram(Socket &socket, Datagram *connectMessage)
+void Network::ReleaseSocket(Socket *socket)
 {
-	OverlappedTransferBuffer *sendData = socket.BeginSend();
-	if (!sendData)
-	{
-		LOG(LogError, "Network::SendUDPConnectDatagram: socket.BeginSend failed! Cannot send UDP connection datagram!");
-		return;
-	}
-	if (connectMessage)
-	{
-		///\todo Craft the proper connection attempt datagram.
-		sendData->bytesContains = std::min<int>(connectMessage->size, sendData->buffer.len);
-		memcpy(sendData->buffer.buf, connectMessage->data, sendData->buffer.len);
-		LOG(LogVerbose, "Network::SendUDPConnectDatagram: Sending UDP connect message of size %d.", (int)sendData->buffer.len);
-	}
+	// Move the last socket to the freed slot.
+	Socket *last = sockets.back();
+	sockets[socket->networkIndex] = last;
+	last->networkIndex = socket->networkIndex;
+	sockets.pop_back();
+
+	if (freeSockets.size() < cMaxFreeSockets)
+		freeSockets.push_back(socket);
 	else
-	{
-		///\todo Craft the proper connection attempt datagram.
-		sendData->bytesContains = std::min<int>(8, sendData->buffer.len);
-		memset(sendData->buffer.buf, 0, sendData->buffer.len);
-		LOG(LogVerbose, "Network::SendUDPConnectDatagram: Sending null UDP connect message of size %d.", (int)sendData->buffer.len);
-	}
-	socket.EndSend(sendData);
+		delete socket;
 }
 
 } // ~kNet
@@ -22,6 +22,9 @@
 #include <cstdio>
 #include <string>
 #include <cstring>
+#include <vector>
+#include <algorithm>
+#include <atomic>
 
 #ifdef KNET_USE_BOOST
 #include <boost/thread/thread.hpp>
@@ -32,6 +35,8 @@
 #include "kNet/NetworkLogging.h"
 #include "kNet/Lockable.h"
 #include "kNet/Clock.h"
+#include "kNet/Thread.h"
+#include "kNet/Types.h"
 
 #if defined(__unix) || defined(ANDROID) || defined(__APPLE__)
 #define _snprintf snprintf
@@ -51,61 +56,419 @@ ofstream kNetLogFile;
 
 Lockable<int> logWriteMutex;
 
-string Time()
+/// The maximum number of lines per second per call site, or 0 if the rate is not limited.
+std::atomic<int> logRateLimit(0);
+std::atomic<u64> numRateLimitedLines(0);
+std::atomic<u64> numDroppedLines(0);
+
+/// The tick the log timestamps are relative to.
+tick_t LogStartTick()
 {
-	static tick_t firstTick;
-	static bool firstCall = true;
-	if (firstCall)
-	{
-		firstCall = false;
-		firstTick = Clock::Tick();
-		return "0.000";
-	}
-	double t = Clock::SecondsSinceD(firstTick);
+	static const tick_t startTick = Clock::Tick();
+	return startTick;
+}
+
+string Time(tick_t tick)
+{
+	const tick_t startTick = LogStartTick();
+	double t = Clock::IsNewer(tick, startTick) ? Clock::TimespanToSecondsD(startTick, tick) : 0.0;
 	std::stringstream ss;
 	ss << t;
+	return ss.str();
+}
+
+string CurrentThreadIdString()
+{
 #ifdef KNET_USE_BOOST
-	ss << ", " << boost::this_thread::get_id();
-#endif
+	std::stringstream ss;
+	ss << boost::this_thread::get_id();
 	return ss.str();
+#else
+	return "";
+#endif
+}
+
+/// Writes a line to the log file, or to std::cout if there is no log file. The caller must hold logWriteMutex.
+void WriteLine(tick_t tick, const string &threadId, const char *text, bool flush)
+{
+	std::ostream &out = kNetLogFile.is_open() ? (std::ostream &)kNetLogFile : std::cout;
+	out << Time(tick);
+#ifdef KNET_USE_BOOST
+	out << ", " << threadId;
+#else
+	(void)threadId;
+#endif
+	out << ": " << text << '\n';
+	if (flush)
+		out.flush();
+}
+
+/// The rate limit bookkeeping of a single LOG() call site.
+struct LogCallSite
+{
+	/// Identifies the call site by its file name pointer and line number. Zero while the slot is free.
+	std::atomic<u64> key;
+	/// The second the count is for.
+	std::atomic<u64> second;
+	/// The number of lines the call site has logged during that second.
+	std::atomic<u32> count;
+	/// The number of lines that were suppressed since the call site last printed.
+	std::atomic<u32> suppressed;
+};
+
+const int cLogCallSiteBits = 10;
+const int cMaxLogCallSiteProbes = 16;
+/// An open-addressed hash table of call sites. Static storage, so the atomics start out zeroed.
+LogCallSite logCallSites[1 << cLogCallSiteBits];
+
+/// Returns the rate limit state of the given call site, or 0 if the table is full.
+LogCallSite *FindLogCallSite(const char *filename, int lineNumber)
+{
+	// __FILE__ is a string literal, so its address and the line number identify the call site.
+	u64 key = (u64)(uintptr_t)filename ^ ((u64)(u32)lineNumber << 48);
+	if (key == 0)
+		key = 1;
+	const u32 hash = (u32)((key * 0x9E3779B97F4A7C15ULL) >> (64 - cLogCallSiteBits));
+	for(int i = 0; i < cMaxLogCallSiteProbes; ++i)
+	{
+		LogCallSite &site = logCallSites[(hash + i) & ((1 << cLogCallSiteBits) - 1)];
+		u64 siteKey = site.key.load(std::memory_order_acquire);
+		if (siteKey == key)
+			return &site;
+		if (siteKey == 0 && (site.key.compare_exchange_strong(siteKey, key) || siteKey == key))
+			return &site;
+	}
+	return 0;
+}
+
+/// Returns true if the call site may print a line at the given time, otherwise counts the line as suppressed.
+/// @param numSuppressed [out] Receives the number of lines of this call site that were suppressed since it last printed.
+bool PassLogRateLimit(const char *filename, int lineNumber, tick_t now, u32 &numSuppressed)
+{
+	numSuppressed = 0;
+	const int limit = logRateLimit.load(std::memory_order_relaxed);
+	if (limit <= 0)
+		return true;
+	LogCallSite *site = FindLogCallSite(filename, lineNumber);
+	if (!site)
+		return true;
+
+	const u64 second = now / Clock::TicksPerSec();
+	u64 siteSecond = site->second.load(std::memory_order_relaxed);
+	if (siteSecond != second && site->second.compare_exchange_strong(siteSecond, second))
+		site->count.store(0, std::memory_order_relaxed);
+	if (site->count.fetch_add(1, std::memory_order_relaxed) >= (u32)limit)
+	{
+		site->suppressed.fetch_add(1, std::memory_order_relaxed);
+		numRateLimitedLines.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	numSuppressed = site->suppressed.exchange(0, std::memory_order_relaxed);
+	return true;
+}
+
+/// A single-producer, single-consumer ring buffer of formatted log lines. Each thread that logs in asynchronous mode
+/// owns one, and the AsyncLogger thread drains them all.
+struct LogRing
+{
+	static const u32 cCapacity = 64 * 1024;
+
+	/// The header of each record in the ring. The NUL-terminated text follows it.
+	struct Record
+	{
+		/// The size of the whole record in bytes, a multiple of 8.
+		u32 size;
+		/// The length of the text, or cPaddingRecord if the rest of the ring is skipped and the next record is at its start.
+		u32 textLength;
+		tick_t tick;
+	};
+	static const u32 cPaddingRecord = 0xFFFFFFFF;
+
+	LogRing()
+	:head(0), tail(0), numDropped(0), numDroppedReported(0), orphaned(false), threadId(CurrentThreadIdString())
+	{
+	}
+
+	/// Appends a line to the ring. [producer thread]
+	/// @return False if the line did not fit, in which case it was counted as dropped.
+	bool Push(tick_t tick, const char *text, u32 textLength)
+	{
+		const u32 size = (u32)((sizeof(Record) + textLength + 1 + 7) & ~(size_t)7);
+		u64 writePos = head.load(std::memory_order_relaxed);
+		const u64 readPos = tail.load(std::memory_order_acquire);
+		u32 offset = (u32)(writePos % cCapacity);
+		const u32 contiguous = cCapacity - offset;
+		const u32 padding = (contiguous < size) ? contiguous : 0;
+		if (writePos + padding + size - readPos > cCapacity)
+		{
+			numDropped.fetch_add(1, std::memory_order_relaxed);
+			numDroppedLines.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		if (padding > 0)
+		{
+			// The offsets are multiples of 8, so the size and textLength fields of a padding record always fit.
+			Record *pad = (Record *)(data + offset);
+			pad->size = padding;
+			pad->textLength = cPaddingRecord;
+			writePos += padding;
+			offset = 0;
+		}
+		Record *record = (Record *)(data + offset);
+		record->size = size;
+		record->textLength = textLength;
+		record->tick = tick;
+		memcpy(data + offset + sizeof(Record), text, textLength);
+		data[offset + sizeof(Record) + textLength] = '\0';
+		head.store(writePos + size, std::memory_order_release);
+		return true;
+	}
+
+	/// A line taken out of a ring, waiting to be written.
+	struct Line
+	{
+		tick_t tick;
+		const string *threadId;
+		string text;
+
+		bool operator <(const Line &rhs) const { return Clock::IsNewer(rhs.tick, tick) && rhs.tick != tick; }
+	};
+
+	/// Moves all the lines in the ring to the given list. [consumer thread]
+	void Drain(std::vector<Line> &out)
+	{
+		u64 readPos = tail.load(std::memory_order_relaxed);
+		const u64 writePos = head.load(std::memory_order_acquire);
+		while(readPos != writePos)
+		{
+			const Record *record = (const Record *)(data + readPos % cCapacity);
+			if (record->textLength != cPaddingRecord)
+			{
+				Line line;
+				line.tick = record->tick;
+				line.threadId = &threadId;
+				line.text.assign((const char *)(record + 1), record->textLength);
+				out.push_back(line);
+			}
+			readPos += record->size;
+		}
+		tail.store(readPos, std::memory_order_release);
+	}
+
+	char data[cCapacity];
+	/// The total number of bytes written into the ring by the producer.
+	std::atomic<u64> head;
+	/// The total number of bytes consumed from the ring by the consumer.
+	std::atomic<u64> tail;
+	/// The number of lines that did not fit into the ring.
+	std::atomic<u64> numDropped;
+	/// The value of numDropped the consumer has last reported. [consumer thread]
+	u64 numDroppedReported;
+	/// Set when the producer thread exits. The consumer frees the ring after draining it.
+	std::atomic<bool> orphaned;
+	string threadId;
+};
+
+/// The background thread of asynchronous logging, and the registry of the per-thread rings it drains.
+class AsyncLogger
+{
+public:
+	AsyncLogger()
+	:enabled(false)
+	{
+	}
+
+	~AsyncLogger()
+	{
+		SetEnabled(false);
+		Lockable<std::vector<LogRing *> >::LockType lock = rings.Acquire();
+		for(size_t i = 0; i < lock->size(); ++i)
+			delete (*lock)[i];
+		lock->clear();
+	}
+
+	bool Enabled() const { return enabled.load(std::memory_order_acquire); }
+
+	void SetEnabled(bool enable)
+	{
+		Lockable<int>::LockType lock = controlMutex.Acquire();
+		if (enable == Enabled())
+			return;
+		if (enable)
+		{
+			enabled.store(true, std::memory_order_release);
+			thread.Run(this, &AsyncLogger::MainLoop);
+			thread.SetName("kNet AsyncLogger");
+		}
+		else
+		{
+			enabled.store(false, std::memory_order_release);
+			thread.Stop();
+			Drain(); // Lines queued just before the switch.
+		}
+	}
+
+	/// Returns the ring of the calling thread, creating it first if needed.
+	LogRing *ThreadRing();
+
+	/// Writes out all the queued lines of all threads in timestamp order. [any thread]
+	/// @return The number of lines written.
+	size_t Drain()
+	{
+		Lockable<int>::LockType drainLock = drainMutex.Acquire();
+		std::vector<LogRing *> orphans;
+		{
+			Lockable<std::vector<LogRing *> >::LockType lock = rings.Acquire();
+			for(size_t i = 0; i < lock->size(); ++i)
+			{
+				LogRing *ring = (*lock)[i];
+				// Read the flag before draining, so that no line pushed before the thread exited is left behind.
+				const bool orphaned = ring->orphaned.load(std::memory_order_acquire);
+				ring->Drain(lines);
+				const u64 numDropped = ring->numDropped.load(std::memory_order_relaxed);
+				if (numDropped != ring->numDroppedReported)
+				{
+					LogRing::Line line;
+					line.tick = Clock::Tick();
+					line.threadId = &ring->threadId;
+					std::stringstream ss;
+					ss << "kNet logging: Dropped " << (numDropped - ring->numDroppedReported) << " lines, since the log ring of the thread was full.";
+					line.text = ss.str();
+					lines.push_back(line);
+					ring->numDroppedReported = numDropped;
+				}
+				if (orphaned)
+				{
+					orphans.push_back(ring);
+					(*lock)[i] = lock->back();
+					lock->pop_back();
+					--i;
+				}
+			}
+		}
+
+		const size_t numLines = lines.size();
+		if (numLines > 0)
+		{
+			std::stable_sort(lines.begin(), lines.end());
+			Lockable<int>::LockType lock = logWriteMutex.Acquire();
+			for(size_t i = 0; i < lines.size(); ++i)
+				WriteLine(lines[i].tick, *lines[i].threadId, lines[i].text.c_str(), i + 1 == lines.size());
+		}
+		lines.clear();
+		for(size_t i = 0; i < orphans.size(); ++i)
+			delete orphans[i];
+		return numLines;
+	}
+
+private:
+	std::atomic<bool> enabled;
+	Lockable<std::vector<LogRing *> > rings;
+	/// Serializes the consumers: the background thread and FlushLog() callers.
+	Lockable<int> drainMutex;
+	/// Serializes SetEnabled() calls.
+	Lockable<int> controlMutex;
+	/// The lines taken out of the rings in the current Drain() call, kept to reuse the memory. Guarded by drainMutex.
+	std::vector<LogRing::Line> lines;
+	Thread thread;
+
+	void MainLoop()
+	{
+		// How long the thread sleeps when there is nothing to write.
+		const int cIdleSleepMSecs = 5;
+		while(!thread.ShouldQuit())
+			if (Drain() == 0)
+				Thread::Sleep(cIdleSleepMSecs);
+	}
+};
+
+AsyncLogger asyncLogger;
+
+/// Marks the ring of a thread orphaned when the thread exits.
+struct ThreadLogRing
+{
+	LogRing *ring;
+
+	ThreadLogRing():ring(0) {}
+	~ThreadLogRing()
+	{
+		if (ring)
+			ring->orphaned.store(true, std::memory_order_release);
+	}
+};
+
+thread_local ThreadLogRing threadLogRing;
+
+LogRing *AsyncLogger::ThreadRing()
+{
+	if (!threadLogRing.ring)
+	{
+		threadLogRing.ring = new LogRing();
+		rings.Acquire()->push_back(threadLogRing.ring);
+	}
+	return threadLogRing.ring;
+}
+
+/// Sends a formatted line to the log, either directly or through the ring of the calling thread.
+void OutputLine(tick_t tick, const char *text, u32 numSuppressed)
+{
+	char suppressedStr[1100];
+	if (numSuppressed > 0)
+	{
+		_snprintf(suppressedStr, sizeof(suppressedStr), "%s (%u similar lines suppressed)", text, numSuppressed);
+		suppressedStr[sizeof(suppressedStr)-1] = '\0';
+		text = suppressedStr;
+	}
+
+	if (asyncLogger.Enabled())
+	{
+		asyncLogger.ThreadRing()->Push(tick, text, (u32)strlen(text));
+		return;
+	}
+
+	Lockable<int>::LockType lock = logWriteMutex.Acquire();
+	WriteLine(tick, CurrentThreadIdString(), text, true);
 }
 
 } // ~unnamed namespace
 
-void TimeOutputDebugStringVariadic(LogChannel logChannel, const char * /*filename*/, int /*lineNumber*/, const char *msg, ...)
+void TimeOutputDebugStringVariadic(LogChannel logChannel, const char *filename, int lineNumber, const char *msg, ...)
 {
 	if (!IsLogChannelActive(logChannel))
 		return;
 
-	Lockable<int>::LockType lock = logWriteMutex.Acquire();
+	LogStartTick();
+	const tick_t now = Clock::Tick();
+	u32 numSuppressed;
+	if (!PassLogRateLimit(filename, lineNumber, now, numSuppressed))
+		return;
 
 	char errorStr[1024];
 	va_list args;
 	va_start(args, msg);
 	vsnprintf(errorStr, 1023, msg, args);
-
-	if (kNetLogFile.is_open())
-		kNetLogFile << Time() << ": " << errorStr << std::endl;
-	else
-		std::cout << Time() << ": " << errorStr << std::endl;
-
 	va_end(args);
+	errorStr[1023] = '\0';
+
+	OutputLine(now, errorStr, numSuppressed);
 }
 
-void TimeOutputDebugString(LogChannel logChannel, const char * /*filename*/, int /*lineNumber*/, const char *msg)
+void TimeOutputDebugString(LogChannel logChannel, const char *filename, int lineNumber, const char *msg)
 {
 	if ((logChannel & kNetActiveLogChannels) == 0)
 		return;
 
-	Lockable<int>::LockType lock = logWriteMutex.Acquire();
+	LogStartTick();
+	const tick_t now = Clock::Tick();
+	u32 numSuppressed;
+	if (!PassLogRateLimit(filename, lineNumber, now, numSuppressed))
+		return;
 
 	char errorStr[1024];
 	_snprintf(errorStr, 1023, "%s", msg);
+	errorStr[1023] = '\0';
 
-	if (kNetLogFile.is_open())
-		kNetLogFile << Time() << ": " << errorStr << std::endl;
-	else
-		std::cout << Time() << ": " << errorStr << std::endl;
+	OutputLine(now, errorStr, numSuppressed);
 }
 
 void SetLogChannels(LogChannel logChannels)
@@ -132,6 +495,41 @@ void SetLogFile(const char *filename)
 		kNetLogFile.open(filename, ios::app);
 }
 
+void SetAsyncLogging(bool enabled)
+{
+	asyncLogger.SetEnabled(enabled);
+}
+
+bool IsAsyncLoggingEnabled()
+{
+	return asyncLogger.Enabled();
+}
+
+void FlushLog()
+{
+	asyncLogger.Drain();
+	Lockable<int>::LockType lock = logWriteMutex.Acquire();
+	if (kNetLogFile.is_open())
+		kNetLogFile.flush();
+	else
+		std::cout.flush();
+}
+
+void SetLogRateLimit(int maxLinesPerSecond)
+{
+	logRateLimit.store(maxLinesPerSecond, std::memory_order_relaxed);
+}
+
+unsigned long long NumDroppedLogLines()
+{
+	return numDroppedLines.load(std::memory_order_relaxed);
+}
+
+unsigned long long NumRateLimitedLogLines()
+{
+	return numRateLimitedLines.load(std::memory_order_relaxed);
+}
+
 void EnableMemoryLeakLoggingAtExit()
 {
 #ifdef _MSC_VER
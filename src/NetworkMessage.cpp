@@ -36,6 +36,10 @@ obsolete(false),
 priority(0),
 transfer(0)
 {
+	enqueueTick = packTick = sendTick = 0;
+#ifdef KNET_NETWORK_PROFILING
+	profilerMetric = cInvalidStatsMetric;
+#endif
 }
 
 NetworkMessage::NetworkMessage(const NetworkMessage &rhs)
@@ -0,0 +1,717 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file NetworkMetrics.cpp
+	@brief */
+
+#include <string>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+#if defined(__unix) || defined(ANDROID) || defined(__APPLE__)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+
+#include "kNet/DebugMemoryLeakCheck.h"
+
+#include "kNet/NetworkMetrics.h"
+#include "kNet/Network.h"
+#include "kNet/NetworkServer.h"
+#include "kNet/UDPMessageConnection.h"
+#include "kNet/NetworkLogging.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace kNet
+{
+
+namespace
+{
+
+/// The longest request header the endpoint reads. Scrapers send only a few short lines.
+const size_t cMaxRequestSize = 4096;
+/// How long the endpoint waits for a client to send its request, or to make room for the next part of the response,
+/// before dropping it.
+const int cRequestTimeoutMSecs = 1000;
+/// How often the serving thread checks whether it should quit.
+const int cQuitPollMSecs = 100;
+
+bool IsValidSocket(SOCKET s)
+{
+	return s != INVALID_SOCKET && s != (SOCKET)KNET_SOCKET_ERROR;
+}
+
+/// Waits until the given socket is readable.
+/// @return True if the socket became readable before the timeout.
+bool WaitReadable(SOCKET s, int msecs)
+{
+	// The endpoint runs next to the connections of the server, so its descriptors may be past FD_SETSIZE.
+#ifdef WIN32
+	fd_set readSet;
+	FD_ZERO(&readSet);
+	FD_SET(s, &readSet);
+	TIMEVAL tv;
+	tv.tv_sec = msecs / 1000;
+	tv.tv_usec = (msecs % 1000) * 1000;
+	return select((int)s + 1, &readSet, 0, 0, &tv) > 0;
+#else
+	pollfd readPoll;
+	readPoll.fd = s;
+	readPoll.events = POLLIN;
+	readPoll.revents = 0;
+	return poll(&readPoll, 1, msecs) > 0;
+#endif
+}
+
+std::string FormatNumber(double value)
+{
+	if (!(value == value) || value > 1e300 || value < -1e300) // NaN and inf are not valid JSON.
+		return "0";
+	char str[64];
+	sprintf(str, "%.9g", value);
+	return str;
+}
+
+std::string FormatNumber(u64 value)
+{
+	char str[32];
+	sprintf(str, "%llu", (unsigned long long)value);
+	return str;
+}
+
+std::string JSONString(const std::string &str)
+{
+	std::string out = "\"";
+	for(size_t i = 0; i < str.length(); ++i)
+	{
+		const unsigned char c = (unsigned char)str[i];
+		if (c == '"' || c == '\\')
+		{
+			out += '\\';
+			out += (char)c;
+		}
+		else if (c < 0x20)
+		{
+			char escape[8];
+			sprintf(escape, "\\u%04x", (unsigned int)c);
+			out += escape;
+		}
+		else
+			out += (char)c;
+	}
+	return out + "\"";
+}
+
+/// Escapes the given string to be used as a Prometheus label value.
+std::string LabelValue(const std::string &str)
+{
+	std::string out = "\"";
+	for(size_t i = 0; i < str.length(); ++i)
+		if (str[i] == '"' || str[i] == '\\')
+		{
+			out += '\\';
+			out += str[i];
+		}
+		else if (str[i] == '\n')
+			out += "\\n";
+		else
+			out += str[i];
+	return out + "\"";
+}
+
+const char *TransportName(SocketTransportLayer transport)
+{
+	switch(transport)
+	{
+	case SocketOverUDP: return "udp";
+	case SocketOverTCP: return "tcp";
+	default: return "invalid";
+	}
+}
+
+void WriteHistogramJSON(std::stringstream &ss, const char *name, const HistogramMetrics &h)
+{
+	ss << "\"" << name << "\":{\"count\":" << FormatNumber(h.count) << ",\"sum\":" << FormatNumber(h.sum)
+		<< ",\"p50\":" << h.p50 << ",\"p90\":" << h.p90 << ",\"p99\":" << h.p99 << ",\"max\":" << h.max << "}";
+}
+
+/// Writes the metric families of the Prometheus text format, with the HELP and TYPE lines before the samples of each family.
+class PrometheusWriter
+{
+public:
+	void Family(const char *name, const char *type, const char *help)
+	{
+		ss << "# HELP knet_" << name << " " << help << "\n# TYPE knet_" << name << " " << type << "\n";
+	}
+
+	void Sample(const char *name, const std::string &labels, const std::string &value)
+	{
+		ss << "knet_" << name;
+		if (!labels.empty())
+			ss << "{" << labels << "}";
+		ss << " " << value << "\n";
+	}
+
+	void Sample(const char *name, const std::string &labels, double value) { Sample(name, labels, FormatNumber(value)); }
+	void Sample(const char *name, const std::string &labels, u64 value) { Sample(name, labels, FormatNumber(value)); }
+
+	/// Writes the quantiles, sum and count of a summary family.
+	void Summary(const char *name, const std::string &labels, const HistogramMetrics &h)
+	{
+		const std::string sep = labels.empty() ? "" : ",";
+		Sample(name, labels + sep + "quantile=\"0.5\"", (u64)h.p50);
+		Sample(name, labels + sep + "quantile=\"0.9\"", (u64)h.p90);
+		Sample(name, labels + sep + "quantile=\"0.99\"", (u64)h.p99);
+		Sample(name, labels + sep + "quantile=\"1\"", (u64)h.max);
+		Sample((std::string(name) + "_sum").c_str(), labels, h.sum);
+		Sample((std::string(name) + "_count").c_str(), labels, h.count);
+	}
+
+	std::string str() const { return ss.str(); }
+
+private:
+	std::stringstream ss;
+};
+
+} // ~unnamed namespace
+
+void NetworkMetrics::Clear()
+{
+	workerThreads.clear();
+	servers.clear();
+	connections.clear();
+	counters.clear();
+	locks.clear();
+}
+
+void SummarizeHistogram(const LogHistogram &histogram, HistogramMetrics &out)
+{
+	out.count = histogram.Count();
+	out.sum = histogram.Sum();
+	out.p50 = histogram.Percentile(0.5);
+	out.p90 = histogram.Percentile(0.9);
+	out.p99 = histogram.Percentile(0.99);
+	out.max = histogram.Max();
+}
+
+void SnapshotConnectionMetrics(const MessageConnection &connection, ConnectionMetrics &out)
+{
+	const Socket *socket = connection.GetSocket();
+	out.localEndPoint = connection.LocalEndPoint().ToString();
+	out.remoteEndPoint = connection.RemoteEndPoint().ToString();
+	out.transport = socket ? socket->TransportLayer() : InvalidTransportLayer;
+	out.state = connection.GetConnectionState();
+	out.serverSide = socket && socket->Type() == ServerClientSocket;
+	out.hibernating = connection.IsHibernating();
+	out.workerThread = -1;
+
+	out.roundTripTime = connection.RoundTripTime();
+	out.lastHeardTime = connection.LastHeardTime();
+	out.bytesInTotal = connection.BytesInTotal();
+	out.bytesOutTotal = connection.BytesOutTotal();
+	connection.TrafficStatistics(out.traffic);
+	out.inboundMessagesPending = (u32)connection.NumInboundMessagesPending();
+	out.outboundMessagesPending = (u32)connection.NumOutboundMessagesPending();
+
+	const UDPMessageConnection *udpConnection = dynamic_cast<const UDPMessageConnection *>(&connection);
+	out.packetLossRate = udpConnection ? udpConnection->PacketLossRate() : 0.f;
+	out.retransmissionTimeout = udpConnection ? udpConnection->RetransmissionTimeout() : 0.f;
+	out.datagramSendRate = udpConnection ? udpConnection->DatagramSendRate() : 0.f;
+	out.outboundUnackedDatagrams = udpConnection ? (u32)udpConnection->NumOutboundUnackedDatagrams() : 0;
+
+	out.messageTypes.clear();
+	std::vector<message_id_t> ids;
+	connection.MessageTypeIds(ids);
+	out.messageTypes.reserve(ids.size());
+	for(size_t i = 0; i < ids.size(); ++i)
+	{
+		const MessageTypeStats s = connection.MessageTypeStatistics(ids[i]);
+		MessageTypeMetrics m;
+		m.id = ids[i];
+		SummarizeHistogram(s.queueTimeUSecs, m.queueTimeUSecs);
+		SummarizeHistogram(s.ackTimeUSecs, m.ackTimeUSecs);
+		SummarizeHistogram(s.sizeBytes, m.sizeBytes);
+		out.messageTypes.push_back(m);
+	}
+}
+
+void SnapshotServerMetrics(const NetworkServer &server, ServerMetrics &out)
+{
+	out.description = server.ToString();
+	out.listenPorts.clear();
+	const std::vector<Socket *> &listenSockets = server.ListenSockets();
+	for(size_t i = 0; i < listenSockets.size(); ++i)
+		out.listenPorts.push_back(std::make_pair(listenSockets[i]->LocalPort(), listenSockets[i]->TransportLayer()));
+	out.acceptsNewConnections = server.AcceptsNewConnections();
+	out.numConnections = server.NumConnections();
+	out.workerThread = -1;
+}
+
+std::string MetricsToJSON(const NetworkMetrics &metrics)
+{
+	std::stringstream ss;
+	ss << "{\"workerThreads\":[";
+	for(size_t i = 0; i < metrics.workerThreads.size(); ++i)
+	{
+		const WorkerThreadMetrics &w = metrics.workerThreads[i];
+		ss << (i > 0 ? "," : "") << "{\"connections\":" << w.numConnections << ",\"servers\":" << w.numServers
+			<< ",\"loop\":{\"iterations\":" << FormatNumber(w.loop.iterations) << ",\"elapsedMSecs\":" << FormatNumber(w.loop.elapsedMSecs);
+		for(int j = 0; j < NumWorkerLoopPhases; ++j)
+			ss << ",\"" << WorkerLoopPhaseToString((WorkerLoopPhase)j) << "MSecs\":" << FormatNumber(w.loop.phaseMSecs[j]);
+		ss << ",\"otherMSecs\":" << FormatNumber(w.loop.OtherMSecs()) << "}}";
+	}
+
+	ss << "],\"servers\":[";
+	for(size_t i = 0; i < metrics.servers.size(); ++i)
+	{
+		const ServerMetrics &s = metrics.servers[i];
+		ss << (i > 0 ? "," : "") << "{\"description\":" << JSONString(s.description) << ",\"listenPorts\":[";
+		for(size_t j = 0; j < s.listenPorts.size(); ++j)
+			ss << (j > 0 ? "," : "") << "{\"port\":" << s.listenPorts[j].first
+				<< ",\"transport\":" << JSONString(SocketTransportLayerToString(s.listenPorts[j].second)) << "}";
+		ss << "],\"acceptsNewConnections\":" << (s.acceptsNewConnections ? "true" : "false")
+			<< ",\"connections\":" << s.numConnections << ",\"workerThread\":" << s.workerThread << "}";
+	}
+
+	ss << "],\"connections\":[";
+	for(size_t i = 0; i < metrics.connections.size(); ++i)
+	{
+		const ConnectionMetrics &c = metrics.connections[i];
+		const TrafficStatsSnapshot &t = c.traffic;
+		ss << (i > 0 ? "," : "") << "{\"localEndPoint\":" << JSONString(c.localEndPoint)
+			<< ",\"remoteEndPoint\":" << JSONString(c.remoteEndPoint)
+			<< ",\"transport\":" << JSONString(SocketTransportLayerToString(c.transport))
+			<< ",\"state\":" << JSONString(ConnectionStateToString(c.state))
+			<< ",\"serverSide\":" << (c.serverSide ? "true" : "false")
+			<< ",\"hibernating\":" << (c.hibernating ? "true" : "false")
+			<< ",\"workerThread\":" << c.workerThread
+			<< ",\"roundTripTime\":" << FormatNumber(c.roundTripTime)
+			<< ",\"lastHeardTime\":" << FormatNumber(c.lastHeardTime)
+			<< ",\"bytesInTotal\":" << FormatNumber(c.bytesInTotal)
+			<< ",\"bytesOutTotal\":" << FormatNumber(c.bytesOutTotal)
+			<< ",\"inboundMessagesPending\":" << c.inboundMessagesPending
+			<< ",\"outboundMessagesPending\":" << c.outboundMessagesPending
+			<< ",\"traffic\":{\"windowSecs\":" << FormatNumber(t.windowSecs)
+			<< ",\"packetsIn\":" << FormatNumber(t.packetsIn) << ",\"packetsOut\":" << FormatNumber(t.packetsOut)
+			<< ",\"messagesIn\":" << FormatNumber(t.messagesIn) << ",\"messagesOut\":" << FormatNumber(t.messagesOut)
+			<< ",\"bytesIn\":" << FormatNumber(t.bytesIn) << ",\"bytesOut\":" << FormatNumber(t.bytesOut) << "}";
+		if (c.transport == SocketOverUDP)
+			ss << ",\"udp\":{\"packetLossRate\":" << FormatNumber(c.packetLossRate)
+				<< ",\"retransmissionTimeout\":" << FormatNumber(c.retransmissionTimeout)
+				<< ",\"datagramSendRate\":" << FormatNumber(c.datagramSendRate)
+				<< ",\"outboundUnackedDatagrams\":" << c.outboundUnackedDatagrams << "}";
+		ss << ",\"messageTypes\":[";
+		for(size_t j = 0; j < c.messageTypes.size(); ++j)
+		{
+			const MessageTypeMetrics &m = c.messageTypes[j];
+			ss << (j > 0 ? "," : "") << "{\"id\":" << m.id << ",";
+			WriteHistogramJSON(ss, "queueTimeUSecs", m.queueTimeUSecs);
+			ss << ",";
+			WriteHistogramJSON(ss, "ackTimeUSecs", m.ackTimeUSecs);
+			ss << ",";
+			WriteHistogramJSON(ss, "sizeBytes", m.sizeBytes);
+			ss << "}";
+		}
+		ss << "]}";
+	}
+
+	ss << "],\"counters\":[";
+	bool first = true;
+	for(size_t i = 0; i < metrics.counters.size(); ++i)
+	{
+		const StatsSample &s = metrics.counters[i];
+		if (s.count == 0)
+			continue;
+		ss << (first ? "" : ",") << "{\"name\":" << JSONString(StatsMetricName((StatsMetricId)i))
+			<< ",\"unit\":" << JSONString(StatsMetricUnit((StatsMetricId)i))
+			<< ",\"count\":" << FormatNumber(s.count) << ",\"sum\":" << FormatNumber(s.sum)
+			<< ",\"min\":" << FormatNumber(s.min) << ",\"max\":" << FormatNumber(s.max)
+			<< ",\"latest\":" << FormatNumber(s.latest) << "}";
+		first = false;
+	}
+
+	ss << "],\"locks\":[";
+	for(size_t i = 0; i < metrics.locks.size(); ++i)
+	{
+		const LockContentionSample &l = metrics.locks[i];
+		ss << (i > 0 ? "," : "") << "{\"name\":" << JSONString(l.name)
+			<< ",\"acquisitions\":" << FormatNumber(l.acquisitions)
+			<< ",\"contendedAcquisitions\":" << FormatNumber(l.contendedAcquisitions)
+			<< ",\"totalWaitMSecs\":" << FormatNumber(l.totalWaitMSecs)
+			<< ",\"maxWaitMSecs\":" << FormatNumber(l.maxWaitMSecs) << "}";
+	}
+	ss << "]}";
+	return ss.str();
+}
+
+std::string MetricsToPrometheus(const NetworkMetrics &metrics)
+{
+	PrometheusWriter w;
+
+	w.Family("worker_threads", "gauge", "The number of running network worker threads.");
+	w.Sample("worker_threads", "", (u64)metrics.workerThreads.size());
+	w.Family("worker_connections", "gauge", "The number of connections managed by each worker thread.");
+	for(size_t i = 0; i < metrics.workerThreads.size(); ++i)
+		w.Sample("worker_connections", "worker=\"" + FormatNumber((u64)i) + "\"", (u64)metrics.workerThreads[i].numConnections);
+	w.Family("worker_servers", "gauge", "The number of servers managed by each worker thread.");
+	for(size_t i = 0; i < metrics.workerThreads.size(); ++i)
+		w.Sample("worker_servers", "worker=\"" + FormatNumber((u64)i) + "\"", (u64)metrics.workerThreads[i].numServers);
+	w.Family("worker_loop_iterations_total", "counter", "The number of main loop iterations of each worker thread.");
+	for(size_t i = 0; i < metrics.workerThreads.size(); ++i)
+		w.Sample("worker_loop_iterations_total", "worker=\"" + FormatNumber((u64)i) + "\"", metrics.workerThreads[i].loop.iterations);
+	w.Family("worker_loop_seconds_total", "counter", "The time each worker thread has spent in each phase of its main loop.");
+	for(size_t i = 0; i < metrics.workerThreads.size(); ++i)
+	{
+		const WorkerLoopStatistics &loop = metrics.workerThreads[i].loop;
+		const std::string worker = "worker=\"" + FormatNumber((u64)i) + "\",phase=\"";
+		for(int j = 0; j < NumWorkerLoopPhases; ++j)
+			w.Sample("worker_loop_seconds_total", worker + WorkerLoopPhaseToString((WorkerLoopPhase)j) + "\"", loop.phaseMSecs[j] / 1000.0);
+		w.Sample("worker_loop_seconds_total", worker + "other\"", loop.OtherMSecs() / 1000.0);
+	}
+
+	std::vector<std::string> serverLabels;
+	for(size_t i = 0; i < metrics.servers.size(); ++i)
+	{
+		std::string ports;
+		for(size_t j = 0; j < metrics.servers[i].listenPorts.size(); ++j)
+			ports += (j > 0 ? " " : "") + std::string(TransportName(metrics.servers[i].listenPorts[j].second)) + ":"
+				+ FormatNumber((u64)metrics.servers[i].listenPorts[j].first);
+		serverLabels.push_back("ports=" + LabelValue(ports));
+	}
+	w.Family("server_connections", "gauge", "The number of active connections of the server.");
+	for(size_t i = 0; i < metrics.servers.size(); ++i)
+		w.Sample("server_connections", serverLabels[i], (u64)metrics.servers[i].numConnections);
+	w.Family("server_accepts_new_connections", "gauge", "1 if the server accepts new connections, 0 otherwise.");
+	for(size_t i = 0; i < metrics.servers.size(); ++i)
+		w.Sample("server_accepts_new_connections", serverLabels[i], (u64)(metrics.servers[i].acceptsNewConnections ? 1 : 0));
+
+	const std::vector<ConnectionMetrics> &connections = metrics.connections;
+	std::vector<std::string> labels;
+	for(size_t i = 0; i < connections.size(); ++i)
+		labels.push_back("local=" + LabelValue(connections[i].localEndPoint) + ",remote=" + LabelValue(connections[i].remoteEndPoint)
+			+ ",transport=\"" + TransportName(connections[i].transport) + "\",side=\"" + (connections[i].serverSide ? "server" : "client") + "\"");
+
+	w.Family("connection_info", "gauge", "Always 1. The state label holds the current state of the connection.");
+	for(size_t i = 0; i < connections.size(); ++i)
+		w.Sample("connection_info", labels[i] + ",state=" + LabelValue(ConnectionStateToString(connections[i].state)), (u64)1);
+	w.Family("connection_hibernating", "gauge", "1 if the connection is idle and hibernating, 0 otherwise.");
+	for(size_t i = 0; i < connections.size(); ++i)
+		w.Sample("connection_hibernating", labels[i], (u64)(connections[i].hibernating ? 1 : 0));
+	w.Family("connection_rtt_milliseconds", "gauge", "The estimated round-trip time of the connection.");
+	for(size_t i = 0; i < connections.size(); ++i)
+		w.Sample("connection_rtt_milliseconds", labels[i], (double)connections[i].roundTripTime);
+	w.Family("connection_last_heard_milliseconds", "gauge", "The time since data was last received from the peer.");
+	for(size_t i = 0; i < connections.size(); ++i)
+		w.Sample("connection_last_heard_milliseconds", labels[i], (double)connections[i].lastHeardTime);
+	w.Family("connection_received_bytes_total", "counter", "The total number of bytes received on the connection.");
+	for(size_t i = 0; i < connections.size(); ++i)
+		w.Sample("connection_received_bytes_total", labels[i], connections[i].bytesInTotal);
+	w.Family("connection_sent_bytes_total", "counter", "The total number of bytes sent on the connection.");
+	for(size_t i = 0; i < connections.size(); ++i)
+		w.Sample("connection_sent_bytes_total", labels[i], connections[i].bytesOutTotal);
+	w.Family("connection_pending_messages", "gauge", "The number of messages waiting in the inbound and outbound queues.");
+	for(size_t i = 0; i < connections.size(); ++i)
+	{
+		w.Sample("connection_pending_messages", labels[i] + ",direction=\"in\"", (u64)connections[i].inboundMessagesPending);
+		w.Sample("connection_pending_messages", labels[i] + ",direction=\"out\"", (u64)connections[i].outboundMessagesPending);
+	}
+	w.Family("connection_packets_per_second", "gauge", "The packet rate over the recent traffic window.");
+	for(size_t i = 0; i < connections.size(); ++i)
+	{
+		w.Sample("connection_packets_per_second", labels[i] + ",direction=\"in\"", (double)connections[i].traffic.PacketsInPerSec());
+		w.Sample("connection_packets_per_second", labels[i] + ",direction=\"out\"", (double)connections[i].traffic.PacketsOutPerSec());
+	}
+	w.Family("connection_messages_per_second", "gauge", "The message rate over the recent traffic window.");
+	for(size_t i = 0; i < connections.size(); ++i)
+	{
+		w.Sample("connection_messages_per_second", labels[i] + ",direction=\"in\"", (double)connections[i].traffic.MessagesInPerSec());
+		w.Sample("connection_messages_per_second", labels[i] + ",direction=\"out\"", (double)connections[i].traffic.MessagesOutPerSec());
+	}
+	w.Family("connection_bytes_per_second", "gauge", "The byte rate over the recent traffic window.");
+	for(size_t i = 0; i < connections.size(); ++i)
+	{
+		w.Sample("connection_bytes_per_second", labels[i] + ",direction=\"in\"", (double)connections[i].traffic.BytesInPerSec());
+		w.Sample("connection_bytes_per_second", labels[i] + ",direction=\"out\"", (double)connections[i].traffic.BytesOutPerSec());
+	}
+
+	w.Family("connection_packet_loss_rate", "gauge", "The fraction of datagrams lost (UDP only).");
+	for(size_t i = 0; i < connections.size(); ++i)
+		if (connections[i].transport == SocketOverUDP)
+			w.Sample("connection_packet_loss_rate", labels[i], (double)connections[i].packetLossRate);
+	w.Family("connection_retransmission_timeout_milliseconds", "gauge", "The retransmission timeout of reliable datagrams (UDP only).");
+	for(size_t i = 0; i < connections.size(); ++i)
+		if (connections[i].transport == SocketOverUDP)
+			w.Sample("connection_retransmission_timeout_milliseconds", labels[i], (double)connections[i].retransmissionTimeout);
+	w.Family("connection_datagram_send_rate", "gauge", "The current datagram send rate limit, in datagrams per second (UDP only).");
+	for(size_t i = 0; i < connections.size(); ++i)
+		if (connections[i].transport == SocketOverUDP)
+			w.Sample("connection_datagram_send_rate", labels[i], (double)connections[i].datagramSendRate);
+	w.Family("connection_unacked_datagrams", "gauge", "The number of sent datagrams waiting for an acknowledgement (UDP only).");
+	for(size_t i = 0; i < connections.size(); ++i)
+		if (connections[i].transport == SocketOverUDP)
+			w.Sample("connection_unacked_datagrams", labels[i], (u64)connections[i].outboundUnackedDatagrams);
+
+	w.Family("message_queue_time_microseconds", "summary", "The time from queueing an outbound message to writing it to the socket.");
+	for(size_t i = 0; i < connections.size(); ++i)
+		for(size_t j = 0; j < connections[i].messageTypes.size(); ++j)
+			w.Summary("message_queue_time_microseconds", labels[i] + ",message_id=\"" + FormatNumber((u64)connections[i].messageTypes[j].id) + "\"",
+				connections[i].messageTypes[j].queueTimeUSecs);
+	w.Family("message_ack_time_microseconds", "summary", "The time from queueing a reliable outbound message to its acknowledgement (UDP only).");
+	for(size_t i = 0; i < connections.size(); ++i)
+		for(size_t j = 0; j < connections[i].messageTypes.size(); ++j)
+			if (connections[i].messageTypes[j].ackTimeUSecs.count > 0)
+				w.Summary("message_ack_time_microseconds", labels[i] + ",message_id=\"" + FormatNumber((u64)connections[i].messageTypes[j].id) + "\"",
+					connections[i].messageTypes[j].ackTimeUSecs);
+	w.Family("message_size_bytes", "summary", "The payload sizes of the outbound messages.");
+	for(size_t i = 0; i < connections.size(); ++i)
+		for(size_t j = 0; j < connections[i].messageTypes.size(); ++j)
+			w.Summary("message_size_bytes", labels[i] + ",message_id=\"" + FormatNumber((u64)connections[i].messageTypes[j].id) + "\"",
+				connections[i].messageTypes[j].sizeBytes);
+
+	std::vector<std::string> counterLabels(metrics.counters.size());
+	for(size_t i = 0; i < metrics.counters.size(); ++i)
+		if (metrics.counters[i].count > 0)
+			counterLabels[i] = "metric=" + LabelValue(StatsMetricName((StatsMetricId)i)) + ",unit=" + LabelValue(StatsMetricUnit((StatsMetricId)i));
+	w.Family("stats_values_total", "counter", "The number of values recorded into each internal statistics counter.");
+	for(size_t i = 0; i < metrics.counters.size(); ++i)
+		if (metrics.counters[i].count > 0)
+			w.Sample("stats_values_total", counterLabels[i], metrics.counters[i].count);
+	w.Family("stats_sum", "gauge", "The sum of the values recorded into each internal statistics counter.");
+	for(size_t i = 0; i < metrics.counters.size(); ++i)
+		if (metrics.counters[i].count > 0)
+			w.Sample("stats_sum", counterLabels[i], metrics.counters[i].sum);
+	w.Family("stats_latest", "gauge", "The most recent value recorded into each internal statistics counter.");
+	for(size_t i = 0; i < metrics.counters.size(); ++i)
+		if (metrics.counters[i].count > 0)
+			w.Sample("stats_latest", counterLabels[i], (double)metrics.counters[i].latest);
+
+	const std::vector<LockContentionSample> &locks = metrics.locks;
+	w.Family("lock_acquisitions_total", "counter", "The number of times the locks of each name were acquired.");
+	for(size_t i = 0; i < locks.size(); ++i)
+		w.Sample("lock_acquisitions_total", "lock=" + LabelValue(locks[i].name), locks[i].acquisitions);
+	w.Family("lock_contended_acquisitions_total", "counter", "The number of acquisitions that had to wait for another thread to release the lock.");
+	for(size_t i = 0; i < locks.size(); ++i)
+		w.Sample("lock_contended_acquisitions_total", "lock=" + LabelValue(locks[i].name), locks[i].contendedAcquisitions);
+	w.Family("lock_wait_seconds_total", "counter", "The total time spent waiting to acquire the locks of each name.");
+	for(size_t i = 0; i < locks.size(); ++i)
+		w.Sample("lock_wait_seconds_total", "lock=" + LabelValue(locks[i].name), locks[i].totalWaitMSecs / 1000.0);
+	w.Family("lock_max_wait_seconds", "gauge", "The longest single wait to acquire the locks of each name.");
+	for(size_t i = 0; i < locks.size(); ++i)
+		w.Sample("lock_max_wait_seconds", "lock=" + LabelValue(locks[i].name), locks[i].maxWaitMSecs / 1000.0);
+
+	return w.str();
+}
+
+MetricsEndpoint::MetricsEndpoint(Network *owner_)
+:owner(owner_), listenSocket(INVALID_SOCKET)
+{
+}
+
+MetricsEndpoint::~MetricsEndpoint()
+{
+	Stop();
+}
+
+bool MetricsEndpoint::StartTCP(unsigned short port, bool loopbackOnly)
+{
+	Stop();
+
+	SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (!IsValidSocket(s))
+	{
+		LOG(LogError, "MetricsEndpoint::StartTCP: Error at socket(): %s", Network::GetLastErrorString().c_str());
+		return false;
+	}
+
+	int reuse = 1;
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(loopbackOnly ? INADDR_LOOPBACK : INADDR_ANY);
+	if (bind(s, (const sockaddr *)&addr, sizeof(addr)) == KNET_SOCKET_ERROR || listen(s, 16) == KNET_SOCKET_ERROR)
+	{
+		LOG(LogError, "MetricsEndpoint::StartTCP: Failed to listen on port %d: %s", (int)port, Network::GetLastErrorString().c_str());
+		closesocket(s);
+		return false;
+	}
+
+	LOG(LogInfo, "MetricsEndpoint serving metrics over HTTP at %s:%d.", loopbackOnly ? "127.0.0.1" : "0.0.0.0", (int)port);
+	return StartThread(s);
+}
+
+#ifndef WIN32
+bool MetricsEndpoint::StartUnix(const char *path)
+{
+	Stop();
+
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	if (!path || strlen(path) >= sizeof(addr.sun_path))
+	{
+		LOG(LogError, "MetricsEndpoint::StartUnix: Invalid socket path!");
+		return false;
+	}
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	SOCKET s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (!IsValidSocket(s))
+	{
+		LOG(LogError, "MetricsEndpoint::StartUnix: Error at socket(): %s", Network::GetLastErrorString().c_str());
+		return false;
+	}
+
+	unlink(path);
+	if (bind(s, (const sockaddr *)&addr, sizeof(addr)) == KNET_SOCKET_ERROR || listen(s, 16) == KNET_SOCKET_ERROR)
+	{
+		LOG(LogError, "MetricsEndpoint::StartUnix: Failed to listen on %s: %s", path, Network::GetLastErrorString().c_str());
+		closesocket(s);
+		return false;
+	}
+
+	unixSocketPath = path;
+	LOG(LogInfo, "MetricsEndpoint serving metrics over HTTP at unix:%s.", path);
+	return StartThread(s);
+}
+#endif
+
+bool MetricsEndpoint::StartThread(SOCKET socket)
+{
+	listenSocket = socket;
+	thread.Run(this, &MetricsEndpoint::MainLoop);
+	thread.SetName("kNet MetricsEndpoint");
+	return true;
+}
+
+void MetricsEndpoint::Stop()
+{
+	if (!IsRunning())
+		return;
+
+	thread.Stop();
+	closesocket(listenSocket);
+	listenSocket = INVALID_SOCKET;
+#ifndef WIN32
+	if (!unixSocketPath.empty())
+		unlink(unixSocketPath.c_str());
+#endif
+	unixSocketPath = "";
+}
+
+void MetricsEndpoint::MainLoop()
+{
+	while(!thread.ShouldQuit())
+	{
+		if (!WaitReadable(listenSocket, cQuitPollMSecs))
+			continue;
+
+		SOCKET client = accept(listenSocket, 0, 0);
+		if (!IsValidSocket(client))
+			continue;
+
+		ServeClient(client);
+		closesocket(client);
+	}
+}
+
+void MetricsEndpoint::ServeClient(SOCKET client)
+{
+	std::string request;
+	while(request.find("\r\n\r\n") == std::string::npos && request.find("\n\n") == std::string::npos)
+	{
+		if (request.length() >= cMaxRequestSize || !WaitReadable(client, cRequestTimeoutMSecs))
+			return;
+		char data[512];
+		int numBytes = recv(client, data, sizeof(data), 0);
+		if (numBytes <= 0)
+			return;
+		request.append(data, numBytes);
+	}
+
+	// The request line is "GET /path?query HTTP/1.1".
+	std::string response;
+	if (request.compare(0, 4, "GET ") != 0)
+		response = "HTTP/1.0 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+	else
+	{
+		std::string path = request.substr(4, request.find_first_of(" ?\r\n", 4) - 4);
+		response = Respond(*owner, path);
+	}
+
+	// The client socket blocks, so bound each send() for a client that stops reading.
+#ifdef WIN32
+	DWORD sendTimeout = cRequestTimeoutMSecs;
+#else
+	timeval sendTimeout;
+	sendTimeout.tv_sec = cRequestTimeoutMSecs / 1000;
+	sendTimeout.tv_usec = (cRequestTimeoutMSecs % 1000) * 1000;
+#endif
+	if (setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, (const char *)&sendTimeout, sizeof(sendTimeout)) != 0)
+		return;
+
+	size_t numBytesSent = 0;
+	while(numBytesSent < response.length())
+	{
+		int ret = send(client, response.data() + numBytesSent, (int)(response.length() - numBytesSent), MSG_NOSIGNAL);
+		if (ret <= 0)
+			return;
+		numBytesSent += ret;
+	}
+}
+
+std::string MetricsEndpoint::Respond(Network &network, const std::string &path)
+{
+	const char *status = "200 OK";
+	std::string contentType = "text/plain";
+	std::string body;
+	if (path == "/metrics" || path == "/metrics.json")
+	{
+		NetworkMetrics metrics;
+		network.SnapshotMetrics(metrics);
+		if (path == "/metrics")
+		{
+			contentType = "text/plain; version=0.0.4";
+			body = MetricsToPrometheus(metrics);
+		}
+		else
+		{
+			contentType = "application/json";
+			body = MetricsToJSON(metrics);
+		}
+	}
+	else
+	{
+		status = "404 Not Found";
+		body = "Not found. The metrics are served at /metrics and /metrics.json.\n";
+	}
+
+	std::stringstream ss;
+	ss << "HTTP/1.0 " << status << "\r\nContent-Type: " << contentType << "\r\nContent-Length: " << body.length()
+		<< "\r\nConnection: close\r\n\r\n" << body;
+	return ss.str();
+}
+
+} // ~kNet
@@ -41,19 +41,28 @@ namespace kNet
 {
 
 NetworkServer::NetworkServer(Network *owner_, std::vector<Socket *> listenSockets_)
-:owner(owner_), listenSockets(listenSockets_), acceptNewConnections(true), networkServerListener(0),
-udpConnectionAttempts(64), workerThread(0)
+:listenSockets(listenSockets_), connectionIdsEnabled(false),
+numClosingClients(0), processPool(0), owner(owner_), workerThread(0)
 #ifdef KNET_THREAD_CHECKING_ENABLED
 ,workerThreadId(Thread::NullThreadId())
 #endif
+,acceptNewConnections(true), networkServerListener(0), udpConnectionAttempts(64), repeatedConnectPackets(64)
 {
 	assert(owner);
 	assert(listenSockets.size() > 0);
+	connectionIds.SetContentionName("NetworkServer::connectionIds");
+	udpConnectionMigrations.SetContentionName("NetworkServer::udpConnectionMigrations");
+	clientsClosedEvent = CreateNewEvent(EventWaitSignal);
+	clientsClosedEvent.Set();
 }
 
 NetworkServer::~NetworkServer()
 {
 	LOG(LogObjectAlloc, "Deleting NetworkServer %p.", this);
+	if (numClosingClients.load(std::memory_order_relaxed) > 0)
+		LOG(LogError, "NetworkServer::~NetworkServer: %d client connections are still closing!", numClosingClients.load(std::memory_order_relaxed));
+	clientsClosedEvent.Close();
+	delete processPool;
 }
 
 void NetworkServer::RegisterServerListener(INetworkServerListener *listener)
@@ -133,32 +142,32 @@ Socket *NetworkServer::AcceptConnections(Socket *listenSocket)
 
 void NetworkServer::CleanupDeadConnections()
 {
-	// When we acquire the list of client connections, don't hold on to it for long, so that the worker thread can properly detach from it.
-	ConnectionMap clientsMap = *clients.Acquire();
+	ConnectionRegistry::ReadGuard snapshot(clients);
 
-	// Clean up all disconnected/timed out connections.
-	ConnectionMap::iterator iter = clientsMap.begin();
-	while(iter != clientsMap.end())
+	// Clean up all disconnected/timed out connections. The snapshot keeps them alive until they are all removed at once.
+	deadClients.clear();
+	for(size_t i = 0; i < snapshot->Size(); ++i)
 	{
-		ConnectionMap::iterator next = iter;
-		++next;
-		if (!iter->second->Connected())
+		MessageConnection *connection = snapshot->At(i);
+		if (!connection->Connected())
 		{
-			LOG(LogInfo, "Client %s disconnected.", iter->second->ToString().c_str());
+			LOG(LogInfo, "Client %s disconnected.", connection->ToString().c_str());
 			if (networkServerListener)
-				networkServerListener->ClientDisconnected(iter->second);
-			if (iter->second->GetSocket() && iter->second->GetSocket()->TransportLayer() == SocketOverTCP)
-				owner->CloseConnection(iter->second);
-
-			{
-				Lockable<ConnectionMap>::LockType clientsLock = clients.Acquire();
-				clientsLock->erase(iter->first);
-			}
+				networkServerListener->ClientDisconnected(connection);
+			if (connection->GetSocket() && connection->GetSocket()->TransportLayer() == SocketOverTCP)
+				owner->CloseConnection(connection);
+			RemoveConnectionId(connection);
+			// The connection may be reaped before the worker thread has noticed that its CloseAsync() is done.
+			connection->FinishCloseAsync();
+			deadClients.push_back(connection);
 		}
-		iter = next;
 	}
+	clients.Remove(deadClients);
 }
 
+/// The most messages Process() handles from one client, the same as the default of MessageConnection::Process().
+static const int cMaxMessagesToProcess = 100;
+
 void NetworkServer::Process()
 {
 	CleanupDeadConnections();
@@ -187,13 +196,7 @@ void NetworkServer::Process()
 				if (networkServerListener)
 					networkServerListener->NewConnectionEstablished(clientConnection);
 
-				{
-					PolledTimer timer;
-					Lockable<ConnectionMap>::LockType clientsLock = clients.Acquire();
-					(*clientsLock)[clientConnection->RemoteEndPoint()] = clientConnection;
-					LOG(LogWaits, "NetworkServer::Process: Adding new accepted TCP connection to connection list took %f msecs.",
-						timer.MSecsElapsed());
-				}
+				clients.Insert(clientConnection->RemoteEndPoint(), clientConnection);
 
 				owner->NewMessageConnectionCreated(clientConnection);
 			}
@@ -211,24 +214,84 @@ void NetworkServer::Process()
 		udpConnectionAttempts.PopFront();
 	}
 
+	ProcessUDPConnectionMigrations();
+
 	// Process all new inbound data for each connection handled by this server.
-	ConnectionMap clientMap = *clients.Acquire();
-	for(ConnectionMap::iterator iter = clientMap.begin(); iter != clientMap.end(); ++iter)
-		iter->second->Process();
+	{
+		ConnectionRegistry::ReadGuard snapshot(clients);
+		parallelClients.clear();
+		for(size_t i = 0; i < snapshot->Size(); ++i)
+		{
+			MessageConnection *connection = snapshot->At(i);
+			if (connection->CloseIfDown())
+				continue;
+			IMessageHandler *handler = connection->inboundMessageHandler;
+			if (processPool && handler && handler->IsThreadSafe())
+				parallelClients.push_back(connection);
+			else
+				connection->HandleInboundMessages(cMaxMessagesToProcess);
+		}
+
+		// The pool takes one client at a time, so the messages of each client stay in order.
+		if (!parallelClients.empty())
+			processPool->Run(parallelClients.size(), &NetworkServer::ProcessClientTask, this);
+	}
+
+	// Free the snapshots the connects and disconnects above replaced, now that this thread no longer reads them.
+	clients.Reclaim();
 }
 
-void NetworkServer::ReadUDPSocketData(Socket *listenSocket) // [worker thread]
+void NetworkServer::ProcessClientTask(void *server, size_t index) // [server process thread]
 {
-	using namespace std;
+	NetworkServer *self = reinterpret_cast<NetworkServer*>(server);
+	self->parallelClients[index]->HandleInboundMessages(cMaxMessagesToProcess);
+}
+
+void NetworkServer::SetNumProcessThreads(int numThreads) // [main thread]
+{
+	if (numThreads == NumProcessThreads())
+		return;
+	delete processPool;
+	processPool = numThreads > 0 ? new WorkStealingPool(numThreads) : 0;
+}
+
+void NetworkServer::QueueRepeatedConnectPackets() // [worker thread]
+{
+	if (!repeatedConnectPackets.Front())
+		return;
 
+	ConnectionRegistry::ReadGuard snapshot(clients);
+	for(ConnectionAttemptDescriptor *desc = repeatedConnectPackets.Front(); desc; desc = repeatedConnectPackets.Front())
+	{
+		UDPMessageConnection *udpConnection = dynamic_cast<UDPMessageConnection*>(snapshot->Find(desc->peer));
+		if (udpConnection)
+			udpConnection->QueueInboundDatagram((const char *)desc->data.data, desc->data.size);
+		repeatedConnectPackets.PopFront();
+	}
+}
+
+void NetworkServer::ReadUDPSocketData(Socket *listenSocket) // [worker thread]
+{
 	assert(listenSocket);
 
-	OverlappedTransferBuffer *recvData = listenSocket->BeginReceive();
-	if (!recvData)
-		return; // No datagram available, return.
-	if (recvData->bytesContains == 0)
+	// The snapshot keeps the receiving connections alive while the datagrams are queued to them.
+	ConnectionRegistry::ReadGuard snapshot(clients);
+
+	// Handle all the datagrams the socket read in with one batch, the next batch waits for the next wakeup.
+	do
 	{
+		OverlappedTransferBuffer *recvData = listenSocket->BeginReceive();
+		if (!recvData)
+			return; // No datagram available, return.
+		HandleUDPDatagram(listenSocket, *snapshot, recvData);
 		listenSocket->EndReceive(recvData);
+	} while(listenSocket->NumBatchedReceives() > 0);
+}
+
+void NetworkServer::HandleUDPDatagram(Socket *listenSocket, const ConnectionRegistry::Snapshot &connections, OverlappedTransferBuffer *recvData) // [worker thread]
+{
+	if (recvData->bytesContains == 0)
+	{
 		LOG(LogError, "Received 0 bytes of data in NetworkServer::ReadUDPSocketData!");
 		return;
 	}
@@ -236,37 +299,47 @@ void NetworkServer::ReadUDPSocketData(Socket *listenSocket) // [worker thread]
 	LOG(LogData, "Received a datagram of size %d to socket %s from endPoint %s.", recvData->bytesContains, listenSocket->ToString().c_str(),
 		endPoint.ToString().c_str());
 
-	PolledTimer timer;
-	MessageConnection *receiverConnection = 0;
-
-	{
-		Lockable<ConnectionMap>::LockType clientsLock = clients.Acquire();
-		if (timer.MSecsElapsed() > 50.f)
-		{
-			LOG(LogWaits, "NetworkServer::ReadUDPSocketData: Accessing the connection list in UDP server receive code took %f msecs.",
-			timer.MSecsElapsed());
-		}
-
-		ConnectionMap::iterator iter = clientsLock->find(endPoint); ///\todo HashTable for performance.
-		if (iter != clientsLock->end())
-			receiverConnection = iter->second;
-	}
+	MessageConnection *receiverConnection = connections.Find(endPoint);
 
 	if (receiverConnection)
 	{
 		// If the datagram came from a known endpoint, pass it to the connection object that handles that endpoint.
 		UDPMessageConnection *udpConnection = dynamic_cast<UDPMessageConnection *>(receiverConnection);
 		if (udpConnection)
-			udpConnection->QueueInboundDatagram(recvData->buffer.buf, recvData->bytesContains);
+		{
+			// The client keeps prefixing its datagrams with the Connection Start header until it hears back from us.
+			const char *connectData, *packet;
+			size_t connectDataSize, packetSize;
+			if (UDPMessageConnection::ParseConnectDatagram(recvData->buffer.buf, recvData->bytesContains, connectData, connectDataSize, packet, packetSize))
+			{
+				if (packetSize > 0)
+					udpConnection->QueueInboundDatagram(packet, packetSize);
+			}
+			else
+				udpConnection->QueueInboundDatagram(recvData->buffer.buf, recvData->bytesContains);
+		}
 		else
 			LOG(LogError, "Critical! UDP socket data received into a TCP socket!");
 	}
 	else
 	{
-		// The endpoint for this datagram is not known, deserialize it as a new connection attempt packet.
-		EnqueueNewUDPConnectionAttempt(listenSocket, endPoint, recvData->buffer.buf, recvData->bytesContains);
+		// A packet with a known connection ID comes from a client that moved to a new address. The connection
+		// validates the packet before it moves over.
+		u32 connectionId = 0;
+		if (connectionIdsEnabled && UDPMessageConnection::ReadConnectionId(recvData->buffer.buf, recvData->bytesContains, connectionId))
+		{
+			Lockable<ConnectionIdMap>::LockType idLock = connectionIds.Acquire();
+			ConnectionIdMap::iterator iter = idLock->find(connectionId);
+			if (iter != idLock->end())
+				receiverConnection = iter->second;
+		}
+
+		if (receiverConnection)
+			static_cast<UDPMessageConnection*>(receiverConnection)->QueueInboundDatagram(recvData->buffer.buf, recvData->bytesContains, &endPoint);
+		else // The endpoint for this datagram is not known, deserialize it as a new connection attempt packet. An unknown
+			// connection ID may as well be the first byte of the connect data of an older client.
+			EnqueueNewUDPConnectionAttempt(listenSocket, endPoint, recvData->buffer.buf, recvData->bytesContains);
 	}
-	listenSocket->EndReceive(recvData);
 }
 
 void NetworkServer::EnqueueNewUDPConnectionAttempt(Socket *listenSocket, const EndPoint &endPoint, const char *data, size_t numBytes)
@@ -296,10 +369,38 @@ bool NetworkServer::ProcessNewUDPConnectionAttempt(Socket *listenSocket, const E
 		return false;
 	}
 
-	// Pass the datagram contents to a callback that decides whether this connection is allowed.
+	// A Connection Start datagram carries the connect data, followed by a packet of the first messages of the client.
+	// Any other datagram is taken whole as the connect data.
+	const char *connectData = data;
+	size_t connectDataSize = numBytes;
+	const char *packet = 0;
+	size_t packetSize = 0;
+	bool takesConnectionId = false;
+	UDPMessageConnection::ParseConnectDatagram(data, numBytes, connectData, connectDataSize, packet, packetSize, &takesConnectionId);
+
+	// The client resends its Connection Start datagram until it is answered, so several of them may have been queued.
+	// Each carries the packet the client sent with it, which goes to the connection the first one opened. Only the
+	// worker thread queues datagrams to a live connection, so the packet is handed over to it.
+	if (ConnectionRegistry::ReadGuard(clients)->Find(endPoint))
+	{
+		if (packetSize > 0)
+		{
+			ConnectionAttemptDescriptor desc;
+			memcpy(&desc.data.data[0], packet, packetSize);
+			desc.data.size = packetSize;
+			desc.peer = endPoint;
+			desc.listenSocket = listenSocket;
+			if (!repeatedConnectPackets.Insert(desc))
+				LOG(LogError, "Dropped the packet of a repeated connection attempt from %s, too many are queued!", endPoint.ToString().c_str());
+		}
+		LOG(LogVerbose, "Passed a repeated connection attempt from %s to its connection.", endPoint.ToString().c_str());
+		return false;
+	}
+
+	// Pass the connect data to a callback that decides whether this connection is allowed.
 	if (networkServerListener)
 	{
-		bool connectionAccepted = networkServerListener->NewConnectionAttempt(endPoint, data, numBytes);
+		bool connectionAccepted = networkServerListener->NewConnectionAttempt(endPoint, connectData, connectDataSize);
 		if (!connectionAccepted)
 		{
 			LOG(LogError, "Server listener did not accept the new connection.");
@@ -322,14 +423,17 @@ bool NetworkServer::ProcessNewUDPConnectionAttempt(Socket *listenSocket, const E
 
 	UDPMessageConnection *udpConnection = new UDPMessageConnection(owner, this, socket, ConnectionOK);
 	Ptr(MessageConnection) connection(udpConnection);
+	// Queue the first messages of the client before the connection becomes visible to the worker thread that reads the
+	// listen socket, so that they are delivered first.
+	if (packetSize > 0)
+		udpConnection->QueueInboundDatagram(packet, packetSize);
+	if (connectionIdsEnabled && takesConnectionId)
 	{
-		PolledTimer timer;
-		Lockable<ConnectionMap>::LockType clientsLock = clients.Acquire();
-		(*clientsLock)[endPoint] = connection;
-
-		LOG(LogWaits, "NetworkServer::ProcessNewUDPConnectionAttempt: Accessing the connection list took %f msecs.",
-			timer.MSecsElapsed());
+		const u32 connectionId = NewConnectionId();
+		udpConnection->SetConnectionId(connectionId);
+		(*connectionIds.Acquire())[connectionId] = connection;
 	}
+	clients.Insert(endPoint, connection);
 
 	// Pass the MessageConnection to the main application so it can hook the inbound packet stream.
 	if (networkServerListener)
@@ -345,19 +449,68 @@ bool NetworkServer::ProcessNewUDPConnectionAttempt(Socket *listenSocket, const E
 	return true;
 }
 
-void NetworkServer::BroadcastMessage(const NetworkMessage &msg, MessageConnection *exclude)
+u32 NetworkServer::NewConnectionId()
+{
+	Lockable<ConnectionIdMap>::LockType idLock = connectionIds.Acquire();
+	for(;;)
+	{
+		const u32 connectionId = (u32)connectionIdGenerator();
+		if (connectionId != 0 && idLock->find(connectionId) == idLock->end())
+			return connectionId;
+	}
+}
+
+void NetworkServer::RemoveConnectionId(MessageConnection *connection)
+{
+	UDPMessageConnection *udpConnection = dynamic_cast<UDPMessageConnection*>(connection);
+	if (udpConnection && udpConnection->ConnectionId() != 0)
+		connectionIds.Acquire()->erase(udpConnection->ConnectionId());
+}
+
+void NetworkServer::QueueUDPConnectionMigration(MessageConnection *connection, const EndPoint &newEndPoint)
+{
+	UDPConnectionMigration migration;
+	migration.connection = connection;
+	migration.newEndPoint = newEndPoint;
+	udpConnectionMigrations.Acquire()->push_back(migration);
+}
+
+void NetworkServer::ProcessUDPConnectionMigrations()
 {
-	PolledTimer timer;
-	Lockable<ConnectionMap>::LockType clientsLock = clients.Acquire();
-	if (timer.MSecsElapsed() >= 50.f)
+	std::vector<UDPConnectionMigration> migrations;
+	udpConnectionMigrations.Acquire()->swap(migrations);
+	for(size_t i = 0; i < migrations.size(); ++i)
 	{
-		LOG(LogWaits, "NetworkServer::BroadcastMessage: Accessing the connection list took %f msecs.",
-			timer.MSecsElapsed());
+		MessageConnection *connection = migrations[i].connection;
+		const EndPoint &newEndPoint = migrations[i].newEndPoint;
+		Socket *oldSocket = connection->GetSocket();
+		if (!oldSocket)
+			continue;
+		// Each datagram that arrived from the new address before the move asked for it.
+		const EndPoint oldEndPoint = oldSocket->RemoteEndPoint();
+		{
+			ConnectionRegistry::ReadGuard snapshot(clients);
+			if (oldEndPoint == newEndPoint || snapshot->Find(oldEndPoint) != connection || snapshot->Find(newEndPoint))
+				continue;
+		}
+
+		// The worker thread keeps reading the old socket while the new one is published, so the old one lives as long as
+		// the connection.
+		Socket *newSocket = owner->StoreSocket(*oldSocket);
+		newSocket->SetUDPPeer(newEndPoint);
+		connection->retiredSockets.push_back(connection->socket.exchange(newSocket, std::memory_order_acq_rel));
+		clients.Move(connection, oldEndPoint, newEndPoint);
+		LOG(LogInfo, "NetworkServer::ProcessUDPConnectionMigrations: Connection %p moved from %s to %s.", connection,
+			oldEndPoint.ToString().c_str(), newEndPoint.ToString().c_str());
 	}
+}
 
-	for(ConnectionMap::iterator iter = clientsLock->begin(); iter != clientsLock->end(); ++iter)
+void NetworkServer::BroadcastMessage(const NetworkMessage &msg, MessageConnection *exclude)
+{
+	ConnectionRegistry::ReadGuard snapshot(clients);
+	for(size_t i = 0; i < snapshot->Size(); ++i)
 	{
-		MessageConnection *connection = iter->second;
+		MessageConnection *connection = snapshot->At(i);
 		if (connection == exclude)
 			continue;
 
@@ -369,17 +522,10 @@ void NetworkServer::BroadcastMessage(unsigned long id, bool reliable, bool inOrd
                                      unsigned long contentID, const char *data, size_t numBytes,
                                      MessageConnection *exclude)
 {
-	PolledTimer timer;
-	Lockable<ConnectionMap>::LockType clientsLock = clients.Acquire();
-	if (timer.MSecsElapsed() >= 50.f)
+	ConnectionRegistry::ReadGuard snapshot(clients);
+	for(size_t i = 0; i < snapshot->Size(); ++i)
 	{
-		LOG(LogWaits, "NetworkServer::BroadcastMessage: Accessing the connection list took %f msecs.",
-			timer.MSecsElapsed());
-	}
-
-	for(ConnectionMap::iterator iter = clientsLock->begin(); iter != clientsLock->end(); ++iter)
-	{
-		MessageConnection *connection = iter->second;
+		MessageConnection *connection = snapshot->At(i);
 		assert(connection);
 		if (connection == exclude || !connection->IsWriteOpen())
 			continue;
@@ -410,34 +556,50 @@ void NetworkServer::DisconnectAllClients()
 {
 	SetAcceptNewConnections(false);
 
-	PolledTimer timer;
-	Lockable<ConnectionMap>::LockType clientsLock = clients.Acquire();
-	LOG(LogWaits, "NetworkServer::DisconnectAllClients: Accessing the connection list took %f msecs.",
-		timer.MSecsElapsed());
+	ConnectionRegistry::ReadGuard snapshot(clients);
+	for(size_t i = 0; i < snapshot->Size(); ++i)
+		snapshot->At(i)->Disconnect(0); // Do not wait for any client.
+}
+
+void NetworkServer::CloseAllClientsAsync(int maxMSecsToWait)
+{
+	SetAcceptNewConnections(false);
 
-	for(ConnectionMap::iterator iter = clientsLock->begin(); iter != clientsLock->end(); ++iter)
-		iter->second->Disconnect(0); // Do not wait for any client.
+	ConnectionRegistry::ReadGuard snapshot(clients);
+	for(size_t i = 0; i < snapshot->Size(); ++i)
+		snapshot->At(i)->CloseAsync(maxMSecsToWait);
 }
 
-void NetworkServer::Close(int disconnectWaitMilliseconds)
+void NetworkServer::ClientCloseStarted()
 {
-	DisconnectAllClients();
+	// The first close in progress resets the event. Only the main thread starts closes, so no worker thread can finish
+	// one and set the event before the reset.
+	if (numClosingClients.fetch_add(1, std::memory_order_acq_rel) == 0)
+		clientsClosedEvent.Reset();
+}
 
-	///\todo Re-implement this function to remove the monolithic Sleep here. Instead of this,
-	/// wait for the individual connections to finish.
-	if (GetConnections().size() > 0)
+void NetworkServer::ClientCloseFinished()
+{
+	if (numClosingClients.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		clientsClosedEvent.Set();
+}
+
+void NetworkServer::Close(int disconnectWaitMilliseconds)
+{
+	if (disconnectWaitMilliseconds > 0)
 	{
-		Clock::Sleep(disconnectWaitMilliseconds);
-		LOG(LogVerbose, "NetworkServer::Close: Waited a fixed period of %d msecs for all connections to disconnect.",
-			disconnectWaitMilliseconds);
+		// The worker threads close the connections, so this only waits as long as the slowest client takes.
+		CloseAllClientsAsync(disconnectWaitMilliseconds);
+		PolledTimer timer;
+		clientsClosedEvent.Wait(disconnectWaitMilliseconds);
+		LOG(LogWaits, "NetworkServer::Close: Waited %f msecs for all connections to disconnect.", timer.MSecsElapsed());
 	}
+	else
+		DisconnectAllClients();
 
-	PolledTimer timer;
-	Lockable<ConnectionMap>::LockType clientsLock = clients.Acquire();
-	LOG(LogWaits, "NetworkServer::Close: Accessing the connection list took %f msecs.",
-		timer.MSecsElapsed());
-	for(ConnectionMap::iterator iter = clientsLock->begin(); iter != clientsLock->end(); ++iter)
-		iter->second->Close(0); // Do not wait for any client.
+	ConnectionRegistry::ReadGuard snapshot(clients);
+	for(size_t i = 0; i < snapshot->Size(); ++i)
+		snapshot->At(i)->Close(0); // Do not wait for any client.
 }
 
 void NetworkServer::RunModalServer()
@@ -456,26 +618,22 @@ void NetworkServer::RunModalServer()
 
 void NetworkServer::ConnectionClosed(MessageConnection *connection)
 {
-	PolledTimer timer;
-	Lockable<ConnectionMap>::LockType clientsLock = clients.Acquire();
-	LOG(LogWaits, "NetworkServer::ConnectionClosed: Accessing the connection list took %f msecs.",
-		timer.MSecsElapsed());
-	for(ConnectionMap::iterator iter = clientsLock->begin(); iter != clientsLock->end(); ++iter)
-		if (iter->second == connection)
-		{
-			if (networkServerListener)
-				networkServerListener->ClientDisconnected(connection);
-
-			if (connection->GetSocket() && connection->GetSocket()->TransportLayer() == SocketOverTCP)
-			{
-				owner->DeleteSocket(connection->socket);
-				connection->socket = 0;
-			}
-
-			clientsLock->erase(iter);
+	ConnectionRegistry::ReadGuard snapshot(clients);
+	if (snapshot->IndexOf(connection) >= 0)
+	{
+		if (networkServerListener)
+			networkServerListener->ClientDisconnected(connection);
 
-			return;
+		if (connection->GetSocket() && connection->GetSocket()->TransportLayer() == SocketOverTCP)
+		{
+			owner->DeleteSocket(connection->socket);
+			connection->socket = 0;
 		}
+		RemoveConnectionId(connection);
+
+		clients.Remove(connection);
+		return;
+	}
 
 	LOG(LogError, "Unknown MessageConnection passed to NetworkServer::Disconnect!");
 }
@@ -487,23 +645,20 @@ std::vector<Socket *> &NetworkServer::ListenSockets()
 
 NetworkServer::ConnectionMap NetworkServer::GetConnections()
 {
-	PolledTimer timer;
-	Lockable<ConnectionMap>::LockType lock = clients.Acquire();
-	if (timer.MSecsElapsed() > 50.f)
-	{
-		LOG(LogWaits, "NetworkServer::GetConnections: Accessing the connection list took %f msecs.",
-			timer.MSecsElapsed());
-	}
-	return *lock;
+	ConnectionRegistry::ReadGuard snapshot(clients);
+	ConnectionMap connections;
+	for(size_t i = 0; i < snapshot->Size(); ++i)
+		connections.insert(connections.end(), std::make_pair(snapshot->EndPointAt(i), Ptr(MessageConnection)(snapshot->At(i))));
+	return connections;
 }
 
 int NetworkServer::NumConnections() const
 {
 	int numConnections = 0;
-	Lockable<ConnectionMap>::ConstLockType lock = clients.Acquire();
-	for(ConnectionMap::const_iterator iter = lock->begin(); iter != lock->end(); ++iter)
+	ConnectionRegistry::ReadGuard snapshot(clients);
+	for(size_t i = 0; i < snapshot->Size(); ++i)
 	{
-		const MessageConnection *connection = iter->second.ptr();
+		const MessageConnection *connection = snapshot->At(i);
 		if (connection && (connection->IsPending() || connection->IsReadOpen() || connection->IsWriteOpen()))
 			++numConnections;
 	}
@@ -549,11 +704,7 @@ std::string NetworkServer::ToString() const
 	}
 	ss << ": ";
 
-	int numConnections = 0;
-	{
-		Lockable<ConnectionMap>::ConstLockType lock = clients.Acquire();
-		numConnections = lock->size();
-	}
+	const int numConnections = (int)ConnectionRegistry::ReadGuard(clients)->Size();
 	ss << numConnections << " connections.";
 
 	if (!acceptNewConnections)
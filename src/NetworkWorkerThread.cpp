@@ -16,29 +16,80 @@
 	@brief */
 
 #include <utility>
+#include <thread>
 
 #ifdef KNET_USE_BOOST
 #include <boost/thread/thread.hpp>
 #endif
 
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
 #include "kNet/DebugMemoryLeakCheck.h"
 
 #include "kNet/UDPMessageConnection.h"
 
 #include "kNet/NetworkWorkerThread.h"
+#include "kNet/NetworkMetrics.h"
 #include "kNet/NetworkLogging.h"
 #include "kNet/Event.h"
 #include "kNet/EventArray.h"
 #include "kNet/Clock.h"
 #include "kNet/Thread.h"
+#include "kNet/Trace.h"
+#include "kNet/Atomics.h"
 
 using namespace std;
 
 namespace kNet
 {
 
+/// How often the worker thread polls the connections of Network::ConnectAsync() that are still resolving or connecting, in msecs.
+static const int cConnectAttemptPollMSecs = 5;
+
+#ifdef __linux__
+/// The timer slack of the worker thread, in nsecs. The default of 50 usecs would delay each paced datagram send.
+static const int cWorkerTimerSlackNSecs = 1000;
+#endif
+
+/// The SO_BUSY_POLL time set on the sockets of a worker thread in the busy-poll mode, in usecs.
+static const int cBusyPollSocketUSecs = 50;
+
+/// The number of CPU pause instructions between two polls of the events in the busy-poll mode.
+static const int cBusyPollPauses = 16;
+
+/// The number of polls after which a busy-polling thread yields its time slice. When there are more spinning threads
+/// than cores, this keeps the thread that has the data from waiting for the end of the time slice of a spinning one.
+static const int cBusyPollsPerYield = 64;
+
+const char *WorkerLoopPhaseToString(WorkerLoopPhase phase)
+{
+	switch(phase)
+	{
+	case WorkerLoopWait: return "wait";
+	case WorkerLoopUpdateConnection: return "updateConnection";
+	case WorkerLoopReadSocket: return "readSocket";
+	case WorkerLoopSendOutPackets: return "sendOutPackets";
+	case WorkerLoopServerRead: return "serverRead";
+	default: return "unknown";
+	}
+}
+
+double WorkerLoopStatistics::OtherMSecs() const
+{
+	double other = elapsedMSecs;
+	for(int i = 0; i < NumWorkerLoopPhases; ++i)
+		other -= phaseMSecs[i];
+	return max(0.0, other);
+}
+
 NetworkWorkerThread::NetworkWorkerThread()
+:busyPollIdleMSecs(0)
 {
+	connections.SetContentionName("NetworkWorkerThread::connections");
+	servers.SetContentionName("NetworkWorkerThread::servers");
+	ResetLoopStatistics();
 }
 
 void NetworkWorkerThread::AddConnection(MessageConnection *connection)
@@ -101,6 +152,7 @@ void NetworkWorkerThread::RemoveServer(NetworkServer *server)
 
 void NetworkWorkerThread::StartThread()
 {
+	ResetLoopStatistics();
 	workThread.Run(this, &NetworkWorkerThread::MainLoop);
 }
 
@@ -136,6 +188,95 @@ int NetworkWorkerThread::NumServers() const
 	return servers.Acquire()->size();
 }
 
+void NetworkWorkerThread::LoopStatistics(WorkerLoopStatistics &out) const
+{
+	const double msecsPerTick = 1000.0 / (double)Clock::TicksPerSec();
+	out.iterations = loopIterations.load(std::memory_order_relaxed);
+	out.elapsedMSecs = Clock::TicksInBetween(Clock::Tick(), loopStatisticsStartTick.load(std::memory_order_relaxed)) * msecsPerTick;
+	for(int i = 0; i < NumWorkerLoopPhases; ++i)
+		out.phaseMSecs[i] = loopPhaseTicks[i].load(std::memory_order_relaxed) * msecsPerTick;
+}
+
+void NetworkWorkerThread::ResetLoopStatistics()
+{
+	loopIterations.store(0, std::memory_order_relaxed);
+	for(int i = 0; i < NumWorkerLoopPhases; ++i)
+		loopPhaseTicks[i].store(0, std::memory_order_relaxed);
+	loopStatisticsStartTick.store(Clock::Tick(), std::memory_order_relaxed);
+}
+
+void NetworkWorkerThread::AddLoopTime(WorkerLoopPhase phase, tick_t &phaseStart)
+{
+	const tick_t now = Clock::Tick();
+	loopPhaseTicks[phase].fetch_add(Clock::TicksInBetween(now, phaseStart), std::memory_order_relaxed);
+	phaseStart = now;
+	Clock::SetLoopTick(now);
+}
+
+void NetworkWorkerThread::SnapshotMetrics(NetworkMetrics &out, int threadIndex) const
+{
+	Lockable<std::vector<NetworkServer *> >::ConstLockType serverLock = servers.Acquire();
+	Lockable<std::vector<MessageConnection *> >::ConstLockType lock = connections.Acquire();
+
+	WorkerThreadMetrics thread;
+	thread.numConnections = (int)lock->size();
+	thread.numServers = (int)serverLock->size();
+	LoopStatistics(thread.loop);
+	out.workerThreads.push_back(thread);
+
+	for(size_t i = 0; i < serverLock->size(); ++i)
+	{
+		out.servers.push_back(ServerMetrics());
+		SnapshotServerMetrics(*(*serverLock)[i], out.servers.back());
+		out.servers.back().workerThread = threadIndex;
+	}
+
+	for(size_t i = 0; i < lock->size(); ++i)
+	{
+		out.connections.push_back(ConnectionMetrics());
+		SnapshotConnectionMetrics(*(*lock)[i], out.connections.back());
+		out.connections.back().workerThread = threadIndex;
+	}
+}
+
+int NetworkWorkerThread::BusyPollWait(EventArray &waitEvents, int usecs)
+{
+	const tick_t deadline = Clock::Tick() + (tick_t)((double)usecs * Clock::TicksPerSec() / 1000000.0);
+	for(int numPolls = 1;; ++numPolls)
+	{
+		int index = waitEvents.WaitMicroseconds(0);
+		if (index != EventArray::WaitTimedOut || Clock::IsNewer(Clock::Tick(), deadline))
+			return index;
+		if (numPolls % cBusyPollsPerYield == 0)
+			std::this_thread::yield();
+		else
+			for(int i = 0; i < cBusyPollPauses; ++i)
+				CpuPause();
+	}
+}
+
+bool NetworkWorkerThread::SetSocketBusyPoll(const std::vector<MessageConnection*> &connectionList, const std::vector<NetworkServer*> &serverList, int usecs)
+{
+	for(size_t i = 0; i < connectionList.size(); ++i)
+	{
+		// The UDP connections of a server share the listen socket, which is set below.
+		Socket *socket = connectionList[i]->GetSocket();
+		if (socket && socket->Connected() && !socket->IsUDPSlaveSocket() && socket->BusyPoll() != usecs)
+			if (!socket->SetBusyPoll(usecs))
+				return false;
+	}
+
+	for(size_t i = 0; i < serverList.size(); ++i)
+	{
+		std::vector<Socket *> &listenSockets = serverList[i]->ListenSockets();
+		for(size_t j = 0; j < listenSockets.size(); ++j)
+			if (listenSockets[j]->TransportLayer() == SocketOverUDP && listenSockets[j]->BusyPoll() != usecs)
+				if (!listenSockets[j]->SetBusyPoll(usecs))
+					return false;
+	}
+	return true;
+}
+
 void NetworkWorkerThread::MainLoop()
 {
 	std::vector<MessageConnection*> writeWaitConnections;
@@ -148,10 +289,20 @@ void NetworkWorkerThread::MainLoop()
 	assert(falseEvent.Test() == false);
 
 	LOG(LogInfo, "NetworkWorkerThread starting main loop.");
+	KNET_TRACE_THREAD_NAME("NetworkWorkerThread");
+
+#ifdef __linux__
+	prctl(PR_SET_TIMERSLACK, cWorkerTimerSlackNSecs, 0, 0, 0);
+#endif
 
 	std::vector<MessageConnection*> connectionList;
 	std::vector<NetworkServer*> serverList;
 
+	// The busy-poll mode spins while events have arrived in the last BusyPollIdleMSecs().
+	tick_t lastEventTick = 0;
+	// Cleared if the system does not allow setting SO_BUSY_POLL, so that it is not tried again on each iteration.
+	bool socketBusyPollAllowed = true;
+
 	while(!workThread.ShouldQuit())
 	{
 		workThread.CheckHold();
@@ -167,12 +318,16 @@ void NetworkWorkerThread::MainLoop()
 			serverList = *serverLock;
 		}
 
+		// The time is read once per phase of the loop, and the connections read it with Clock::LoopTick().
+		tick_t phaseStart = Clock::Tick();
+		Clock::SetLoopTick(phaseStart);
+
 		// Inconveniency: Cannot wait for long time periods, since this will call select() or WSAWaitForMultipleObjects,
 		// which does not support aborting from the wait if the thread is signalled to interrupt and quit/join. To fix
 		// this, should add a custom "interrupt Event" into the WaitArray to wake the thread up when it is supposed to be killed.
 		// For now, just sleep only small periods of time at once to make this issue not a problem at application exit time.
 		const int maxWaitTime = 50; // msecs. ///\todo Make this a lot larger, like, 2000msecs, once the thread interrupts are handled in Sleep and EventArray::Wait.
-		int waitTime = maxWaitTime;
+		int waitUSecs = maxWaitTime * 1000; // The UDP send rates are paced with usec precision.
 
 		waitEvents.Clear();
 		writeWaitConnections.clear();
@@ -184,6 +339,20 @@ void NetworkWorkerThread::MainLoop()
 		{
 			MessageConnection &connection = *connectionList[i];
 
+			// A connection from Network::ConnectAsync() has no socket to wait on until it has resolved and connected,
+			// so poll it at short intervals, and keep its two event slots filled to keep the indices straight.
+			if (connection.connectAttempt)
+			{
+				connection.UpdateConnectAttempt();
+				if (connection.connectAttempt)
+				{
+					waitEvents.AddEvent(falseEvent);
+					waitEvents.AddEvent(falseEvent);
+					waitUSecs = min(waitUSecs, cConnectAttemptPollMSecs * 1000);
+					continue;
+				}
+			}
+
 			try
 			{
 				connection.UpdateConnection();
@@ -221,8 +390,8 @@ void NetworkWorkerThread::MainLoop()
 			{
 				if (connection.GetSocket()->TransportLayer() == SocketOverUDP)
 				{
-					int msecsLeftUntilWrite = (int)connection.TimeUntilCanSendPacket();
-					waitTime = min(waitTime, msecsLeftUntilWrite);
+					int usecsLeftUntilWrite = (int)connection.MicrosecondsUntilCanSendPacket();
+					waitUSecs = min(waitUSecs, usecsLeftUntilWrite);
 					writeWaitConnections.push_back(&connection);
 					waitEvents.AddEvent(falseEvent);
 					assert(falseEvent.Test() == false && !falseEvent.IsNull());
@@ -243,6 +412,7 @@ void NetworkWorkerThread::MainLoop()
 				waitEvents.AddEvent(connection.NewOutboundMessagesEvent());
 			}
 		}
+		AddLoopTime(WorkerLoopUpdateConnection, phaseStart);
 
 		// Add all the UDP server listen sockets to the wait event list.
 		// For UDP servers, only a single socket is used for receiving data from all clients.
@@ -252,6 +422,7 @@ void NetworkWorkerThread::MainLoop()
 		for(size_t i = 0; i < serverList.size(); ++i)
 		{
 			NetworkServer &server = *serverList[i];
+			server.QueueRepeatedConnectPackets();
 
 			std::vector<Socket *> &listenSockets = server.ListenSockets();
 
@@ -266,20 +437,44 @@ void NetworkWorkerThread::MainLoop()
 				}
 		}
 
-		// If we did not end up adding any wait events to the queue above, the worker thread does not have 
+		// Wake up as soon as the main thread wants to add or remove a connection or a server, or stop this thread.
+		// The hold event goes last, so that the indices of the sockets above are not affected.
+		const int holdEventIndex = waitEvents.Size();
+		waitEvents.AddEvent(workThread.HoldEvent());
+
+		// If we did not end up adding any socket events to the queue above, the worker thread does not have 
 		// any connections to manage. Sleep for a moment, until we get some connections to handle.
-		if (waitEvents.Size() == 0)
+		if (holdEventIndex == 0)
 		{
-			Thread::Sleep(maxWaitTime);
+			phaseStart = Clock::Tick();
+			waitEvents.Wait(maxWaitTime);
+			AddLoopTime(WorkerLoopWait, phaseStart);
+			loopIterations.fetch_add(1, std::memory_order_relaxed);
 			continue;
 		}
 
+		// The sockets get SO_BUSY_POLL while the busy-poll mode is enabled, and lose it when it is disabled.
+		const int busyPollIdleMSecs = BusyPollIdleMSecs();
+		if (socketBusyPollAllowed && !SetSocketBusyPoll(connectionList, serverList, busyPollIdleMSecs > 0 ? cBusyPollSocketUSecs : 0))
+		{
+			LOG(LogInfo, "NetworkWorkerThread: Cannot set SO_BUSY_POLL on the sockets. Busy polling only in user space.");
+			socketBusyPollAllowed = false;
+		}
+		const bool busyPoll = busyPollIdleMSecs > 0 && lastEventTick != 0 &&
+			Clock::TicksInBetween(phaseStart, lastEventTick) < (tick_t)busyPollIdleMSecs * Clock::TicksPerMillisecond();
+
 		// Wait until an event occurs either from the application end or in the socket.
 		// When the application wants to send out a message, it is signaled by an event here.
 		// Also, when the socket is ready for reading, writing or if it has been closed, it is signaled here.
-		int index = waitEvents.Wait(max<int>(1, waitTime));
-
-		if (index >= 0 && index < waitEvents.Size()) // An event was triggered?
+		KNET_TRACE(TraceWorkerWaitBegin, this, waitUSecs, waitEvents.Size());
+		phaseStart = Clock::Tick();
+		int index = busyPoll ? BusyPollWait(waitEvents, waitUSecs) : waitEvents.WaitMicroseconds(waitUSecs);
+		AddLoopTime(WorkerLoopWait, phaseStart);
+		KNET_TRACE(TraceWorkerWaitEnd, this, index, 0);
+		if (index >= 0 && index != holdEventIndex)
+			lastEventTick = phaseStart;
+
+		if (index >= 0 && index < waitEvents.Size() && index != holdEventIndex) // An event was triggered?
 		{
 			if ((index >> 1) < (int)connectionList.size())
 			{
@@ -292,10 +487,12 @@ void NetworkWorkerThread::MainLoop()
 					if ((index & 1) == 0)
 					{
 						connection->ReadSocket();
+						AddLoopTime(WorkerLoopReadSocket, phaseStart);
 						connection->SendOutPackets();
 					}
 					else // new outbound messages were received from the application.
 						connection->SendOutPackets();
+					AddLoopTime(WorkerLoopSendOutPackets, phaseStart);
 				} catch(const NetException &e)
 				{
 					LOG(LogError, (std::string("kNet::NetException thrown when processing client connection: ") + e.what()).c_str());
@@ -315,6 +512,7 @@ void NetworkWorkerThread::MainLoop()
 						try
 						{
 							server.ReadUDPSocketData(listenSockets[socketIndex]);
+							AddLoopTime(WorkerLoopServerRead, phaseStart);
 						} catch(const NetException &e)
 						{
 							LOG(LogError, (std::string("kNet::NetException thrown when reading server socket: ") + e.what()).c_str());
@@ -336,7 +534,7 @@ void NetworkWorkerThread::MainLoop()
 		}
 
 		// The UDP send throttle timers are not read through events. The writeWaitConnections list
-		// contains a list of UDP connections which are now, or will very soon (in less than 1msec) be ready for writing. 
+		// contains a list of UDP connections, and the wait above ended no later than the first of them was due to send. 
 		// Poll each and try to send a message.
 		for(size_t i = 0; i < writeWaitConnections.size(); ++i)
 		{
@@ -348,7 +546,11 @@ void NetworkWorkerThread::MainLoop()
 				LOG(LogError, (std::string("kNet::NetException thrown when sending out a network message: ") + e.what()).c_str());
 			}
 		}
+		if (!writeWaitConnections.empty())
+			AddLoopTime(WorkerLoopSendOutPackets, phaseStart);
+		loopIterations.fetch_add(1, std::memory_order_relaxed);
 	}
+	Clock::SetLoopTick(0);
 	falseEvent.Close();
 	LOG(LogInfo, "NetworkWorkerThread quit.");
 }
@@ -47,6 +47,17 @@ const int numConcurrentReceiveBuffers = 4;
 const int numConcurrentSendBuffers = 4;
 #endif
 
+/// The size of the buffers the datagrams and TCP stream data are read into.
+static const int cReceiveBufferSize = 4096;
+
+#ifdef __linux__
+/// The maximum number of datagrams a UDP server socket reads in with one recvmmsg() call.
+static const int cReceiveBatchSize = 32;
+
+/// The maximum number of datagrams Socket::EndSend() holds before it sends them out with sendmmsg().
+static const int cSendBatchSize = 32;
+#endif
+
 namespace kNet
 {
 
@@ -95,14 +106,19 @@ std::string SocketTypeToString(SocketType type)
 
 Socket::Socket()
 :connectSocket(INVALID_SOCKET),
+transport(InvalidTransportLayer),
+type(InvalidSocketType),
 writeOpen(false),
 readOpen(false),
-transport(InvalidTransportLayer),
-type(InvalidSocketType)
+busyPollUSecs(0)
 #ifdef WIN32
 ,queuedReceiveBuffers(numConcurrentReceiveBuffers)
 ,queuedSendBuffers(numConcurrentSendBuffers)
 #endif
+#ifdef __linux__
+,receiveBatchPos(0)
+,sendBatching(false)
+#endif
 {
 	localEndPoint.Reset();
 	remoteEndPoint.Reset();
@@ -116,6 +132,9 @@ Socket::~Socket()
 #ifdef WIN32
 	FreeOverlappedTransferBuffers();
 #endif
+#ifdef __linux__
+	FreeBatchBuffers();
+#endif
 }
 
 Socket::Socket(SOCKET connection, const EndPoint &localEndPoint_, const char *localHostName_,
@@ -124,21 +143,47 @@ Socket::Socket(SOCKET connection, const EndPoint &localEndPoint_, const char *lo
 :connectSocket(connection), localEndPoint(localEndPoint_), localHostName(localHostName_),
 remoteEndPoint(remoteEndPoint_), remoteHostName(remoteHostName_), 
 transport(transport_), type(type_), maxSendSize(maxSendSize_),
-writeOpen(true), readOpen(true)
+writeOpen(true), readOpen(true), busyPollUSecs(0)
 #ifdef WIN32
 ,queuedReceiveBuffers(numConcurrentReceiveBuffers)
 ,queuedSendBuffers(numConcurrentSendBuffers)
 #endif
+#ifdef __linux__
+,receiveBatchPos(0)
+,sendBatching(false)
+#endif
 {
 	SetSendBufferSize(512 * 1024);
 	SetReceiveBufferSize(512 * 1024);
 	udpPeerAddress = remoteEndPoint.ToSockAddrIn();
 }
 
+Socket::Socket(const char *localHostName_, const char *remoteHostName_, SocketTransportLayer transport_, size_t maxSendSize_)
+:connectSocket(INVALID_SOCKET), localHostName(localHostName_), remoteHostName(remoteHostName_),
+transport(transport_), type(ClientSocket), maxSendSize(maxSendSize_),
+writeOpen(false), readOpen(false), busyPollUSecs(0)
+#ifdef WIN32
+,queuedReceiveBuffers(numConcurrentReceiveBuffers)
+,queuedSendBuffers(numConcurrentSendBuffers)
+#endif
+#ifdef __linux__
+,receiveBatchPos(0)
+,sendBatching(false)
+#endif
+{
+	localEndPoint.Reset();
+	remoteEndPoint.Reset();
+	udpPeerAddress = remoteEndPoint.ToSockAddrIn();
+}
+
 Socket::Socket(const Socket &rhs)
+:RefCountable()
 #ifdef WIN32
-:queuedReceiveBuffers(numConcurrentReceiveBuffers)
+,queuedReceiveBuffers(numConcurrentReceiveBuffers)
 ,queuedSendBuffers(numConcurrentSendBuffers)
+#elif defined(__linux__)
+,receiveBatchPos(0)
+,sendBatching(false)
 #endif
 {
 	*this = rhs;
@@ -165,6 +210,7 @@ Socket &Socket::operator=(const Socket &rhs)
 	maxSendSize = rhs.maxSendSize;
 	writeOpen = rhs.writeOpen;
 	readOpen = rhs.readOpen;
+	busyPollUSecs = rhs.busyPollUSecs;
 	udpPeerAddress = rhs.udpPeerAddress;
 
 	return *this;
@@ -467,6 +513,10 @@ Event Socket::GetOverlappedReceiveEvent()
 
 	return Event(receivedData->overlapped.hEvent, EventWaitRead);
 #else
+	// A socket that has read the end of the stream stays readable for good. Waiting on it would busy-loop the worker
+	// thread and starve the connections after it in the wait list.
+	if (!readOpen)
+		return Event();
 	return Event(connectSocket, EventWaitRead);
 #endif
 }
@@ -567,8 +617,19 @@ OverlappedTransferBuffer *Socket::BeginReceive()
 	if (!readOpen)
 		return 0;
 
-	const int receiveBufferSize = 4096;
-	OverlappedTransferBuffer *buffer = AllocateOverlappedTransferBuffer(receiveBufferSize);
+#ifdef __linux__
+	// A UDP server socket reads the datagrams in batches, and returns them from the batch one at a time.
+	if (IsUDPServerSocket())
+	{
+		if (receiveBatchPos == receiveBatch.size())
+			ReceiveBatch();
+		if (receiveBatchPos == receiveBatch.size())
+			return 0;
+		return receiveBatch[receiveBatchPos++];
+	}
+#endif
+
+	OverlappedTransferBuffer *buffer = AllocateOverlappedTransferBuffer(cReceiveBufferSize);
 	EndPoint source;
 	buffer->bytesContains = Receive(buffer->buffer.buf, buffer->buffer.len, &source);
 	if (buffer->bytesContains > 0)
@@ -595,10 +656,173 @@ void Socket::EndReceive(OverlappedTransferBuffer *buffer)
 		return;
 	}
 #endif
+#ifdef __linux__
+	if (readOpen && IsUDPServerSocket() && spareReceiveBuffers.size() < (size_t)cReceiveBatchSize)
+	{
+		spareReceiveBuffers.push_back(buffer);
+		return;
+	}
+#endif
 
 	DeleteOverlappedTransferBuffer(buffer);
 }
 
+int Socket::NumBatchedReceives() const
+{
+#ifdef __linux__
+	return (int)(receiveBatch.size() - receiveBatchPos);
+#else
+	return 0;
+#endif
+}
+
+#ifdef __linux__
+void Socket::ReceiveBatch()
+{
+	receiveBatch.clear();
+	receiveBatchPos = 0;
+
+	OverlappedTransferBuffer *buffers[cReceiveBatchSize];
+	iovec iovecs[cReceiveBatchSize];
+	mmsghdr messages[cReceiveBatchSize];
+	memset(messages, 0, sizeof(messages));
+	for(int i = 0; i < cReceiveBatchSize; ++i)
+	{
+		if (!spareReceiveBuffers.empty())
+		{
+			buffers[i] = spareReceiveBuffers.back();
+			spareReceiveBuffers.pop_back();
+		}
+		else
+			buffers[i] = AllocateOverlappedTransferBuffer(cReceiveBufferSize);
+		iovecs[i].iov_base = buffers[i]->buffer.buf;
+		iovecs[i].iov_len = buffers[i]->buffer.len;
+		messages[i].msg_hdr.msg_iov = &iovecs[i];
+		messages[i].msg_hdr.msg_iovlen = 1;
+		messages[i].msg_hdr.msg_name = &buffers[i]->from;
+		messages[i].msg_hdr.msg_namelen = sizeof(buffers[i]->from);
+	}
+
+	int numReceived = recvmmsg(connectSocket, messages, cReceiveBatchSize, MSG_DONTWAIT, 0);
+	if (numReceived == KNET_SOCKET_ERROR)
+	{
+		int error = Network::GetLastError();
+		if (error != KNET_EWOULDBLOCK && error != 0)
+			LOG(LogError, "Socket::ReceiveBatch: recvmmsg failed: %s in socket %s", Network::GetErrorString(error).c_str(), ToString().c_str());
+		numReceived = 0;
+	}
+	else if (numReceived > 0)
+		LOG(LogData, "recvmmsg (%d datagrams) in socket %s", numReceived, ToString().c_str());
+
+	// The datagrams are handed out in the order they arrived. The buffers left over go back to the spares.
+	for(int i = 0; i < cReceiveBatchSize; ++i)
+		if (i < numReceived && messages[i].msg_len > 0)
+		{
+			buffers[i]->bytesContains = messages[i].msg_len;
+			buffers[i]->fromLen = messages[i].msg_hdr.msg_namelen;
+			receiveBatch.push_back(buffers[i]);
+		}
+		else
+			spareReceiveBuffers.push_back(buffers[i]);
+}
+
+bool Socket::SendBatch()
+{
+	if (sendBatch.empty())
+		return true;
+
+	if (connectSocket == INVALID_SOCKET || !writeOpen)
+	{
+		LOG(LogError, "Trying to send %d datagrams to a socket that is not open for writing!", (int)sendBatch.size());
+		FreeBatchBuffers();
+		return false;
+	}
+
+	const int numDatagrams = (int)sendBatch.size();
+	assert(numDatagrams <= cSendBatchSize);
+	iovec iovecs[cSendBatchSize];
+	mmsghdr messages[cSendBatchSize];
+	memset(messages, 0, sizeof(messages));
+	for(int i = 0; i < numDatagrams; ++i)
+	{
+		iovecs[i].iov_base = sendBatch[i]->buffer.buf;
+		iovecs[i].iov_len = sendBatch[i]->buffer.len;
+		messages[i].msg_hdr.msg_iov = &iovecs[i];
+		messages[i].msg_hdr.msg_iovlen = 1;
+		// Client sockets are connected, the others name the peer the same way Send() does.
+		if (type != ClientSocket)
+		{
+			messages[i].msg_hdr.msg_name = &udpPeerAddress;
+			messages[i].msg_hdr.msg_namelen = sizeof(udpPeerAddress);
+		}
+	}
+
+	// sendmmsg() stops at the first datagram that fails, so go on from there until nothing more goes through.
+	int numSent = 0;
+	int ret = 0;
+	while(numSent < numDatagrams && (ret = sendmmsg(connectSocket, messages + numSent, numDatagrams - numSent, 0)) > 0)
+		numSent += ret;
+
+	for(int i = 0; i < numDatagrams; ++i)
+		DeleteOverlappedTransferBuffer(sendBatch[i]);
+	sendBatch.clear();
+
+	if (numSent == numDatagrams)
+	{
+		LOG(LogData, "Socket::SendBatch: Sent out %d datagrams to socket %s.", numSent, ToString().c_str());
+		return true;
+	}
+
+	int error = Network::GetLastError();
+	if (error != KNET_EWOULDBLOCK)
+	{
+		LOG(LogError, "Socket::SendBatch() failed after %d of %d datagrams! Error: %s.", numSent, numDatagrams, Network::GetErrorString(error).c_str());
+		if (type == ServerClientSocket)
+		{
+			// The handle is shared with the server socket, so do the same soft close as Send().
+			readOpen = false;
+			writeOpen = false;
+		}
+		else
+			Close();
+	}
+	return false;
+}
+
+void Socket::FreeBatchBuffers()
+{
+	for(size_t i = receiveBatchPos; i < receiveBatch.size(); ++i)
+		DeleteOverlappedTransferBuffer(receiveBatch[i]);
+	receiveBatch.clear();
+	receiveBatchPos = 0;
+
+	for(size_t i = 0; i < spareReceiveBuffers.size(); ++i)
+		DeleteOverlappedTransferBuffer(spareReceiveBuffers[i]);
+	spareReceiveBuffers.clear();
+
+	for(size_t i = 0; i < sendBatch.size(); ++i)
+		DeleteOverlappedTransferBuffer(sendBatch[i]);
+	sendBatch.clear();
+}
+#endif
+
+void Socket::BeginSendBatch()
+{
+#ifdef __linux__
+	sendBatching = (transport == SocketOverUDP);
+#endif
+}
+
+bool Socket::EndSendBatch()
+{
+#ifdef __linux__
+	sendBatching = false;
+	return SendBatch();
+#else
+	return true;
+#endif
+}
+
 void Socket::Disconnect()
 {
 	if (connectSocket == INVALID_SOCKET)
@@ -658,6 +882,9 @@ void Socket::Close()
 #ifdef WIN32
 	FreeOverlappedTransferBuffers();
 #endif
+#ifdef __linux__
+	FreeBatchBuffers();
+#endif
 }
 
 #ifdef WIN32
@@ -673,6 +900,14 @@ void Socket::FreeOverlappedTransferBuffers()
 }
 #endif
 
+void Socket::SetUDPPeer(const EndPoint &remoteEndPoint_)
+{
+	assert(transport == SocketOverUDP && type == ServerClientSocket);
+	remoteEndPoint = remoteEndPoint_;
+	remoteHostName = remoteEndPoint.IPToString();
+	udpPeerAddress = remoteEndPoint.ToSockAddrIn();
+}
+
 void Socket::SetBlocking(bool isBlocking)
 {
 	if (connectSocket == INVALID_SOCKET)
@@ -890,6 +1125,13 @@ bool Socket::EndSend(OverlappedTransferBuffer *sendBuffer)
 	return true;
 
 #elif defined(__unix) || defined(ANDROID) || defined(__APPLE__)
+#ifdef __linux__
+	if (sendBatching)
+	{
+		sendBatch.push_back(sendBuffer);
+		return sendBatch.size() < (size_t)cSendBatchSize || SendBatch();
+	}
+#endif
 	bool success = Send(sendBuffer->buffer.buf, sendBuffer->buffer.len);
 	DeleteOverlappedTransferBuffer(sendBuffer);
 	return success;
@@ -970,4 +1212,50 @@ void Socket::SetNaglesAlgorithmEnabled(bool enabled)
 			enabled ? "true" : "false", (int)connectSocket, Network::GetLastErrorString().c_str());
 }
 
+bool Socket::SetMaxPacingRate(u64 bytesPerSec)
+{
+	if (connectSocket == INVALID_SOCKET)
+	{
+		LOG(LogError, "Socket::SetMaxPacingRate called for invalid socket object!");
+		return false;
+	}
+
+#ifdef SO_MAX_PACING_RATE
+	// Zero means no limit to the caller. The kernel uses ~0 for that, and would stop sending at a rate of 0.
+	u64 rate = (bytesPerSec == 0) ? ~(u64)0 : bytesPerSec;
+	int ret = setsockopt(connectSocket, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate));
+	if (ret != 0)
+	{
+		LOG(LogError, "Setting SO_MAX_PACING_RATE=%llu for socket %d failed. Reason: %s.",
+			(unsigned long long)bytesPerSec, (int)connectSocket, Network::GetLastErrorString().c_str());
+		return false;
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool Socket::SetBusyPoll(int usecs)
+{
+	if (connectSocket == INVALID_SOCKET)
+	{
+		LOG(LogError, "Socket::SetBusyPoll called for invalid socket object!");
+		return false;
+	}
+
+#ifdef SO_BUSY_POLL
+	if (setsockopt(connectSocket, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) != 0)
+	{
+		LOG(LogVerbose, "Setting SO_BUSY_POLL=%d for socket %d failed. Reason: %s.",
+			usecs, (int)connectSocket, Network::GetLastErrorString().c_str());
+		return false;
+	}
+	busyPollUSecs = usecs;
+	return true;
+#else
+	return false;
+#endif
+}
+
 } // ~kNet
@@ -0,0 +1,307 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file StatsCounters.cpp
+	@brief Implements the metric registry and the StatsCounters class. */
+
+#include <map>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+
+#include "kNet/DebugMemoryLeakCheck.h"
+
+#include "kNet/StatsCounters.h"
+#include "kNet/StatsEventHierarchy.h"
+
+namespace kNet
+{
+
+namespace
+{
+
+/// Stores the names and units of all the interned metrics.
+struct StatsMetricRegistry
+{
+	/// Maps each metric name to its id. Guards the writes to names and units.
+	Lockable<std::map<std::string, StatsMetricId> > ids;
+	std::string names[cMaxStatsMetrics];
+	std::string units[cMaxStatsMetrics];
+	/// The number of metrics whose names and units have been filled in. Published with a release store after filling
+	/// in the strings, so that the strings of ids below this can be read without taking the lock.
+	std::atomic<int> numMetrics;
+
+	StatsMetricRegistry():numMetrics(0) {}
+};
+
+StatsMetricRegistry &Registry()
+{
+	static StatsMetricRegistry registry;
+	return registry;
+}
+
+std::atomic<u64> nextStatsCountersId(1);
+
+/// The number of StatsCounters objects each thread remembers its own counters for.
+const int cThreadCacheSize = 4;
+
+struct ThreadCacheEntry
+{
+	u64 ownerId;
+	void *counters;
+};
+
+thread_local ThreadCacheEntry threadCache[cThreadCacheSize];
+thread_local int threadCacheNextSlot = 0;
+
+} // ~unnamed namespace
+
+StatsMetricId RegisterStatsMetric(const char *name, const char *unit)
+{
+	StatsMetricRegistry &registry = Registry();
+	Lock<std::map<std::string, StatsMetricId> > ids = registry.ids.Acquire();
+	std::map<std::string, StatsMetricId>::iterator iter = ids->find(name);
+	if (iter != ids->end())
+		return iter->second;
+
+	const int id = registry.numMetrics.load(std::memory_order_relaxed);
+	if (id >= cMaxStatsMetrics)
+		return cInvalidStatsMetric;
+	registry.names[id] = name;
+	registry.units[id] = unit ? unit : "";
+	(*ids)[name] = id;
+	registry.numMetrics.store(id + 1, std::memory_order_release);
+	return id;
+}
+
+int NumStatsMetrics()
+{
+	return Registry().numMetrics.load(std::memory_order_acquire);
+}
+
+const char *StatsMetricName(StatsMetricId id)
+{
+	if (id < 0 || id >= NumStatsMetrics())
+		return "";
+	return Registry().names[id].c_str();
+}
+
+const char *StatsMetricUnit(StatsMetricId id)
+{
+	if (id < 0 || id >= NumStatsMetrics())
+		return "";
+	return Registry().units[id].c_str();
+}
+
+int StatsHistogramBucket(float value)
+{
+	if (!(value >= 1.f)) // Also catches NaNs.
+		return 0;
+	int exponent;
+	frexpf(value, &exponent); // value = m * 2^exponent, m in [0.5, 1[, so value is in [2^(exponent-1), 2^exponent[.
+	return exponent < cNumStatsHistogramBuckets ? exponent : cNumStatsHistogramBuckets - 1;
+}
+
+StatsMetricFamily::StatsMetricFamily(const char *nameFormat_, const char *unit_)
+:nameFormat(nameFormat_), unit(unit_ ? unit_ : "")
+{
+	for(u32 i = 0; i < cNumDirectIndices; ++i)
+		directIds[i].store(cInvalidStatsMetric, std::memory_order_relaxed);
+}
+
+StatsMetricId StatsMetricFamily::Get(u32 index)
+{
+	if (index < cNumDirectIndices)
+	{
+		StatsMetricId id = directIds[index].load(std::memory_order_relaxed);
+		if (id != cInvalidStatsMetric)
+			return id;
+	}
+
+	char name[512];
+	snprintf(name, sizeof(name), nameFormat.c_str(), (unsigned int)index);
+	StatsMetricId id = RegisterStatsMetric(name, unit.c_str());
+	if (index < cNumDirectIndices)
+		directIds[index].store(id, std::memory_order_relaxed);
+	return id;
+}
+
+void StatsSample::Clear()
+{
+	count = 0;
+	sum = 0.0;
+	min = max = latest = 0.f;
+	memset(histogram, 0, sizeof(histogram));
+}
+
+StatsCounters::StatsCounters()
+:uniqueId(nextStatsCountersId.fetch_add(1))
+{
+}
+
+StatsCounters::~StatsCounters()
+{
+	std::vector<ThreadCounters*> &threadCounters = threads.UnsafeGetValue();
+	for(size_t i = 0; i < threadCounters.size(); ++i)
+	{
+		for(int j = 0; j < cNumChunks; ++j)
+			delete threadCounters[i]->chunks[j].load(std::memory_order_relaxed);
+		delete threadCounters[i];
+	}
+	threadCounters.clear();
+}
+
+StatsCounters::ThreadCounters *StatsCounters::CurrentThreadCounters()
+{
+	for(int i = 0; i < cThreadCacheSize; ++i)
+		if (threadCache[i].ownerId == uniqueId)
+			return static_cast<ThreadCounters*>(threadCache[i].counters);
+
+	// This thread has not recorded into this object recently. Look up or create its counters.
+	ThreadCounters *counters = 0;
+	{
+		const std::thread::id thisThread = std::this_thread::get_id();
+		Lock<std::vector<ThreadCounters*> > lock = threads.Acquire();
+		for(size_t i = 0; i < lock->size(); ++i)
+			if ((*lock)[i]->threadId == thisThread)
+			{
+				counters = (*lock)[i];
+				break;
+			}
+		if (!counters)
+		{
+			counters = new ThreadCounters;
+			for(int i = 0; i < cNumChunks; ++i)
+				counters->chunks[i].store(0, std::memory_order_relaxed);
+			counters->threadId = thisThread;
+			lock->push_back(counters);
+		}
+	}
+
+	ThreadCacheEntry &entry = threadCache[threadCacheNextSlot];
+	threadCacheNextSlot = (threadCacheNextSlot + 1) % cThreadCacheSize;
+	entry.ownerId = uniqueId;
+	entry.counters = counters;
+	return counters;
+}
+
+void StatsCounters::Add(StatsMetricId id, float value)
+{
+	if (id < 0 || id >= cMaxStatsMetrics)
+		return;
+
+	ThreadCounters *counters = CurrentThreadCounters();
+	std::atomic<Chunk*> &chunkSlot = counters->chunks[id / cCellsPerChunk];
+	Chunk *chunk = chunkSlot.load(std::memory_order_relaxed);
+	if (!chunk)
+	{
+		chunk = new Chunk(); // Value-initialization zeroes all the cells.
+		chunkSlot.store(chunk, std::memory_order_release);
+	}
+
+	// Only this thread writes to the cell, so plain load-modify-store sequences suffice.
+	Cell &cell = chunk->cells[id % cCellsPerChunk];
+	const u64 count = cell.count.load(std::memory_order_relaxed);
+	if (count == 0 || value < cell.min.load(std::memory_order_relaxed))
+		cell.min.store(value, std::memory_order_relaxed);
+	if (count == 0 || value > cell.max.load(std::memory_order_relaxed))
+		cell.max.store(value, std::memory_order_relaxed);
+	cell.sum.store(cell.sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	cell.latest.store(value, std::memory_order_relaxed);
+	std::atomic<u32> &bucket = cell.histogram[StatsHistogramBucket(value)];
+	bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	cell.count.store(count + 1, std::memory_order_release);
+}
+
+void StatsCounters::AccumulateCell(const Cell &cell, StatsSample &out, u64 &mostValuesPerThread)
+{
+	// The fields are read while the owning thread may be writing to them, so a sample can be off by the values
+	// recorded during the read. This is fine for statistics, and the counts never go backwards.
+	const u64 count = cell.count.load(std::memory_order_acquire);
+	if (count == 0)
+		return;
+	const float min = cell.min.load(std::memory_order_relaxed);
+	const float max = cell.max.load(std::memory_order_relaxed);
+	if (out.count == 0 || min < out.min)
+		out.min = min;
+	if (out.count == 0 || max > out.max)
+		out.max = max;
+	if (count > mostValuesPerThread)
+	{
+		out.latest = cell.latest.load(std::memory_order_relaxed);
+		mostValuesPerThread = count;
+	}
+	out.count += count;
+	out.sum += cell.sum.load(std::memory_order_relaxed);
+	for(int i = 0; i < cNumStatsHistogramBuckets; ++i)
+		out.histogram[i] += cell.histogram[i].load(std::memory_order_relaxed);
+}
+
+void StatsCounters::Read(StatsMetricId id, StatsSample &out) const
+{
+	out.Clear();
+	if (id < 0 || id >= cMaxStatsMetrics)
+		return;
+
+	u64 mostValuesPerThread = 0;
+	ConstLock<std::vector<ThreadCounters*> > lock = threads.Acquire();
+	for(size_t i = 0; i < lock->size(); ++i)
+	{
+		const Chunk *chunk = (*lock)[i]->chunks[id / cCellsPerChunk].load(std::memory_order_acquire);
+		if (chunk)
+			AccumulateCell(chunk->cells[id % cCellsPerChunk], out, mostValuesPerThread);
+	}
+}
+
+void StatsCounters::ReadAll(std::vector<StatsSample> &out) const
+{
+	const int numMetrics = NumStatsMetrics();
+	out.resize(numMetrics);
+	for(int i = 0; i < numMetrics; ++i)
+		out[i].Clear();
+	std::vector<u64> mostValuesPerThread(numMetrics, 0);
+
+	ConstLock<std::vector<ThreadCounters*> > lock = threads.Acquire();
+	for(size_t i = 0; i < lock->size(); ++i)
+		for(int id = 0; id < numMetrics; ++id)
+		{
+			const Chunk *chunk = (*lock)[i]->chunks[id / cCellsPerChunk].load(std::memory_order_acquire);
+			if (chunk)
+				AccumulateCell(chunk->cells[id % cCellsPerChunk], out[id], mostValuesPerThread[id]);
+			else
+				id += cCellsPerChunk - 1 - id % cCellsPerChunk; // Skip the rest of the missing chunk.
+		}
+}
+
+void StatsCounters::UpdateHierarchy(StatsEventHierarchyNode &root, int oldAgeMSecs)
+{
+	std::vector<StatsSample> samples;
+	ReadAll(samples);
+	if (hierarchyBookkeeping.size() < samples.size())
+		hierarchyBookkeeping.resize(samples.size(), std::make_pair((u64)0, 0.0));
+
+	for(size_t id = 0; id < samples.size(); ++id)
+	{
+		const StatsSample &s = samples[id];
+		std::pair<u64, double> &previous = hierarchyBookkeeping[id];
+		if (s.count <= previous.first)
+			continue;
+		const float average = (float)((s.sum - previous.second) / (double)(s.count - previous.first));
+		root.AddEventToHierarchy(StatsMetricName((StatsMetricId)id), average, StatsMetricUnit((StatsMetricId)id), oldAgeMSecs);
+		previous = std::make_pair(s.count, s.sum);
+	}
+}
+
+} // ~kNet
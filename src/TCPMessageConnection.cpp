@@ -30,6 +30,7 @@
 #include "kNet/VLEPacker.h"
 #include "kNet/NetException.h"
 #include "kNet/Network.h"
+#include "kNet/Trace.h"
 
 namespace kNet
 {
@@ -38,9 +39,12 @@ namespace kNet
 /// it as a protocol violation and kill the connection.
 static const u32 cMaxReceivableTCPMessageSize = 1024 * 1024;
 
+/// The initial capacity of the inbound byte buffer. ReadSocket grows the buffer as needed.
+static const int cInitialInboundBufferSize = 8 * 1024;
+
 TCPMessageConnection::TCPMessageConnection(Network *owner, NetworkServer *ownerServer, Socket *socket, ConnectionState startingState)
 :MessageConnection(owner, ownerServer, socket, startingState),
-tcpInboundSocketData(64 * 1024)
+tcpInboundSocketData(cInitialInboundBufferSize)
 {
 }
 
@@ -56,7 +60,7 @@ MessageConnection::SocketReadResult TCPMessageConnection::ReadSocket(size_t &tot
 
 	totalBytesRead = 0;
 
-	if (!socket || !socket->IsReadOpen())
+	if (!socket || !GetSocket()->IsReadOpen())
 		return SocketReadError;
 
 	using namespace std;
@@ -66,7 +70,7 @@ MessageConnection::SocketReadResult TCPMessageConnection::ReadSocket(size_t &tot
 	// the application handles the previous messages first.
 	const int arbitraryInboundMessageCapacityLimit = 2048;
 
-	if (inboundMessageQueue.CapacityLeft() < arbitraryInboundMessageCapacityLimit) 
+	if (InboundMessageQueueCapacityLeft() < arbitraryInboundMessageCapacityLimit) 
 	{
 		LOG(LogVerbose, "TCPMessageConnection::ReadSocket: Read throttled! Application cannot consume data fast enough.");
 		return SocketReadThrottled; // Can't read in new data, since the client app can't process it so fast.
@@ -91,7 +95,7 @@ MessageConnection::SocketReadResult TCPMessageConnection::ReadSocket(size_t &tot
 				return SocketReadThrottled;
 		}
 
-		OverlappedTransferBuffer *buffer = socket->BeginReceive();
+		OverlappedTransferBuffer *buffer = GetSocket()->BeginReceive();
 		if (!buffer)
 			break; // Nothing to receive.
 
@@ -110,7 +114,7 @@ MessageConnection::SocketReadResult TCPMessageConnection::ReadSocket(size_t &tot
 		}
 
 		LOG(LogData, "TCPMessageConnection::ReadSocket: Received %d bytes from the network from peer %s.", 
-			buffer->bytesContains, socket->ToString().c_str());
+			buffer->bytesContains, GetSocket()->ToString().c_str());
 
 		assert((size_t)buffer->bytesContains <= (size_t)tcpInboundSocketData.ContiguousFreeBytesLeft());
 		///\todo For performance, this memcpy can be optimized away. We can parse the message directly
@@ -121,13 +125,14 @@ MessageConnection::SocketReadResult TCPMessageConnection::ReadSocket(size_t &tot
 		tcpInboundSocketData.Inserted(buffer->bytesContains); // Mark the memory area in the ring buffer as used.
 
 		totalBytesRead += buffer->bytesContains;
-		socket->EndReceive(buffer);
+		GetSocket()->EndReceive(buffer);
 	}
 
 	// Update statistics about the connection.
 	if (totalBytesRead > 0)
 	{
-		lastHeardTime = Clock::Tick();
+		lastHeardTime = Clock::LoopTick();
+		KNET_TRACE(TracePacketReceived, this, 0, totalBytesRead);
 		ADDEVENT("tcpDataIn", (float)totalBytesRead, "bytes");
 		AddInboundStats(totalBytesRead, 1, 0);
 	}
@@ -164,13 +169,14 @@ MessageConnection::PacketSendResult TCPMessageConnection::SendOutPacket()
 	if (bOutboundSendsPaused || outboundQueue.Size() == 0)
 		return PacketSendNoMessages;
 
-	if (!socket || !socket->IsWriteOpen())
+	if (!socket || !GetSocket()->IsWriteOpen())
 	{
-		LOG(LogVerbose, "TCPMessageConnection::SendOutPacket: Socket is not write open %p!", socket);
+		LOG(LogVerbose, "TCPMessageConnection::SendOutPacket: Socket is not write open %p!", GetSocket());
 		if (connectionState == ConnectionOK) ///\todo This is slightly annoying to manually update the state here,
 			connectionState = ConnectionPeerClosed; /// reorganize to be able to have this automatically apply.
 		if (connectionState == ConnectionDisconnecting)
 			connectionState = ConnectionClosed;
+		KNET_TRACE(TraceConnectionState, this, connectionState, 0);
 		return PacketSendSocketClosed;
 	}
 
@@ -178,13 +184,13 @@ MessageConnection::PacketSendResult TCPMessageConnection::SendOutPacket()
 	// Get the maximum number of bytes we can coalesce for the send() call. This is only a soft limit
 	// in the sense that if we encounter a single message that is larger than this limit, then we try
 	// to send that through in one send() call.
-	const size_t maxSendSize = socket->MaxSendSize();
+	const size_t maxSendSize = GetSocket()->MaxSendSize();
 
 	// Push out all the pending data to the socket.
 //	assert(ContainerUniqueAndNoNullElements(serializedMessages));
 //	assert(ContainerUniqueAndNoNullElements(outboundQueue));
 	serializedMessages.clear(); // 'serializedMessages' is a temporary data structure used only by this member function.
-	OverlappedTransferBuffer *overlappedTransfer = socket->BeginSend();
+	OverlappedTransferBuffer *overlappedTransfer = GetSocket()->BeginSend();
 	if (!overlappedTransfer)
 	{
 		LOG(LogError, "TCPMessageConnection::SendOutPacket: Starting an overlapped send failed!");
@@ -192,6 +198,7 @@ MessageConnection::PacketSendResult TCPMessageConnection::SendOutPacket()
 	}
 
 	int numMessagesPacked = 0;
+	const tick_t packTick = Clock::Tick();
 	DataSerializer writer(overlappedTransfer->buffer.buf, overlappedTransfer->buffer.len);
 	while(outboundQueue.Size() > 0)
 	{
@@ -221,6 +228,8 @@ MessageConnection::PacketSendResult TCPMessageConnection::SendOutPacket()
 		if (msg->dataSize > 0)
 			writer.AddAlignedByteArray(msg->data, msg->dataSize);
 		++numMessagesPacked;
+		msg->packTick = packTick;
+		KNET_TRACE(TraceMessagePacked, this, msg->messageNumber, 0);
 
 		serializedMessages.push_back(msg);
 #ifdef KNET_NO_MAXHEAP
@@ -233,10 +242,10 @@ MessageConnection::PacketSendResult TCPMessageConnection::SendOutPacket()
 //	assert(ContainerUniqueAndNoNullElements(serializedMessages));
 
 	if (writer.BytesFilled() == 0 && outboundQueue.Size() > 0)
-		LOG(LogError, "Failed to send any messages to socket %s! (Probably next message was too big to fit in the buffer).", socket->ToString().c_str());
+		LOG(LogError, "Failed to send any messages to socket %s! (Probably next message was too big to fit in the buffer).", GetSocket()->ToString().c_str());
 
 	overlappedTransfer->bytesContains = writer.BytesFilled();
-	bool success = socket->EndSend(overlappedTransfer);
+	bool success = GetSocket()->EndSend(overlappedTransfer);
 
 	if (!success) // If we failed to send, put all the messages back into the outbound queue to wait for the next send round.
 	{
@@ -253,8 +262,11 @@ MessageConnection::PacketSendResult TCPMessageConnection::SendOutPacket()
 		return PacketSendSocketFull;
 	}
 
-	LOG(LogData, "TCPMessageConnection::SendOutPacket: Sent %d bytes (%d messages) to peer %s.", (int)writer.BytesFilled(), (int)serializedMessages.size(), socket->ToString().c_str());
+	LOG(LogData, "TCPMessageConnection::SendOutPacket: Sent %d bytes (%d messages) to peer %s.", (int)writer.BytesFilled(), (int)serializedMessages.size(), GetSocket()->ToString().c_str());
+	KNET_TRACE(TracePacketSent, this, 0, writer.BytesFilled());
 	AddOutboundStats(writer.BytesFilled(), 1, numMessagesPacked);
+	if (!serializedMessages.empty())
+		AddMessageSendStats(&serializedMessages[0], serializedMessages.size(), packTick);
 	ADDEVENT("tcpDataOut", (float)writer.BytesFilled(), "bytes");
 
 	// The messages in serializedMessages array are now in the TCP driver to handle. It will guarantee
@@ -262,12 +274,7 @@ MessageConnection::PacketSendResult TCPMessageConnection::SendOutPacket()
 	for(size_t i = 0; i < serializedMessages.size(); ++i)
 	{
 #ifdef KNET_NETWORK_PROFILING
-		std::stringstream ss;
-		if (!serializedMessages[i]->profilerName.empty())
-			ss << "messageOut." << serializedMessages[i]->profilerName;
-		else
-			ss << "messageOut." << serializedMessages[i]->id;
-		ADDEVENT(ss.str().c_str(), (float)serializedMessages[i]->Size(), "bytes");
+		ADDMETRIC(OutboundMessageMetric(*serializedMessages[i]), (float)serializedMessages[i]->Size());
 #endif
 		ClearOutboundMessageWithContentID(serializedMessages[i]);
 		FreeMessage(serializedMessages[i]);
@@ -281,11 +288,25 @@ void TCPMessageConnection::DoUpdateConnection() // [worker thread]
 	ExtractMessages();
 }
 
+bool TCPMessageConnection::CanHibernate() const
+{
+	return tcpInboundSocketData.Size() == 0;
+}
+
+void TCPMessageConnection::ReleaseIdleMemory()
+{
+	AssertInWorkerThreadContext();
+
+	if (tcpInboundSocketData.Size() == 0 && tcpInboundSocketData.Capacity() > cInitialInboundBufferSize)
+		tcpInboundSocketData = RingBuffer(cInitialInboundBufferSize);
+	std::vector<NetworkMessage*>().swap(serializedMessages);
+}
+
 void TCPMessageConnection::SendOutPackets()
 {
 	AssertInWorkerThreadContext();
 
-	if (!socket || !socket->IsWriteOpen() || !socket->IsOverlappedSendReady())
+	if (!socket || !GetSocket()->IsWriteOpen() || !GetSocket()->IsOverlappedSendReady())
 		return;
 
 	PacketSendResult result = PacketSendOK;
@@ -312,7 +333,7 @@ void TCPMessageConnection::ExtractMessages()
 			if (tcpInboundSocketData.Size() == 0) // No new packets in yet.
 				break;
 
-			if (inboundMessageQueue.CapacityLeft() == 0) // If the application can't take in any new messages, abort.
+			if (InboundMessageQueueCapacityLeft() == 0) // If the application can't take in any new messages, abort.
 				break;
 
 			DataDeserializer reader(tcpInboundSocketData.Begin(), tcpInboundSocketData.Size());
@@ -345,8 +366,9 @@ void TCPMessageConnection::ExtractMessages()
 	{
 		LOG(LogError, "TCPMessageConnection::ExtractMessages() caught a network exception: \"%s\"!", e.what());
 		if (socket)
-			socket->Close();
+			GetSocket()->Close();
 		connectionState = ConnectionClosed;
+		KNET_TRACE(TraceConnectionState, this, connectionState, 0);
 	}
 }
 
@@ -355,7 +377,7 @@ void TCPMessageConnection::PerformDisconnection()
 	AssertInMainThreadContext();
 
 	if (socket)
-		socket->Disconnect();
+		GetSocket()->Disconnect();
 }
 
 void TCPMessageConnection::DumpConnectionStatus() const
@@ -383,4 +405,9 @@ unsigned long TCPMessageConnection::TimeUntilCanSendPacket() const
 	return 0;
 }
 
+unsigned long TCPMessageConnection::MicrosecondsUntilCanSendPacket() const
+{
+	return 0;
+}
+
 } // ~kNet
@@ -43,10 +43,9 @@ void Thread::Hold()
 	if (threadHoldEvent.Test())
 		return;
 
-	threadResumeEvent.Reset();
-	threadHoldEvent.Reset();
+	// The resume event is left alone here: it is reset by the thread when it wakes up. Resetting it here
+	// would lose a Resume() the thread has not seen yet, and leave it sleeping until CheckHold times out.
 	threadHoldEventAcked.Reset();
-
 	threadHoldEvent.Set();
 
 	PolledTimer timer;
@@ -62,9 +61,8 @@ void Thread::Hold()
 /// Resumes the thread that is being held.
 void Thread::Resume()
 {
-	threadResumeEvent.Set();
 	threadHoldEvent.Reset();
-	threadHoldEventAcked.Reset();
+	threadResumeEvent.Set();
 }
 
 void Thread::CheckHold()
@@ -81,8 +79,8 @@ void Thread::CheckHold()
 			if (success)
 				break;
 		}
+		threadResumeEvent.Reset();
 		LOG(LogWaits, "Thread::CheckHold: Slept for %f msecs.", timer.MSecsElapsed());
-		threadHoldEventAcked.Reset();
 	}
 }
 
@@ -0,0 +1,360 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file Trace.cpp
+	@brief Implements the per-thread trace buffers and the Chrome trace event exporter. */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "kNet/DebugMemoryLeakCheck.h"
+
+#include "kNet/Trace.h"
+#include "kNet/Alignment.h"
+#include "kNet/Lockable.h"
+#include "kNet/MessageConnection.h"
+
+namespace kNet
+{
+
+std::atomic<bool> traceEnabled(false);
+
+namespace
+{
+
+static_assert(sizeof(TraceRecord) == 32, "TraceRecord is meant to fill exactly half a cache line.");
+static_assert((cTraceBufferSize & (cTraceBufferSize - 1)) == 0, "cTraceBufferSize must be a power of two.");
+
+/// The flight recorder of a single thread. Only the owning thread writes records, and it overwrites the oldest ones
+/// when the buffer is full. Readers copy the records without blocking the writer, and then discard the ones the
+/// writer may have overwritten during the copy.
+struct alignas(KNET_CACHE_LINE_SIZE) ThreadTraceBuffer
+{
+	/// The total number of records ever written into this buffer. The record n lives at records[n % cTraceBufferSize].
+	std::atomic<u64> head;
+	/// The records before this index were discarded by ClearTrace().
+	std::atomic<u64> clearedBefore;
+	/// Set when the owning thread exits, so that the next new thread can take the buffer over.
+	std::atomic<bool> orphaned;
+	u16 thread;
+	/// The name given with SetTraceThreadName(). Guarded by the lock of TraceBuffers::buffers.
+	std::string name;
+	TraceRecord records[cTraceBufferSize];
+
+	explicit ThreadTraceBuffer(u16 thread_)
+	:head(0), clearedBefore(0), orphaned(false), thread(thread_)
+	{
+	}
+};
+
+struct TraceBuffers
+{
+	/// The buffers of all threads that have recorded events, indexed by TraceRecord::thread.
+	Lockable<std::vector<ThreadTraceBuffer*> > buffers;
+
+	~TraceBuffers()
+	{
+		Lock<std::vector<ThreadTraceBuffer*> > lock = buffers.Acquire();
+		for(size_t i = 0; i < lock->size(); ++i)
+			delete (*lock)[i];
+		lock->clear();
+	}
+};
+
+TraceBuffers &Buffers()
+{
+	static TraceBuffers buffers;
+	return buffers;
+}
+
+/// Marks the buffer of a thread orphaned when the thread exits.
+struct ThreadTraceBufferRef
+{
+	ThreadTraceBuffer *buffer;
+
+	ThreadTraceBufferRef():buffer(0) {}
+	~ThreadTraceBufferRef()
+	{
+		if (buffer)
+			buffer->orphaned.store(true, std::memory_order_release);
+	}
+};
+
+thread_local ThreadTraceBufferRef threadTraceBuffer;
+
+/// Returns the buffer of the calling thread, taking over the buffer of an exited thread or allocating a new one on first use.
+ThreadTraceBuffer *CurrentThreadBuffer()
+{
+	if (threadTraceBuffer.buffer)
+		return threadTraceBuffer.buffer;
+
+	Lock<std::vector<ThreadTraceBuffer*> > lock = Buffers().buffers.Acquire();
+	ThreadTraceBuffer *buffer = 0;
+	for(size_t i = 0; i < lock->size(); ++i)
+		if ((*lock)[i]->orphaned.load(std::memory_order_acquire))
+		{
+			// The records of the exited thread are dropped, so that the new thread does not appear to have recorded them.
+			buffer = (*lock)[i];
+			buffer->clearedBefore.store(buffer->head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			buffer->name.clear();
+			buffer->orphaned.store(false, std::memory_order_relaxed);
+			break;
+		}
+	if (!buffer)
+	{
+		buffer = new ThreadTraceBuffer((u16)lock->size());
+		lock->push_back(buffer);
+	}
+	threadTraceBuffer.buffer = buffer;
+	return buffer;
+}
+
+struct TraceEventInfo
+{
+	const char *name;
+	const char *arg0Name;
+	const char *arg1Name;
+};
+
+const TraceEventInfo traceEventInfo[NumTraceEventTypes] =
+{
+	{ "MessageQueued", "number", "id" },
+	{ "MessageAccepted", "number", "id" },
+	{ "MessagePacked", "number", "packetID" },
+	{ "PacketSent", "packetID", "bytes" },
+	{ "PacketAcked", "packetID", "messages" },
+	{ "PacketTimedOut", "packetID", "messages" },
+	{ "PacketReceived", "packetID", "bytes" },
+	{ "MessageReceived", "packetID", "id" },
+	{ "MessageHandled", "packetID", "id" },
+	{ "ConnectionState", "state", 0 },
+	{ "Wait", "usecs", "events" },
+	{ "Wait", "signalled", 0 }
+};
+
+void AppendEscapedJSON(std::string &out, const std::string &str)
+{
+	for(size_t i = 0; i < str.length(); ++i)
+	{
+		const unsigned char c = (unsigned char)str[i];
+		if (c == '"' || c == '\\')
+		{
+			out += '\\';
+			out += (char)c;
+		}
+		else if (c < 0x20)
+		{
+			char escape[8];
+			sprintf(escape, "\\u%04x", (unsigned int)c);
+			out += escape;
+		}
+		else
+			out += (char)c;
+	}
+}
+
+} // ~unnamed namespace
+
+const char *TraceEventTypeToString(TraceEventType event)
+{
+	if (event < 0 || event >= NumTraceEventTypes)
+		return "Unknown";
+	return traceEventInfo[event].name;
+}
+
+void SetTracingEnabled(bool enabled)
+{
+	traceEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+void TraceEvent(TraceEventType event, const void *object, u32 arg0, u32 arg1)
+{
+	ThreadTraceBuffer *buffer = CurrentThreadBuffer();
+	const u64 index = buffer->head.load(std::memory_order_relaxed);
+	// Orders the publication of the previous record before the writes below, so that a reader that sees this record
+	// half-written also sees the head that tells it to discard the record being overwritten.
+	std::atomic_thread_fence(std::memory_order_release);
+	TraceRecord &record = buffer->records[index & (cTraceBufferSize - 1)];
+	record.tick = Clock::Tick();
+	record.object = (u64)(uintptr_t)object;
+	record.arg0 = arg0;
+	record.arg1 = arg1;
+	record.event = (u16)event;
+	record.thread = buffer->thread;
+	record.reserved = 0;
+	buffer->head.store(index + 1, std::memory_order_release);
+}
+
+void SetTraceThreadName(const char *name)
+{
+	ThreadTraceBuffer *buffer = CurrentThreadBuffer();
+	Lock<std::vector<ThreadTraceBuffer*> > lock = Buffers().buffers.Acquire();
+	buffer->name = name ? name : "";
+}
+
+void ReadTrace(std::vector<TraceRecord> &out)
+{
+	out.clear();
+	Lock<std::vector<ThreadTraceBuffer*> > lock = Buffers().buffers.Acquire();
+	for(size_t i = 0; i < lock->size(); ++i)
+	{
+		const ThreadTraceBuffer &buffer = *(*lock)[i];
+		// The slot of the oldest record of a full buffer is the one the writer fills next, so it is not read at all.
+		const u64 end = buffer.head.load(std::memory_order_acquire);
+		const u64 begin = std::max<u64>(end >= (u64)cTraceBufferSize ? end - cTraceBufferSize + 1 : 0,
+			buffer.clearedBefore.load(std::memory_order_relaxed));
+		const size_t firstCopied = out.size();
+		for(u64 j = begin; j < end; ++j)
+			out.push_back(buffer.records[j & (cTraceBufferSize - 1)]);
+
+		// While the records were copied, the writer may have wrapped around and overwritten the oldest ones. The record
+		// j is intact only if the writer had not yet started on the record j + cTraceBufferSize.
+		std::atomic_thread_fence(std::memory_order_acquire);
+		const u64 endAfterCopy = buffer.head.load(std::memory_order_relaxed);
+		if (endAfterCopy >= begin + cTraceBufferSize)
+		{
+			const u64 numOverwritten = std::min<u64>(endAfterCopy - cTraceBufferSize - begin + 1, end - begin);
+			out.erase(out.begin() + firstCopied, out.begin() + firstCopied + (size_t)numOverwritten);
+		}
+	}
+	lock.Unlock();
+
+	struct TickLess
+	{
+		bool operator()(const TraceRecord &a, const TraceRecord &b) const { return a.tick < b.tick; }
+	};
+	std::stable_sort(out.begin(), out.end(), TickLess());
+}
+
+std::string TraceThreadName(int thread)
+{
+	Lock<std::vector<ThreadTraceBuffer*> > lock = Buffers().buffers.Acquire();
+	if (thread < 0 || thread >= (int)lock->size())
+		return "";
+	return (*lock)[thread]->name;
+}
+
+void ClearTrace()
+{
+	Lock<std::vector<ThreadTraceBuffer*> > lock = Buffers().buffers.Acquire();
+	for(size_t i = 0; i < lock->size(); ++i)
+		(*lock)[i]->clearedBefore.store((*lock)[i]->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+}
+
+std::string TraceToChromeJSON(const std::vector<TraceRecord> &records)
+{
+	std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+	char str[256];
+
+	// Name the threads that were given a name.
+	std::vector<bool> threadSeen;
+	for(size_t i = 0; i < records.size(); ++i)
+	{
+		const u16 thread = records[i].thread;
+		if (thread < threadSeen.size() && threadSeen[thread])
+			continue;
+		if (thread >= threadSeen.size())
+			threadSeen.resize(thread + 1, false);
+		threadSeen[thread] = true;
+		const std::string name = TraceThreadName(thread);
+		if (name.empty())
+			continue;
+		sprintf(str, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"", first ? "" : ",", (int)thread);
+		json += str;
+		AppendEscapedJSON(json, name);
+		json += "\"}}";
+		first = false;
+	}
+
+	const tick_t startTick = records.empty() ? 0 : records[0].tick;
+	const double usecsPerTick = 1e6 / (double)Clock::TicksPerSec();
+	for(size_t i = 0; i < records.size(); ++i)
+	{
+		const TraceRecord &r = records[i];
+		if (r.event >= NumTraceEventTypes)
+			continue;
+		const TraceEventInfo &info = traceEventInfo[r.event];
+		const double ts = (double)Clock::TicksInBetween(r.tick, startTick) * usecsPerTick;
+
+		// Each message is an async span from the time it was queued to the time it was packed, keyed by its connection and number.
+		const char *phase = "i";
+		switch(r.event)
+		{
+		case TraceMessageQueued: phase = "b"; break;
+		case TraceMessageAccepted: phase = "n"; break;
+		case TraceMessagePacked: phase = "e"; break;
+		case TraceWorkerWaitBegin: phase = "B"; break;
+		case TraceWorkerWaitEnd: phase = "E"; break;
+		}
+
+		sprintf(str, "%s{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%d", first ? "" : ",",
+			(phase[0] == 'b' || phase[0] == 'n' || phase[0] == 'e') ? "Message" : info.name, phase, ts, (int)r.thread);
+		json += str;
+		first = false;
+		if (phase[0] == 'b' || phase[0] == 'n' || phase[0] == 'e')
+		{
+			sprintf(str, ",\"cat\":\"message\",\"id\":\"0x%llx.%u\"", (unsigned long long)r.object, (unsigned int)r.arg0);
+			json += str;
+		}
+		else if (phase[0] == 'i')
+			json += ",\"cat\":\"connection\",\"s\":\"t\"";
+		else
+			json += ",\"cat\":\"worker\"";
+
+		sprintf(str, ",\"args\":{\"event\":\"%s\",\"object\":\"0x%llx\"", info.name, (unsigned long long)r.object);
+		json += str;
+		if (r.event == TraceConnectionState)
+		{
+			json += ",\"state\":\"";
+			json += ConnectionStateToString((ConnectionState)r.arg0);
+			json += "\"";
+		}
+		else
+		{
+			if (info.arg0Name)
+			{
+				sprintf(str, ",\"%s\":%u", info.arg0Name, (unsigned int)r.arg0);
+				json += str;
+			}
+			if (info.arg1Name)
+			{
+				sprintf(str, ",\"%s\":%u", info.arg1Name, (unsigned int)r.arg1);
+				json += str;
+			}
+		}
+		json += "}}";
+	}
+	json += "]}";
+	return json;
+}
+
+bool WriteChromeTrace(const char *filename)
+{
+	std::vector<TraceRecord> records;
+	ReadTrace(records);
+	const std::string json = TraceToChromeJSON(records);
+
+	FILE *handle = fopen(filename, "wb");
+	if (!handle)
+		return false;
+	const bool success = fwrite(json.data(), 1, json.length(), handle) == json.length();
+	return fclose(handle) == 0 && success;
+}
+
+} // ~kNet
@@ -36,6 +36,7 @@
 #include "kNet/NetException.h"
 #include "kNet/Network.h"
 #include "kNet/Sort.h"
+#include "kNet/Trace.h"
 
 using namespace std;
 
@@ -46,29 +47,63 @@ static const int initialDatagramRatePerSecond = 30;
 /// The maximum time to wait before acking a packet. If there are enough packets to ack for a full ack message,
 /// acking will be performed earlier. (milliseconds)
 static const float maxAckDelay = 33.f; // (1/30th of a second)
+
+/// The resolution of the ack delay field in the PacketAck messages. 16 usecs allows delays of up to a second.
+static const int cAckDelayUnitUSecs = 16;
 /// The time counter after which an unacked reliable message will be resent. (UDP only)
 static const float timeOutMilliseconds = 2000.f;//750.f;
 /// The maximum number of datagrams to read in from the socket at one go - after this reads will be throttled
 /// to give time for data sending as well.
 static const int cMaxDatagramsToReadInOneFrame = 2048;
 
+/// How far a connection may fall behind its datagram send schedule and still catch up, in usecs. This covers the
+/// wake-up latency of the worker thread. Anything older is dropped, so that it is not sent as a burst.
+static const int cMaxPacingCreditUSecs = 250;
+
 static const u32 cMaxUDPMessageFragmentSize = 470;
 
+/// The initial number of slots in outboundPacketAckTrack. The queue doubles in size when it fills up.
+static const int cInitialPacketAckTrackCapacity = 32;
+
+/// The number of slots receivedPacketIDs starts out with, and the number it can grow up to.
+static const int cInitialReceivedPacketIDsSize = 256;
+static const int cMaxReceivedPacketIDsSize = 64 * 1024;
+
+/// receivedPacketIDs is grown until it remembers the packet IDs received during at least this time.
+static const float cReceivedPacketIDHistoryMSecs = 5 * 1000.f;
+
+/// The maximum number of datagrams queued by the server for this connection, before new ones are dropped.
+static const int cMaxQueuedInboundDatagrams = 128;
+
+/// The first bytes of a Connection Start datagram. The last byte is the version of the format.
+static const char cConnectDatagramMagic[8] = { 'k', 'N', 'e', 't', 'C', 'o', 'n', 2 };
+/// The Connection Start capability flag of a client that handles the ConnectionId message.
+static const u8 cConnectCapabilityConnectionId = 1;
+/// The interval at which a client resends its Connection Start datagram while the server has not answered.
+static const float cConnectDatagramResendMSecs = 1000.f;
+
+/// A datagram from a new address moves the connection there only if its packet ID is at most this far ahead of the
+/// newest packet received, or at most cMaxMigrationPacketIdLag behind it.
+static const int cMaxMigrationPacketIdLead = 1024;
+static const int cMaxMigrationPacketIdLag = 64;
+
 UDPMessageConnection::UDPMessageConnection(Network *owner, NetworkServer *ownerServer, Socket *socket, ConnectionState startingState)
 :MessageConnection(owner, ownerServer, socket, startingState),
-retransmissionTimeout(3.f), numAcksLastFrame(0), numLossesLastFrame(0), smoothedRTT(3.f), rttVariation(0.f), rttCleared(true), // Set RTT initial values as per RFC 2988.
-lastReceivedInOrderPacketID(0), 
-lastSentInOrderPacketID(0), datagramPacketIDCounter(1),
-packetLossRate(0.f), packetLossCount(0.f), datagramOutRatePerSecond(initialDatagramRatePerSecond), 
-datagramInRatePerSecond(initialDatagramRatePerSecond),
-datagramSendRate(70),
-receivedPacketIDs(64 * 1024), outboundPacketAckTrack(1024),
-previousReceivedPacketID(0), queuedInboundDatagrams(128)
+lastReceivedInOrderPacketID(0), lastSentInOrderPacketID(0), datagramPacketIDCounter(1),
+retransmissionTimeout(3000.f), numAcksLastFrame(0), numLossesLastFrame(0), datagramSendRate(70),
+rttCleared(true), smoothedRTT(3000.f), rttVariation(0.f), // Set RTT initial values as per RFC 2988.
+ackDelayEnabled(false), numAckRttSamples(0), packetLossRate(0.f), packetLossCount(0.f),
+sendStalled(false), kernelPacingEnabled(false), kernelPacingRate(0.f), outboundPacketAckTrack(cInitialPacketAckTrackCapacity),
+sendConnectHeader(false), lastConnectDatagramTick(0), connectionId(0), sendConnectionId(false),
+datagramOutRatePerSecond(initialDatagramRatePerSecond), datagramInRatePerSecond(initialDatagramRatePerSecond),
+receivedPacketIDs(cInitialReceivedPacketIDsSize, cMaxReceivedPacketIDsSize, cReceivedPacketIDHistoryMSecs),
+previousReceivedPacketID(0)
 {
 	LOG(LogObjectAlloc, "Allocated UDPMessageConnection %p.", this);
 
 	lastFrameTime = Clock::Tick();
 	lastDatagramSendTime = Clock::Tick();
+	connectData.size = 0;
 }
 
 UDPMessageConnection::~UDPMessageConnection()
@@ -83,12 +118,163 @@ UDPMessageConnection::~UDPMessageConnection()
 	assert(!workerThread);
 
 	while(outboundPacketAckTrack.Size() > 0)
-		FreeOutboundPacketAckTrack(outboundPacketAckTrack.Front()->packetID);
+		FreeOutboundPacketAckTrack(outboundPacketAckTrack.Front()->packetID, false);
 
 	outboundPacketAckTrack.Clear();
 }
 
-void UDPMessageConnection::QueueInboundDatagram(const char *data, size_t numBytes)
+void UDPMessageConnection::StartConnect(const Datagram *connectMessage)
+{
+	AssertInMainThreadContext();
+
+	sendConnectHeader = true;
+	lastConnectDatagramTick = 0;
+	connectData.size = 0;
+	if (connectMessage)
+	{
+		// Leave room for the header and the packet of at least one small message.
+		const size_t maxConnectDataSize = GetSocket()->MaxSendSize() / 4;
+		connectData.size = std::min<size_t>(connectMessage->size, maxConnectDataSize);
+		if (connectData.size < connectMessage->size)
+			LOG(LogError, "UDPMessageConnection::StartConnect: Truncated the connect message of %d bytes to %d bytes!", (int)connectMessage->size, (int)connectData.size);
+		memcpy(connectData.data, connectMessage->data, connectData.size);
+	}
+}
+
+bool UDPMessageConnection::ParseConnectDatagram(const char *data, size_t numBytes, const char *&connectData, size_t &connectDataSize,
+	const char *&packet, size_t &packetSize, bool *takesConnectionId)
+{
+	const size_t versionPos = sizeof(cConnectDatagramMagic) - 1;
+	if (!data || numBytes < sizeof(cConnectDatagramMagic) + 2 || memcmp(data, cConnectDatagramMagic, versionPos) != 0)
+		return false;
+	// Version 1 has no capability flags.
+	u8 capabilities = 0;
+	size_t headerSize = sizeof(cConnectDatagramMagic) + 2;
+	if (data[versionPos] == cConnectDatagramMagic[versionPos])
+	{
+		headerSize += 1;
+		if (numBytes < headerSize)
+			return false;
+		capabilities = (u8)data[sizeof(cConnectDatagramMagic)];
+	}
+	else if (data[versionPos] != 1)
+		return false;
+	DataDeserializer reader(data + headerSize - 2, 2);
+	const size_t dataSize = reader.Read<u16>();
+	if (headerSize + dataSize > numBytes)
+		return false;
+	if (takesConnectionId)
+		*takesConnectionId = (capabilities & cConnectCapabilityConnectionId) != 0;
+	connectData = data + headerSize;
+	connectDataSize = dataSize;
+	packet = data + headerSize + dataSize;
+	packetSize = numBytes - headerSize - dataSize;
+	return true;
+}
+
+size_t UDPMessageConnection::ConnectHeaderSize() const
+{
+	return sizeof(cConnectDatagramMagic) + 1 + 2 + connectData.size;
+}
+
+void UDPMessageConnection::WriteConnectHeader(DataSerializer &writer) const
+{
+	writer.AddAlignedByteArray(cConnectDatagramMagic, sizeof(cConnectDatagramMagic));
+	writer.Add<u8>(cConnectCapabilityConnectionId);
+	writer.Add<u16>((u16)connectData.size);
+	if (connectData.size > 0)
+		writer.AddAlignedByteArray(connectData.data, connectData.size);
+}
+
+void UDPMessageConnection::SendConnectDatagram()
+{
+	AssertInWorkerThreadContext();
+
+	OverlappedTransferBuffer *data = GetSocket()->BeginSend();
+	if (!data)
+		return;
+	DataSerializer writer(data->buffer.buf, data->buffer.len);
+	WriteConnectHeader(writer);
+	data->bytesContains = writer.BytesFilled();
+	if (!GetSocket()->EndSend(data))
+	{
+		LOG(LogError, "UDPMessageConnection::SendConnectDatagram: Socket::EndSend failed to socket %s!", GetSocket()->ToString().c_str());
+		return;
+	}
+	lastConnectDatagramTick = Clock::Tick();
+	AddOutboundStats(writer.BytesFilled(), 1, 0);
+	LOG(LogVerbose, "UDPMessageConnection::SendConnectDatagram: Sent a Connection Start datagram of %d bytes.", (int)writer.BytesFilled());
+}
+
+bool UDPMessageConnection::ReadConnectionId(const char *data, size_t numBytes, u32 &connectionId)
+{
+	if (!data || numBytes < 7 || (data[0] & 0x80) == 0)
+		return false;
+	DataDeserializer reader(data + 3, 4);
+	connectionId = reader.Read<u32>();
+	return true;
+}
+
+void UDPMessageConnection::SetConnectionId(u32 connectionId_)
+{
+	AssertInMainThreadContext();
+
+	connectionId = connectionId_;
+	NetworkMessage *msg = StartNewMessage(MsgIdConnectionId, 4);
+	DataSerializer mb(msg->data, 4);
+	mb.Add<u32>(connectionId);
+	msg->reliable = true;
+	msg->priority = NetworkMessage::cMaxPriority - 1;
+#ifdef KNET_NETWORK_PROFILING
+	static const StatsMetricId profilerMetric = RegisterStatsMetric("messageOut.ConnectionId (5)", "bytes");
+	msg->profilerMetric = profilerMetric;
+#endif
+	EndAndQueueMessage(msg, mb.BytesFilled(), false);
+}
+
+void UDPMessageConnection::HandleConnectionIdMessage(const char *data, size_t numBytes)
+{
+	AssertInWorkerThreadContext();
+
+	if (numBytes != 4)
+	{
+		LOG(LogError, "Malformed ConnectionId message received! Size was %d bytes, expected 4 bytes!", (int)numBytes);
+		throw NetException("Received a ConnectionId message of wrong size! (expected 4 bytes)");
+	}
+	// Only the server hands out IDs, and only a client puts them in its packets.
+	if (ownerServer)
+		return;
+	DataDeserializer mr(data, numBytes);
+	connectionId = mr.Read<u32>();
+	sendConnectionId = (connectionId != 0);
+	LOG(LogInfo, "UDPMessageConnection::HandleConnectionIdMessage: The server assigned the connection ID 0x%08X.", (unsigned int)connectionId);
+}
+
+bool UDPMessageConnection::IsValidMigrationDatagram(const char *data, size_t numBytes) const
+{
+	AssertInWorkerThreadContext();
+
+	u32 id;
+	if (connectionId == 0 || !ReadConnectionId(data, numBytes, id) || id != connectionId)
+		return false;
+	const packet_id_t packetID = ((packet_id_t)(u8)data[1] << 6) | ((packet_id_t)(u8)data[2] << 14) | (data[0] & 63);
+	if (HaveReceivedPacketID(packetID))
+		return false;
+	return PacketIDIsNewerThan(packetID, SubPacketID(previousReceivedPacketID, cMaxMigrationPacketIdLag))
+		&& !PacketIDIsNewerThan(packetID, AddPacketID(previousReceivedPacketID, cMaxMigrationPacketIdLead));
+}
+
+void UDPMessageConnection::MigrateToEndPoint(const EndPoint &newEndPoint)
+{
+	AssertInWorkerThreadContext();
+
+	LOG(LogVerbose, "UDPMessageConnection::MigrateToEndPoint: Connection 0x%08X is moving from %s to %s.", (unsigned int)connectionId,
+		GetSocket()->RemoteEndPoint().ToString().c_str(), newEndPoint.ToString().c_str());
+	if (ownerServer)
+		ownerServer->QueueUDPConnectionMigration(this, newEndPoint);
+}
+
+void UDPMessageConnection::QueueInboundDatagram(const char *data, size_t numBytes, const EndPoint *newEndPoint)
 {
 	if (!data || numBytes == 0)
 	{
@@ -101,15 +287,19 @@ void UDPMessageConnection::QueueInboundDatagram(const char *data, size_t numByte
 		return;
 	}
 
-	Datagram d;
-	memcpy(d.data, data, numBytes);
-	d.size = numBytes;
-	bool success = queuedInboundDatagrams.Insert(d);
-	if (!success)
+	if (queuedInboundDatagrams.Size() >= cMaxQueuedInboundDatagrams)
 	{
 		LOG(LogError, "UDPMessageConnection::QueueInboundDatagram: Dropping received datagram, since the client receive buffer is full!");
 		return;
 	}
+
+	QueuedDatagram d;
+	memcpy(d.datagram.data, data, numBytes);
+	d.datagram.size = numBytes;
+	d.fromNewEndPoint = (newEndPoint != 0);
+	if (newEndPoint)
+		d.newEndPoint = *newEndPoint;
+	queuedInboundDatagrams.Insert(d);
 }
 
 void UDPMessageConnection::ProcessQueuedDatagrams()
@@ -118,8 +308,18 @@ void UDPMessageConnection::ProcessQueuedDatagrams()
 
 	while(queuedInboundDatagrams.Size() > 0)
 	{
-		Datagram *d = queuedInboundDatagrams.Front();
-		ExtractMessages((const char*)d->data, d->size);
+		QueuedDatagram *d = queuedInboundDatagrams.Front();
+		const char *data = (const char*)d->datagram.data;
+		if (!d->fromNewEndPoint || !socket || d->newEndPoint == GetSocket()->RemoteEndPoint())
+			ExtractMessages(data, d->datagram.size);
+		else if (IsValidMigrationDatagram(data, d->datagram.size))
+		{
+			ExtractMessages(data, d->datagram.size);
+			MigrateToEndPoint(d->newEndPoint);
+		}
+		else
+			LOG(LogError, "UDPMessageConnection::ProcessQueuedDatagrams: Ignored a datagram from %s that did not validate as a move of connection 0x%08X.",
+				d->newEndPoint.ToString().c_str(), (unsigned int)connectionId);
 		queuedInboundDatagrams.PopFront();
 	}
 }
@@ -128,7 +328,7 @@ UDPMessageConnection::SocketReadResult UDPMessageConnection::ReadSocket(size_t &
 {
 	AssertInWorkerThreadContext();
 
-	assert(!socket || socket->TransportLayer() == SocketOverUDP);
+	assert(!socket || GetSocket()->TransportLayer() == SocketOverUDP);
 
 	SocketReadResult readResult = SocketReadOK;
 		
@@ -137,9 +337,11 @@ UDPMessageConnection::SocketReadResult UDPMessageConnection::ReadSocket(size_t &
 	///\todo Replace with ConnectSyn,ConnectSynAck and ConnectAck.
 	if (bytesRead > 0 && connectionState == ConnectionPending)
 	{
+		sendConnectHeader = false;
 		connectionState = ConnectionOK;
+		KNET_TRACE(TraceConnectionState, this, connectionState, 0);
 		LOG(LogUser, "UDPMessageConnection::ReadSocket: Received data from socket %s. Transitioned from ConnectionPending to ConnectionOK state.", 
-			(socket ? socket->ToString().c_str() : "(null)"));
+			(socket ? GetSocket()->ToString().c_str() : "(null)"));
 	}
 	if (readResult == SocketReadError)
 		return SocketReadError;
@@ -154,7 +356,7 @@ void UDPMessageConnection::PerformPacketAckSends()
 {
 	AssertInWorkerThreadContext();
 
-	tick_t now = Clock::Tick();
+	tick_t now = Clock::LoopTick();
 	while(inboundPacketAckTrack.size() > 0)
 	{
 		if (Clock::TimespanToMillisecondsF(inboundPacketAckTrack.begin()->second.sentTick, now) < maxAckDelay &&
@@ -169,7 +371,7 @@ UDPMessageConnection::SocketReadResult UDPMessageConnection::UDPReadSocket(size_
 {
 	AssertInWorkerThreadContext();
 
-	if (!socket || !socket->IsReadOpen())
+	if (!socket || !GetSocket()->IsReadOpen())
 		return SocketReadError;
 
 	totalBytesRead = 0;
@@ -181,7 +383,7 @@ UDPMessageConnection::SocketReadResult UDPMessageConnection::UDPReadSocket(size_
 	while(maxReads-- > 0)
 	{
 		assert(socket);
-		OverlappedTransferBuffer *data = socket->BeginReceive();
+		OverlappedTransferBuffer *data = GetSocket()->BeginReceive();
 		if (!data || data->bytesContains == 0)
 			break;
 
@@ -191,7 +393,7 @@ UDPMessageConnection::SocketReadResult UDPMessageConnection::UDPReadSocket(size_
 		ExtractMessages(data->buffer.buf, data->bytesContains);
 
 		// Done with the received data buffer. Free it up for a future socket read.
-		socket->EndReceive(data);
+		GetSocket()->EndReceive(data);
 	}
 
 	if (maxReads == 0)
@@ -208,10 +410,10 @@ void UDPMessageConnection::ProcessPacketTimeouts() // [worker thread]
 {
 	AssertInWorkerThreadContext();
 
-	if (!socket || !socket->IsWriteOpen())
+	if (!socket || !GetSocket()->IsWriteOpen())
 		return;
 
-	assert(socket->TransportLayer() == SocketOverUDP);
+	assert(GetSocket()->TransportLayer() == SocketOverUDP);
 
 	const tick_t now = Clock::Tick();
 
@@ -225,6 +427,7 @@ void UDPMessageConnection::ProcessPacketTimeouts() // [worker thread]
 			return; // Note here: for optimization purposes, the packets will time out in the order they were sent.
 
 		++numPacketsTimedOut;
+		KNET_TRACE(TracePacketTimedOut, this, track->packetID, track->messages.size());
 			
 		LOG(LogVerbose, "A packet with ID %d timed out. Age: %.2fms. Contains %d messages.", 
 			(int)track->packetID, (float)Clock::TimespanToMillisecondsD(track->sentTick, now), (int)track->messages.size());
@@ -297,13 +500,40 @@ void UDPMessageConnection::SendOutPackets()
 {
 	AssertInWorkerThreadContext();
 
-	if (!socket || !socket->IsWriteOpen())
+	if (!socket || !GetSocket()->IsWriteOpen())
 		return;
 
+	UpdateKernelPacingRate();
+
+	// The datagrams of this round go out to the kernel with a single call.
+	// The main thread may replace the socket meanwhile, so the batch is flushed from the socket it was started on.
 	PacketSendResult result = PacketSendOK;
 	int maxSends = 50;
-	while(result == PacketSendOK && TimeUntilCanSendPacket() == 0 && maxSends-- > 0)
+	Socket *batchSocket = GetSocket();
+	batchSocket->BeginSendBatch();
+	while(result == PacketSendOK && CanSendOutNewDatagram() && maxSends-- > 0)
 		result = SendOutPacket();
+	if (!batchSocket->EndSendBatch() && result == PacketSendOK)
+		result = PacketSendSocketFull;
+
+	// A throttled send due to the send rate is woken up by MicrosecondsUntilCanSendPacket(), any other failure is polled.
+	sendStalled = (result != PacketSendOK && (result != PacketSendThrottled || CanSendOutNewDatagram()));
+}
+
+void UDPMessageConnection::UpdateKernelPacingRate()
+{
+	if (!kernelPacingEnabled || GetSocket()->IsUDPSlaveSocket())
+		return;
+
+	// Only pass on changes of over 1/16th, since the flow control adjusts the rate a little on each frame.
+	if (fabs(datagramSendRate - kernelPacingRate) * 16.f <= kernelPacingRate)
+		return;
+
+	// The datagrams are at most MaxSendSize() bytes each, so this is never a tighter limit than datagramSendRate itself.
+	if (GetSocket()->SetMaxPacingRate((u64)(datagramSendRate * GetSocket()->MaxSendSize())))
+		kernelPacingRate = datagramSendRate;
+	else
+		kernelPacingEnabled = false;
 }
 
 /// Returns the 'earlier' of the two message numbers, taking number wrap-around into account.
@@ -321,7 +551,7 @@ MessageConnection::PacketSendResult UDPMessageConnection::SendOutPacket()
 {
 	AssertInWorkerThreadContext();
 
-	if (!socket || !socket->IsWriteOpen())
+	if (!socket || !GetSocket()->IsWriteOpen())
 		return PacketSendSocketClosed;
 
 	// If the main thread has asked the worker thread to hold sending any messages, stop here already.
@@ -335,22 +565,27 @@ MessageConnection::PacketSendResult UDPMessageConnection::SendOutPacket()
 	if (!CanSendOutNewDatagram())
 		return PacketSendThrottled;
 
-	OverlappedTransferBuffer *data = socket->BeginSend();
+	OverlappedTransferBuffer *data = GetSocket()->BeginSend();
 	if (!data)
 		return PacketSendThrottled;
 
 	const size_t minSendSize = 1;
-	const size_t maxSendSize = socket->MaxSendSize();
+	const size_t maxSendSize = GetSocket()->MaxSendSize();
 
 	// Push out all the pending data to the socket.
 	datagramSerializedMessages.clear();
 
 	// If true, the receiver needs to Ack the packet we are now crafting.
 	bool reliable = false;
-	// If true, the packet contains in-order deliverable messages.
-	bool inOrder = false;
+
+	// Until the server answers, the datagrams of a client carry the Connection Start header in front of the packet.
+	bool connectHeader = sendConnectHeader && connectionState == ConnectionPending;
 
 	int packetSizeInBytes = 7; // The datagram header takes up 3-7 bytes. (PacketID + Flags take at least three bytes to start with)
+	if (sendConnectionId)
+		packetSizeInBytes += 4;
+	if (connectHeader)
+		packetSizeInBytes += (int)ConnectHeaderSize();
 	const int cBytesForInOrderDeltaCounter = 2;
 
 	unsigned long smallestReliableMessageNumber = 0xFFFFFFFF;
@@ -402,6 +637,14 @@ MessageConnection::PacketSendResult UDPMessageConnection::SendOutPacket()
 		if (datagramSerializedMessages.size() > 0 && (size_t)packetSizeInBytes + totalMessageSize >= maxSendSize)
 			break;
 
+		// If the first message does not fit behind the Connection Start header, send the header in a datagram of its own.
+		if (connectHeader && datagramSerializedMessages.size() == 0 && (size_t)packetSizeInBytes + totalMessageSize >= maxSendSize)
+		{
+			SendConnectDatagram();
+			connectHeader = false;
+			packetSizeInBytes -= (int)ConnectHeaderSize();
+		}
+
 		if (totalMessageSize > (int)maxSendSize)
 			LOG(LogError, "Warning: Sending out a message of ID %d and size %d bytes, but UDP socket max send size is only %d bytes!", (int)msg->id, totalMessageSize, (int)maxSendSize);
 
@@ -415,9 +658,6 @@ MessageConnection::PacketSendResult UDPMessageConnection::SendOutPacket()
 			reliable = true;
 			smallestReliableMessageNumber = (smallestReliableMessageNumber == 0xFFFFFFFF) ? msg->reliableMessageNumber : PrecedingMessageNumber(smallestReliableMessageNumber, msg->reliableMessageNumber);
 		}
-
-		if (msg->inOrder)
-			inOrder = true;
 	}
 
 	// Ensure that the range of the message numbers is within the capacity that the protocol can represent in the byte stream.
@@ -446,10 +686,14 @@ MessageConnection::PacketSendResult UDPMessageConnection::SendOutPacket()
 
 	// Finally proceed to crafting the actual UDP packet.
 	DataSerializer writer(data->buffer.buf, data->buffer.len);
+	if (connectHeader)
+		WriteConnectHeader(writer);
 
 	const packet_id_t packetID = datagramPacketIDCounter;
-	writer.Add<u8>((u8)((packetID & 63) | ((reliable ? 1 : 0) << 6)  | ((inOrder ? 1 : 0) << 7)));
+	writer.Add<u8>((u8)((packetID & 63) | ((reliable ? 1 : 0) << 6)  | ((sendConnectionId ? 1 : 0) << 7)));
 	writer.Add<u16>((u16)(packetID >> 6));
+	if (sendConnectionId)
+		writer.Add<u32>(connectionId);
 	if (reliable)
 	{
 		assert((smallestReliableMessageNumber & 0x80000000) == 0);
@@ -458,12 +702,15 @@ MessageConnection::PacketSendResult UDPMessageConnection::SendOutPacket()
 
 	bool sentDisconnectMessage = false;
 	bool sentDisconnectAckMessage = false;
+	const tick_t packTick = Clock::Tick();
 
 	// Write all the messages in this UDP packet.
 	for(size_t i = 0; i < datagramSerializedMessages.size(); ++i)
 	{
 		NetworkMessage *msg = datagramSerializedMessages[i];
 		assert(!msg->transfer || msg->transfer->id != -1);
+		msg->packTick = packTick;
+		KNET_TRACE(TraceMessagePacked, this, msg->messageNumber, packetID);
 
 		const int encodedMsgIdLength = (msg->transfer == 0 || msg->fragmentIndex == 0) ? VLE8_16_32::GetEncodedBitLength(msg->id)/8 : 0;
 		const size_t messageContentSize = msg->dataSize + encodedMsgIdLength; // 1/2/4 bytes: Message ID. X bytes: Content.
@@ -511,7 +758,7 @@ MessageConnection::PacketSendResult UDPMessageConnection::SendOutPacket()
 	bool success;
 
 	if (!networkSendSimulator.enabled)
-		success = socket->EndSend(data); // Send the data out.
+		success = GetSocket()->EndSend(data); // Send the data out.
 	else
 	{
 		// We're running a network simulator. Pass the buffer to networkSendSimulator for delayed sending.
@@ -526,7 +773,7 @@ MessageConnection::PacketSendResult UDPMessageConnection::SendOutPacket()
 		for(size_t i = 0; i < datagramSerializedMessages.size(); ++i)
 			outboundQueue.Insert(datagramSerializedMessages[i]);
 
-		LOG(LogError, "UDPMessageConnection::SendOutPacket: Socket::EndSend failed to socket %s!", socket->ToString().c_str());
+		LOG(LogError, "UDPMessageConnection::SendOutPacket: Socket::EndSend failed to socket %s!", GetSocket()->ToString().c_str());
 		return PacketSendSocketFull;
 	}
 
@@ -536,12 +783,7 @@ MessageConnection::PacketSendResult UDPMessageConnection::SendOutPacket()
 		++datagramSerializedMessages[i]->sendCount;
 
 #ifdef KNET_NETWORK_PROFILING
-		std::stringstream ss;
-		if (!datagramSerializedMessages[i]->profilerName.empty())
-			ss << "messageOut." << datagramSerializedMessages[i]->profilerName;
-		else
-			ss << "messageOut." << datagramSerializedMessages[i]->id;
-		ADDEVENT(ss.str().c_str(), (float)datagramSerializedMessages[i]->Size(), "bytes");
+		ADDMETRIC(OutboundMessageMetric(*datagramSerializedMessages[i]), (float)datagramSerializedMessages[i]->Size());
 		if (datagramSerializedMessages[i]->transfer)
 		{
 			if (datagramSerializedMessages[i]->fragmentIndex > 0)
@@ -551,7 +793,7 @@ MessageConnection::PacketSendResult UDPMessageConnection::SendOutPacket()
 #endif
 	}
 
-	assert(socket->TransportLayer() == SocketOverUDP);
+	assert(GetSocket()->TransportLayer() == SocketOverUDP);
 
 	// Now we have to wait 1/datagramSendRate seconds again until we can send the next datagram.
 	NewDatagramSent();
@@ -560,7 +802,13 @@ MessageConnection::PacketSendResult UDPMessageConnection::SendOutPacket()
 	lastSentInOrderPacketID = datagramPacketIDCounter;
 	datagramPacketIDCounter = AddPacketID(datagramPacketIDCounter, 1);
 
+	const tick_t now = Clock::Tick();
+	if (connectHeader)
+		lastConnectDatagramTick = now;
+	KNET_TRACE(TracePacketSent, this, packetID, writer.BytesFilled());
 	AddOutboundStats(writer.BytesFilled(), 1, datagramSerializedMessages.size());
+	if (!datagramSerializedMessages.empty())
+		AddMessageSendStats(&datagramSerializedMessages[0], datagramSerializedMessages.size(), now);
 	ADDEVENT("datagramOut", (float)writer.BytesFilled(), "bytes");
 
 	if (reliable)
@@ -569,7 +817,6 @@ MessageConnection::PacketSendResult UDPMessageConnection::SendOutPacket()
 		// serialized into this datagram so that we can properly resend the messages in the datagram if it times out.
 		PacketAckTrack ack;
 		ack.packetID = packetID;
-		const tick_t now = Clock::Tick();
 		ack.sendCount = 1;
 		ack.sentTick = now;
 		retransmissionTimeout = 5000.f; ///\todo Remove this.
@@ -606,8 +853,9 @@ MessageConnection::PacketSendResult UDPMessageConnection::SendOutPacket()
 			connectionState = ConnectionDisconnecting;
 		if (connectionState == ConnectionPeerClosed)
 			connectionState = ConnectionClosed;
+		KNET_TRACE(TraceConnectionState, this, connectionState, 0);
 		if (socket)
-			socket->MarkWriteClosed();
+			GetSocket()->MarkWriteClosed();
 		LOG(LogInfo, "UDPMessageConnection::SendOutPacket: Send Disconnect from connection %s.", ToString().c_str());
 	}
 	// If we sent out the DisconnectAck message, we can tear down the connection right now - we're finished.
@@ -615,10 +863,11 @@ MessageConnection::PacketSendResult UDPMessageConnection::SendOutPacket()
 	{
 		if (socket)
 		{
-			socket->MarkReadClosed();
-			socket->MarkWriteClosed();
+			GetSocket()->MarkReadClosed();
+			GetSocket()->MarkWriteClosed();
 		}
 		connectionState = ConnectionClosed;
+		KNET_TRACE(TraceConnectionState, this, connectionState, 0);
 		LOG(LogInfo, "UDPMessageConnection::SendOutPacket: Send DisconnectAck from connection %s.", ToString().c_str());
 	}
 
@@ -632,6 +881,14 @@ void UDPMessageConnection::DoUpdateConnection()
 
 	ProcessQueuedDatagrams();
 
+	// Until the server answers, keep sending the Connection Start header. SendOutPacket() puts it in front of the queued messages.
+	if (sendConnectHeader && connectionState == ConnectionPending && socket && GetSocket()->IsWriteOpen() && !bOutboundSendsPaused && outboundQueue.Size() == 0
+		&& (lastConnectDatagramTick == 0 || Clock::TimespanToMillisecondsF(lastConnectDatagramTick, Clock::LoopTick()) >= cConnectDatagramResendMSecs))
+		SendConnectDatagram();
+
+	if (hibernating)
+		return;
+
 	if (udpUpdateTimer.TriggeredOrNotRunning())
 	{
 		// We can send out data now. Perform connection management before sending out any messages.
@@ -664,6 +921,25 @@ void UDPMessageConnection::DoUpdateConnection()
 */
 }
 
+bool UDPMessageConnection::CanHibernate() const
+{
+	return outboundPacketAckTrack.Size() == 0 && inboundPacketAckTrack.empty() && queuedInboundDatagrams.Size() == 0;
+}
+
+void UDPMessageConnection::ReleaseIdleMemory()
+{
+	AssertInWorkerThreadContext();
+
+	receivedPacketIDs.Release();
+	if (outboundPacketAckTrack.Size() == 0 && outboundPacketAckTrack.Capacity() + 1 > cInitialPacketAckTrackCapacity)
+		outboundPacketAckTrack.Resize(cInitialPacketAckTrackCapacity);
+	queuedInboundDatagrams.ReleaseSpareBlock();
+
+	std::vector<NetworkMessage *>().swap(datagramSerializedMessages);
+	std::vector<NetworkMessage *>().swap(skippedMessages);
+	std::vector<char>().swap(assembledData);
+}
+
 unsigned long UDPMessageConnection::TimeUntilCanSendPacket() const
 {
 	const tick_t now = Clock::Tick();
@@ -679,6 +955,22 @@ unsigned long UDPMessageConnection::TimeUntilCanSendPacket() const
 	return (unsigned long)Clock::TimespanToMillisecondsF(now, nextDatagramSendTime);
 }
 
+unsigned long UDPMessageConnection::MicrosecondsUntilCanSendPacket() const
+{
+	if (sendStalled)
+		return 1000;
+
+	const tick_t now = Clock::Tick();
+	const tick_t datagramSendTickDelay = (tick_t)(Clock::TicksPerSec() / datagramSendRate);
+	const tick_t nextDatagramSendTime = lastDatagramSendTime + datagramSendTickDelay;
+
+	if (Clock::IsNewer(now, nextDatagramSendTime))
+		return 0;
+
+	// Round up, so that the worker does not wake up just before the datagram is due.
+	return (unsigned long)ceil(Clock::TimespanToMillisecondsD(now, nextDatagramSendTime) * 1000.0);
+}
+
 bool UDPMessageConnection::HaveReceivedPacketID(packet_id_t packetID) const
 {
 	return receivedPacketIDs.Exists(packetID);
@@ -697,7 +989,7 @@ void UDPMessageConnection::AddReceivedPacketIDStats(packet_id_t packetID)
 
 	cs.recvPacketIDs.push_back(ConnectionStatistics::DatagramIDTrack());
 	ConnectionStatistics::DatagramIDTrack &t = cs.recvPacketIDs.back();
-	t.tick = Clock::Tick();
+	t.tick = Clock::LoopTick();
 	t.packetID = packetID;
 //	LOG(LogVerbose, "Marked packet with ID %d received.", (int)packetID);
 	statistics.Unlock();
@@ -720,13 +1012,13 @@ void UDPMessageConnection::ExtractMessages(const char *data, size_t numBytes)
 	// Immediately discard this datagram if it might contain more messages than we can handle. Otherwise
 	// we might end up in a situation where we have already applied some of the messages in the datagram
 	// and realize we don't have space to take in the rest, which would require a "partial ack" of sorts.
-	if (inboundMessageQueue.CapacityLeft() < 64)
+	if (InboundMessageQueueCapacityLeft() < 64)
 	{
 		ADDEVENT("inputDiscarded", (float)numBytes, "bytes");
 		return;
 	}
 
-	lastHeardTime = Clock::Tick();
+	lastHeardTime = Clock::LoopTick();
 
 	if (numBytes < 3)
 	{
@@ -738,11 +1030,24 @@ void UDPMessageConnection::ExtractMessages(const char *data, size_t numBytes)
 
 	// Start by reading the packet header (flags, packetID).
 	u8 flags = reader.Read<u8>();
-	bool inOrder = (flags & (1 << 7)) != 0;
+	bool hasConnectionId = (flags & (1 << 7)) != 0;
 	bool packetReliable = (flags & (1 << 6)) != 0;
 	packet_id_t packetID = (reader.Read<u16>() << 6) | (flags & 63);
+	// Older clients set the bit as the InOrder flag. Only a client that took the ID in its Connection Start datagram
+	// has been assigned one, and it sets the bit only after it has received the ID.
+	if (hasConnectionId && connectionId != 0 && ownerServer)
+	{
+		if (reader.BytesLeft() < 4)
+			throw NetException("Malformed UDP packet received! No space for the connection ID.");
+		if (reader.Read<u32>() != connectionId)
+		{
+			LOG(LogError, "Discarded a UDP packet with a wrong connection ID from %s!", GetSocket()->ToString().c_str());
+			return;
+		}
+	}
 
 	unsigned long reliableMessageIndexBase = (packetReliable ? reader.ReadVLE<VLE16_32>() : 0); ///\todo sanitize input length.
+	KNET_TRACE(TracePacketReceived, this, packetID, numBytes);
 
 	// If the 'reliable'-flag is set, remember this PacketID, we need to Ack it later on.
 	if (packetReliable)
@@ -752,7 +1057,7 @@ void UDPMessageConnection::ExtractMessages(const char *data, size_t numBytes)
 		// The following are not used right now.
 		///\todo If we want to queue up a few acks before sending an ack message, we should possibly save here
 		// the time when we received the packet.
-		t.sentTick = Clock::Tick();
+		t.sentTick = Clock::LoopTick();
 	}
 
 	// Note that this check must be after the ack check (above), since we still need to ack the new packet as well (our
@@ -766,19 +1071,6 @@ void UDPMessageConnection::ExtractMessages(const char *data, size_t numBytes)
 	if (packetID != previousReceivedPacketID + 1)
 		ADDEVENT("outOfOrderReceived", fabs((float)(packetID - (previousReceivedPacketID + 1))), "");
 
-	// If the 'inOrder'-flag is set, there's an extra 'Order delta counter' field present,
-	// that specifies the processing ordering of this packet.
-	packet_id_t inOrderID = 0;
-	if (inOrder)
-	{
-//		inOrderID = reader.ReadVLE<VLE8_16>();
-		if (inOrderID == DataDeserializer::VLEReadError)
-		{
-			LOG(LogError, "Malformed UDP packet! Size = %d bytes, no space for packet header field 'inOrder'!", (int)numBytes);
-			throw NetException("Malformed UDP packet received! The inOrder field was invalid.");
-		}
-	}
-
 	size_t numMessagesReceived = 0;
 	while(reader.BytesLeft() > 0)
 	{
@@ -916,10 +1208,13 @@ void UDPMessageConnection::NewDatagramSent()
 	const tick_t datagramSendTickDelay = (tick_t)(Clock::TicksPerSec() / datagramSendRate);
 	const tick_t now = Clock::Tick();
 
-	if (Clock::TicksInBetween(now, lastDatagramSendTime) / datagramSendTickDelay < 20)
-		lastDatagramSendTime += datagramSendTickDelay;
-	else
-		lastDatagramSendTime = now;
+	// Each datagram is scheduled one interval after the previous one, so the datagrams go out evenly at
+	// datagramSendRate. If the worker woke up late, it may catch up with the schedule, but by at most
+	// cMaxPacingCreditUSecs or one interval, whichever is longer. A larger credit would be sent as a burst.
+	const tick_t maxCredit = max<tick_t>(datagramSendTickDelay, Clock::TicksPerSec() * cMaxPacingCreditUSecs / 1000000);
+	lastDatagramSendTime += datagramSendTickDelay;
+	if (Clock::IsNewer(now, lastDatagramSendTime) && Clock::TicksInBetween(now, lastDatagramSendTime) > maxCredit)
+		lastDatagramSendTime = now - maxCredit;
 }
 
 void UDPMessageConnection::SendDisconnectMessage(bool isInternal)
@@ -930,7 +1225,8 @@ void UDPMessageConnection::SendDisconnectMessage(bool isInternal)
 	msg->priority = NetworkMessage::cMaxPriority; ///\todo Highest or lowest priority depending on whether to finish all pending messages?
 	msg->reliable = true;
 #ifdef KNET_NETWORK_PROFILING
-	msg->profilerName = "Disconnect (0x3FFFFFFF)";
+	static const StatsMetricId profilerMetric = RegisterStatsMetric("messageOut.Disconnect (0x3FFFFFFF)", "bytes");
+	msg->profilerMetric = profilerMetric;
 #endif
 	EndAndQueueMessage(msg, 0, isInternal);
 
@@ -945,7 +1241,8 @@ void UDPMessageConnection::SendDisconnectAckMessage()
 	msg->priority = NetworkMessage::cMaxPriority; ///\todo Highest or lowest priority depending on whether to finish all pending messages?
 	msg->reliable = false;
 #ifdef KNET_NETWORK_PROFILING
-	msg->profilerName = "DisconnectAck (0x3FFFFFFE)";
+	static const StatsMetricId profilerMetric = RegisterStatsMetric("messageOut.DisconnectAck (0x3FFFFFFE)", "bytes");
+	msg->profilerMetric = profilerMetric;
 #endif
 	EndAndQueueMessage(msg, 0, true); ///\todo Check this flag!
 
@@ -1013,7 +1310,7 @@ int UDPMessageConnection::BiasedBinarySearchFindPacketIndex(PacketAckTrackQueue
 	return -1;
 }
 
-void UDPMessageConnection::FreeOutboundPacketAckTrack(packet_id_t packetID)
+void UDPMessageConnection::FreeOutboundPacketAckTrack(packet_id_t packetID, bool acked, bool sampleRtt, tick_t ackDelay)
 {
 	AssertInWorkerThreadContext();
 
@@ -1026,6 +1323,11 @@ void UDPMessageConnection::FreeOutboundPacketAckTrack(packet_id_t packetID)
 
 	// Free up all the messages in the acked packet. We don't need to keep track of those any more (to be sent to peer).
 	PacketAckTrack &track = *outboundPacketAckTrack.ItemAt(itemIndex);
+	const tick_t now = Clock::Tick();
+	if (acked)
+		KNET_TRACE(TracePacketAcked, this, packetID, track.messages.size());
+	if (acked && track.messages.size() > 0)
+		AddMessageAckStats(&track.messages[0], track.messages.size(), now);
 	for(size_t i = 0; i < track.messages.size(); ++i)
 	{
 		// If the message was part of a fragmented transfer, remove the message from that data structure.
@@ -1040,9 +1342,18 @@ void UDPMessageConnection::FreeOutboundPacketAckTrack(packet_id_t packetID)
 		FreeMessage(track.messages[i]);
 	}
 
-	if (track.sendCount <= 1)
+	if (acked && track.sendCount <= 1)
 	{
-		UpdateRTOCounterOnPacketAck((float)Clock::TimespanToSecondsD(track.sentTick, Clock::Tick()));
+		const tick_t elapsed = Clock::TicksInBetween(now, track.sentTick);
+		if (sampleRtt && ackDelay == cAckDelayUnknown)
+			UpdateRTOCounterOnPacketAck((float)Clock::TicksToMillisecondsD(elapsed));
+		else if (sampleRtt && ackDelay < elapsed)
+		{
+			UpdateRTOCounterOnPacketAck((float)Clock::TicksToMillisecondsD(elapsed - ackDelay));
+			++numAckRttSamples;
+			rttFromPacketAcks = true;
+			rtt = smoothedRTT;
+		}
 		++numAcksLastFrame;
 	}
 
@@ -1053,7 +1364,7 @@ static const float minRTOTimeoutValue = 1000.f;
 static const float maxRTOTimeoutValue = 5000.f;
 
 /// Adjusts the retransmission timer values as per RFC 2988.
-/// @param rtt The round trip time that was measured on the packet that was just acked.
+/// @param rtt The round trip time that was measured on the packet that was just acked, in milliseconds.
 void UDPMessageConnection::UpdateRTOCounterOnPacketAck(float rtt)
 {
 	AssertInWorkerThreadContext();
@@ -1115,9 +1426,11 @@ void UDPMessageConnection::SendPacketAckMessage()
 {
 	AssertInWorkerThreadContext();
 
+	const tick_t now = Clock::LoopTick();
 	while(inboundPacketAckTrack.size() > 0)
 	{
 		packet_id_t packetID = inboundPacketAckTrack.begin()->first;
+		const tick_t receiveTick = inboundPacketAckTrack.begin()->second.sentTick;
 		u32 sequence = 0;
 
 		inboundPacketAckTrack.erase(packetID);
@@ -1133,14 +1446,23 @@ void UDPMessageConnection::SendPacketAckMessage()
 			}
 		}
 
-		NetworkMessage *msg = StartNewMessage(MsgIdPacketAck, 7);
-		DataSerializer mb(msg->data, 7);
+		// PacketAck format: u8 + u16 the acked packetID, u32 a bitmask of the 32 packetIDs that follow it, and if
+		// ackDelayEnabled, u16 the time the first packet waited for this ack, in units of cAckDelayUnitUSecs.
+		const size_t messageSize = ackDelayEnabled ? 9 : 7;
+		NetworkMessage *msg = StartNewMessage(MsgIdPacketAck, messageSize);
+		DataSerializer mb(msg->data, messageSize);
 		mb.Add<u8>((u8)(packetID & 0xFF));
 		mb.Add<u16>((u16)(packetID >> 8));
 		mb.Add<u32>(sequence);
+		if (ackDelayEnabled)
+		{
+			const double ackDelayUnits = Clock::TimespanToMillisecondsD(receiveTick, now) * 1000.0 / cAckDelayUnitUSecs;
+			mb.Add<u16>((u16)min(ackDelayUnits, 65535.0));
+		}
 		msg->priority = NetworkMessage::cMaxPriority - 1;
 #ifdef KNET_NETWORK_PROFILING
-		msg->profilerName = "PacketAck (4)";
+		static const StatsMetricId profilerMetric = RegisterStatsMetric("messageOut.PacketAck (4)", "bytes");
+		msg->profilerMetric = profilerMetric;
 #endif
 		EndAndQueueMessage(msg, mb.BytesFilled(), true);
 	}
@@ -1150,10 +1472,10 @@ void UDPMessageConnection::HandlePacketAckMessage(const char *data, size_t numBy
 {
 	AssertInWorkerThreadContext();
 
-	if (numBytes != 7)
+	if (numBytes != 7 && numBytes != 9)
 	{
-		LOG(LogError, "Malformed PacketAck message received! Size was %d bytes, expected 7 bytes!", (int)numBytes);
-		throw NetException("Received a PacketAck message of wrong size! (expected 7 bytes)");
+		LOG(LogError, "Malformed PacketAck message received! Size was %d bytes, expected 7 or 9 bytes!", (int)numBytes);
+		throw NetException("Received a PacketAck message of wrong size! (expected 7 or 9 bytes)");
 	}
 
 	DataDeserializer mr(data, numBytes);
@@ -1162,12 +1484,24 @@ void UDPMessageConnection::HandlePacketAckMessage(const char *data, size_t numBy
 	packet_id_t packetID = packetIDLow | (packetIDHigh << 8);
 	u32 sequence = mr.Read<u32>();
 
-	FreeOutboundPacketAckTrack(packetID);
+	if (numBytes == 9)
+	{
+		// The ack delay is only known for the first packet. The packets in the bitmask arrived after it and were
+		// held back for less time, but by an unknown amount, so they do not give RTT samples.
+		const tick_t ackDelay = (tick_t)mr.Read<u16>() * cAckDelayUnitUSecs * Clock::TicksPerSec() / 1000000;
+		FreeOutboundPacketAckTrack(packetID, true, true, ackDelay);
+		for(size_t i = 0; i < 32; ++i)
+			if ((sequence & (1 << i)) != 0)
+				FreeOutboundPacketAckTrack(AddPacketID(packetID, 1 + i), true, false);
+		return;
+	}
+
+	FreeOutboundPacketAckTrack(packetID, true);
 	for(size_t i = 0; i < 32; ++i)
 		if ((sequence & (1 << i)) != 0)
 		{
 			packet_id_t id = AddPacketID(packetID, 1 + i);
-			FreeOutboundPacketAckTrack(id);
+			FreeOutboundPacketAckTrack(id, true);
 		}
 }
 
@@ -1176,13 +1510,16 @@ void UDPMessageConnection::HandleDisconnectMessage()
 	AssertInWorkerThreadContext();
 
 	if (connectionState != ConnectionClosed)
+	{
 		connectionState = ConnectionDisconnecting;
+		KNET_TRACE(TraceConnectionState, this, connectionState, 0);
+	}
 	else
 		LOG(LogError, "UDPMessageConnection::HandleDisconnectMessage: Received Disconnect message when in ConnectionClosed state!");
 
 	if (socket)
 	{
-		socket->MarkReadClosed();
+		GetSocket()->MarkReadClosed();
 		SendDisconnectAckMessage();
 	}
 }
@@ -1193,8 +1530,8 @@ void UDPMessageConnection::HandleDisconnectAckMessage()
 
 	if (socket)
 	{
-		socket->MarkReadClosed();
-		socket->MarkWriteClosed();
+		GetSocket()->MarkReadClosed();
+		GetSocket()->MarkWriteClosed();
 	}
 
 	if (connectionState != ConnectionDisconnecting)
@@ -1204,6 +1541,7 @@ void UDPMessageConnection::HandleDisconnectAckMessage()
 		LOG(LogInfo, "UDPMessageConnection::HandleDisconnectAckMessage: Connection closed to %s.", ToString().c_str());
 
 	connectionState = ConnectionClosed;
+	KNET_TRACE(TraceConnectionState, this, connectionState, 0);
 }
 
 void UDPMessageConnection::PerformFlowControl()
@@ -1212,7 +1550,7 @@ void UDPMessageConnection::PerformFlowControl()
 
 	/*
 	// The manual flow control only applies to UDP connections.
-	if (socket->TransportLayer() == SocketOverTCP)
+	if (GetSocket()->TransportLayer() == SocketOverTCP)
 		return;
 
 	const float maxAllowedPacketLossRate = 0.f;
@@ -1245,7 +1583,7 @@ void UDPMessageConnection::ComputePacketLoss()
 	}
 
 	const tick_t maxEntryAge = Clock::TicksPerSec() * 5;
-	const tick_t timeNow = Clock::Tick();
+	const tick_t timeNow = Clock::LoopTick();
 	const tick_t maxTickAge = timeNow - maxEntryAge;
 
 	// Remove old entries.
@@ -1308,7 +1646,8 @@ void UDPMessageConnection::SetDatagramInFlowRatePerSecond(int newDatagramReceive
 	AppendU16ToVector(msg->data, newDatagramReceiveRate);
 	msg->priority = NetworkMessage::cMaxPriority - 1;
 #ifdef KNET_NETWORK_PROFILING
-	msg->profilerName = "FlowControlRequest (3)";
+	static const StatsMetricId profilerMetric = RegisterStatsMetric("messageOut.FlowControlRequest (3)", "bytes");
+	msg->profilerMetric = profilerMetric;
 #endif
 	EndAndQueueMessage(msg, 2, internalCall);*/
 }
@@ -1329,6 +1668,9 @@ bool UDPMessageConnection::HandleMessage(packet_id_t packetID, message_id_t mess
 	case MsgIdPacketAck:
 		HandlePacketAckMessage(data, numBytes);
 		return true;
+	case MsgIdConnectionId:
+		HandleConnectionIdMessage(data, numBytes);
+		return true;
 	case MsgIdDisconnect:
 		HandleDisconnectMessage();
 		return true;
@@ -1361,6 +1703,7 @@ void UDPMessageConnection::DumpConnectionStatus() const
 		"\tDatagram send rate: %.2f/sec.\n"
 		"\tSmoothed RTT: %.2fms.\n"
 		"\tRTT variation: %.2f.\n"
+		"\tAck RTT samples: %d.\n"
 		"\tOutbound reliable datagrams in flight: %d.\n"
 		"\tReceived unacked datagrams: %d.\n"
 		"\tPacket loss count: %.2f.\n"
@@ -1371,6 +1714,7 @@ void UDPMessageConnection::DumpConnectionStatus() const
 	datagramSendRate,
 	smoothedRTT,
 	rttVariation,
+	(int)numAckRttSamples,
 	(int)outboundPacketAckTrack.Size(), ///\todo Accessing this variable is not thread-safe.
 	(int)inboundPacketAckTrack.size(), ///\todo Accessing this variable is not thread-safe.
 	packetLossCount,
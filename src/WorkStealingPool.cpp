@@ -0,0 +1,178 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file WorkStealingPool.cpp
+	@brief */
+
+#include <cassert>
+
+#include "kNet/DebugMemoryLeakCheck.h"
+
+#include "kNet/WorkStealingPool.h"
+
+namespace kNet
+{
+
+/// How often the idle pool threads check whether they should quit.
+static const int cQuitPollMSecs = 100;
+
+static inline u64 MakeRange(u32 begin, u32 end) { return ((u64)begin << 32) | end; }
+static inline u32 RangeBegin(u64 range) { return (u32)(range >> 32); }
+static inline u32 RangeEnd(u64 range) { return (u32)range; }
+
+WorkStealingPool::WorkStealingPool(int numThreads)
+:taskFunc(0), taskContext(0), numBusy(0), quit(false)
+{
+	if (numThreads < 0)
+		numThreads = 0;
+	doneEvent = CreateNewEvent(EventWaitSignal);
+	for(int i = 0; i <= numThreads; ++i)
+		ranges.push_back(new std::atomic<u64>(0));
+
+	for(int i = 0; i < numThreads; ++i)
+	{
+		Worker *worker = new Worker;
+		worker->pool = this;
+		worker->index = i;
+		worker->wakeEvent = CreateNewEvent(EventWaitSignal);
+		workers.push_back(worker);
+		worker->thread.RunFunc(&WorkStealingPool::WorkerMain, worker);
+		worker->thread.SetName("kNet WorkStealingPool");
+	}
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+	quit = true;
+	for(size_t i = 0; i < workers.size(); ++i)
+	{
+		workers[i]->wakeEvent.Set();
+		workers[i]->thread.Stop();
+		workers[i]->wakeEvent.Close();
+		delete workers[i];
+	}
+	workers.clear();
+	for(size_t i = 0; i < ranges.size(); ++i)
+		delete ranges[i];
+	ranges.clear();
+	doneEvent.Close();
+}
+
+void WorkStealingPool::Run(size_t numTasks, TaskFunc func, void *context)
+{
+	assert(func);
+	assert(numTasks <= 0xFFFFFFFFu);
+	if (numTasks == 0)
+		return;
+
+	// Too few tasks to be worth waking the threads for.
+	if (workers.empty() || numTasks == 1)
+	{
+		for(size_t i = 0; i < numTasks; ++i)
+			func(context, i);
+		return;
+	}
+
+	taskFunc = func;
+	taskContext = context;
+	const size_t numRanges = ranges.size();
+	for(size_t i = 0; i < numRanges; ++i)
+		ranges[i]->store(MakeRange((u32)(numTasks * i / numRanges), (u32)(numTasks * (i + 1) / numRanges)), std::memory_order_relaxed);
+
+	numBusy.store((int)workers.size(), std::memory_order_relaxed);
+	doneEvent.Reset();
+	// Setting the events publishes the ranges and the task to the workers.
+	for(size_t i = 0; i < workers.size(); ++i)
+		workers[i]->wakeEvent.Set();
+
+	RunTasks((int)numRanges - 1);
+
+	// The ranges are all empty now, but the workers may still be running the last tasks they took.
+	while(numBusy.load(std::memory_order_acquire) > 0)
+		doneEvent.Wait(cQuitPollMSecs);
+
+	taskFunc = 0;
+	taskContext = 0;
+}
+
+void WorkStealingPool::RunTasks(int rangeIndex)
+{
+	size_t taskIndex;
+	while(TakeFront(rangeIndex, taskIndex))
+		taskFunc(taskContext, taskIndex);
+
+	const int numRanges = (int)ranges.size();
+	for(int i = 1; i < numRanges; ++i)
+	{
+		const int victim = (rangeIndex + i) % numRanges;
+		while(TakeBack(victim, taskIndex))
+			taskFunc(taskContext, taskIndex);
+	}
+}
+
+bool WorkStealingPool::TakeFront(int rangeIndex, size_t &taskIndex)
+{
+	std::atomic<u64> &range = *ranges[rangeIndex];
+	u64 cur = range.load(std::memory_order_relaxed);
+	for(;;)
+	{
+		const u32 begin = RangeBegin(cur);
+		const u32 end = RangeEnd(cur);
+		if (begin >= end)
+			return false;
+		if (range.compare_exchange_weak(cur, MakeRange(begin + 1, end), std::memory_order_acq_rel, std::memory_order_relaxed))
+		{
+			taskIndex = begin;
+			return true;
+		}
+	}
+}
+
+bool WorkStealingPool::TakeBack(int rangeIndex, size_t &taskIndex)
+{
+	std::atomic<u64> &range = *ranges[rangeIndex];
+	u64 cur = range.load(std::memory_order_relaxed);
+	for(;;)
+	{
+		const u32 begin = RangeBegin(cur);
+		const u32 end = RangeEnd(cur);
+		if (begin >= end)
+			return false;
+		if (range.compare_exchange_weak(cur, MakeRange(begin, end - 1), std::memory_order_acq_rel, std::memory_order_relaxed))
+		{
+			taskIndex = end - 1;
+			return true;
+		}
+	}
+}
+
+void WorkStealingPool::WorkerMain(Worker *worker)
+{
+	WorkStealingPool *pool = worker->pool;
+	while(!pool->quit && !worker->thread.ShouldQuit())
+	{
+		if (!worker->wakeEvent.Wait(cQuitPollMSecs))
+			continue;
+		worker->wakeEvent.Reset();
+		if (pool->quit)
+			break;
+
+		pool->RunTasks(worker->index);
+
+		if (pool->numBusy.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			pool->doneEvent.Set();
+	}
+}
+
+} // ~kNet
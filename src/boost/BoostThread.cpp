@@ -61,6 +61,8 @@ void Thread::Stop()
 	PolledTimer timer;
 
 	thread.interrupt();
+	// Wake the thread up if it is waiting on its hold event, so that it sees the quit request at once.
+	threadHoldEvent.Set();
 	thread.join();
 
 	LOG(LogWaits, "Thread::Stop: Took %f msecs.", timer.MSecsElapsed());
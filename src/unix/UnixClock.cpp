@@ -18,6 +18,7 @@
 #include <cassert>
 
 #include <time.h>
+#include <unistd.h> // For _POSIX_MONOTONIC_CLOCK.
 #include <errno.h>
 #include <string.h>
 #include <sys/time.h>
@@ -25,17 +26,110 @@
 #include "kNet/Clock.h"
 #include "kNet/NetworkLogging.h"
 
+// The TSC clock source is only available on x86-64 with GCC or Clang, elsewhere KNET_ENABLE_TSC_CLOCK has no effect.
+#if defined(KNET_ENABLE_TSC_CLOCK) && defined(_POSIX_MONOTONIC_CLOCK) && defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define KNET_TSC_CLOCK
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
 namespace kNet
 {
 
 tick_t Clock::appStartTime = 0;
+thread_local tick_t Clock::loopTick = 0;
+
+#ifdef KNET_TSC_CLOCK
+
+namespace
+{
+
+/// How long the TSC is calibrated against CLOCK_MONOTONIC at startup. The conversion error is about
+/// the time of a clock_gettime() call divided by this, i.e. a few parts per million.
+const int cTSCCalibrationMSecs = 10;
+
+/// The TSC value and the CLOCK_MONOTONIC time in nanoseconds at the end of the calibration.
+unsigned long long tscBase = 0;
+tick_t tscBaseNsecs = 0;
+/// Nanoseconds per TSC cycle, in 32.32 fixed point. While this is zero, Tick() reads CLOCK_MONOTONIC.
+unsigned long long tscNsecsPerCycle = 0;
+
+tick_t MonotonicNsecs()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (tick_t)t.tv_sec * 1000 * 1000 * 1000 + (tick_t)t.tv_nsec;
+}
+
+/// Returns true if the CPU reports an invariant TSC, i.e. one that ticks at a constant rate regardless of
+/// frequency scaling and sleep states, and is synchronized between cores.
+bool HasInvariantTSC()
+{
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+		return false;
+	__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+	return (edx & (1 << 8)) != 0;
+}
+
+/// Reads the TSC and CLOCK_MONOTONIC at the same instant. Keeps the tightest of a few tries, so that the thread
+/// being preempted between the reads does not skew the calibration.
+void SampleClocks(unsigned long long &tsc, tick_t &nsecs)
+{
+	unsigned long long narrowest = ~0ULL;
+	for(int i = 0; i < 5; ++i)
+	{
+		const unsigned long long before = __rdtsc();
+		const tick_t now = MonotonicNsecs();
+		const unsigned long long after = __rdtsc();
+		if (after - before < narrowest)
+		{
+			narrowest = after - before;
+			tsc = before + narrowest / 2;
+			nsecs = now;
+		}
+	}
+}
+
+void CalibrateTSC()
+{
+	if (!HasInvariantTSC())
+	{
+		LOG(LogVerbose, "The CPU does not have an invariant TSC, Clock::Tick() uses clock_gettime().");
+		return;
+	}
+	unsigned long long tsc0, tsc1;
+	tick_t nsecs0, nsecs1;
+	SampleClocks(tsc0, nsecs0);
+	timespec ts;
+	ts.tv_sec = 0;
+	ts.tv_nsec = cTSCCalibrationMSecs * 1000 * 1000;
+	nanosleep(&ts, NULL);
+	SampleClocks(tsc1, nsecs1);
+	if (tsc1 <= tsc0 || nsecs1 <= nsecs0)
+		return;
+
+	tscBase = tsc1;
+	tscBaseNsecs = nsecs1;
+	tscNsecsPerCycle = (unsigned long long)(((unsigned __int128)(nsecs1 - nsecs0) << 32) / (tsc1 - tsc0));
+	LOG(LogVerbose, "Calibrated the TSC to %.3f MHz.", (double)(tsc1 - tsc0) * 1000.0 / (nsecs1 - nsecs0));
+}
+
+} // ~unnamed namespace
+
+#endif
 
 Clock impl;
 
 void Clock::InitClockData()
 {
 	if (appStartTime == 0)
+	{
+#ifdef KNET_TSC_CLOCK
+		CalibrateTSC();
+#endif
 		appStartTime = Tick();
+	}
 }
 
 Clock::Clock()
@@ -102,7 +196,18 @@ unsigned long Clock::Time()
 
 tick_t Clock::Tick()
 {
-#ifdef _POSIX_MONOTONIC_CLOCK
+#ifdef KNET_TSC_CLOCK
+	// The TSC is converted to nanoseconds continuing from CLOCK_MONOTONIC, so the ticks read before the calibration
+	// and the value of TicksPerSec() stay the same.
+	if (tscNsecsPerCycle != 0)
+	{
+		const long long cycles = (long long)(__rdtsc() - tscBase);
+		if (cycles <= 0) // The TSCs of the cores may differ by a few cycles.
+			return tscBaseNsecs;
+		return tscBaseNsecs + (tick_t)(((unsigned __int128)cycles * tscNsecsPerCycle) >> 32);
+	}
+	return MonotonicNsecs();
+#elif defined(_POSIX_MONOTONIC_CLOCK)
 	timespec t;
 	clock_gettime(CLOCK_MONOTONIC, &t);
     return (tick_t)t.tv_sec * 1000 * 1000 * 1000 + (tick_t)t.tv_nsec;
@@ -116,6 +221,21 @@ tick_t Clock::Tick()
 #endif
 }
 
+const char *Clock::TickSource()
+{
+#ifdef KNET_TSC_CLOCK
+	if (tscNsecsPerCycle != 0)
+		return "tsc";
+#endif
+#ifdef _POSIX_MONOTONIC_CLOCK
+	return "clock_gettime";
+#elif defined(_POSIX_C_SOURCE) || defined(__APPLE__)
+	return "gettimeofday";
+#else
+	return "time";
+#endif
+}
+
 unsigned long Clock::TickU32()
 {
 	return (unsigned long)Tick();
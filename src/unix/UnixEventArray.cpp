@@ -23,6 +23,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 
 #include "kNet/EventArray.h"
 #include "kNet/Thread.h"
@@ -61,6 +62,19 @@ void EventArray::AddEvent(const Event &e)
 	}
 	assert(numAdded < maxEvents);
 
+	// select() can only track descriptors below FD_SETSIZE, and FD_SET on a larger one writes out of bounds.
+	// Keep an empty slot so that the event indices still match the caller's expectations.
+	if (e.fd[0] >= FD_SETSIZE)
+	{
+		static bool warningPrinted = false;
+		if (!warningPrinted)
+			LOG(LogError, "EventArray::AddEvent: Descriptor %d exceeds FD_SETSIZE (%d) and cannot be waited on with select()!", e.fd[0], (int)FD_SETSIZE);
+		warningPrinted = true;
+		cachedEvents.push_back(Event());
+		++numAdded;
+		return;
+	}
+
 	switch(e.Type())
 	{
 	case EventWaitInvalid:
@@ -87,6 +101,20 @@ void EventArray::AddEvent(const Event &e)
 }
 
 int EventArray::Wait(int msecs)
+{
+	tv.tv_sec = msecs / 1000;
+	tv.tv_usec = (msecs - tv.tv_sec * 1000) * 1000;
+	return WaitTimeval();
+}
+
+int EventArray::WaitMicroseconds(int usecs)
+{
+	tv.tv_sec = usecs / 1000000;
+	tv.tv_usec = usecs - tv.tv_sec * 1000000;
+	return WaitTimeval();
+}
+
+int EventArray::WaitTimeval()
 {
 	if (numAdded == 0)
 	{
@@ -96,23 +124,26 @@ int EventArray::Wait(int msecs)
 
 	// If we have added some number of events to the event array, but nfds == -1, it means we are waiting on a set
 	// of dummy events, which are always false. In that case, sleep for a small arbitrary duration and return a timeout.
-	// Note that it's a bad idea to wait for the full msecs delay, since it can be very large, and would effectively 
+	// Note that it's a bad idea to wait for the full delay, since it can be very large, and would effectively 
 	// stall this thread.
 	if (nfds == -1)
 	{
-		if (msecs > 0)
-			Thread::Sleep(min(msecs, 10)); // Arbitrary max sleep 10 msecs.
+		timespec sleepTime;
+		sleepTime.tv_sec = 0;
+		sleepTime.tv_nsec = (tv.tv_sec > 0) ? 10000000 : min<long>(tv.tv_usec, 10000) * 1000; // Arbitrary max sleep 10 msecs.
+		if (sleepTime.tv_nsec > 0)
+			nanosleep(&sleepTime, 0);
 		return WaitTimedOut;
 	}
 
-	tv.tv_sec = msecs / 1000;
-	tv.tv_usec = (msecs - tv.tv_sec * 1000) * 1000;
-
-	int ret = select(nfds, &readfds, &writefds, NULL, &tv); // http://linux.die.net/man/2/select
+	// select() overwrites the sets with the triggered descriptors, so pass copies to allow waiting on this array again.
+	fd_set readyReadfds = readfds;
+	fd_set readyWritefds = writefds;
+	int ret = select(nfds, &readyReadfds, &readyWritefds, NULL, &tv); // http://linux.die.net/man/2/select
 	if (ret == -1)
 	{
 		LOG(LogError, "EventArray::Wait(%d, %p, %p, NULL, {%d, %d}: select() failed on an array of %d events: %s(%d)", 
-			(int)nfds, &readfds, &writefds, (int)tv.tv_sec, (int)tv.tv_usec,
+			(int)nfds, &readyReadfds, &readyWritefds, (int)tv.tv_sec, (int)tv.tv_usec,
 			numAdded,
 			strerror(errno), (int)errno);
 		return WaitFailed;
@@ -133,11 +164,11 @@ int EventArray::Wait(int msecs)
 		{
 		case EventWaitRead:
 		case EventWaitSignal:
-			if (FD_ISSET(cachedEvents[i].fd[0], &readfds))
+			if (FD_ISSET(cachedEvents[i].fd[0], &readyReadfds))
 				return i;
 			break;
 		case EventWaitWrite:
-			if (FD_ISSET(cachedEvents[i].fd[0], &writefds))
+			if (FD_ISSET(cachedEvents[i].fd[0], &readyWritefds))
 				return i;
 		default:
 			break; // The dummy events are skipped over.
@@ -65,7 +65,8 @@ void Thread::Stop()
 		return;
 	}
 
-	kNet::Clock::Sleep(10);
+	// Wake the thread up if it is waiting on its hold event, so that it sees the quit request at once.
+	threadHoldEvent.Set();
 	assert(thread);
 
 	/// \todo Do not block indefinitely while waiting for the thread to terminate
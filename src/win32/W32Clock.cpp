@@ -32,6 +32,7 @@ Clock impl;
 
 LARGE_INTEGER Clock::ddwTimerFrequency;
 tick_t Clock::appStartTime = 0xFFFFFFFF;
+thread_local tick_t Clock::loopTick = 0;
 
 void Clock::InitClockData()
 {
@@ -123,6 +124,11 @@ tick_t Clock::Tick()
 	return ddwTimer.QuadPart;
 }
 
+const char *Clock::TickSource()
+{
+	return "QueryPerformanceCounter";
+}
+
 unsigned long Clock::TickU32()
 {
 	LARGE_INTEGER ddwTimer;
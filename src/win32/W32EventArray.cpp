@@ -77,4 +77,10 @@ int EventArray::Wait(int msecs)
 	}
 }
 
+int EventArray::WaitMicroseconds(int usecs)
+{
+	// WSAWaitForMultipleEvents only takes milliseconds. Round up, so that the wait never ends before the given time.
+	return Wait((usecs + 999) / 1000);
+}
+
 } // ~kNet
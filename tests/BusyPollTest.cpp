@@ -0,0 +1,132 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file BusyPollTest.cpp
+	@brief */
+
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "kNet/Network.h"
+#include "tassert.h"
+#include "kNet/DebugMemoryLeakCheck.h"
+
+using namespace kNet;
+
+namespace
+{
+
+/// Echoes the messages received by the server back to the client.
+class EchoListener : public INetworkServerListener, public IMessageHandler
+{
+public:
+	void NewConnectionEstablished(MessageConnection *connection)
+	{
+		connection->RegisterInboundMessageHandler(this);
+	}
+
+	void HandleMessage(MessageConnection *source, packet_id_t, message_id_t messageId, const char *data, size_t numBytes)
+	{
+		source->SendMessage(messageId, true, true, 100, 0, data, numBytes);
+	}
+};
+
+/// Records the messages received by the client.
+class ReplyHandler : public IMessageHandler
+{
+public:
+	std::vector<std::string> replies;
+
+	void HandleMessage(MessageConnection *, packet_id_t, message_id_t, const char *data, size_t numBytes)
+	{
+		replies.push_back(std::string(data, numBytes));
+	}
+};
+
+}
+
+void BusyPollTest()
+{
+	TEST("NetworkWorkerThread busy poll")
+	Network serverNetwork, clientNetwork;
+	serverNetwork.SetWorkerBusyPoll(20);
+	clientNetwork.SetWorkerBusyPoll(20);
+	EchoListener listener;
+	ReplyHandler handler;
+	NetworkServer *server = serverNetwork.StartServer(48242, SocketOverUDP, &listener, true);
+	assert(server);
+	Ptr(MessageConnection) client = clientNetwork.Connect("127.0.0.1", 48242, SocketOverUDP, &handler);
+	assert(client);
+
+	tick_t start = Clock::Tick();
+	while(client->GetConnectionState() != ConnectionOK && Clock::SecondsSinceF(start) < 5.f)
+	{
+		server->Process();
+		client->Process();
+		Clock::Sleep(1);
+	}
+	assert(client->GetConnectionState() == ConnectionOK);
+
+	// Ping-pong in the busy-poll mode.
+	for(int i = 0; i < 20; ++i)
+	{
+		client->SendMessage(200, true, true, 100, 0, "ping", 4);
+		start = Clock::Tick();
+		while(handler.replies.size() < (size_t)i+1 && Clock::SecondsSinceF(start) < 5.f)
+		{
+			server->Process();
+			client->Process();
+		}
+		assert(handler.replies.size() == (size_t)i+1 && handler.replies[i] == "ping");
+	}
+
+#ifndef WIN32
+	// While messages keep arriving, the workers spin instead of sleeping, even though the main thread sleeps.
+	std::clock_t cpuStart = std::clock();
+	start = Clock::Tick();
+	while(Clock::SecondsSinceF(start) < 0.5f)
+	{
+		client->SendMessage(201, false, true, 100, 0, "data", 4);
+		server->Process();
+		client->Process();
+		Clock::Sleep(1);
+	}
+	double cpuSecs = (double)(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+	assert(cpuSecs > 0.25);
+
+	// After 20 msecs without events, the workers go back to blocking waits, and stop using the CPU.
+	Clock::Sleep(200);
+	cpuStart = std::clock();
+	Clock::Sleep(500);
+	cpuSecs = (double)(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+	assert(cpuSecs < 0.25);
+#endif
+
+	// Disabling the mode goes back to blocking waits right away.
+	clientNetwork.SetWorkerBusyPoll(0);
+	serverNetwork.SetWorkerBusyPoll(0);
+	client->SendMessage(200, true, true, 100, 0, "pong", 4);
+	start = Clock::Tick();
+	while((handler.replies.empty() || handler.replies.back() != "pong") && Clock::SecondsSinceF(start) < 5.f)
+	{
+		server->Process();
+		client->Process();
+		Clock::Sleep(1);
+	}
+	assert(!handler.replies.empty() && handler.replies.back() == "pong");
+	client->Close(0);
+	serverNetwork.StopServer();
+	ENDTEST()
+}
@@ -0,0 +1,53 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file ClockTest.cpp
+	@brief */
+
+#include <cstring>
+
+#include "kNet/Clock.h"
+#include "tassert.h"
+#include "kNet/DebugMemoryLeakCheck.h"
+
+using namespace kNet;
+
+void ClockTest()
+{
+	TEST("Clock Tick")
+	assert(Clock::TickSource() != 0 && strlen(Clock::TickSource()) > 0);
+	tick_t prev = Clock::Tick();
+	for(int i = 0; i < 100000; ++i)
+	{
+		tick_t now = Clock::Tick();
+		assert(Clock::IsNewer(now, prev));
+		prev = now;
+	}
+	// Whichever counter is used, a sleep must measure close to its length.
+	tick_t start = Clock::Tick();
+	Clock::Sleep(20);
+	double msecs = Clock::MillisecondsSinceD(start);
+	assert(msecs >= 19.0 && msecs < 1000.0);
+	ENDTEST()
+
+	TEST("Clock LoopTick")
+	tick_t before = Clock::Tick();
+	assert(Clock::IsNewer(Clock::LoopTick(), before));
+	Clock::SetLoopTick(before);
+	Clock::Sleep(2);
+	assert(Clock::LoopTick() == before);
+	Clock::SetLoopTick(0);
+	assert(Clock::LoopTick() != before && Clock::IsNewer(Clock::LoopTick(), before));
+	ENDTEST()
+}
@@ -0,0 +1,109 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file CloseAsyncTest.cpp
+	@brief */
+
+#include "kNet/Network.h"
+#include "tassert.h"
+#include "kNet/DebugMemoryLeakCheck.h"
+
+using namespace kNet;
+
+namespace
+{
+
+/// Processes the servers and the clients until all the clients are connected.
+bool WaitForClients(NetworkServer *tcpServer, NetworkServer *udpServer, std::vector<Ptr(MessageConnection)> &clients)
+{
+	tick_t start = Clock::Tick();
+	while(Clock::SecondsSinceF(start) < 5.f)
+	{
+		tcpServer->Process();
+		udpServer->Process();
+		bool pending = false;
+		for(size_t i = 0; i < clients.size(); ++i)
+		{
+			clients[i]->Process();
+			pending = pending || clients[i]->GetConnectionState() != ConnectionOK;
+		}
+		if (!pending && tcpServer->GetConnections().size() + udpServer->GetConnections().size() == clients.size())
+			return true;
+		Clock::Sleep(1);
+	}
+	return false;
+}
+
+}
+
+void CloseAsyncTest()
+{
+	TEST("NetworkServer::CloseAllClientsAsync")
+	Network tcpServerNetwork, udpServerNetwork, clientNetwork;
+	NetworkServer *tcpServer = tcpServerNetwork.StartServer(48239, SocketOverTCP, 0, true);
+	NetworkServer *udpServer = udpServerNetwork.StartServer(48240, SocketOverUDP, 0, true);
+	assert(tcpServer && udpServer);
+
+	const int numClients = 8;
+	std::vector<Ptr(MessageConnection)> clients;
+	for(int i = 0; i < numClients; ++i)
+	{
+		clients.push_back(clientNetwork.Connect("127.0.0.1", 48239, SocketOverTCP, 0));
+		clients.push_back(clientNetwork.Connect("127.0.0.1", 48240, SocketOverUDP, 0));
+	}
+	assert(WaitForClients(tcpServer, udpServer, clients));
+
+	// The first TCP client never closes its end, and the first UDP client never acknowledges the disconnect,
+	// so the server has to time those two out.
+	MessageConnection *silentTcp = clients[0];
+	MessageConnection *silentUdp = clients[1];
+	silentUdp->PauseOutboundSends();
+
+	const int closeTimeoutMSecs = 300;
+	tick_t start = Clock::Tick();
+	tcpServer->CloseAllClientsAsync(closeTimeoutMSecs);
+	udpServer->CloseAllClientsAsync(closeTimeoutMSecs);
+	assert(Clock::MillisecondsSinceF(start) < 100.f);
+	assert(tcpServer->NumClosingClients() + udpServer->NumClosingClients() > 0);
+	assert(!tcpServer->AcceptsNewConnections() && !udpServer->AcceptsNewConnections());
+
+	// The UDP clients acknowledge the disconnect on their worker threads, the TCP clients close their end like an application would.
+	while(!(tcpServer->ClientsClosedEvent().Test() && udpServer->ClientsClosedEvent().Test()) && Clock::SecondsSinceF(start) < 5.f)
+	{
+		tcpServer->Process();
+		udpServer->Process();
+		for(size_t i = 0; i < clients.size(); i += 2)
+		{
+			clients[i]->Process();
+			if (clients[i] != silentTcp && clients[i]->GetConnectionState() == ConnectionPeerClosed)
+				clients[i]->Disconnect(0);
+		}
+		Clock::Sleep(1);
+	}
+	const float closeMSecs = Clock::MillisecondsSinceF(start);
+	assert(tcpServer->NumClosingClients() == 0 && udpServer->NumClosingClients() == 0);
+	assert(closeMSecs >= closeTimeoutMSecs && closeMSecs < 2000.f);
+
+	// The closed connections are reaped by the next Process().
+	tcpServer->Process();
+	udpServer->Process();
+	assert(tcpServer->GetConnections().size() == 0 && udpServer->GetConnections().size() == 0);
+
+	for(size_t i = 0; i < clients.size(); ++i)
+		clients[i]->Close(0);
+	clients.clear();
+	tcpServerNetwork.StopServer();
+	udpServerNetwork.StopServer();
+	ENDTEST()
+}
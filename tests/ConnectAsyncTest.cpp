@@ -0,0 +1,122 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file ConnectAsyncTest.cpp
+	@brief */
+
+#include "kNet/Network.h"
+#include "kNet/HostResolver.h"
+#include "tassert.h"
+#include "kNet/DebugMemoryLeakCheck.h"
+
+using namespace kNet;
+
+namespace
+{
+
+HostResolver::RequestState WaitForRequest(HostResolver::Request *request)
+{
+	tick_t start = Clock::Tick();
+	while(request->State() == HostResolver::RequestResolving && Clock::SecondsSinceF(start) < 10.f)
+		Clock::Sleep(1);
+	return request->State();
+}
+
+/// Waits until all the given connections have left the ConnectionPending state.
+void WaitForConnections(NetworkServer *server, std::vector<Ptr(MessageConnection)> &connections, float maxSeconds)
+{
+	tick_t start = Clock::Tick();
+	for(;;)
+	{
+		bool pending = false;
+		for(size_t i = 0; i < connections.size(); ++i)
+		{
+			connections[i]->Process();
+			pending = pending || connections[i]->GetConnectionState() == ConnectionPending;
+		}
+		if (!pending || Clock::SecondsSinceF(start) >= maxSeconds)
+			return;
+		if (server)
+			server->Process();
+		Clock::Sleep(1);
+	}
+}
+
+}
+
+void ConnectAsyncTest()
+{
+	TEST("HostResolver")
+	HostResolver resolver(2);
+	HostResolver::Request *numeric = resolver.Resolve("127.0.0.1");
+	assert(numeric->State() == HostResolver::RequestResolved);
+	assert(numeric->address.ToString() == "127.0.0.1:0");
+	HostResolver::Release(numeric);
+
+	HostResolver::Request *name = resolver.Resolve("localhost");
+	assert(WaitForRequest(name) == HostResolver::RequestResolved);
+	assert(name->address.IPToString() == "127.0.0.1");
+	HostResolver::Release(name);
+	assert(resolver.NumPendingRequests() == 0);
+	// The second lookup of the name is served from the cache.
+	HostResolver::Request *cached = resolver.Resolve("localhost");
+	assert(cached->State() == HostResolver::RequestResolved);
+	HostResolver::Release(cached);
+
+	HostResolver::Request *bad = resolver.Resolve("knet-test.invalid");
+	assert(WaitForRequest(bad) == HostResolver::RequestFailed);
+	HostResolver::Release(bad);
+
+	// Releasing a request while it is queued hands it over to the resolver.
+	resolver.ClearCache();
+	HostResolver::Release(resolver.Resolve("localhost"));
+	ENDTEST()
+
+	TEST("Network::ConnectAsync")
+	Network tcpServerNetwork, udpServerNetwork, clientNetwork;
+	NetworkServer *tcpServer = tcpServerNetwork.StartServer(48234, SocketOverTCP, 0, true);
+	NetworkServer *udpServer = udpServerNetwork.StartServer(48235, SocketOverUDP, 0, true);
+	assert(tcpServer && udpServer);
+
+	std::vector<Ptr(MessageConnection)> connections;
+	for(int i = 0; i < 3; ++i)
+	{
+		connections.push_back(clientNetwork.ConnectAsync("localhost", 48234, SocketOverTCP, 0));
+		connections.push_back(clientNetwork.ConnectAsync("127.0.0.1", 48235, SocketOverUDP, 0));
+	}
+	// The returned connections are pending, or already connected if a worker thread got to them.
+	for(size_t i = 0; i < connections.size(); ++i)
+		assert(connections[i] && connections[i]->GetConnectionState() != ConnectionClosed);
+	WaitForConnections(udpServer, connections, 5.f);
+	for(size_t i = 0; i < connections.size(); ++i)
+	{
+		assert(connections[i]->GetConnectionState() == ConnectionOK);
+		assert(connections[i]->GetSocket()->RemoteEndPoint().IPToString() == "127.0.0.1");
+		connections[i]->Close(0);
+	}
+	connections.clear();
+
+	// A name that does not resolve and a connect that is never answered both fail, the latter once the timeout passes.
+	connections.push_back(clientNetwork.ConnectAsync("knet-test.invalid", 48234, SocketOverTCP, 0));
+	connections.push_back(clientNetwork.ConnectAsync("127.0.0.1", 48236, SocketOverUDP, 0, 0, 200));
+	tick_t start = Clock::Tick();
+	WaitForConnections(0, connections, 5.f);
+	assert(connections[0]->GetConnectionState() == ConnectionClosed);
+	assert(connections[1]->GetConnectionState() == ConnectionClosed);
+	assert(Clock::SecondsSinceF(start) < 2.f);
+	assert(!clientNetwork.ConnectAsync("127.0.0.1", 48236, SocketOverUDP, 0, 0, 0));
+	tcpServerNetwork.StopServer();
+	udpServerNetwork.StopServer();
+	ENDTEST()
+}
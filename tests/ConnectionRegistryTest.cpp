@@ -0,0 +1,154 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file ConnectionRegistryTest.cpp
+	@brief */
+
+#include <atomic>
+#include <vector>
+
+#include "kNet/ConnectionRegistry.h"
+#include "kNet/TCPMessageConnection.h"
+#include "kNet/Thread.h"
+#include "tassert.h"
+#include "kNet/DebugMemoryLeakCheck.h"
+
+using namespace kNet;
+
+namespace
+{
+
+EndPoint MakeEndPoint(unsigned char lastOctet, unsigned short port)
+{
+	EndPoint endPoint;
+	endPoint.ip[0] = 10;
+	endPoint.ip[3] = lastOctet;
+	endPoint.port = port;
+	return endPoint;
+}
+
+/// A connection that is not attached to any Network, for storing in a registry.
+Ptr(MessageConnection) NewDetachedConnection()
+{
+	return Ptr(MessageConnection)(new TCPMessageConnection(0, 0, 0, ConnectionClosed));
+}
+
+struct ReaderContext
+{
+	ConnectionRegistry *registry;
+	std::atomic<bool> done;
+	std::atomic<int> numErrors;
+	std::atomic<int> numReads;
+};
+
+/// Checks that each snapshot it reads is sorted and holds live connections, until told to stop.
+void ReadSnapshots(ReaderContext *context)
+{
+	while(!context->done)
+	{
+		ConnectionRegistry::ReadGuard snapshot(*context->registry);
+		for(size_t i = 0; i < snapshot->Size(); ++i)
+		{
+			if (i > 0 && !(snapshot->EndPointAt(i - 1) < snapshot->EndPointAt(i)))
+				++context->numErrors;
+			if (snapshot->At(i)->RefCount() <= 0 || snapshot->Find(snapshot->EndPointAt(i)) != snapshot->At(i))
+				++context->numErrors;
+		}
+		++context->numReads;
+	}
+}
+
+}
+
+void ConnectionRegistryTest()
+{
+	TEST("ConnectionRegistry snapshots")
+	ConnectionRegistry registry;
+	Ptr(MessageConnection) a = NewDetachedConnection();
+	Ptr(MessageConnection) b = NewDetachedConnection();
+	Ptr(MessageConnection) c = NewDetachedConnection();
+	registry.Insert(MakeEndPoint(3, 100), a);
+	registry.Insert(MakeEndPoint(1, 100), b);
+	registry.Insert(MakeEndPoint(2, 100), c);
+	{
+		ConnectionRegistry::ReadGuard snapshot(registry);
+		assert(snapshot->Size() == 3);
+		assert(snapshot->At(0) == b.ptr() && snapshot->At(1) == c.ptr() && snapshot->At(2) == a.ptr());
+		assert(snapshot->Find(MakeEndPoint(3, 100)) == a.ptr());
+		assert(snapshot->Find(MakeEndPoint(3, 101)) == 0);
+		assert(snapshot->IndexOf(c) == 1);
+	}
+
+	// A reader keeps the snapshot it took, and with it the references to the connections in it.
+	{
+		ConnectionRegistry::ReadGuard before(registry);
+		assert(registry.Remove(c));
+		assert(!registry.Remove(c));
+		assert(registry.Move(a, MakeEndPoint(3, 100), MakeEndPoint(0, 100)));
+		assert(!registry.Move(a, MakeEndPoint(3, 100), MakeEndPoint(4, 100)));
+		assert(before->Size() == 3 && before->At(1) == c.ptr());
+		assert(c.RefCount() > 1);
+		assert(registry.NumRetiredSnapshots() > 0);
+
+		ConnectionRegistry::ReadGuard after(registry);
+		assert(after->Size() == 2);
+		assert(after->At(0) == a.ptr() && after->Find(MakeEndPoint(0, 100)) == a.ptr());
+	}
+	registry.Reclaim();
+	assert(registry.NumRetiredSnapshots() == 0);
+	assert(c.RefCount() == 1);
+
+	// Inserting at a taken end point replaces the connection.
+	registry.Insert(MakeEndPoint(1, 100), c);
+	assert(ConnectionRegistry::ReadGuard(registry)->Find(MakeEndPoint(1, 100)) == c.ptr());
+	assert(b.RefCount() == 1);
+	ENDTEST()
+
+	TEST("ConnectionRegistry concurrent readers")
+	ConnectionRegistry registry;
+	std::vector<Ptr(MessageConnection)> connections;
+	for(int i = 0; i < 64; ++i)
+		connections.push_back(NewDetachedConnection());
+
+	ReaderContext context;
+	context.registry = &registry;
+	context.done = false;
+	context.numErrors = 0;
+	context.numReads = 0;
+	Thread reader;
+	reader.RunFunc(&ReadSnapshots, &context);
+
+	for(int round = 0; round < 50; ++round)
+	{
+		for(size_t i = 0; i < connections.size(); ++i)
+			registry.Insert(MakeEndPoint((unsigned char)i, (unsigned short)round), connections[i]);
+		std::vector<MessageConnection*> removed;
+		for(size_t i = 0; i < connections.size(); i += 2)
+			removed.push_back(connections[i]);
+		assert(registry.Remove(removed) == removed.size());
+		for(size_t i = 1; i < connections.size(); i += 2)
+			registry.Remove(connections[i]);
+	}
+	context.done = true;
+	reader.Stop();
+	assert(context.numReads > 0);
+	assert(context.numErrors == 0);
+
+	registry.Reclaim();
+	assert(registry.NumRetiredSnapshots() == 0);
+	assert(ConnectionRegistry::ReadGuard(registry)->Size() == 0);
+	for(size_t i = 0; i < connections.size(); ++i)
+		assert(connections[i].RefCount() == 1);
+	ENDTEST()
+}
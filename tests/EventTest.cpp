@@ -15,7 +15,11 @@
 /** @file EventTest.cpp
 	@brief */
 
+#include <algorithm>
+
 #include "kNet/Event.h"
+#include "kNet/EventArray.h"
+#include "kNet/Clock.h"
 #include "tassert.h"
 #include "kNet/DebugMemoryLeakCheck.h"
 
@@ -64,3 +68,31 @@ void EventTest()
 	}
 	ENDTEST()
 }
+
+void EventArrayTest()
+{
+	using namespace kNet;
+
+	TEST("EventArray WaitMicroseconds")
+	Event e;
+	e.Create(EventWaitSignal);
+	EventArray events;
+	events.AddEvent(e);
+	double shortestUSecs = 1e9;
+	for(int i = 0; i < 10; ++i)
+	{
+		tick_t start = Clock::Tick();
+		assert(events.WaitMicroseconds(300) == EventArray::WaitTimedOut);
+		double usecs = Clock::MillisecondsSinceD(start) * 1000.0;
+		assert(usecs >= 300.0);
+		shortestUSecs = std::min(shortestUSecs, usecs);
+	}
+#ifndef WIN32
+	// A millisecond wait would have taken at least 1000 usecs.
+	assert(shortestUSecs < 1000.0);
+#endif
+	e.Set();
+	assert(events.WaitMicroseconds(300) == 0);
+	e.Close();
+	ENDTEST()
+}
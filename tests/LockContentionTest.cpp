@@ -0,0 +1,115 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file LockContentionTest.cpp
+	@brief */
+
+#include <vector>
+#include <atomic>
+
+#include "kNet/Lockable.h"
+#include "kNet/LockContention.h"
+#include "kNet/Thread.h"
+#include "kNet/Clock.h"
+#include "tassert.h"
+#include "kNet/DebugMemoryLeakCheck.h"
+
+using namespace kNet;
+
+namespace
+{
+
+struct HolderContext
+{
+	Lockable<int> *lockable;
+	std::atomic<bool> locked;
+	std::atomic<bool> done;
+};
+
+/// Holds the lock for a moment, so that the main thread blocks on it.
+void HoldLock(HolderContext *context)
+{
+	Lock<int> lock = context->lockable->Acquire();
+	context->locked = true;
+	Clock::Sleep(50);
+	++*lock;
+	lock.Unlock();
+	context->done = true;
+}
+
+LockContentionSample FindSample(const char *name)
+{
+	std::vector<LockContentionSample> samples;
+	ReadLockContention(samples);
+	for(size_t i = 0; i < samples.size(); ++i)
+		if (samples[i].name == name)
+			return samples[i];
+	LockContentionSample empty;
+	empty.acquisitions = empty.contendedAcquisitions = 0;
+	empty.totalWaitMSecs = empty.maxWaitMSecs = 0;
+	return empty;
+}
+
+}
+
+void LockContentionTest()
+{
+	TEST("LockContention uncontended")
+	Lockable<int> a(0), b(0), unnamed(0);
+	a.SetContentionName("LockContentionTest::shared");
+	b.SetContentionName("LockContentionTest::shared");
+	for(int i = 0; i < 10; ++i)
+	{
+		++*a.Acquire();
+		++*b.Acquire();
+		++*unnamed.Acquire();
+	}
+	{
+		// Recursive acquisitions by the owning thread are not contended.
+		Lock<int> outer = a.Acquire();
+		Lock<int> inner = a.Acquire();
+	}
+	LockContentionSample s = FindSample("LockContentionTest::shared");
+	assert(s.acquisitions == 22);
+	assert(s.contendedAcquisitions == 0 && s.totalWaitMSecs == 0 && s.ContentionRate() == 0.f);
+	ENDTEST()
+
+	TEST("LockContention contended")
+	Lockable<int> lockable(0);
+	lockable.SetContentionName("LockContentionTest::contended");
+	HolderContext context;
+	context.lockable = &lockable;
+	context.locked = false;
+	context.done = false;
+	Thread holder;
+	holder.RunFunc(&HoldLock, &context);
+	while(!context.locked)
+		Clock::Sleep(1);
+	{
+		Lock<int> lock = lockable.Acquire();
+		assert(*lock == 1);
+	}
+	while(!context.done)
+		Clock::Sleep(1);
+	holder.Stop();
+
+	LockContentionSample s = FindSample("LockContentionTest::contended");
+	assert(s.acquisitions == 2 && s.contendedAcquisitions == 1);
+	assert(s.totalWaitMSecs > 10.0 && s.maxWaitMSecs == s.totalWaitMSecs);
+	assert(s.ContentionRate() == 0.5f);
+	ResetLockContention();
+	s = FindSample("LockContentionTest::contended");
+	assert(s.acquisitions == 0 && s.contendedAcquisitions == 0 && s.maxWaitMSecs == 0);
+	ENDTEST()
+}
@@ -0,0 +1,130 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file LogHistogramTest.cpp
+	@brief */
+
+#include "kNet/LogHistogram.h"
+#include "kNet/MessageTypeStatsTable.h"
+#include "kNet/Thread.h"
+#include "tassert.h"
+#include "kNet/DebugMemoryLeakCheck.h"
+
+using namespace kNet;
+
+namespace
+{
+
+struct TableWriterContext
+{
+	MessageTypeStatsTable *table;
+	int numMessages;
+};
+
+void WriteMessageStats(TableWriterContext *context)
+{
+	// The IDs grow over time so that the index is replaced while the reader uses it. Every send adds one value to
+	// both histograms of its ID, so a consistent copy always has equal counts.
+	for(int i = 0; i < context->numMessages; ++i)
+		context->table->AddSend((message_id_t)(i % (1 + i / 100)), 10, 100);
+}
+
+}
+
+void LogHistogramTest()
+{
+	TEST("LogHistogram bucket mapping")
+	int previousIndex = -1;
+	for(u64 value = 0; value <= 0xFFFFFFFFULL; value = value < 1024 ? value + 1 : value + value / 7)
+	{
+		const int index = LogHistogram::BucketIndex((u32)value);
+		assert(index >= previousIndex);
+		assert(index < LogHistogram::cNumBuckets);
+		assert(LogHistogram::BucketUpperBound(index) >= value);
+		// Every value is known to within 1/16th of its magnitude.
+		assert(LogHistogram::BucketUpperBound(index) - value <= value / LogHistogram::cNumSubBuckets);
+		previousIndex = index;
+	}
+	assert(LogHistogram::BucketIndex(0xFFFFFFFF) == LogHistogram::cNumBuckets - 1);
+	assert(LogHistogram::BucketUpperBound(LogHistogram::cNumBuckets - 1) == 0xFFFFFFFF);
+	ENDTEST()
+
+	TEST("LogHistogram percentiles")
+	LogHistogram h;
+	assert(h.Percentile(0.5) == 0);
+	for(u32 i = 1; i <= 10000; ++i)
+		h.Add(i);
+	assert(h.Count() == 10000);
+	assert(h.Min() == 1 && h.Max() == 10000);
+	assert(h.Mean() > 5000.f && h.Mean() < 5001.f);
+	const u32 p50 = h.Percentile(0.5);
+	const u32 p99 = h.Percentile(0.99);
+	assert(p50 >= 5000 && p50 <= 5000 + 5000 / 16);
+	assert(p99 >= 9900 && p99 <= 10000);
+	assert(h.Percentile(1.0) == 10000);
+	assert(h.Percentile(0.0) == 1);
+	ENDTEST()
+
+	TEST("LogHistogram Merge")
+	LogHistogram a, b;
+	a.Add(10);
+	a.Add(20);
+	b.Add(5);
+	b.Add(1000000);
+	a.Merge(b);
+	assert(a.Count() == 4);
+	assert(a.Min() == 5 && a.Max() == 1000000);
+	assert(a.Percentile(0.25) == 5);
+	a.Clear();
+	assert(a.Count() == 0);
+	ENDTEST()
+
+	TEST("MessageTypeStatsTable")
+	MessageTypeStatsTable table;
+	MessageTypeStats s;
+	assert(!table.Read(1, s));
+	table.AddSend(1, 10, 100);
+	table.AddSend(1, 30, 300);
+	table.AddAck(1, 50);
+	table.AddSend(1000, 10, 100);
+	table.AddSend(MessageTypeStatsTable::cOverflowId + 5, 1, 1);
+	table.AddSend(0xFFFFFFFF, 1, 1);
+	assert(table.Read(1, s));
+	assert(s.queueTimeUSecs.Count() == 2 && s.queueTimeUSecs.Max() == 30);
+	assert(s.sizeBytes.Min() == 100 && s.sizeBytes.Max() == 300);
+	assert(s.ackTimeUSecs.Count() == 1);
+	assert(table.Read(0xFFFFFFFF, s) && s.sizeBytes.Count() == 2);
+	std::vector<message_id_t> ids;
+	table.MessageIds(ids);
+	assert(ids.size() == 3 && ids[0] == 1 && ids[1] == 1000 && ids[2] == MessageTypeStatsTable::cOverflowId);
+	ENDTEST()
+
+	TEST("MessageTypeStatsTable consistent reads")
+	MessageTypeStatsTable table;
+	TableWriterContext context = { &table, 200000 };
+	Thread writer;
+	writer.RunFunc(&WriteMessageStats, &context);
+	for(int i = 0; i < 2000; ++i)
+	{
+		MessageTypeStats s;
+		if (table.Read(0, s))
+			assert(s.queueTimeUSecs.Count() == s.sizeBytes.Count());
+		std::vector<message_id_t> ids;
+		table.MessageIds(ids);
+		for(size_t j = 0; j < ids.size(); ++j)
+			assert(table.Read(ids[j], s));
+	}
+	writer.Stop();
+	ENDTEST()
+}
@@ -0,0 +1,663 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file MicroBenchmarks.cpp
+	@brief Microbenchmarks for the kNet core containers and codecs.
+
+	Each benchmark is a function that performs the given number of iterations of the operation being measured.
+	The harness calibrates the iteration count until a run takes at least the minimum measurement time, and
+	then reports the best time per operation out of a number of repetitions. */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "kNet/Types.h"
+#include "kNet/Clock.h"
+#include "kNet/Thread.h"
+#include "kNet/WaitFreeQueue.h"
+#include "kNet/SegmentedQueue.h"
+#include "kNet/MaxHeap.h"
+#include "kNet/DataSerializer.h"
+#include "kNet/DataDeserializer.h"
+#include "kNet/VLEPacker.h"
+#include "kNet/RingBuffer.h"
+#include "kNet/SequentialIntegerSet.h"
+#include "kNet/OrderedHashTable.h"
+#include "kNet/Sort.h"
+#include "kNet/StatsCounters.h"
+#include "kNet/StatsEventHierarchy.h"
+#include "kNet/NetworkLogging.h"
+#include "kNet/Lockable.h"
+#include "kNet/DebugMemoryLeakCheck.h"
+
+using namespace std;
+using namespace kNet;
+
+/// Benchmarks write their results here so that the compiler cannot optimize the measured work away.
+volatile u32 benchmarkSink = 0;
+
+/// Benchmarks add here the time spent in setup or teardown work that should not count towards the measured operations.
+tick_t excludedTicks = 0;
+
+/// A benchmark performs the given number of operations.
+typedef void (*BenchmarkFunc)(u64 numIterations);
+
+struct Benchmark
+{
+	const char *name;
+	BenchmarkFunc func;
+};
+
+struct BenchmarkResult
+{
+	std::string name;
+	u64 iterations;
+	double nsPerOp;
+};
+
+u32 randu32()
+{
+	return (u32)rand() ^ ((u32)rand() << 15) ^ ((u32)rand() << 30);
+}
+
+// WaitFreeQueue
+
+const size_t cQueueSize = 1024;
+
+void BM_WaitFreeQueue_InsertPop(u64 numIterations)
+{
+	WaitFreeQueue<u32> queue(cQueueSize);
+	u32 sum = 0;
+	for(u64 i = 0; i < numIterations; ++i)
+	{
+		queue.Insert((u32)i);
+		sum += *queue.Front();
+		queue.PopFront();
+	}
+	benchmarkSink = sum;
+}
+
+struct SPSCContext
+{
+	WaitFreeQueue<u32> *queue;
+	u64 numItems;
+};
+
+void SPSCProducer(SPSCContext *context)
+{
+	WaitFreeQueue<u32> &queue = *context->queue;
+	for(u64 i = 0; i < context->numItems; ++i)
+		while(!queue.Insert((u32)i))
+			std::this_thread::yield(); // Lets the consumer run when both threads share a core.
+}
+
+/// Measures the throughput of passing items from one thread to another through a WaitFreeQueue.
+void BM_WaitFreeQueue_SPSC(u64 numIterations)
+{
+	WaitFreeQueue<u32> queue(cQueueSize);
+	SPSCContext context = { &queue, numIterations };
+	Thread producer;
+	producer.RunFunc(&SPSCProducer, &context);
+
+	u32 sum = 0;
+	for(u64 i = 0; i < numIterations; ++i)
+	{
+		u32 *item;
+		while((item = queue.Front()) == 0)
+			std::this_thread::yield();
+		sum += *item;
+		queue.PopFront();
+	}
+	benchmarkSink = sum;
+
+	// Thread::Stop() sleeps before joining, keep that out of the measurement.
+	tick_t stopStart = Clock::Tick();
+	producer.Stop();
+	excludedTicks += Clock::TicksInBetween(Clock::Tick(), stopStart);
+}
+
+const int cBatchSize = 32;
+
+void SPSCBatchProducer(SPSCContext *context)
+{
+	WaitFreeQueue<u32> &queue = *context->queue;
+	u32 batch[cBatchSize];
+	u64 numInserted = 0;
+	while(numInserted < context->numItems)
+	{
+		int numValues = (int)std::min<u64>(cBatchSize, context->numItems - numInserted);
+		for(int i = 0; i < numValues; ++i)
+			batch[i] = (u32)(numInserted + i);
+		int numDone = 0;
+		while((numDone += queue.InsertBatch(batch + numDone, numValues - numDone)) < numValues)
+			std::this_thread::yield();
+		numInserted += numValues;
+	}
+}
+
+/// Same as BM_WaitFreeQueue_SPSC, but both sides move items in batches with InsertBatch and PopFrontBatch.
+void BM_WaitFreeQueue_SPSCBatch(u64 numIterations)
+{
+	WaitFreeQueue<u32> queue(cQueueSize);
+	SPSCContext context = { &queue, numIterations };
+	Thread producer;
+	producer.RunFunc(&SPSCBatchProducer, &context);
+
+	u32 sum = 0;
+	u32 batch[cBatchSize];
+	u64 numReceived = 0;
+	while(numReceived < numIterations)
+	{
+		int numPopped = queue.PopFrontBatch(batch, cBatchSize);
+		if (numPopped == 0)
+			std::this_thread::yield();
+		for(int i = 0; i < numPopped; ++i)
+			sum += batch[i];
+		numReceived += numPopped;
+	}
+	benchmarkSink = sum;
+
+	tick_t stopStart = Clock::Tick();
+	producer.Stop();
+	excludedTicks += Clock::TicksInBetween(Clock::Tick(), stopStart);
+}
+
+// SegmentedQueue
+
+void BM_SegmentedQueue_InsertPop(u64 numIterations)
+{
+	SegmentedQueue<u32> queue;
+	u32 sum = 0;
+	for(u64 i = 0; i < numIterations; ++i)
+	{
+		queue.Insert((u32)i);
+		sum += *queue.Front();
+		queue.PopFront();
+	}
+	benchmarkSink = sum;
+}
+
+struct SegmentedSPSCContext
+{
+	SegmentedQueue<u32> *queue;
+	u64 numItems;
+};
+
+void SegmentedSPSCProducer(SegmentedSPSCContext *context)
+{
+	SegmentedQueue<u32> &queue = *context->queue;
+	for(u64 i = 0; i < context->numItems; ++i)
+	{
+		queue.Insert((u32)i);
+		// The queue never fills up, so hold the producer back a bit to keep the memory use bounded.
+		while(queue.Size() >= (int)cQueueSize)
+			std::this_thread::yield();
+	}
+}
+
+/// Measures the throughput of passing items from one thread to another through a SegmentedQueue.
+void BM_SegmentedQueue_SPSC(u64 numIterations)
+{
+	SegmentedQueue<u32> queue;
+	SegmentedSPSCContext context = { &queue, numIterations };
+	Thread producer;
+	producer.RunFunc(&SegmentedSPSCProducer, &context);
+
+	u32 sum = 0;
+	for(u64 i = 0; i < numIterations; ++i)
+	{
+		u32 *item;
+		while((item = queue.Front()) == 0)
+			std::this_thread::yield();
+		sum += *item;
+		queue.PopFront();
+	}
+	benchmarkSink = sum;
+
+	tick_t stopStart = Clock::Tick();
+	producer.Stop();
+	excludedTicks += Clock::TicksInBetween(Clock::Tick(), stopStart);
+}
+
+// MaxHeap
+
+/// Measures one Insert and one PopFront on a heap that holds 1024 elements.
+void BM_MaxHeap_InsertPop(u64 numIterations)
+{
+	MaxHeap<u32> heap;
+	heap.Reserve(1025);
+	for(int i = 0; i < 1024; ++i)
+		heap.Insert(randu32());
+
+	for(u64 i = 0; i < numIterations; ++i)
+	{
+		heap.Insert(randu32());
+		heap.PopFront();
+	}
+	benchmarkSink = heap.Front();
+}
+
+// DataSerializer and DataDeserializer
+
+const size_t cSerializerBufferSize = 4096;
+
+void BM_DataSerializer_AddU32(u64 numIterations)
+{
+	char buffer[cSerializerBufferSize];
+	const int perBuffer = cSerializerBufferSize / sizeof(u32);
+	for(u64 i = 0; i < numIterations; i += perBuffer)
+	{
+		DataSerializer ds(buffer, sizeof(buffer));
+		for(int j = 0; j < perBuffer; ++j)
+			ds.Add<u32>((u32)j);
+	}
+	benchmarkSink = buffer[0];
+}
+
+void BM_DataSerializer_AppendBits5(u64 numIterations)
+{
+	char buffer[cSerializerBufferSize];
+	const int perBuffer = cSerializerBufferSize * 8 / 5;
+	for(u64 i = 0; i < numIterations; i += perBuffer)
+	{
+		DataSerializer ds(buffer, sizeof(buffer));
+		for(int j = 0; j < perBuffer; ++j)
+			ds.AppendBits((u32)j, 5);
+	}
+	benchmarkSink = buffer[0];
+}
+
+void BM_DataSerializer_AddVLE8_16_32(u64 numIterations)
+{
+	char buffer[cSerializerBufferSize];
+	const int perBuffer = cSerializerBufferSize / 4;
+	const u32 values[4] = { 100, 5000, 70000, 12 };
+	for(u64 i = 0; i < numIterations; i += perBuffer)
+	{
+		DataSerializer ds(buffer, sizeof(buffer));
+		for(int j = 0; j < perBuffer; ++j)
+			ds.AddVLE<VLE8_16_32>(values[j&3]);
+	}
+	benchmarkSink = buffer[0];
+}
+
+void BM_DataDeserializer_ReadU32(u64 numIterations)
+{
+	char buffer[cSerializerBufferSize];
+	memset(buffer, 0x5A, sizeof(buffer));
+	const int perBuffer = cSerializerBufferSize / sizeof(u32);
+	u32 sum = 0;
+	for(u64 i = 0; i < numIterations; i += perBuffer)
+	{
+		DataDeserializer dd(buffer, sizeof(buffer));
+		for(int j = 0; j < perBuffer; ++j)
+			sum += dd.Read<u32>();
+	}
+	benchmarkSink = sum;
+}
+
+void BM_DataDeserializer_ReadBits5(u64 numIterations)
+{
+	char buffer[cSerializerBufferSize];
+	memset(buffer, 0x5A, sizeof(buffer));
+	const int perBuffer = cSerializerBufferSize * 8 / 5;
+	u32 sum = 0;
+	for(u64 i = 0; i < numIterations; i += perBuffer)
+	{
+		DataDeserializer dd(buffer, sizeof(buffer));
+		for(int j = 0; j < perBuffer; ++j)
+			sum += dd.ReadBits(5);
+	}
+	benchmarkSink = sum;
+}
+
+void BM_DataDeserializer_ReadVLE8_16_32(u64 numIterations)
+{
+	char buffer[cSerializerBufferSize];
+	const int perBuffer = cSerializerBufferSize / 4;
+	const u32 values[4] = { 100, 5000, 70000, 12 };
+	DataSerializer ds(buffer, sizeof(buffer));
+	for(int j = 0; j < perBuffer; ++j)
+		ds.AddVLE<VLE8_16_32>(values[j&3]);
+
+	u32 sum = 0;
+	for(u64 i = 0; i < numIterations; i += perBuffer)
+	{
+		DataDeserializer dd(buffer, ds.BytesFilled());
+		for(int j = 0; j < perBuffer; ++j)
+			sum += dd.ReadVLE<VLE8_16_32>();
+	}
+	benchmarkSink = sum;
+}
+
+// RingBuffer
+
+/// Measures appending a 64-byte chunk to a RingBuffer and consuming it, like the TCP receive path does.
+void BM_RingBuffer_InsertConsume64(u64 numIterations)
+{
+	RingBuffer buffer(64 * 1024);
+	char chunk[64];
+	memset(chunk, 1, sizeof(chunk));
+	for(u64 i = 0; i < numIterations; ++i)
+	{
+		if (buffer.ContiguousFreeBytesLeft() < (int)sizeof(chunk))
+			buffer.Compact();
+		memcpy(buffer.End(), chunk, sizeof(chunk));
+		buffer.Inserted(sizeof(chunk));
+		// Consume in larger bursts so that the buffer stays partially filled and has to be compacted occasionally.
+		if (buffer.Size() >= 32 * (int)sizeof(chunk))
+		{
+			benchmarkSink = *buffer.Begin();
+			buffer.Consumed(31 * sizeof(chunk));
+		}
+	}
+}
+
+// SequentialIntegerSet
+
+/// Measures adding a sequential packet ID and checking for a duplicate, like the UDP receive path does.
+void BM_SequentialIntegerSet_AddExists(u64 numIterations)
+{
+	SequentialIntegerSet set(64 * 1024);
+	u32 found = 0;
+	for(u64 i = 0; i < numIterations; ++i)
+	{
+		unsigned long id = (unsigned long)(i & 0x3FFFFFFF);
+		if (!set.Exists(id))
+			set.Add(id);
+		else
+			++found;
+		if ((i & 0x3FFF) == 0x3FFF)
+			set.Prune();
+	}
+	benchmarkSink = found;
+}
+
+// OrderedHashTable
+
+struct IntHash
+{
+	static int Hash(u32 value, size_t mask) { return (int)(value & mask); }
+};
+
+void BM_OrderedHashTable_InsertFindPop(u64 numIterations)
+{
+	OrderedHashTable<u32, IntHash> table(4096);
+	u32 found = 0;
+	for(u64 i = 0; i < numIterations; ++i)
+	{
+		table.Insert((u32)i);
+		if (table.Find((u32)i))
+			++found;
+		if (table.Size() > 1024)
+			table.PopFront();
+	}
+	benchmarkSink = found;
+}
+
+// Statistics
+
+/// Measures recording an event by name into the string-keyed StatsEventHierarchyNode, the way ADDEVENT used to.
+void BM_StatsEventHierarchy_AddEvent(u64 numIterations)
+{
+	Lockable<StatsEventHierarchyNode> statistics;
+	for(u64 i = 0; i < numIterations; ++i)
+		statistics.Acquire()->AddEventToHierarchy("messageIn.5", (float)(i & 0xFF), "bytes", cEventOldAgeMSecs);
+	benchmarkSink = (u32)statistics.Acquire()->AccumulateTotalCountHierarchy();
+}
+
+/// Measures recording an event into an interned metric of StatsCounters.
+void BM_StatsCounters_Add(u64 numIterations)
+{
+	StatsCounters counters;
+	StatsMetricFamily family("microBenchmark.messageIn.%u", "bytes");
+	for(u64 i = 0; i < numIterations; ++i)
+		counters.Add(family.Get(5), (float)(i & 0xFF));
+	StatsSample s;
+	counters.Read(family.Get(5), s);
+	benchmarkSink = (u32)s.count;
+}
+
+// Lockable.h
+
+/// Measures an uncontended Acquire and release of a Lockable, with or without contention accounting.
+template<bool named>
+void LockableBenchmark(u64 numIterations)
+{
+	Lockable<u32> lockable(0);
+	if (named)
+		lockable.SetContentionName("MicroBenchmarks::lockable");
+	for(u64 i = 0; i < numIterations; ++i)
+		++*lockable.Acquire();
+	benchmarkSink = *lockable.Acquire();
+}
+
+// Clock.h
+
+/// Measures reading the clock, or the time cached for the worker loop.
+template<bool cached>
+void ClockBenchmark(u64 numIterations)
+{
+	if (cached)
+		Clock::SetLoopTick(Clock::Tick());
+	tick_t sum = 0;
+	for(u64 i = 0; i < numIterations; ++i)
+		sum += cached ? Clock::LoopTick() : Clock::Tick();
+	Clock::SetLoopTick(0);
+	benchmarkSink = (u32)sum;
+}
+
+// NetworkLogging.h
+
+/// Measures the cost of a LOG() call to the thread that logs, with the log written to a file.
+template<bool async>
+void LoggingBenchmark(u64 numIterations)
+{
+	const char *logFileName = "MicroBenchmarks.log";
+	const LogChannel oldChannels = GetLogChannels();
+	SetLogChannels(LogUser);
+	SetLogFile(logFileName);
+	SetAsyncLogging(async);
+	for(u64 i = 0; i < numIterations; ++i)
+		LOGUSER("MicroBenchmark log line %d with a value of %f.", (int)i, 1.5f);
+	tick_t start = Clock::Tick();
+	SetAsyncLogging(false);
+	SetLogFile(0);
+	excludedTicks += Clock::TicksInBetween(Clock::Tick(), start);
+	SetLogChannels(oldChannels);
+	remove(logFileName);
+}
+
+// Sort.inl
+
+const int cSortSize = 1024;
+
+/// Runs the given sort on random arrays of cSortSize elements. One iteration sorts one element, so that the
+/// results are comparable with the per-operation numbers above.
+template<void (*SortFunc)(u32 *, int)>
+void SortBenchmark(u64 numIterations)
+{
+	std::vector<u32> source(cSortSize);
+	for(int i = 0; i < cSortSize; ++i)
+		source[i] = randu32();
+	std::vector<u32> data(cSortSize);
+	for(u64 i = 0; i < numIterations; i += cSortSize)
+	{
+		data = source;
+		SortFunc(&data[0], cSortSize);
+	}
+	benchmarkSink = data[0];
+}
+
+void QuickSortU32(u32 *list, int n) { sort::QuickSort(list, n); }
+void MergeSortU32(u32 *list, int n) { sort::MergeSort(list, n); }
+void HeapSortU32(u32 *list, int n) { sort::HeapSort(list, n); }
+void IntroSortU32(u32 *list, int n) { sort::IntroSort(list, n); }
+void ShellSortU32(u32 *list, int n) { sort::ShellSort(list, n); }
+void CombSortU32(u32 *list, int n) { sort::CombSort(list, n); }
+void StdSortU32(u32 *list, int n) { std::sort(list, list + n); }
+
+const Benchmark benchmarks[] =
+{
+	{ "WaitFreeQueue/InsertPop", &BM_WaitFreeQueue_InsertPop },
+	{ "WaitFreeQueue/SPSC", &BM_WaitFreeQueue_SPSC },
+	{ "WaitFreeQueue/SPSCBatch", &BM_WaitFreeQueue_SPSCBatch },
+	{ "SegmentedQueue/InsertPop", &BM_SegmentedQueue_InsertPop },
+	{ "SegmentedQueue/SPSC", &BM_SegmentedQueue_SPSC },
+	{ "MaxHeap/InsertPop1024", &BM_MaxHeap_InsertPop },
+	{ "DataSerializer/AddU32", &BM_DataSerializer_AddU32 },
+	{ "DataSerializer/AppendBits5", &BM_DataSerializer_AppendBits5 },
+	{ "DataSerializer/AddVLE8_16_32", &BM_DataSerializer_AddVLE8_16_32 },
+	{ "DataDeserializer/ReadU32", &BM_DataDeserializer_ReadU32 },
+	{ "DataDeserializer/ReadBits5", &BM_DataDeserializer_ReadBits5 },
+	{ "DataDeserializer/ReadVLE8_16_32", &BM_DataDeserializer_ReadVLE8_16_32 },
+	{ "RingBuffer/InsertConsume64", &BM_RingBuffer_InsertConsume64 },
+	{ "SequentialIntegerSet/AddExists", &BM_SequentialIntegerSet_AddExists },
+	{ "OrderedHashTable/InsertFindPop", &BM_OrderedHashTable_InsertFindPop },
+	{ "StatsEventHierarchy/AddEvent", &BM_StatsEventHierarchy_AddEvent },
+	{ "StatsCounters/Add", &BM_StatsCounters_Add },
+	{ "Lockable/Unnamed", &LockableBenchmark<false> },
+	{ "Lockable/Named", &LockableBenchmark<true> },
+	{ "Clock/Tick", &ClockBenchmark<false> },
+	{ "Clock/LoopTick", &ClockBenchmark<true> },
+	{ "Logging/Sync", &LoggingBenchmark<false> },
+	{ "Logging/Async", &LoggingBenchmark<true> },
+	{ "Sort/QuickSort1024", &SortBenchmark<&QuickSortU32> },
+	{ "Sort/MergeSort1024", &SortBenchmark<&MergeSortU32> },
+	{ "Sort/HeapSort1024", &SortBenchmark<&HeapSortU32> },
+	{ "Sort/IntroSort1024", &SortBenchmark<&IntroSortU32> },
+	{ "Sort/ShellSort1024", &SortBenchmark<&ShellSortU32> },
+	{ "Sort/CombSort1024", &SortBenchmark<&CombSortU32> },
+	{ "Sort/std::sort1024", &SortBenchmark<&StdSortU32> },
+};
+
+/// Runs the given benchmark once and returns the time it took in milliseconds, minus any excluded setup time.
+double TimeBenchmarkRun(const Benchmark &benchmark, u64 numIterations)
+{
+	excludedTicks = 0;
+	tick_t start = Clock::Tick();
+	benchmark.func(numIterations);
+	tick_t elapsed = Clock::TicksInBetween(Clock::Tick(), start);
+	return Clock::TicksToMillisecondsD(elapsed - std::min(elapsed, excludedTicks));
+}
+
+/// Calibrates the iteration count so that a single run takes at least minMSecs, and returns the best
+/// nanoseconds per operation out of numRepetitions runs.
+BenchmarkResult RunBenchmark(const Benchmark &benchmark, double minMSecs, int numRepetitions)
+{
+	u64 numIterations = 1;
+	double msecs = 0.0;
+	for(;;)
+	{
+		msecs = TimeBenchmarkRun(benchmark, numIterations);
+		if (msecs >= minMSecs || numIterations >= (1ULL << 40))
+			break;
+		// Aim a bit over the target, but never grow by more than 10x in one step.
+		double scale = (msecs > 0.0) ? std::min(10.0, 1.5 * minMSecs / msecs) : 10.0;
+		numIterations = std::max(numIterations + 1, (u64)(numIterations * scale));
+	}
+
+	double bestMSecs = msecs;
+	for(int i = 1; i < numRepetitions; ++i)
+	{
+		bestMSecs = std::min(bestMSecs, TimeBenchmarkRun(benchmark, numIterations));
+	}
+
+	BenchmarkResult result;
+	result.name = benchmark.name;
+	result.iterations = numIterations;
+	result.nsPerOp = bestMSecs * 1e6 / numIterations;
+	return result;
+}
+
+void PrintUsage()
+{
+	cout << "Usage: " << endl;
+	cout << "       MicroBenchmarks [filter <substring>] [time <msecs>] [repetitions <n>] [json <file.json>]" << endl;
+	cout << "   filter: Only runs the benchmarks whose name contains the given substring." << endl;
+	cout << "   time: The minimum duration of a single measured run (default: 100 msecs)." << endl;
+	cout << "   repetitions: The number of measured runs, of which the fastest is reported (default: 3)." << endl;
+	cout << "   json: Writes the results as JSON into the given file." << endl;
+}
+
+int main(int argc, char **argv)
+{
+	const char *filter = 0;
+	double minMSecs = 100.0;
+	int numRepetitions = 3;
+	const char *jsonFile = 0;
+
+	for(int i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "filter") && i+1 < argc)
+			filter = argv[++i];
+		else if (!strcmp(argv[i], "time") && i+1 < argc)
+			minMSecs = atof(argv[++i]);
+		else if (!strcmp(argv[i], "repetitions") && i+1 < argc)
+			numRepetitions = std::max(1, atoi(argv[++i]));
+		else if (!strcmp(argv[i], "json") && i+1 < argc)
+			jsonFile = argv[++i];
+		else
+		{
+			PrintUsage();
+			return 0;
+		}
+	}
+
+	srand(0x1234);
+
+	std::vector<BenchmarkResult> results;
+	printf("%-36s %16s %14s\n", "Benchmark", "Iterations", "ns/op");
+	for(size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); ++i)
+	{
+		if (filter && !strstr(benchmarks[i].name, filter))
+			continue;
+		BenchmarkResult r = RunBenchmark(benchmarks[i], minMSecs, numRepetitions);
+		printf("%-36s %16llu %14.3f\n", r.name.c_str(), (unsigned long long)r.iterations, r.nsPerOp);
+		fflush(stdout);
+		results.push_back(r);
+	}
+
+	if (jsonFile)
+	{
+		std::ofstream out(jsonFile);
+		out << "{" << endl;
+		out << "  \"benchmarks\": [" << endl;
+		for(size_t i = 0; i < results.size(); ++i)
+		{
+			char str[512];
+			sprintf(str, "    { \"name\": \"%s\", \"iterations\": %llu, \"nsPerOp\": %.4f, \"opsPerSec\": %.1f }%s",
+				results[i].name.c_str(), (unsigned long long)results[i].iterations, results[i].nsPerOp,
+				(results[i].nsPerOp > 0.0) ? 1e9 / results[i].nsPerOp : 0.0, (i+1 < results.size()) ? "," : "");
+			out << str << endl;
+		}
+		out << "  ]" << endl;
+		out << "}" << endl;
+		if (!out)
+		{
+			cerr << "Failed to write the benchmark results to " << jsonFile << "!" << endl;
+			return 1;
+		}
+	}
+
+	return 0;
+}
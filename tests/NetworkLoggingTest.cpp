@@ -0,0 +1,123 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file NetworkLoggingTest.cpp
+	@brief */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <atomic>
+
+#include "kNet/NetworkLogging.h"
+#include "kNet/Thread.h"
+#include "kNet/Clock.h"
+#include "tassert.h"
+#include "kNet/DebugMemoryLeakCheck.h"
+
+using namespace kNet;
+
+namespace
+{
+
+const char *cLogFileName = "NetworkLoggingTest.log";
+
+struct LoggerContext
+{
+	int threadIndex;
+	std::atomic<bool> done;
+};
+
+void LogLines(LoggerContext *context)
+{
+	for(int i = 0; i < 2000; ++i)
+		LOGUSER("NetworkLoggingTest %d %d", context->threadIndex, i);
+	context->done = true;
+}
+
+std::vector<std::string> ReadLogLines()
+{
+	std::vector<std::string> lines;
+	std::ifstream file(cLogFileName);
+	std::string line;
+	while(std::getline(file, line))
+		if (line.find("NetworkLoggingTest") != std::string::npos)
+			lines.push_back(line);
+	return lines;
+}
+
+}
+
+void NetworkLoggingTest()
+{
+	const LogChannel oldChannels = GetLogChannels();
+	SetLogChannels(LogUser);
+
+	TEST("NetworkLogging asynchronous lines")
+	remove(cLogFileName);
+	SetLogFile(cLogFileName);
+	const unsigned long long numDroppedBefore = NumDroppedLogLines();
+	SetAsyncLogging(true);
+	assert(IsAsyncLoggingEnabled());
+	LoggerContext contexts[2];
+	for(int i = 0; i < 2; ++i)
+	{
+		contexts[i].threadIndex = i;
+		contexts[i].done = false;
+	}
+	Thread other;
+	other.RunFunc(&LogLines, &contexts[1]);
+	LogLines(&contexts[0]);
+	while(!contexts[1].done)
+		Clock::Sleep(1);
+	other.Stop();
+	FlushLog();
+	SetAsyncLogging(false);
+	SetLogFile(0);
+
+	std::vector<std::string> lines = ReadLogLines();
+	assert(lines.size() + (NumDroppedLogLines() - numDroppedBefore) == 4000);
+	// The lines of each thread are written in the order they were logged.
+	int next[2] = { 0, 0 };
+	for(size_t i = 0; i < lines.size(); ++i)
+	{
+		int threadIndex, index;
+		assert(sscanf(strstr(lines[i].c_str(), "NetworkLoggingTest"), "NetworkLoggingTest %d %d", &threadIndex, &index) == 2);
+		assert(threadIndex == 0 || threadIndex == 1);
+		assert(index >= next[threadIndex]);
+		next[threadIndex] = index + 1;
+	}
+	ENDTEST()
+
+	TEST("NetworkLogging rate limit")
+	remove(cLogFileName);
+	SetLogFile(cLogFileName);
+	const unsigned long long numLimitedBefore = NumRateLimitedLogLines();
+	SetLogRateLimit(5);
+	for(int i = 0; i < 100; ++i)
+		LOGUSER("NetworkLoggingTest %d", i);
+	SetLogRateLimit(0);
+	SetLogFile(0);
+
+	std::vector<std::string> lines = ReadLogLines();
+	// At most 5 lines per second get through, and the loop may straddle a second boundary.
+	assert(lines.size() >= 5 && lines.size() <= 10);
+	assert(lines.size() + (NumRateLimitedLogLines() - numLimitedBefore) == 100);
+	ENDTEST()
+
+	remove(cLogFileName);
+	SetLogChannels(oldChannels);
+}
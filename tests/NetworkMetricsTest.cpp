@@ -0,0 +1,194 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file NetworkMetricsTest.cpp
+	@brief */
+
+#include <string>
+#include <cstring>
+
+#include "kNet/Network.h"
+#include "kNet/NetworkMetrics.h"
+#include "tassert.h"
+#include "kNet/DebugMemoryLeakCheck.h"
+
+#if defined(__unix) || defined(ANDROID) || defined(__APPLE__)
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+
+using namespace kNet;
+
+namespace
+{
+
+bool Contains(const std::string &str, const char *substr)
+{
+	return str.find(substr) != std::string::npos;
+}
+
+ConnectionMetrics TestConnection()
+{
+	ConnectionMetrics c;
+	memset(&c.traffic, 0, sizeof(c.traffic));
+	c.localEndPoint = "127.0.0.1:2345";
+	c.remoteEndPoint = "10.0.0.1:\"5\"";
+	c.transport = SocketOverUDP;
+	c.state = ConnectionOK;
+	c.serverSide = true;
+	c.hibernating = false;
+	c.workerThread = 0;
+	c.roundTripTime = 12.5f;
+	c.lastHeardTime = 3.f;
+	c.bytesInTotal = 1000;
+	c.bytesOutTotal = 2000;
+	c.traffic.bytesIn = 100;
+	c.traffic.windowSecs = 2.f;
+	c.inboundMessagesPending = 1;
+	c.outboundMessagesPending = 2;
+	c.packetLossRate = 0.25f;
+	c.retransmissionTimeout = 250.f;
+	c.datagramSendRate = 70.f;
+	c.outboundUnackedDatagrams = 3;
+
+	LogHistogram h;
+	for(u32 i = 1; i <= 100; ++i)
+		h.Add(i);
+	MessageTypeMetrics m;
+	m.id = 7;
+	SummarizeHistogram(h, m.queueTimeUSecs);
+	SummarizeHistogram(LogHistogram(), m.ackTimeUSecs);
+	SummarizeHistogram(h, m.sizeBytes);
+	c.messageTypes.push_back(m);
+	return c;
+}
+
+/// Sends a GET request to the metrics endpoint at the given local port and returns the whole response.
+std::string HttpGet(unsigned short port, const char *path)
+{
+	SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(s, (const sockaddr *)&addr, sizeof(addr)) == KNET_SOCKET_ERROR)
+	{
+		closesocket(s);
+		return "";
+	}
+	std::string request = std::string("GET ") + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+	send(s, request.data(), (int)request.length(), 0);
+	std::string response;
+	char data[1024];
+	int numBytes;
+	while((numBytes = recv(s, data, sizeof(data), 0)) > 0)
+		response.append(data, numBytes);
+	closesocket(s);
+	return response;
+}
+
+}
+
+void NetworkMetricsTest()
+{
+	TEST("NetworkMetrics histogram summary")
+	LogHistogram h;
+	for(u32 i = 1; i <= 100; ++i)
+		h.Add(i);
+	HistogramMetrics m;
+	SummarizeHistogram(h, m);
+	assert(m.count == 100 && m.sum == 5050);
+	assert(m.p50 >= 50 && m.p50 <= 51 && m.max == 100);
+	assert(m.p90 >= 90 && m.p99 >= 99 && m.p99 <= 100);
+	ENDTEST()
+
+	TEST("NetworkMetrics JSON")
+	NetworkMetrics metrics;
+	WorkerThreadMetrics w = WorkerThreadMetrics();
+	w.numConnections = 1;
+	w.numServers = 1;
+	metrics.workerThreads.push_back(w);
+	metrics.connections.push_back(TestConnection());
+	std::string json = MetricsToJSON(metrics);
+	assert(json[0] == '{' && json[json.length()-1] == '}');
+	assert(Contains(json, "\"workerThreads\":[{\"connections\":1,\"servers\":1,\"loop\":{\"iterations\":0,\"elapsedMSecs\":0,\"waitMSecs\":0,"));
+	assert(Contains(json, "\"remoteEndPoint\":\"10.0.0.1:\\\"5\\\"\""));
+	assert(Contains(json, "\"state\":\"ConnectionOK\""));
+	assert(Contains(json, "\"roundTripTime\":12.5"));
+	assert(Contains(json, "\"udp\":{\"packetLossRate\":0.25"));
+	assert(Contains(json, "\"id\":7,\"queueTimeUSecs\":{\"count\":100,\"sum\":5050,\"p50\":51"));
+	assert(Contains(json, "\"counters\":[],\"locks\":[]}"));
+	ENDTEST()
+
+	TEST("NetworkMetrics Prometheus")
+	NetworkMetrics metrics;
+	metrics.connections.push_back(TestConnection());
+	StatsCounters counters;
+	StatsMetricId id = RegisterStatsMetric("metricsTest.value", "bytes");
+	counters.Add(id, 5.f);
+	counters.ReadAll(metrics.counters);
+	std::string text = MetricsToPrometheus(metrics);
+	const char *labels = "local=\"127.0.0.1:2345\",remote=\"10.0.0.1:\\\"5\\\"\",transport=\"udp\",side=\"server\"";
+	assert(Contains(text, "# TYPE knet_worker_threads gauge\nknet_worker_threads 0\n"));
+	assert(Contains(text, (std::string("knet_connection_rtt_milliseconds{") + labels + "} 12.5\n").c_str()));
+	assert(Contains(text, (std::string("knet_connection_sent_bytes_total{") + labels + "} 2000\n").c_str()));
+	assert(Contains(text, (std::string("knet_connection_bytes_per_second{") + labels + ",direction=\"in\"} 50\n").c_str()));
+	assert(Contains(text, (std::string("knet_message_queue_time_microseconds{") + labels + ",message_id=\"7\",quantile=\"0.5\"} 51\n").c_str()));
+	assert(Contains(text, (std::string("knet_message_size_bytes_count{") + labels + ",message_id=\"7\"} 100\n").c_str()));
+	assert(!Contains(text, "knet_message_ack_time_microseconds{")); // No acks were recorded.
+	assert(Contains(text, "knet_stats_values_total{metric=\"metricsTest.value\",unit=\"bytes\"} 1\n"));
+	ENDTEST()
+
+	TEST("NetworkMetrics worker loop")
+	Network network;
+	NetworkServer *server = network.StartServer(48232, SocketOverUDP, 0, true);
+	assert(server);
+	Clock::Sleep(200);
+	NetworkMetrics metrics;
+	network.SnapshotMetrics(metrics);
+	assert(metrics.workerThreads.size() == 1);
+	const WorkerLoopStatistics &loop = metrics.workerThreads[0].loop;
+	assert(loop.iterations > 0);
+	// An idle server worker spends nearly all of its time waiting for the listen socket.
+	assert(loop.phaseMSecs[WorkerLoopWait] > 0.5 * loop.elapsedMSecs);
+	assert(loop.phaseMSecs[WorkerLoopWait] <= loop.elapsedMSecs);
+	bool foundLock = false;
+	for(size_t i = 0; i < metrics.locks.size(); ++i)
+		if (metrics.locks[i].name == "NetworkWorkerThread::servers")
+			foundLock = metrics.locks[i].acquisitions > 0;
+	assert(foundLock);
+	std::string text = MetricsToPrometheus(metrics);
+	assert(Contains(text, "knet_worker_loop_seconds_total{worker=\"0\",phase=\"wait\"} "));
+	assert(Contains(text, "knet_lock_acquisitions_total{lock=\"NetworkWorkerThread::servers\"} "));
+	network.StopServer();
+	ENDTEST()
+
+	TEST("NetworkMetrics endpoint")
+	Network network;
+	const unsigned short port = 48231;
+	assert(network.StartMetricsEndpoint(port));
+	std::string response = HttpGet(port, "/metrics.json");
+	assert(Contains(response, "HTTP/1.0 200 OK\r\n"));
+	assert(Contains(response, "Content-Type: application/json\r\n"));
+	assert(Contains(response, "\r\n\r\n{\"workerThreads\":[],\"servers\":[],\"connections\":[]"));
+	response = HttpGet(port, "/metrics");
+	assert(Contains(response, "Content-Type: text/plain; version=0.0.4\r\n"));
+	assert(Contains(response, "knet_worker_threads 0\n"));
+	response = HttpGet(port, "/other");
+	assert(Contains(response, "HTTP/1.0 404 Not Found\r\n"));
+	network.StopMetricsEndpoint();
+	assert(HttpGet(port, "/metrics").empty());
+	ENDTEST()
+}
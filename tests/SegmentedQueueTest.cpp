@@ -0,0 +1,100 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file SegmentedQueueTest.cpp
+	@brief */
+
+#include <thread>
+
+#include "kNet/SegmentedQueue.h"
+#include "kNet/Thread.h"
+#include "tassert.h"
+#include "kNet/DebugMemoryLeakCheck.h"
+
+using namespace kNet;
+
+namespace
+{
+
+struct ProducerContext
+{
+	SegmentedQueue<int, 4> *queue;
+	int numItems;
+};
+
+void ProduceItems(ProducerContext *context)
+{
+	for(int i = 0; i < context->numItems; ++i)
+		context->queue->Insert(i);
+}
+
+}
+
+void SegmentedQueueTest()
+{
+	TEST("SegmentedQueue Insert/PopFront across blocks")
+	SegmentedQueue<int, 4> queue;
+	assert(queue.Size() == 0);
+	assert(queue.Front() == 0);
+	for(int i = 0; i < 19; ++i)
+		queue.Insert(i);
+	assert(queue.Size() == 19);
+	for(int i = 0; i < 19; ++i)
+	{
+		assert(*queue.Front() == i);
+		queue.PopFront();
+	}
+	assert(queue.Size() == 0);
+	assert(queue.Front() == 0);
+	ENDTEST()
+
+	TEST("SegmentedQueue InsertBatch/PopFrontBatch")
+	SegmentedQueue<int, 4> queue;
+	int values[10];
+	for(int i = 0; i < 10; ++i)
+		values[i] = i;
+	queue.InsertBatch(values, 10);
+	queue.InsertBatch(values, 3);
+	assert(queue.Size() == 13);
+	int out[16];
+	assert(queue.PopFrontBatch(out, 6) == 6);
+	for(int i = 0; i < 6; ++i)
+		assert(out[i] == i);
+	assert(queue.TakeFront() == 6);
+	assert(queue.PopFrontBatch(out, 16) == 6);
+	assert(out[2] == 9 && out[3] == 0 && out[5] == 2);
+	assert(queue.PopFrontBatch(out, 16) == 0);
+	queue.Insert(42);
+	queue.Clear();
+	assert(queue.Size() == 0);
+	ENDTEST()
+
+	TEST("SegmentedQueue two threads")
+	SegmentedQueue<int, 4> queue;
+	const int numItems = 100000;
+	ProducerContext context = { &queue, numItems };
+	Thread producer;
+	producer.RunFunc(&ProduceItems, &context);
+	for(int i = 0; i < numItems; ++i)
+	{
+		int *item;
+		while((item = queue.Front()) == 0)
+			std::this_thread::yield();
+		assert(*item == i);
+		queue.PopFront();
+	}
+	producer.Stop();
+	assert(queue.Size() == 0);
+	ENDTEST()
+}
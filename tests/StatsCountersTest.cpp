@@ -0,0 +1,127 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file StatsCountersTest.cpp
+	@brief */
+
+#include <cstring>
+#include <atomic>
+
+#include "kNet/StatsCounters.h"
+#include "kNet/StatsEventHierarchy.h"
+#include "kNet/Thread.h"
+#include "kNet/Clock.h"
+#include "tassert.h"
+#include "kNet/DebugMemoryLeakCheck.h"
+
+using namespace kNet;
+
+namespace
+{
+
+struct RecorderContext
+{
+	StatsCounters *counters;
+	StatsMetricId id;
+	int numValues;
+	/// The number of calls to RecordValues() that have finished.
+	std::atomic<int> numFinished;
+};
+
+void RecordValues(RecorderContext *context)
+{
+	for(int i = 0; i < context->numValues; ++i)
+		context->counters->Add(context->id, 2.f);
+	++context->numFinished;
+}
+
+}
+
+void StatsCountersTest()
+{
+	TEST("StatsCounters metric interning")
+	StatsMetricId a = RegisterStatsMetric("statsTest.a", "bytes");
+	StatsMetricId b = RegisterStatsMetric("statsTest.b", "");
+	assert(a != cInvalidStatsMetric && b != cInvalidStatsMetric);
+	assert(a != b);
+	assert(RegisterStatsMetric("statsTest.a", "bytes") == a);
+	assert(!strcmp(StatsMetricName(a), "statsTest.a"));
+	assert(!strcmp(StatsMetricUnit(a), "bytes"));
+	StatsMetricFamily family("statsTest.family.%u", "bytes");
+	assert(family.Get(7) == family.Get(7));
+	assert(family.Get(7) == RegisterStatsMetric("statsTest.family.7", "bytes"));
+	assert(family.Get(100000) == RegisterStatsMetric("statsTest.family.100000", "bytes"));
+	ENDTEST()
+
+	TEST("StatsCounters Add/Read")
+	StatsCounters counters;
+	StatsMetricId id = RegisterStatsMetric("statsTest.addRead", "");
+	StatsSample s;
+	counters.Read(id, s);
+	assert(s.count == 0);
+	counters.Add(id, 0.5f);
+	counters.Add(id, 3.f);
+	counters.Add(id, 100.f);
+	counters.Read(id, s);
+	assert(s.count == 3);
+	assert(s.sum == 103.5);
+	assert(s.min == 0.5f && s.max == 100.f && s.latest == 100.f);
+	assert(s.histogram[0] == 1 && s.histogram[2] == 1 && s.histogram[7] == 1);
+	counters.Add(cInvalidStatsMetric, 1.f); // Ignored.
+	ENDTEST()
+
+	TEST("StatsCounters aggregate across threads")
+	StatsCounters counters;
+	StatsMetricId id = RegisterStatsMetric("statsTest.threads", "");
+	const int numValues = 50000;
+	RecorderContext context;
+	context.counters = &counters;
+	context.id = id;
+	context.numValues = numValues;
+	context.numFinished = 0;
+	Thread recorder;
+	recorder.RunFunc(&RecordValues, &context);
+	RecordValues(&context);
+	// A thread stopped before it gets to start does not run its function at all.
+	tick_t start = Clock::Tick();
+	while(context.numFinished < 2 && Clock::SecondsSinceF(start) < 5.f)
+		Clock::Sleep(1);
+	recorder.Stop();
+	StatsSample s;
+	counters.Read(id, s);
+	assert(s.count == 2 * numValues);
+	assert(s.sum == 4.0 * numValues);
+	assert(s.histogram[StatsHistogramBucket(2.f)] == 2 * numValues);
+	ENDTEST()
+
+	TEST("StatsCounters UpdateHierarchy")
+	StatsCounters counters;
+	StatsEventHierarchyNode root;
+	StatsMetricId id = RegisterStatsMetric("statsTest.hierarchy.value", "msecs");
+	counters.Add(id, 2.f);
+	counters.Add(id, 4.f);
+	counters.UpdateHierarchy(root, cEventOldAgeMSecs);
+	StatsEventHierarchyNode *node = root.FindChild("statsTest.hierarchy.value");
+	assert(node);
+	assert(node->valueType == "msecs");
+	assert(node->AccumulateTotalCountThisLevel() == 1);
+	assert(node->LatestValue() == 3.f);
+	counters.UpdateHierarchy(root, cEventOldAgeMSecs); // No new values, no new events.
+	assert(node->AccumulateTotalCountThisLevel() == 1);
+	counters.Add(id, 10.f);
+	counters.UpdateHierarchy(root, cEventOldAgeMSecs);
+	assert(node->AccumulateTotalCountThisLevel() == 2);
+	assert(node->LatestValue() == 10.f);
+	ENDTEST()
+}
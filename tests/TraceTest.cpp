@@ -0,0 +1,138 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file TraceTest.cpp
+	@brief */
+
+#include <string>
+#include <vector>
+#include <atomic>
+
+#include "kNet/Trace.h"
+#include "kNet/Thread.h"
+#include "kNet/MessageConnection.h"
+#include "tassert.h"
+#include "kNet/DebugMemoryLeakCheck.h"
+
+using namespace kNet;
+
+namespace
+{
+
+struct TracerContext
+{
+	const void *object;
+	std::atomic<bool> done;
+};
+
+void TraceFromThread(TracerContext *context)
+{
+	SetTraceThreadName("TraceTest \"other\"");
+	for(u32 i = 0; i < 100; ++i)
+		TraceEvent(TracePacketSent, context->object, i, 1000 + i);
+	context->done = true;
+}
+
+/// Returns the records of the given object, in the order they were read.
+std::vector<TraceRecord> RecordsOf(const void *object)
+{
+	std::vector<TraceRecord> records;
+	ReadTrace(records);
+	std::vector<TraceRecord> filtered;
+	for(size_t i = 0; i < records.size(); ++i)
+		if (records[i].object == (u64)(uintptr_t)object)
+			filtered.push_back(records[i]);
+	return filtered;
+}
+
+bool Contains(const std::string &str, const char *substr)
+{
+	return str.find(substr) != std::string::npos;
+}
+
+}
+
+void TraceTest()
+{
+	TEST("Trace per-thread records")
+	ClearTrace();
+	int object = 0;
+	TraceEvent(TraceMessageQueued, &object, 1, 7);
+	TracerContext context;
+	context.object = &object;
+	context.done = false;
+	Thread other;
+	other.RunFunc(&TraceFromThread, &context);
+	while(!context.done)
+		Clock::Sleep(1);
+	other.Stop();
+	TraceEvent(TraceMessagePacked, &object, 1, 5);
+
+	std::vector<TraceRecord> records = RecordsOf(&object);
+	assert(records.size() == 102);
+	assert(records[0].event == TraceMessageQueued && records[0].arg0 == 1 && records[0].arg1 == 7);
+	assert(records[101].event == TraceMessagePacked && records[101].arg1 == 5);
+	const u16 otherThread = records[1].thread;
+	assert(otherThread != records[0].thread && records[101].thread == records[0].thread);
+	assert(TraceThreadName(otherThread) == "TraceTest \"other\"");
+	for(u32 i = 0; i < 100; ++i)
+	{
+		assert(records[1+i].event == TracePacketSent && records[1+i].thread == otherThread);
+		assert(records[1+i].arg0 == i && records[1+i].arg1 == 1000 + i);
+		assert(records[1+i].tick >= records[i].tick);
+	}
+	ClearTrace();
+	assert(RecordsOf(&object).empty());
+	ENDTEST()
+
+	TEST("Trace buffer wraps around")
+	ClearTrace();
+	int object = 0;
+	for(u32 i = 0; i < (u32)cTraceBufferSize + 100; ++i)
+		TraceEvent(TraceMessageAccepted, &object, i, 0);
+	std::vector<TraceRecord> records = RecordsOf(&object);
+	// A full buffer holds the cTraceBufferSize-1 most recent records.
+	assert(records.size() == (size_t)cTraceBufferSize - 1);
+	assert(records.front().arg0 == 101 && records.back().arg0 == (u32)cTraceBufferSize + 99);
+	ClearTrace();
+	ENDTEST()
+
+	TEST("Trace Chrome JSON")
+	std::vector<TraceRecord> records(3);
+	for(size_t i = 0; i < records.size(); ++i)
+	{
+		records[i].tick = 1000 + i * Clock::TicksPerMillisecond();
+		records[i].object = 0xABC;
+		records[i].thread = 0;
+		records[i].reserved = 0;
+	}
+	records[0].event = TraceMessageQueued;
+	records[0].arg0 = 4;
+	records[0].arg1 = 9;
+	records[1].event = TracePacketAcked;
+	records[1].arg0 = 77;
+	records[1].arg1 = 2;
+	records[2].event = TraceConnectionState;
+	records[2].arg0 = ConnectionClosed;
+	records[2].arg1 = 0;
+	std::string json = TraceToChromeJSON(records);
+	assert(Contains(json, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":["));
+	assert(json[json.length()-2] == ']' && json[json.length()-1] == '}');
+	assert(Contains(json, "{\"name\":\"Message\",\"ph\":\"b\",\"ts\":0.000,\"pid\":1,\"tid\":0,\"cat\":\"message\",\"id\":\"0xabc.4\","
+		"\"args\":{\"event\":\"MessageQueued\",\"object\":\"0xabc\",\"number\":4,\"id\":9}}"));
+	assert(Contains(json, "{\"name\":\"PacketAcked\",\"ph\":\"i\",\"ts\":1000.000,"));
+	assert(Contains(json, "\"packetID\":77,\"messages\":2}}"));
+	assert(Contains(json, "\"state\":\"ConnectionClosed\"}}"));
+	ENDTEST()
+}
@@ -0,0 +1,101 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file TrafficStatsWindowTest.cpp
+	@brief */
+
+#include "kNet/TrafficStatsWindow.h"
+#include "kNet/Thread.h"
+#include "tassert.h"
+#include "kNet/DebugMemoryLeakCheck.h"
+
+using namespace kNet;
+
+namespace
+{
+
+tick_t MSecsToTicks(u64 msecs)
+{
+	return (tick_t)(msecs * Clock::TicksPerSec() / 1000);
+}
+
+struct WriterContext
+{
+	TrafficStatsWindow *window;
+	int numEvents;
+};
+
+void WriteEvents(WriterContext *context)
+{
+	// Every event adds the same amount to each inbound counter, so a consistent snapshot always has them equal.
+	for(int i = 0; i < context->numEvents; ++i)
+		context->window->AddInbound(3, 3, 3, Clock::Tick());
+}
+
+}
+
+void TrafficStatsWindowTest()
+{
+	TEST("TrafficStatsWindow totals and rates")
+	TrafficStatsWindow window;
+	const tick_t start = MSecsToTicks(1000 * 1000);
+	TrafficStatsSnapshot s;
+	window.Snapshot(s, start);
+	assert(s.bytesIn == 0 && s.bytesOut == 0);
+	window.AddInbound(100, 1, 2, start);
+	window.AddOutbound(50, 1, 1, start + MSecsToTicks(250));
+	window.AddInbound(100, 1, 2, start + MSecsToTicks(1900));
+	window.Snapshot(s, start + MSecsToTicks(2000));
+	assert(s.bytesIn == 200 && s.packetsIn == 2 && s.messagesIn == 4);
+	assert(s.bytesOut == 50 && s.packetsOut == 1 && s.messagesOut == 1);
+	assert(s.windowSecs > 1.99f && s.windowSecs < 2.01f);
+	assert(s.BytesInPerSec() > 99.f && s.BytesInPerSec() < 101.f);
+	ENDTEST()
+
+	TEST("TrafficStatsWindow old buckets expire")
+	TrafficStatsWindow window;
+	const tick_t start = MSecsToTicks(1000 * 1000);
+	const int windowMSecs = TrafficStatsWindow::cNumBuckets * TrafficStatsWindow::cBucketMSecs;
+	window.AddInbound(100, 1, 1, start);
+	window.AddInbound(10, 1, 1, start + MSecsToTicks(windowMSecs / 2));
+	TrafficStatsSnapshot s;
+	window.Snapshot(s, start + MSecsToTicks(windowMSecs + 10));
+	assert(s.bytesIn == 10);
+	// Reusing the bucket slot of the first event must not carry over its counts.
+	window.AddInbound(1, 1, 1, start + MSecsToTicks(windowMSecs + 20));
+	window.Snapshot(s, start + MSecsToTicks(windowMSecs + 30));
+	assert(s.bytesIn == 11 && s.packetsIn == 2);
+	window.Snapshot(s, start + MSecsToTicks(10 * windowMSecs));
+	assert(s.bytesIn == 0);
+	assert(s.windowSecs == 1.f);
+	window.Clear();
+	window.Snapshot(s, start + MSecsToTicks(windowMSecs + 30));
+	assert(s.bytesIn == 0);
+	ENDTEST()
+
+	TEST("TrafficStatsWindow consistent snapshots")
+	TrafficStatsWindow window;
+	WriterContext context = { &window, 200000 };
+	Thread writer;
+	writer.RunFunc(&WriteEvents, &context);
+	for(int i = 0; i < 2000; ++i)
+	{
+		TrafficStatsSnapshot s;
+		window.Snapshot(s, Clock::Tick());
+		assert(s.bytesIn == s.packetsIn && s.packetsIn == s.messagesIn);
+		assert(s.bytesOut == 0);
+	}
+	writer.Stop();
+	ENDTEST()
+}
@@ -0,0 +1,375 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file UDPMessageConnectionTest.cpp
+	@brief */
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+
+#include "kNet/Network.h"
+#include "kNet/UDPMessageConnection.h"
+#include "tassert.h"
+#include "kNet/DebugMemoryLeakCheck.h"
+
+using namespace kNet;
+
+namespace
+{
+
+/// Makes the server side of each new connection send the ack delay.
+class AckDelayListener : public INetworkServerListener
+{
+public:
+	void NewConnectionEstablished(MessageConnection *connection)
+	{
+		UDPMessageConnection *udp = dynamic_cast<UDPMessageConnection*>(connection);
+		if (udp)
+			udp->SetAckDelayEnabled(true);
+	}
+};
+
+/// Records the connect data of the connection attempts, and the messages received by the server.
+class ConnectDataListener : public INetworkServerListener, public IMessageHandler
+{
+public:
+	std::string connectData;
+	std::vector<std::string> messages;
+
+	bool NewConnectionAttempt(const EndPoint &, const char *data, size_t numBytes)
+	{
+		connectData.assign(data, numBytes);
+		return true;
+	}
+
+	void NewConnectionEstablished(MessageConnection *connection)
+	{
+		connection->RegisterInboundMessageHandler(this);
+	}
+
+	void HandleMessage(MessageConnection *, packet_id_t, message_id_t messageId, const char *data, size_t numBytes)
+	{
+		if (messageId == 200)
+			messages.push_back(std::string(data, numBytes));
+	}
+};
+
+}
+
+void UDPMessageConnectionTest()
+{
+	TEST("UDPMessageConnection RTT from ack delay")
+	Network serverNetwork, clientNetwork;
+	AckDelayListener listener;
+	NetworkServer *server = serverNetwork.StartServer(48233, SocketOverUDP, &listener, true);
+	assert(server);
+	Ptr(MessageConnection) client = clientNetwork.Connect("127.0.0.1", 48233, SocketOverUDP, 0);
+	assert(client);
+	UDPMessageConnection *udp = dynamic_cast<UDPMessageConnection*>(client.ptr());
+	assert(udp && !udp->AckDelayEnabled());
+
+	tick_t start = Clock::Tick();
+	while(client->GetConnectionState() != ConnectionOK && Clock::SecondsSinceF(start) < 5.f)
+	{
+		server->Process();
+		client->Process();
+		Clock::Sleep(1);
+	}
+	assert(client->GetConnectionState() == ConnectionOK);
+	for(int i = 0; i < 50; ++i)
+	{
+		client->SendMessage(100, true, false, 100, 0, "0123456789", 10);
+		server->Process();
+		Clock::Sleep(5);
+	}
+	start = Clock::Tick();
+	while(udp->NumOutboundUnackedDatagrams() > 0 && Clock::SecondsSinceF(start) < 5.f)
+	{
+		server->Process();
+		Clock::Sleep(1);
+	}
+	server->Process();
+	client->Process();
+	// The server holds back its acks for up to 33 msecs. The samples leave that out, so the RTT over loopback is small.
+	assert(udp->NumAckRttSamples() > 0);
+	assert(client->RoundTripTime() == udp->SmoothedRtt());
+	assert(client->RoundTripTime() < 10.f);
+	client->Close(0);
+	serverNetwork.StopServer();
+	ENDTEST()
+
+	TEST("UDPMessageConnection messages in the Connection Start datagram")
+	Network serverNetwork, clientNetwork;
+	ConnectDataListener listener;
+	NetworkServer *server = serverNetwork.StartServer(48237, SocketOverUDP, &listener, true);
+	assert(server);
+	Datagram connectMessage;
+	memcpy(connectMessage.data, "hello", 5);
+	connectMessage.size = 5;
+	// Hold the connect back until the login messages are queued, so that they travel with the connection attempt.
+	Ptr(MessageConnection) client = clientNetwork.Connect("127.0.0.1", 48237, SocketOverUDP, 0, &connectMessage, true);
+	assert(client);
+	client->SendMessage(200, true, true, 100, 0, "login", 5);
+	client->SendMessage(200, true, true, 100, 0, "join", 4);
+	client->ResumeOutboundSends();
+
+	tick_t start = Clock::Tick();
+	while(listener.messages.size() < 2 && Clock::SecondsSinceF(start) < 5.f)
+	{
+		server->Process();
+		client->Process();
+		Clock::Sleep(1);
+	}
+	assert(listener.connectData == "hello");
+	assert(listener.messages.size() == 2);
+	assert(listener.messages[0] == "login" && listener.messages[1] == "join");
+	// Both messages fit in the first datagram, so they did not wait for a resend of an unacked datagram.
+	assert(Clock::SecondsSinceF(start) < 0.5f);
+	assert(server->GetConnections().size() == 1);
+	client->Close(0);
+	serverNetwork.StopServer();
+	ENDTEST()
+
+	TEST("UDPMessageConnection messages in a repeated Connection Start datagram")
+	Network serverNetwork, clientNetwork;
+	ConnectDataListener listener;
+	NetworkServer *server = serverNetwork.StartServer(48245, SocketOverUDP, &listener, true);
+	assert(server);
+	Ptr(MessageConnection) client = clientNetwork.Connect("127.0.0.1", 48245, SocketOverUDP, 0);
+	assert(client);
+	// Both datagrams carry the Connection Start header and queue up as connection attempts before the server accepts
+	// the first one.
+	client->SendMessage(200, true, true, 100, 0, "login", 5);
+	Clock::Sleep(100);
+	client->SendMessage(200, true, true, 100, 0, "join", 4);
+	Clock::Sleep(100);
+
+	tick_t start = Clock::Tick();
+	while(listener.messages.size() < 2 && Clock::SecondsSinceF(start) < 5.f)
+	{
+		server->Process();
+		Clock::Sleep(1);
+	}
+	assert(listener.messages.size() == 2);
+	assert(listener.messages[0] == "login" && listener.messages[1] == "join");
+	// The second message did not wait for a resend of its datagram.
+	assert(Clock::SecondsSinceF(start) < 0.5f);
+	assert(server->GetConnections().size() == 1);
+	client->Close(0);
+	serverNetwork.StopServer();
+	ENDTEST()
+
+	TEST("UDPMessageConnection paces datagrams evenly")
+	Network serverNetwork, clientNetwork;
+	ConnectDataListener listener;
+	NetworkServer *server = serverNetwork.StartServer(48239, SocketOverUDP, &listener, true);
+	assert(server);
+	Ptr(MessageConnection) client = clientNetwork.Connect("127.0.0.1", 48239, SocketOverUDP, 0);
+	assert(client);
+	UDPMessageConnection *udp = dynamic_cast<UDPMessageConnection*>(client.ptr());
+	tick_t start = Clock::Tick();
+	while(client->GetConnectionState() != ConnectionOK && Clock::SecondsSinceF(start) < 5.f)
+	{
+		server->Process();
+		client->Process();
+		Clock::Sleep(1);
+	}
+	assert(client->GetConnectionState() == ConnectionOK);
+
+	// Each message fills a datagram of its own, so they go out one per 1/DatagramSendRate() seconds.
+	const int numMessages = 30;
+	std::vector<char> payload(1000, 'x');
+	for(int i = 0; i < numMessages; ++i)
+		client->SendMessage(200, false, true, 100, 0, &payload[0], payload.size());
+	start = Clock::Tick();
+	tick_t firstReceived = 0;
+	while(listener.messages.size() < (size_t)numMessages && Clock::SecondsSinceF(start) < 5.f)
+	{
+		server->Process();
+		if (firstReceived == 0 && !listener.messages.empty())
+			firstReceived = Clock::Tick();
+		Clock::Sleep(1);
+	}
+	assert(listener.messages.size() == (size_t)numMessages);
+	// The messages were queued at once. Without pacing, they would arrive in a few bursts.
+	const float minSpreadSecs = 0.8f * (numMessages - 2) / udp->DatagramSendRate();
+	assert(Clock::SecondsSinceF(firstReceived) >= minSpreadSecs);
+	client->Close(0);
+	serverNetwork.StopServer();
+	ENDTEST()
+
+	TEST("UDP server reads bursts of datagrams from many clients")
+	Network serverNetwork, clientNetwork;
+	ConnectDataListener listener;
+	NetworkServer *server = serverNetwork.StartServer(48243, SocketOverUDP, &listener, true);
+	assert(server);
+	const int numClients = 8;
+	std::vector<Ptr(MessageConnection)> clients;
+	for(int i = 0; i < numClients; ++i)
+		clients.push_back(clientNetwork.Connect("127.0.0.1", 48243, SocketOverUDP, 0));
+	tick_t start = Clock::Tick();
+	bool allConnected = false;
+	while(!allConnected && Clock::SecondsSinceF(start) < 5.f)
+	{
+		server->Process();
+		allConnected = true;
+		for(int i = 0; i < numClients; ++i)
+			allConnected = allConnected && clients[i]->GetConnectionState() == ConnectionOK;
+		Clock::Sleep(1);
+	}
+	assert(allConnected);
+
+	// Each message fills a datagram of its own. The clients send at the same time, so the datagrams queue up at the server socket.
+	const int numMessages = 40;
+	std::vector<char> payload(1000, 'x');
+	for(int n = 0; n < numMessages; ++n)
+		for(int i = 0; i < numClients; ++i)
+		{
+			payload[0] = (char)i;
+			payload[1] = (char)n;
+			clients[i]->SendMessage(200, true, true, 100, 0, &payload[0], payload.size());
+		}
+	start = Clock::Tick();
+	while(listener.messages.size() < (size_t)(numClients * numMessages) && Clock::SecondsSinceF(start) < 10.f)
+	{
+		server->Process();
+		Clock::Sleep(1);
+	}
+	assert(listener.messages.size() == (size_t)(numClients * numMessages));
+	std::vector<int> nextMessage(numClients, 0);
+	for(size_t i = 0; i < listener.messages.size(); ++i)
+	{
+		const std::string &message = listener.messages[i];
+		assert(message.size() == payload.size());
+		assert(message[0] >= 0 && message[0] < numClients);
+		assert(message[1] == nextMessage[(int)message[0]]);
+		++nextMessage[(int)message[0]];
+	}
+	for(int i = 0; i < numClients; ++i)
+		clients[i]->Close(0);
+	serverNetwork.StopServer();
+	ENDTEST()
+
+#ifndef WIN32
+	TEST("UDPMessageConnection moves to a new client address by connection ID")
+	Network serverNetwork, clientNetwork;
+	ConnectDataListener listener;
+	NetworkServer *server = serverNetwork.StartServer(48238, SocketOverUDP, &listener, true);
+	assert(server);
+	server->SetConnectionIdsEnabled(true);
+	Ptr(MessageConnection) client = clientNetwork.Connect("127.0.0.1", 48238, SocketOverUDP, 0);
+	assert(client);
+	UDPMessageConnection *udp = dynamic_cast<UDPMessageConnection*>(client.ptr());
+	client->SendMessage(200, true, true, 100, 0, "before", 6);
+	tick_t start = Clock::Tick();
+	while((listener.messages.size() < 1 || udp->ConnectionId() == 0) && Clock::SecondsSinceF(start) < 5.f)
+	{
+		server->Process();
+		client->Process();
+		Clock::Sleep(1);
+	}
+	assert(udp->ConnectionId() != 0);
+	NetworkServer::ConnectionMap connections = server->GetConnections();
+	assert(connections.size() == 1);
+	Ptr(MessageConnection) serverSide = connections.begin()->second;
+	assert(dynamic_cast<UDPMessageConnection*>(serverSide.ptr())->ConnectionId() == udp->ConnectionId());
+
+	// Simulate a NAT rebinding: swap a socket bound to another local port under the client connection.
+	int rebound = ::socket(AF_INET, SOCK_DGRAM, 0);
+	sockaddr_in serverAddr;
+	memset(&serverAddr, 0, sizeof(serverAddr));
+	serverAddr.sin_family = AF_INET;
+	serverAddr.sin_port = htons(48238);
+	serverAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	assert(::connect(rebound, (sockaddr*)&serverAddr, sizeof(serverAddr)) == 0);
+	sockaddr_in newAddr;
+	socklen_t newAddrLen = sizeof(newAddr);
+	getsockname(rebound, (sockaddr*)&newAddr, &newAddrLen);
+	assert(dup2(rebound, (int)client->GetSocket()->GetSocketHandle()) >= 0);
+	close(rebound);
+	client->GetSocket()->SetBlocking(false);
+
+	client->SendMessage(200, true, true, 100, 0, "after", 5);
+	start = Clock::Tick();
+	while((listener.messages.size() < 2 || udp->NumOutboundUnackedDatagrams() > 0) && Clock::SecondsSinceF(start) < 5.f)
+	{
+		server->Process();
+		client->Process();
+		Clock::Sleep(1);
+	}
+	assert(listener.messages.size() == 2 && listener.messages[1] == "after");
+	// The same server-side connection now talks to the new port, and the acks of the server reach the client there.
+	connections = server->GetConnections();
+	assert(connections.size() == 1 && connections.begin()->second == serverSide);
+	assert(serverSide->GetSocket()->RemoteEndPoint().port == ntohs(newAddr.sin_port));
+	assert(udp->NumOutboundUnackedDatagrams() == 0);
+	assert(client->GetConnectionState() == ConnectionOK);
+	client->Close(0);
+	serverNetwork.StopServer();
+	ENDTEST()
+
+	TEST("UDP server assigns connection IDs only to clients that take them")
+	Network serverNetwork;
+	ConnectDataListener listener;
+	NetworkServer *server = serverNetwork.StartServer(48244, SocketOverUDP, &listener, true);
+	assert(server);
+	server->SetConnectionIdsEnabled(true);
+	sockaddr_in serverAddr;
+	memset(&serverAddr, 0, sizeof(serverAddr));
+	serverAddr.sin_family = AF_INET;
+	serverAddr.sin_port = htons(48244);
+	serverAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+	// A client of the version 1 Connection Start header, without the capability flags.
+	int oldClient = ::socket(AF_INET, SOCK_DGRAM, 0);
+	const char oldConnect[] = { 'k', 'N', 'e', 't', 'C', 'o', 'n', 1, 3, 0, 'o', 'l', 'd' };
+	assert(::sendto(oldClient, oldConnect, sizeof(oldConnect), 0, (sockaddr*)&serverAddr, sizeof(serverAddr)) == (ssize_t)sizeof(oldConnect));
+	tick_t start = Clock::Tick();
+	while(server->GetConnections().size() < 1 && Clock::SecondsSinceF(start) < 5.f)
+	{
+		server->Process();
+		Clock::Sleep(1);
+	}
+	NetworkServer::ConnectionMap connections = server->GetConnections();
+	assert(connections.size() == 1);
+	assert(listener.connectData == "old");
+	assert(dynamic_cast<UDPMessageConnection*>(connections.begin()->second.ptr())->ConnectionId() == 0);
+
+	// Raw connect data that happens to look like a packet with an unknown connection ID is still a connection attempt.
+	int rawClient = ::socket(AF_INET, SOCK_DGRAM, 0);
+	const char rawConnect[] = { (char)0x81, 0, 0, 1, 2, 3, 4, 'r', 'a', 'w' };
+	assert(::sendto(rawClient, rawConnect, sizeof(rawConnect), 0, (sockaddr*)&serverAddr, sizeof(serverAddr)) == (ssize_t)sizeof(rawConnect));
+	start = Clock::Tick();
+	while(server->GetConnections().size() < 2 && Clock::SecondsSinceF(start) < 5.f)
+	{
+		server->Process();
+		Clock::Sleep(1);
+	}
+	assert(server->GetConnections().size() == 2);
+	assert(listener.connectData == std::string(rawConnect, sizeof(rawConnect)));
+	close(oldClient);
+	close(rawClient);
+	serverNetwork.StopServer();
+	ENDTEST()
+#endif
+}
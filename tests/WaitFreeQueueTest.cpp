@@ -0,0 +1,88 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file WaitFreeQueueTest.cpp
+	@brief */
+
+#include "kNet/WaitFreeQueue.h"
+#include "tassert.h"
+#include "kNet/DebugMemoryLeakCheck.h"
+
+void WaitFreeQueueTest()
+{
+	using namespace kNet;
+
+	TEST("WaitFreeQueue Insert/PopFront")
+	WaitFreeQueue<int> queue(8);
+	assert(queue.Size() == 0);
+	assert(queue.Front() == 0);
+	for(int i = 0; i < 7; ++i)
+		assert(queue.Insert(i));
+	assert(!queue.Insert(7));
+	assert(queue.Size() == 7);
+	assert(queue.CapacityLeft() == 0);
+	for(int i = 0; i < 7; ++i)
+	{
+		assert(*queue.Front() == i);
+		queue.PopFront();
+	}
+	assert(queue.Size() == 0);
+	ENDTEST()
+
+	TEST("WaitFreeQueue InsertBatch/PopFrontBatch")
+	WaitFreeQueue<int> queue(16);
+	int values[32];
+	for(int i = 0; i < 32; ++i)
+		values[i] = i;
+	// Advance the indices so that the batches below wrap around the end of the ring.
+	for(int i = 0; i < 10; ++i)
+	{
+		queue.Insert(-1);
+		queue.PopFront();
+	}
+	assert(queue.InsertBatch(values, 12) == 12);
+	assert(queue.InsertBatch(values + 12, 20) == 3); // Capacity is 15.
+	assert(queue.Size() == 15);
+	int out[32];
+	assert(queue.PopFrontBatch(out, 4) == 4);
+	for(int i = 0; i < 4; ++i)
+		assert(out[i] == i);
+	assert(*queue.Front() == 4);
+	assert(queue.InsertBatch(values + 15, 17) == 4);
+	assert(queue.PopFrontBatch(out, 32) == 15);
+	for(int i = 0; i < 15; ++i)
+		assert(out[i] == i + 4);
+	assert(queue.PopFrontBatch(out, 32) == 0);
+	assert(queue.InsertBatch(values, 0) == 0);
+	ENDTEST()
+
+	TEST("WaitFreeQueue Clear/EraseItemAt")
+	WaitFreeQueue<int> queue(8);
+	for(int i = 0; i < 5; ++i)
+		queue.Insert(i);
+	queue.EraseItemAt(3);
+	assert(queue.Size() == 4);
+	assert(*queue.Back() == 4);
+	queue.EraseItemAt(1);
+	assert(queue.Size() == 3);
+	assert(*queue.Front() == 0);
+	assert(*queue.ItemAt(1) == 2);
+	for(int i = 0; i < 4; ++i)
+		assert(queue.Insert(10 + i));
+	assert(!queue.Insert(20));
+	queue.Clear();
+	assert(queue.Size() == 0);
+	assert(queue.Front() == 0);
+	ENDTEST()
+}
@@ -0,0 +1,137 @@
+/* Copyright The kNet Project.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. */
+
+/** @file WorkStealingPoolTest.cpp
+	@brief */
+
+#include <atomic>
+#include <map>
+#include <vector>
+
+#include "kNet/Network.h"
+#include "kNet/WorkStealingPool.h"
+#include "tassert.h"
+#include "kNet/DebugMemoryLeakCheck.h"
+
+using namespace kNet;
+
+namespace
+{
+
+struct TaskCounts
+{
+	std::vector<std::atomic<int>*> counts;
+};
+
+/// Counts the runs of each task. The tasks at the start take longer, so that the other threads have to steal them.
+void CountTask(void *context, size_t index)
+{
+	TaskCounts *tasks = reinterpret_cast<TaskCounts*>(context);
+	if (index < 8)
+		Clock::Sleep(2);
+	tasks->counts[index]->fetch_add(1);
+}
+
+/// Checks that the messages of each client arrive in the order they were sent.
+class SequenceChecker : public INetworkServerListener, public IMessageHandler
+{
+public:
+	SequenceChecker():numHandled(0), numOutOfOrder(0) {}
+
+	/// The next sequence number expected from each client. Only touched by the thread handling the client.
+	std::map<MessageConnection*, u32> nextSequence;
+	std::atomic<int> numHandled;
+	std::atomic<int> numOutOfOrder;
+
+	void NewConnectionEstablished(MessageConnection *connection)
+	{
+		nextSequence[connection] = 0;
+		connection->RegisterInboundMessageHandler(this);
+	}
+
+	void HandleMessage(MessageConnection *source, packet_id_t, message_id_t, const char *data, size_t numBytes)
+	{
+		u32 sequence = 0;
+		memcpy(&sequence, data, std::min(numBytes, sizeof(sequence)));
+		u32 &expected = nextSequence[source];
+		if (sequence != expected)
+			++numOutOfOrder;
+		expected = sequence + 1;
+		++numHandled;
+	}
+
+	bool IsThreadSafe() const { return true; }
+};
+
+}
+
+void WorkStealingPoolTest()
+{
+	TEST("WorkStealingPool runs each task once")
+	WorkStealingPool pool(3);
+	assert(pool.NumThreads() == 3);
+	TaskCounts tasks;
+	const size_t numTasks = 200;
+	for(size_t i = 0; i < numTasks; ++i)
+		tasks.counts.push_back(new std::atomic<int>(0));
+	for(int round = 0; round < 20; ++round)
+		pool.Run(numTasks, &CountTask, &tasks);
+	pool.Run(0, &CountTask, &tasks);
+	for(size_t i = 0; i < numTasks; ++i)
+	{
+		assert(tasks.counts[i]->load() == 20);
+		delete tasks.counts[i];
+	}
+	ENDTEST()
+
+	TEST("NetworkServer::SetNumProcessThreads")
+	Network serverNetwork, clientNetwork;
+	SequenceChecker checker;
+	NetworkServer *server = serverNetwork.StartServer(48241, SocketOverTCP, &checker, true);
+	assert(server);
+	server->SetNumProcessThreads(3);
+	assert(server->NumProcessThreads() == 3);
+
+	const int numClients = 8;
+	std::vector<Ptr(MessageConnection)> clients;
+	for(int i = 0; i < numClients; ++i)
+		clients.push_back(clientNetwork.Connect("127.0.0.1", 48241, SocketOverTCP, 0));
+	tick_t start = Clock::Tick();
+	while(server->GetConnections().size() < (size_t)numClients && Clock::SecondsSinceF(start) < 5.f)
+	{
+		server->Process();
+		Clock::Sleep(1);
+	}
+	assert(server->GetConnections().size() == (size_t)numClients);
+
+	const u32 numMessages = 300;
+	for(u32 i = 0; i < numMessages; ++i)
+		for(int j = 0; j < numClients; ++j)
+			clients[j]->SendMessage(100, true, true, 100, 0, (const char *)&i, sizeof(i));
+	while(checker.numHandled < (int)numMessages * numClients && Clock::SecondsSinceF(start) < 10.f)
+	{
+		server->Process();
+		Clock::Sleep(1);
+	}
+	assert(checker.numHandled == (int)numMessages * numClients);
+	assert(checker.numOutOfOrder == 0);
+
+	server->SetNumProcessThreads(0);
+	assert(server->NumProcessThreads() == 0);
+	for(size_t i = 0; i < clients.size(); ++i)
+		clients[i]->Close(0);
+	clients.clear();
+	serverNetwork.StopServer();
+	ENDTEST()
+}
@@ -21,7 +21,24 @@ void VLETest();
 void DataSerializerTest();
 void MaxHeapTest();
 void EventTest();
+void EventArrayTest();
 void LockFreePoolAllocatorTest();
+void WaitFreeQueueTest();
+void SegmentedQueueTest();
+void StatsCountersTest();
+void TrafficStatsWindowTest();
+void LogHistogramTest();
+void NetworkMetricsTest();
+void NetworkLoggingTest();
+void TraceTest();
+void LockContentionTest();
+void ClockTest();
+void UDPMessageConnectionTest();
+void ConnectAsyncTest();
+void CloseAsyncTest();
+void WorkStealingPoolTest();
+void ConnectionRegistryTest();
+void BusyPollTest();
 
 BottomMemoryAllocator bma;
 
@@ -31,6 +48,24 @@ int main()
 
 	DataSerializerTest();
 	MaxHeapTest();
+	EventArrayTest();
+	WaitFreeQueueTest();
+	SegmentedQueueTest();
+	StatsCountersTest();
+	TrafficStatsWindowTest();
+	LogHistogramTest();
+	NetworkMetricsTest();
+	NetworkLoggingTest();
+	TraceTest();
+	LockContentionTest();
+	ClockTest();
+	UDPMessageConnectionTest();
+	ConnectAsyncTest();
+	CloseAsyncTest();
+	WorkStealingPoolTest();
+	ConnectionRegistryTest();
+	BusyPollTest();
+	// The slow tests run last, so that a failure in the tests above shows up quickly.
 	VLETest();
 	EventTest();
 	for(int i = 0; i < 100; ++i)